@@ -23,6 +23,7 @@ int ceph_arch_intel_ssse3 = 0;
 int ceph_arch_intel_sse3 = 0;
 int ceph_arch_intel_sse2 = 0;
 int ceph_arch_intel_aesni = 0;
+int ceph_arch_intel_avx2 = 0;
 
 #ifdef __x86_64__
 #include <cpuid.h>
@@ -36,6 +37,17 @@ int ceph_arch_intel_aesni = 0;
 #define CPUID_SSE3	(1)
 #define CPUID_SSE2	(1 << 26)
 #define CPUID_AESNI (1 << 25)
+#define CPUID_OSXSAVE	(1 << 27)
+#define CPUID_AVX	(1 << 28)
+#define CPUID7_AVX2	(1 << 5)
+
+/* the OS saves (and so lets us use) the xmm and ymm registers */
+static int ymm_enabled(void)
+{
+	unsigned int xcr0_lo, xcr0_hi;
+	__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+	return (xcr0_lo & 6) == 6;
+}
 
 int ceph_arch_intel_probe(void)
 {
@@ -65,6 +77,13 @@ int ceph_arch_intel_probe(void)
   if ((ecx & CPUID_AESNI) != 0) {
           ceph_arch_intel_aesni = 1;
   }
+	if ((ecx & CPUID_OSXSAVE) != 0 && (ecx & CPUID_AVX) != 0 &&
+	    __get_cpuid_max(0, NULL) >= 7 && ymm_enabled()) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		if ((ebx & CPUID7_AVX2) != 0) {
+			ceph_arch_intel_avx2 = 1;
+		}
+	}
 
 	return 0;
 }
@@ -5,6 +5,7 @@
 #define CEPH_OS_BLUESTORE_CHECKSUMMER
 
 #include "xxHash/xxhash.h"
+#include "common/csum_multibuf.h"
 
 class Checksummer {
 public:
@@ -17,6 +18,10 @@ public:
     CSUM_CRC32C_8 = 6,  // low 8 bits of crc32c
     CSUM_MAX,
   };
+
+  // whole csum blocks handed to the multi-buffer kernels at a time
+  static constexpr size_t multi_blocks = 16;
+
   static const char *get_csum_type_string(unsigned t) {
     switch (t) {
     case CSUM_NONE: return "none";
@@ -86,6 +91,20 @@ public:
       ) {
       return p.crc32c(len, init_value);
     }
+
+    static void calc_multi(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint32_t v[multi_blocks];
+      ceph_crc32c_multi(init_value, (const unsigned char*)data, len, n, v);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] = v[i];
+      }
+    }
   };
 
   struct crc32c_16 {
@@ -107,6 +126,20 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xffff;
     }
+
+    static void calc_multi(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint32_t v[multi_blocks];
+      ceph_crc32c_multi(init_value, (const unsigned char*)data, len, n, v);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] = v[i] & 0xffff;
+      }
+    }
   };
 
   struct crc32c_8 {
@@ -128,6 +161,20 @@ public:
       ) {
       return p.crc32c(len, init_value) & 0xff;
     }
+
+    static void calc_multi(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint32_t v[multi_blocks];
+      ceph_crc32c_multi(init_value, (const unsigned char*)data, len, n, v);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] = v[i] & 0xff;
+      }
+    }
   };
 
   struct xxhash32 {
@@ -157,6 +204,20 @@ public:
       }
       return XXH32_digest(state);
     }
+
+    static void calc_multi(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint32_t v[multi_blocks];
+      ceph_xxhash32_multi(init_value, (const unsigned char*)data, len, n, v);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] = v[i];
+      }
+    }
   };
 
   struct xxhash64 {
@@ -186,6 +247,20 @@ public:
       }
       return XXH64_digest(state);
     }
+
+    static void calc_multi(
+      init_value_t init_value,
+      size_t len,
+      size_t n,
+      const char *data,
+      value_t *out
+      ) {
+      uint64_t v[multi_blocks];
+      ceph_xxhash64_multi(init_value, (const unsigned char*)data, len, n, v);
+      for (size_t i = 0; i < n; ++i) {
+	out[i] = v[i];
+      }
+    }
   };
 
   template<class Alg>
@@ -221,9 +296,24 @@ public:
     typename Alg::value_t *pv =
       reinterpret_cast<typename Alg::value_t*>(csum_data->c_str());
     pv += offset / csum_block_size;
-    while (blocks--) {
-      *pv = Alg::calc(state, init_value, csum_block_size, p);
-      ++pv;
+    while (blocks) {
+      // the blocks that are contiguous in memory go to the multi-buffer
+      // kernel together; a block spanning buffers is done on its own
+      const char *data;
+      size_t l = p.get_ptr_and_advance(
+	std::min(blocks, multi_blocks) * csum_block_size, &data);
+      size_t n = l / csum_block_size;
+      if (n) {
+	Alg::calc_multi(init_value, csum_block_size, n, data, pv);
+	pv += n;
+	blocks -= n;
+      }
+      if (l % csum_block_size) {
+	p.advance(-(int)(l % csum_block_size));
+	*pv = Alg::calc(state, init_value, csum_block_size, p);
+	++pv;
+	--blocks;
+      }
     }
     Alg::fini(&state);
     return 0;
@@ -249,18 +339,32 @@ public:
       reinterpret_cast<const typename Alg::value_t*>(csum_data.c_str());
     pv += offset / csum_block_size;
     size_t pos = offset;
+    typename Alg::value_t v[multi_blocks];
     while (length > 0) {
-      typename Alg::value_t v = Alg::calc(state, -1, csum_block_size, p);
-      if (*pv != v) {
-	if (bad_csum) {
-	  *bad_csum = v;
+      // as in calculate()
+      const char *data;
+      size_t l = p.get_ptr_and_advance(
+	std::min(length, multi_blocks * csum_block_size), &data);
+      size_t n = l / csum_block_size;
+      if (n) {
+	Alg::calc_multi(-1, csum_block_size, n, data, v);
+      }
+      if (l % csum_block_size) {
+	p.advance(-(int)(l % csum_block_size));
+	v[n++] = Alg::calc(state, -1, csum_block_size, p);
+      }
+      for (size_t i = 0; i < n; ++i) {
+	if (*pv != v[i]) {
+	  if (bad_csum) {
+	    *bad_csum = v[i];
+	  }
+	  Alg::fini(&state);
+	  return pos;
 	}
-	Alg::fini(&state);
-	return pos;
+	++pv;
+	pos += csum_block_size;
+	length -= csum_block_size;
       }
-      ++pv;
-      pos += csum_block_size;
-      length -= csum_block_size;
     }
     Alg::fini(&state);
     return -1;  // no errors
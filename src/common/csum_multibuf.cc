@@ -0,0 +1,236 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <string.h>
+
+#include "common/csum_multibuf.h"
+#include "include/crc32c.h"
+#include "arch/probe.h"
+#include "arch/intel.h"
+#include "xxHash/xxhash.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// the xxhash primes, see xxHash/xxhash.c
+static const uint32_t PRIME32_1 = 2654435761U;
+static const uint32_t PRIME32_2 = 2246822519U;
+static const uint32_t PRIME32_3 = 3266489917U;
+static const uint32_t PRIME32_4 =  668265263U;
+static const uint32_t PRIME32_5 =  374761393U;
+
+void ceph_crc32c_multi_generic(
+  uint32_t crc, const unsigned char *data, size_t len, size_t n,
+  uint32_t *out)
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = ceph_crc32c(crc, data + i * len, len);
+  }
+}
+
+void ceph_xxhash32_multi_generic(
+  uint32_t seed, const unsigned char *data, size_t len, size_t n,
+  uint32_t *out)
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = XXH32(data + i * len, len, seed);
+  }
+}
+
+void ceph_xxhash64_multi_generic(
+  uint64_t seed, const unsigned char *data, size_t len, size_t n,
+  uint64_t *out)
+{
+  for (size_t i = 0; i < n; ++i) {
+    out[i] = XXH64(data + i * len, len, seed);
+  }
+}
+
+#if defined(__x86_64__)
+
+static inline uint32_t read32(const unsigned char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t rotl32(uint32_t x, int r)
+{
+  return (x << r) | (x >> (32 - r));
+}
+
+// crc32c: four blocks per pass, each with its own crc; the crc32
+// instruction has a latency of three cycles but can start every cycle,
+// so the four chains keep it busy where a single one would stall.
+__attribute__((target("sse4.2")))
+static void crc32c_multi_sse42(
+  uint32_t crc, const unsigned char *data, size_t len, size_t n,
+  uint32_t *out)
+{
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const unsigned char *b0 = data + i * len;
+    const unsigned char *b1 = b0 + len;
+    const unsigned char *b2 = b1 + len;
+    const unsigned char *b3 = b2 + len;
+    uint64_t c0 = crc, c1 = crc, c2 = crc, c3 = crc;
+    size_t j = 0;
+    for (; j + 8 <= len; j += 8) {
+      c0 = _mm_crc32_u64(c0, read64(b0 + j));
+      c1 = _mm_crc32_u64(c1, read64(b1 + j));
+      c2 = _mm_crc32_u64(c2, read64(b2 + j));
+      c3 = _mm_crc32_u64(c3, read64(b3 + j));
+    }
+    for (; j < len; ++j) {
+      c0 = _mm_crc32_u8(c0, b0[j]);
+      c1 = _mm_crc32_u8(c1, b1[j]);
+      c2 = _mm_crc32_u8(c2, b2[j]);
+      c3 = _mm_crc32_u8(c3, b3[j]);
+    }
+    out[i] = c0;
+    out[i + 1] = c1;
+    out[i + 2] = c2;
+    out[i + 3] = c3;
+  }
+  ceph_crc32c_multi_generic(crc, data + i * len, len, n - i, out + i);
+}
+
+// xxhash32: eight blocks per pass, block k in lane k.  The 16 byte
+// stripes of the blocks are transposed so that one register holds the
+// same word of all eight stripes; the tail and the final avalanche are
+// done per block.
+static uint32_t xxh32_finish(uint32_t h, const unsigned char *p, size_t len)
+{
+  const unsigned char *end = p + len;
+  while (p + 4 <= end) {
+    h += read32(p) * PRIME32_3;
+    h = rotl32(h, 17) * PRIME32_4;
+    p += 4;
+  }
+  while (p < end) {
+    h += (*p) * PRIME32_5;
+    h = rotl32(h, 11) * PRIME32_1;
+    ++p;
+  }
+  h ^= h >> 15;
+  h *= PRIME32_2;
+  h ^= h >> 13;
+  h *= PRIME32_3;
+  h ^= h >> 16;
+  return h;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i xxh32_round_avx2(__m256i acc, __m256i input)
+{
+  acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(
+			   input, _mm256_set1_epi32(PRIME32_2)));
+  acc = _mm256_or_si256(_mm256_slli_epi32(acc, 13),
+			_mm256_srli_epi32(acc, 32 - 13));
+  return _mm256_mullo_epi32(acc, _mm256_set1_epi32(PRIME32_1));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i rotl32_avx2(__m256i x, int r)
+{
+  return _mm256_or_si256(_mm256_slli_epi32(x, r),
+			 _mm256_srli_epi32(x, 32 - r));
+}
+
+__attribute__((target("avx2")))
+static void xxhash32_multi_avx2(
+  uint32_t seed, const unsigned char *data, size_t len, size_t n,
+  uint32_t *out)
+{
+  size_t i = 0;
+  if (len >= 16) {
+    size_t stripes = len / 16;
+    for (; i + 8 <= n; i += 8) {
+      const unsigned char *b = data + i * len;
+      __m256i v1 = _mm256_set1_epi32(seed + PRIME32_1 + PRIME32_2);
+      __m256i v2 = _mm256_set1_epi32(seed + PRIME32_2);
+      __m256i v3 = _mm256_set1_epi32(seed);
+      __m256i v4 = _mm256_set1_epi32(seed - PRIME32_1);
+      for (size_t s = 0; s < stripes; ++s) {
+	const unsigned char *p = b + s * 16;
+#define LOAD_PAIR(k)							\
+	_mm256_inserti128_si256(					\
+	  _mm256_castsi128_si256(					\
+	    _mm_loadu_si128((const __m128i*)(p + (k) * len))),		\
+	  _mm_loadu_si128((const __m128i*)(p + ((k) + 4) * len)), 1)
+	// blocks 0-3 in the low halves, 4-7 in the high halves
+	__m256i a0 = LOAD_PAIR(0);
+	__m256i a1 = LOAD_PAIR(1);
+	__m256i a2 = LOAD_PAIR(2);
+	__m256i a3 = LOAD_PAIR(3);
+#undef LOAD_PAIR
+	__m256i t0 = _mm256_unpacklo_epi32(a0, a1);
+	__m256i t1 = _mm256_unpacklo_epi32(a2, a3);
+	__m256i t2 = _mm256_unpackhi_epi32(a0, a1);
+	__m256i t3 = _mm256_unpackhi_epi32(a2, a3);
+	v1 = xxh32_round_avx2(v1, _mm256_unpacklo_epi64(t0, t1));
+	v2 = xxh32_round_avx2(v2, _mm256_unpackhi_epi64(t0, t1));
+	v3 = xxh32_round_avx2(v3, _mm256_unpacklo_epi64(t2, t3));
+	v4 = xxh32_round_avx2(v4, _mm256_unpackhi_epi64(t2, t3));
+      }
+      __m256i h = _mm256_add_epi32(
+	_mm256_add_epi32(rotl32_avx2(v1, 1), rotl32_avx2(v2, 7)),
+	_mm256_add_epi32(rotl32_avx2(v3, 12), rotl32_avx2(v4, 18)));
+      h = _mm256_add_epi32(h, _mm256_set1_epi32(len));
+      uint32_t hs[8];
+      _mm256_storeu_si256((__m256i*)hs, h);
+      for (unsigned k = 0; k < 8; ++k) {
+	out[i + k] = xxh32_finish(hs[k], b + k * len + stripes * 16,
+				  len - stripes * 16);
+      }
+    }
+  }
+  ceph_xxhash32_multi_generic(seed, data + i * len, len, n - i, out + i);
+}
+
+#endif // __x86_64__
+
+/*
+ * choose the best implementations based on the CPU architecture.
+ */
+static ceph_crc32c_multi_func_t choose_crc32c_multi()
+{
+  ceph_arch_probe();
+#if defined(__x86_64__)
+  if (ceph_arch_intel_sse42) {
+    return crc32c_multi_sse42;
+  }
+#endif
+  return ceph_crc32c_multi_generic;
+}
+
+static ceph_xxhash32_multi_func_t choose_xxhash32_multi()
+{
+  ceph_arch_probe();
+#if defined(__x86_64__)
+  if (ceph_arch_intel_avx2) {
+    return xxhash32_multi_avx2;
+  }
+#endif
+  return ceph_xxhash32_multi_generic;
+}
+
+static ceph_xxhash64_multi_func_t choose_xxhash64_multi()
+{
+  // xxhash64 is bound by the 64 bit multiplies, which scalar code
+  // already issues back to back; avx2 has to emulate them and loses.
+  return ceph_xxhash64_multi_generic;
+}
+
+ceph_crc32c_multi_func_t ceph_crc32c_multi = choose_crc32c_multi();
+ceph_xxhash32_multi_func_t ceph_xxhash32_multi = choose_xxhash32_multi();
+ceph_xxhash64_multi_func_t ceph_xxhash64_multi = choose_xxhash64_multi();
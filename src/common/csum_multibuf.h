@@ -0,0 +1,49 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_COMMON_CSUM_MULTIBUF_H
+#define CEPH_COMMON_CSUM_MULTIBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Multi-buffer checksums: the checksums of n independent blocks of len
+ * bytes each, laid out back to back, i.e. block i is
+ * [data + i * len, data + (i + 1) * len).
+ *
+ * The blocks are hashed side by side, so the dependency chains of the
+ * individual hashes overlap in the pipeline (crc32c, sse 4.2) or share
+ * the lanes of a vector register (xxhash32, avx2).  The results are the
+ * same as hashing each block on its own.
+ *
+ * The implementation is chosen once, based on the CPU features; see
+ * crc32c.cc.
+ */
+
+typedef void (*ceph_crc32c_multi_func_t)(
+  uint32_t crc, const unsigned char *data, size_t len, size_t n,
+  uint32_t *out);
+typedef void (*ceph_xxhash32_multi_func_t)(
+  uint32_t seed, const unsigned char *data, size_t len, size_t n,
+  uint32_t *out);
+typedef void (*ceph_xxhash64_multi_func_t)(
+  uint64_t seed, const unsigned char *data, size_t len, size_t n,
+  uint64_t *out);
+
+extern ceph_crc32c_multi_func_t ceph_crc32c_multi;
+extern ceph_xxhash32_multi_func_t ceph_xxhash32_multi;
+extern ceph_xxhash64_multi_func_t ceph_xxhash64_multi;
+
+// one block at a time; the fallback, and the baseline for benchmarks
+void ceph_crc32c_multi_generic(
+  uint32_t crc, const unsigned char *data, size_t len, size_t n,
+  uint32_t *out);
+void ceph_xxhash32_multi_generic(
+  uint32_t seed, const unsigned char *data, size_t len, size_t n,
+  uint32_t *out);
+void ceph_xxhash64_multi_generic(
+  uint64_t seed, const unsigned char *data, size_t len, size_t n,
+  uint64_t *out);
+
+#endif
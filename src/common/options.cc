@@ -3267,6 +3267,13 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description(""),
 
+    Option("osd_async_read", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Do not block op threads on reads in replicated pools")
+    .set_long_description("Plain reads of replicated pools are issued to the object store asynchronously and the op is parked until the data is there, instead of holding the op thread for the duration of the device read; fewer op threads per shard are then needed to keep slow devices busy.  Replies to reads that are not rwordered may then be sent out of order.")
+    .add_see_also("osd_op_num_threads_per_shard"),
+
     Option("osd_backoff_on_unfound", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
     .set_default(true)
     .set_description(""),
@@ -3740,6 +3747,37 @@ std::vector<Option> get_global_options() {
     .set_default(16)
     .set_description(""),
 
+    Option("bdev_ioring", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("use io_uring instead of libaio for kernel block devices")
+    .set_long_description("falls back to libaio if the kernel or the build "
+                          "does not support io_uring, or if the kernel may "
+                          "drop completions (before 5.5)")
+    .add_see_also("bdev_aio_max_queue_depth"),
+
+    Option("bdev_ioring_sqthread_poll", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("let a kernel thread poll the io_uring submission queue")
+    .set_long_description("submitting I/O then needs no system call, at the "
+                          "cost of a kernel thread spinning while I/O is "
+                          "being issued")
+    .add_see_also("bdev_ioring"),
+
+    Option("bdev_ioring_registered_buffers", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_description("number of read buffers registered with io_uring")
+    .set_long_description("reads that fit go through a buffer registered "
+                          "with the kernel once, instead of having their "
+                          "pages mapped for every I/O, and are copied out "
+                          "when they complete; needs enough locked memory "
+                          "(RLIMIT_MEMLOCK)")
+    .add_see_also({"bdev_ioring", "bdev_ioring_registered_buffer_size"}),
+
+    Option("bdev_ioring_registered_buffer_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(64_K)
+    .set_description("size of each read buffer registered with io_uring")
+    .add_see_also("bdev_ioring_registered_buffers"),
+
     Option("bdev_block_size", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(4_K)
     .set_description(""),
@@ -3776,6 +3814,13 @@ std::vector<Option> get_global_options() {
     .set_default(1_M)
     .set_description(""),
 
+    Option("bluefs_async_readahead", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Read ahead of BlueFS readers with asynchronous I/O")
+    .set_long_description("Sequential readers (e.g. compaction inputs) keep the read of their next window in flight while consuming the current one, and prefetch hints from RocksDB are issued in the background. Readahead bypasses the page cache when the device is opened with direct I/O.")
+    .add_see_also("bluefs_max_prefetch"),
+
     Option("bluefs_min_log_runway", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(1_M)
     .set_description(""),
@@ -3975,6 +4020,13 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_RUNTIME)
     .set_description("Default bluestore_prefer_deferred_size for non-rotational (solid state) media"),
 
+    Option("bluestore_inline_data_max_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(0)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Keep the data of objects up to this size inline in the onode")
+    .set_long_description("Data of tiny objects is stored in the onode key/value record instead of an allocated blob, which saves a min_alloc_size allocation and a device write per object. Once the object grows past this size its data is moved to a regular blob. 0 disables inline data. Once an object has been stored inline, older releases refuse to mount the store, so do not enable this if a downgrade may be needed.")
+    .add_see_also("bluestore_min_alloc_size"),
+
     Option("bluestore_compression_mode", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("none")
     .set_enum_allowed({"none", "passive", "aggressive", "force"})
@@ -4052,6 +4104,18 @@ std::vector<Option> get_global_options() {
     .set_description("Compression ratio required to store compressed data")
     .set_long_description("If we compress data and get less than this we discard the result and store the original uncompressed data."),
 
+    Option("bluestore_compression_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(2)
+    .set_description("Threads compressing the blobs of a large write in parallel")
+    .set_long_description("A write that spans several blobs has them compressed by these threads (and the writing thread) concurrently instead of one after the other. 0 compresses everything on the writing thread. Takes effect on mount."),
+
+    Option("bluestore_compression_sample_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(8192)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Bytes sampled from a blob to detect incompressible data")
+    .set_long_description("Before compressing a blob at least four times this size, this many bytes taken from four places in the blob are compressed; if they do not reach bluestore_compression_required_ratio the blob is stored uncompressed without compressing the rest of it. 0 disables sampling.")
+    .add_see_also("bluestore_compression_required_ratio"),
+
     Option("bluestore_extent_map_shard_max_size", Option::TYPE_SIZE, Option::LEVEL_DEV)
     .set_default(1200)
     .set_description("Max size (bytes) for a single extent map shard before splitting"),
@@ -4082,8 +4146,13 @@ std::vector<Option> get_global_options() {
 
     Option("bluestore_cache_type", Option::TYPE_STR, Option::LEVEL_DEV)
     .set_default("2q")
-    .set_enum_allowed({"2q", "lru"})
-    .set_description("Cache replacement algorithm"),
+    .set_enum_allowed({"2q", "lru", "clock"})
+    .set_description("Cache replacement algorithm")
+    .set_long_description("clock is CLOCK with adaptive replacement (CAR): "
+			  "a cache hit only sets a reference bit, onodes as "
+			  "well as buffers resist one-time scans, and the "
+			  "misses on recently evicted entries feed the cache "
+			  "autotuner."),
 
     Option("bluestore_2q_cache_kin_ratio", Option::TYPE_FLOAT, Option::LEVEL_DEV)
     .set_default(.5)
@@ -4139,8 +4208,21 @@ std::vector<Option> get_global_options() {
 
     Option("bluestore_allocator", Option::TYPE_STR, Option::LEVEL_ADVANCED)
     .set_default("bitmap")
-    .set_enum_allowed({"bitmap", "stupid"})
-    .set_description("Allocator policy"),
+    .set_enum_allowed({"bitmap", "stupid", "avl"})
+    .set_description("Allocator policy")
+    .set_long_description("Bitmap is fast with plenty of free space; avl keeps the free extents indexed by offset and size and stays fast on heavily fragmented devices"),
+
+    Option("bluestore_alloc_snapshot", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_description("Checkpoint the allocator state so mount does not have to rebuild it from the freelist")
+    .set_long_description("The free extents are written to the key/value store at umount (and periodically while the store is idle). A clean mount loads them in one sequential pass instead of enumerating the whole freelist; any transaction that changes the freelist invalidates the snapshot, in which case mount falls back to the freelist. Writing the first snapshot raises min_compat_ondisk_format, after which older releases refuse to mount the store.")
+    .add_see_also("bluestore_alloc_snapshot_interval"),
+
+    Option("bluestore_alloc_snapshot_interval", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(300)
+    .set_min(0)
+    .set_description("Seconds between allocator snapshots taken while mounted (0 to only write one at umount)")
+    .add_see_also("bluestore_alloc_snapshot"),
 
     Option("bluestore_freelist_blocks_per_key", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(128)
@@ -4194,6 +4276,18 @@ std::vector<Option> get_global_options() {
     .set_default(false)
     .set_description("Run deep fsck after mkfs"),
 
+    Option("bluestore_fsck_threads", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4)
+    .set_min(1)
+    .set_description("Number of threads fsck checks the objects with")
+    .set_long_description("The object keyspace is split at the collection boundaries and the ranges are handed out to the threads. Each thread keeps a bitmap of the blocks used by its objects, so memory use grows with the number of threads on large devices."),
+
+    Option("bluestore_fsck_read_queue_depth", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(32)
+    .set_min(1)
+    .set_description("Number of blob regions each thread keeps in flight during deep fsck")
+    .add_see_also("bluestore_fsck_threads"),
+
     Option("bluestore_sync_submit_transaction", Option::TYPE_BOOL, Option::LEVEL_DEV)
     .set_default(false)
     .set_description("Try to submit metadata transaction to rocksdb in queuing thread context"),
@@ -4223,6 +4317,19 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_RUNTIME)
     .set_description("Default bluestore_throttle_cost_per_io for non-rotation (solid state) media"),
 
+    Option("bluestore_txc_slow_history_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(20)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("How many of the slowest recent transactions to keep for the dump_objectstore_slow_txcs admin socket command")
+    .set_long_description("Each transaction is kept with the time it spent in each state (prepare, aio_wait, kv_queued, deferred_queued, ...) and the sequencer it belonged to.  0 disables tracking.")
+    .add_see_also("bluestore_txc_slow_history_duration"),
+
+    Option("bluestore_txc_slow_history_duration", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(600)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Seconds a finished transaction is considered recent for the dump_objectstore_slow_txcs admin socket command")
+    .add_see_also("bluestore_txc_slow_history_size"),
+
 
     Option("bluestore_deferred_batch_ops", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
     .set_default(0)
@@ -4239,6 +4346,18 @@ std::vector<Option> get_global_options() {
     .set_flag(Option::FLAG_RUNTIME)
     .set_description("Default bluestore_deferred_batch_ops for non-rotational (solid state) media"),
 
+    Option("bluestore_deferred_combine_hdd", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(true)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Write the deferred batches of all PGs out together on rotational media")
+    .set_long_description("When deferred writes are flushed, the batches of all sequencers (PGs) are merged and written out in device offset order, with contiguous writes combined into a single I/O, so that the disk sees a few sequential writes instead of many seeks."),
+
+    Option("bluestore_deferred_combine_ssd", Option::TYPE_BOOL, Option::LEVEL_ADVANCED)
+    .set_default(false)
+    .set_flag(Option::FLAG_RUNTIME)
+    .set_description("Write the deferred batches of all PGs out together on non-rotational (solid state) media")
+    .add_see_also("bluestore_deferred_combine_hdd"),
+
     Option("bluestore_nid_prealloc", Option::TYPE_INT, Option::LEVEL_DEV)
     .set_default(1024)
     .set_description("Number of unique object ids to preallocate at a time"),
@@ -6347,6 +6466,131 @@ static std::vector<Option> get_rbd_options() {
     .set_default(false)
     .set_description("whether to block writes to the cache before the aio_write call completes"),
 
+    Option("rbd_prefetch_cache_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(64_M)
+    .set_description("maximum number of bytes held by the prefetch image cache"),
+
+    Option("rbd_prefetch_cache_shards", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(16)
+    .set_min(1)
+    .set_description("number of independently locked partitions of the prefetch image cache")
+    .set_long_description("the byte budget set by rbd_prefetch_cache_size is "
+                          "split evenly between the shards"),
+
+    Option("rbd_prefetch_cache_chunk_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(128_K)
+    .set_description("maximum size of a prefetch image cache chunk")
+    .set_long_description("the chunk size is chosen when the image is opened so "
+                          "that chunks never cross a stripe unit; set to 0 to "
+                          "use one chunk per stripe unit"),
+
+    Option("rbd_prefetch_cache_warmup_writes", Option::TYPE_UINT, Option::LEVEL_DEV)
+    .set_default(389)
+    .set_description("number of writes to pass through before the prefetch image cache starts caching reads")
+    .set_long_description("lets test data be written to a fresh image without "
+                          "training the prediction model; set to 0 to cache "
+                          "from the first read"),
+
+    Option("rbd_prefetch_model_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(4_M)
+    .set_description("memory used by each access prediction model of the prefetch image cache")
+    .set_long_description("successor statistics are kept in a fixed-size table; "
+                          "when it is full, the least active chunks are "
+                          "forgotten"),
+
+    Option("rbd_prefetch_model_followers", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(8)
+    .set_min(1)
+    .set_description("number of most frequent followers tracked per chunk by the prefetch prediction model"),
+
+    Option("rbd_prefetch_model_decay_interval", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(100000)
+    .set_min(1)
+    .set_description("number of recorded chunk transitions after which the prefetch prediction model halves its counts"),
+
+    Option("rbd_prefetch_vcache_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(5)
+    .set_min(1)
+    .set_description("number of predicted chunks tracked by the virtual cache of the prefetch prediction model")
+    .set_long_description("chunks entering the virtual cache are prefetched; "
+                          "the chunks with the lowest belief are dropped when "
+                          "it is full"),
+
+    Option("rbd_prefetch_access_ring_size", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(4096)
+    .set_min(2)
+    .set_description("number of chunk accesses buffered between the I/O path and the prefetch model")
+    .set_long_description("accesses are handed to the prediction and phase "
+                          "detection workers through a lock-free ring of this "
+                          "size; accesses arriving while it is full are not "
+                          "used to train the model"),
+
+    Option("rbd_prefetch_model_dir", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_description("local directory where learned prefetch models are saved")
+    .set_long_description("when set, the prediction model of an image is saved "
+                          "when the image is closed and reloaded the next time "
+                          "it is opened by this client host"),
+
+    Option("rbd_prefetch_stream_count", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(8)
+    .set_min(1)
+    .set_description("number of concurrent sequential or strided read streams tracked per image"),
+
+    Option("rbd_prefetch_stream_trigger", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(3)
+    .set_min(1)
+    .set_description("number of chunk reads with the same stride that confirm a stream")
+    .set_long_description("reads of a confirmed stream are prefetched directly "
+                          "and are not passed to the prediction model"),
+
+    Option("rbd_prefetch_stream_max_depth", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64)
+    .set_min(1)
+    .set_description("maximum number of chunks prefetched ahead of a stream"),
+
+    Option("rbd_prefetch_stream_max_stride", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(8)
+    .set_min(1)
+    .set_description("largest distance between reads, in chunks, that can form a strided stream"),
+
+    Option("rbd_prefetch_ssd_cache_dir", Option::TYPE_STR, Option::LEVEL_ADVANCED)
+    .set_default("")
+    .set_description("directory on a local SSD for the second tier of the prefetch cache")
+    .set_long_description("when set, chunks evicted from the in-memory prefetch "
+                          "cache are kept in a per-image file in this directory "
+                          "and read back instead of being fetched from the "
+                          "cluster; the file is removed when it is created and "
+                          "never outlives the image handle"),
+
+    Option("rbd_prefetch_ssd_cache_size", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(10_G)
+    .set_description("maximum size of the SSD tier of the prefetch cache per image"),
+
+    Option("rbd_prefetch_ssd_cache_queue_depth", Option::TYPE_UINT, Option::LEVEL_ADVANCED)
+    .set_default(64)
+    .set_min(1)
+    .set_description("maximum number of asynchronous I/Os in flight to the SSD tier per image"),
+
+    Option("rbd_prefetch_batch_window", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.001)
+    .set_min(0)
+    .set_description("seconds to collect predicted chunks before issuing prefetch reads")
+    .set_long_description("predictions collected within the window are merged "
+                          "into one read per object, with adjacent chunks "
+                          "read as a single extent"),
+
+    Option("rbd_prefetch_max_age", Option::TYPE_FLOAT, Option::LEVEL_ADVANCED)
+    .set_default(.1)
+    .set_min(0)
+    .set_description("seconds after which a predicted chunk that has not been prefetched yet is dropped"),
+
+    Option("rbd_prefetch_max_in_flight_bytes", Option::TYPE_SIZE, Option::LEVEL_ADVANCED)
+    .set_default(16_M)
+    .set_description("maximum number of bytes of prefetch reads in flight per image")
+    .set_long_description("bounds prefetch traffic independently of client I/O; "
+                          "predictions wait while the limit is reached"),
+
     Option("rbd_concurrent_management_ops", Option::TYPE_INT, Option::LEVEL_ADVANCED)
     .set_default(10)
     .set_min(1)
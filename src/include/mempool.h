@@ -148,6 +148,7 @@ namespace mempool {
 #define DEFINE_MEMORY_POOLS_HELPER(f) \
   f(bloom_filter)		      \
   f(bluestore_alloc)		      \
+  f(bluestore_alloc_avl)	      \
   f(bluestore_cache_data)	      \
   f(bluestore_cache_onode)	      \
   f(bluestore_cache_other)	      \
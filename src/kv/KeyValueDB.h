@@ -173,6 +173,10 @@ public:
   }
 
   /// Retrieve Keys
+  ///
+  /// This is the batched lookup: backends should read all the keys in one
+  /// pass against a single consistent view of the db rather than doing a
+  /// point lookup per key.
   virtual int get(
     const std::string &prefix,               ///< [in] Prefix/CF for key
     const std::set<std::string> &key,        ///< [in] Key to retrieve
@@ -199,6 +203,16 @@ public:
     return get(prefix, string(key, keylen), value);
   }
 
+  /// like get(), but the value may be handed out in place, in which case
+  /// it pins the memory backing it in the db (e.g. a block cache block)
+  /// until the last reference to it is gone.  for callers that decode the
+  /// value right away and keep no references into it.
+  virtual int get_in_place(const std::string &prefix,
+			   const std::string &key,
+			   bufferlist *value) {
+    return get(prefix, key, value);
+  }
+
   // This superclass is used both by kv iterators *and* by the ObjectMap
   // omap iterator.  The class hiearchies are unfortunatley tied together
   // by the legacy DBOjectMap implementation :(.
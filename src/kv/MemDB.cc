@@ -408,10 +408,20 @@ int MemDB::get(const string &prefix, const std::string& key,
 int MemDB::get(const string &prefix, const std::set<string> &keys,
     std::map<string, bufferlist> *out)
 {
+  // a single lock hold gives the whole batch a consistent view; the keys
+  // come sorted, so once one is past the end of the map the rest are too
+  std::lock_guard<std::mutex> l(m_lock);
   for (const auto& i : keys) {
-    bufferlist bl;
-    if (_get_locked(prefix, i, &bl))
+    string key = make_key(prefix, i);
+    mdb_iter_t iter = m_map.lower_bound(key);
+    if (iter == m_map.end()) {
+      break;
+    }
+    if (iter->first == key) {
+      bufferlist bl;
+      bl.push_back(iter->second.clone());
       out->insert(make_pair(i, bl));
+    }
   }
 
   return 0;
@@ -22,6 +22,7 @@ using std::string;
 #include "common/perf_counters.h"
 #include "common/debug.h"
 #include "common/PriorityCache.h"
+#include "include/buffer_raw.h"
 #include "include/str_list.h"
 #include "include/stringify.h"
 #include "include/str_map.h"
@@ -1014,32 +1015,33 @@ int RocksDBStore::get(
 {
   utime_t start = ceph_clock_now();
   auto cf = get_cf_handle(prefix);
+  // one MultiGet reads all the keys at the same sequence number and pins
+  // the memtables and the sst version once for the whole batch
+  std::vector<string> combined;  // backs the slices without a CF
+  std::vector<rocksdb::Slice> key_slices;
+  key_slices.reserve(keys.size());
   if (cf) {
     for (auto& key : keys) {
-      std::string value;
-      auto status = db->Get(rocksdb::ReadOptions(),
-			    cf,
-			    rocksdb::Slice(key),
-			    &value);
-      if (status.ok()) {
-	(*out)[key].append(value);
-      } else if (status.IsIOError()) {
-	ceph_abort_msg(cct, status.ToString());
-      }
+      key_slices.emplace_back(key);
     }
   } else {
+    combined.reserve(keys.size());
     for (auto& key : keys) {
-      std::string value;
-      string k = combine_strings(prefix, key);
-      auto status = db->Get(rocksdb::ReadOptions(),
-			    default_cf,
-			    rocksdb::Slice(k),
-			    &value);
-      if (status.ok()) {
-	(*out)[key].append(value);
-      } else if (status.IsIOError()) {
-	ceph_abort_msg(cct, status.ToString());
-      }
+      combined.push_back(combine_strings(prefix, key));
+      key_slices.emplace_back(combined.back());
+    }
+  }
+  std::vector<rocksdb::ColumnFamilyHandle*> cfs(keys.size(),
+						cf ? cf : default_cf);
+  std::vector<std::string> values;
+  auto statuses = db->MultiGet(rocksdb::ReadOptions(), cfs, key_slices,
+			       &values);
+  auto key = keys.begin();
+  for (size_t i = 0; i < statuses.size(); ++i, ++key) {
+    if (statuses[i].ok()) {
+      (*out)[*key].append(values[i]);
+    } else if (statuses[i].IsIOError()) {
+      ceph_abort_msg(cct, statuses[i].ToString());
     }
   }
   utime_t lat = ceph_clock_now() - start;
@@ -1048,34 +1050,51 @@ int RocksDBStore::get(
   return 0;
 }
 
-int RocksDBStore::get(
-    const string &prefix,
-    const string &key,
-    bufferlist *out)
+namespace {
+  /// a value read in place: it points into a block cache block or
+  /// memtable, which stays pinned until the last reference goes away.
+  /// not shareable, so that bufferlist copies and claims of it make
+  /// their own copy instead of extending the pin.
+  class raw_pinnable_slice : public buffer::raw {
+    std::unique_ptr<rocksdb::PinnableSlice> slice;
+  public:
+    explicit raw_pinnable_slice(std::unique_ptr<rocksdb::PinnableSlice> s)
+      : raw(const_cast<char*>(s->data()), s->size()),
+	slice(std::move(s)) {}
+    raw* clone_empty() override {
+      return buffer::create(len);
+    }
+    bool is_shareable() override {
+      return false;
+    }
+  };
+}
+
+int RocksDBStore::_get(
+  const string &prefix,
+  const rocksdb::Slice& key,
+  rocksdb::PinnableSlice *value)
 {
-  assert(out && (out->length() == 0));
   utime_t start = ceph_clock_now();
   int r = 0;
-  string value;
   rocksdb::Status s;
   auto cf = get_cf_handle(prefix);
   if (cf) {
     s = db->Get(rocksdb::ReadOptions(),
 		cf,
-		rocksdb::Slice(key),
-		&value);
+		key,
+		value);
   } else {
-    string k = combine_strings(prefix, key);
+    string k;
+    combine_strings(prefix, key.data(), key.size(), &k);
     s = db->Get(rocksdb::ReadOptions(),
 		default_cf,
 		rocksdb::Slice(k),
-		&value);
+		value);
   }
-  if (s.ok()) {
-    out->append(value);
-  } else if (s.IsNotFound()) {
+  if (s.IsNotFound()) {
     r = -ENOENT;
-  } else {
+  } else if (!s.ok()) {
     ceph_abort_msg(cct, s.ToString());
   }
   utime_t lat = ceph_clock_now() - start;
@@ -1084,6 +1103,21 @@ int RocksDBStore::get(
   return r;
 }
 
+int RocksDBStore::get(
+    const string &prefix,
+    const string &key,
+    bufferlist *out)
+{
+  assert(out && (out->length() == 0));
+  // a pinnable slice saves the copy into a std::string
+  rocksdb::PinnableSlice value;
+  int r = _get(prefix, rocksdb::Slice(key), &value);
+  if (r == 0) {
+    out->append(value.data(), value.size());
+  }
+  return r;
+}
+
 int RocksDBStore::get(
   const string& prefix,
   const char *key,
@@ -1091,34 +1125,25 @@ int RocksDBStore::get(
   bufferlist *out)
 {
   assert(out && (out->length() == 0));
-  utime_t start = ceph_clock_now();
-  int r = 0;
-  string value;
-  rocksdb::Status s;
-  auto cf = get_cf_handle(prefix);
-  if (cf) {
-    s = db->Get(rocksdb::ReadOptions(),
-		cf,
-		rocksdb::Slice(key, keylen),
-		&value);
-  } else {
-    string k;
-    combine_strings(prefix, key, keylen, &k);
-    s = db->Get(rocksdb::ReadOptions(),
-		default_cf,
-		rocksdb::Slice(k),
-		&value);
+  rocksdb::PinnableSlice value;
+  int r = _get(prefix, rocksdb::Slice(key, keylen), &value);
+  if (r == 0) {
+    out->append(value.data(), value.size());
   }
-  if (s.ok()) {
-    out->append(value);
-  } else if (s.IsNotFound()) {
-    r = -ENOENT;
-  } else {
-    ceph_abort_msg(cct, s.ToString());
+  return r;
+}
+
+int RocksDBStore::get_in_place(
+  const string &prefix,
+  const string &key,
+  bufferlist *out)
+{
+  assert(out && (out->length() == 0));
+  std::unique_ptr<rocksdb::PinnableSlice> value(new rocksdb::PinnableSlice);
+  int r = _get(prefix, rocksdb::Slice(key), value.get());
+  if (r == 0 && value->size()) {
+    out->push_back(bufferptr(new raw_pinnable_slice(std::move(value))));
   }
-  utime_t lat = ceph_clock_now() - start;
-  logger->inc(l_rocksdb_gets);
-  logger->tinc(l_rocksdb_get_latency, lat);
   return r;
 }
 
@@ -53,6 +53,7 @@ namespace rocksdb{
   class FilterPolicy;
   class Snapshot;
   class Slice;
+  class PinnableSlice;
   class WriteBatch;
   class Iterator;
   class Logger;
@@ -349,6 +350,15 @@ public:
     const char *key,
     size_t keylen,
     bufferlist *out) override;
+  int get_in_place(
+    const string &prefix,
+    const string &key,
+    bufferlist *out) override;
+private:
+  int _get(const string &prefix,
+	   const rocksdb::Slice& key,
+	   rocksdb::PinnableSlice *value);
+public:
 
 
   class RocksDBWholeSpaceIteratorImpl :
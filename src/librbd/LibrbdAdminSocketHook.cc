@@ -2,10 +2,12 @@
 // vim: ts=8 sw=2 smarttab
 
 #include "common/errno.h"
+#include "common/Formatter.h"
 
 #include "librbd/ImageCtx.h"
 #include "librbd/LibrbdAdminSocketHook.h"
 #include "librbd/internal.h"
+#include "librbd/cache/PrefetchImageCache.h"
 #include "librbd/io/ImageRequestWQ.h"
 
 #define dout_subsys ceph_subsys_rbd
@@ -54,6 +56,30 @@ private:
   ImageCtx *ictx;
 };
 
+struct PrefetchStatusCommand : public LibrbdAdminSocketCommand {
+public:
+  explicit PrefetchStatusCommand(ImageCtx *ictx) : ictx(ictx) {}
+
+  bool call(stringstream *ss) override {
+    auto image_cache = dynamic_cast<cache::PrefetchImageCache<ImageCtx>*>(
+      ictx->image_cache);
+    if (image_cache == nullptr) {
+      *ss << "prefetch status: prefetch cache is not enabled";
+      return false;
+    }
+
+    JSONFormatter f(true);
+    f.open_object_section("prefetch_cache");
+    image_cache->dump(&f);
+    f.close_section();
+    f.flush(*ss);
+    return true;
+  }
+
+private:
+  ImageCtx *ictx;
+};
+
 LibrbdAdminSocketHook::LibrbdAdminSocketHook(ImageCtx *ictx) :
   admin_socket(ictx->cct->get_admin_socket()) {
 
@@ -78,6 +104,14 @@ LibrbdAdminSocketHook::LibrbdAdminSocketHook(ImageCtx *ictx) :
   if (r == 0) {
     commands[command] = new InvalidateCacheCommand(ictx);
   }
+
+  command = "rbd cache prefetch status " + imagename;
+  r = admin_socket->register_command(command, command, this,
+				     "dump rbd image " + imagename +
+				     " prefetch cache parameters");
+  if (r == 0) {
+    commands[command] = new PrefetchStatusCommand(ictx);
+  }
 }
 
 LibrbdAdminSocketHook::~LibrbdAdminSocketHook() {
@@ -0,0 +1,110 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_LIBRBD_CACHE_ACCESS_RING_H
+#define CEPH_LIBRBD_CACHE_ACCESS_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace librbd {
+namespace cache {
+
+/**
+ * Bounded, lock-free multi-producer/multi-consumer ring used to hand the
+ * access stream from the I/O path to the prefetch workers. Every cell
+ * carries a sequence number that tells producers and consumers whether it
+ * is free or filled for the current lap, so neither side ever waits on the
+ * other: a push into a full ring fails and the caller drops the access.
+ */
+template <typename T>
+class AccessRing {
+public:
+  explicit AccessRing(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    m_mask = size - 1;
+    m_cells.reset(new Cell[size]);
+    for (size_t i = 0; i < size; ++i) {
+      m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+  AccessRing(const AccessRing&) = delete;
+  AccessRing& operator=(const AccessRing&) = delete;
+
+  bool try_push(const T &value) {
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &cell = m_cells[pos & m_mask];
+      size_t seq = cell.sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        // the consumer has not freed this cell yet: the ring is full
+        return false;
+      } else {
+        pos = m_enqueue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool try_pop(T *value) {
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    while (true) {
+      Cell &cell = m_cells[pos & m_mask];
+      size_t seq = cell.sequence.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) -
+                      static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                                std::memory_order_relaxed)) {
+          *value = cell.value;
+          cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_dequeue_pos.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// approximate number of queued entries, for monitoring only
+  size_t size() const {
+    size_t enqueue_pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    size_t dequeue_pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+  }
+
+  size_t capacity() const {
+    return m_mask + 1;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> m_cells;
+  size_t m_mask;
+
+  // keep producers and consumers off each other's cache line
+  alignas(64) std::atomic<size_t> m_enqueue_pos = {0};
+  alignas(64) std::atomic<size_t> m_dequeue_pos = {0};
+};
+
+} // namespace cache
+} // namespace librbd
+
+#endif // CEPH_LIBRBD_CACHE_ACCESS_RING_H
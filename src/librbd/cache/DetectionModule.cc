@@ -1,7 +1,10 @@
 #include "DetectionModule.h"
+#include "PrefetchTypes.h"
+#include "common/perf_counters.h"
 
 // STL includes
 #include <algorithm>
+#include <vector>
 
 // Enable Ceph debug output
 #define dout_subsys ceph_subsys_rbd
@@ -11,15 +14,21 @@
 
 #define MAX_RECENCY_TIME 50000
 
+// Maximum number of inputs applied per lock hold
+#define MAX_INPUT_BATCH 256
+
 namespace librbd {
     namespace cache {
         DetectionModule::DetectionModule(std::string n, time_t ti, ThreadPool* p,
-            std::function<void()> detectionCallback, CephContext* cct, uint64_t ticksPerCycle,
+            std::function<void()> detectionCallback, CephContext* cct,
+            PerfCounters* perfcounter, uint64_t ticksPerCycle,
             uint64_t detectionBuckets) :
             WorkQueueVal<DetectionInput>(n, ti, 0, p),
+            inputRing_(cct->_conf->get_val<uint64_t>("rbd_prefetch_access_ring_size")),
             detectionCallback_(detectionCallback),
             lock("DetectionModule::lock", true, false),
             cct_(cct),
+            perfcounter_(perfcounter),
             ticksPerCycle_(ticksPerCycle),
             frequencyDetect_(detectionBuckets),
             recencyDetect_(detectionBuckets),
@@ -28,21 +37,66 @@ namespace librbd {
             ldout(cct_, 20) << "Creating detection module " << dendl;
         }
 
-        void DetectionModule::_process(DetectionInput input, ThreadPool::TPHandle &) {
-            lock.Lock();
+        void DetectionModule::record(const DetectionInput& input) {
+            if (!inputRing_.try_push(input)) {
+                if (perfcounter_ != nullptr) {
+                    perfcounter_->inc(l_librbd_prefetch_access_dropped);
+                }
+                return;
+            }
+
+            scheduleDrain();
+        }
+
+        void DetectionModule::scheduleDrain() {
+            if (!drainQueued_.exchange(true)) {
+                queue(DetectionInput());
+            }
+        }
+
+        void DetectionModule::_process(DetectionInput, ThreadPool::TPHandle &) {
+            processInputs();
+
+            drainQueued_ = false;
+            if (inputRing_.size() > 0) {
+                scheduleDrain();
+            }
+        }
+
+        void DetectionModule::processInputs() {
+            std::vector<DetectionInput> batch;
+            batch.reserve(MAX_INPUT_BATCH);
 
-            updateRecency(input.elementId);
-            updateFrequency(input.elementId);
+            DetectionInput input;
+            while (batch.size() < MAX_INPUT_BATCH && inputRing_.try_pop(&input)) {
+                batch.push_back(input);
+            }
+            if (perfcounter_ != nullptr) {
+                perfcounter_->set(l_librbd_prefetch_detection_queue, inputRing_.size());
+            }
 
-            hitrate_ = input.hitrate;
+            bool phaseShift = false;
+            {
+                Mutex::Locker locker(lock);
+                for (auto& in : batch) {
+                    updateRecency(in.elementId);
+                    updateFrequency(in.elementId);
 
-            accessCounts_[input.elementId] ++;
-            lastAccess_[input.elementId] = totalAccessCount_++;
+                    hitrate_ = in.hitrate;
 
-            lock.Unlock();
+                    accessCounts_[in.elementId] ++;
+                    lastAccess_[in.elementId] = totalAccessCount_++;
 
-            if (totalAccessCount_ % ticksPerCycle_ == 0) {
-                checkPhase();
+                    if (totalAccessCount_ % ticksPerCycle_ == 0 && checkPhase()) {
+                        phaseShift = true;
+                    }
+                }
+            }
+
+            // The callback queues a retrain on the prediction work queue and
+            // takes the thread pool lock, so it never runs under ours
+            if (phaseShift) {
+                detectionCallback_();
             }
         }
 
@@ -79,14 +133,19 @@ namespace librbd {
             ldout(cct_, 20) << "Recency: " << recency_ << dendl;
         }
 
-        void DetectionModule::checkPhase() {
+        bool DetectionModule::checkPhase() {
             bool frequencyShift = frequencyDetect_.update(frequency_);
             bool recencyShift = recencyDetect_.update(recency_);
             bool hitrateShift = hitrateDetect_.update(recency_);
 
             if (frequencyShift && recencyShift && hitrateShift) {
-                detectionCallback_();
+                ldout(cct_, 10) << "Phase change detected" << dendl;
+                if (perfcounter_ != nullptr) {
+                    perfcounter_->inc(l_librbd_prefetch_phase_change);
+                }
+                return true;
             }
+            return false;
         }
 
         bool DetectionModule::_empty() {
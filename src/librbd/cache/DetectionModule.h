@@ -2,15 +2,19 @@
 #define CEPH_LIBRBD_DETECTION_MODULE
 
 // STL includes
+#include <atomic>
 #include <deque>
 #include <map>
 
 // Ceph includes
 #include "common/WorkQueue.h"
+#include "AccessRing.h"
 
 // ext includes
 #include "librbd/cache/ext/adwin/C++/Adwin.h"
 
+class PerfCounters;
+
 namespace librbd {
     namespace cache {
         /**
@@ -22,6 +26,9 @@ namespace librbd {
             double hitrate;
             uint64_t elementId;
 
+            DetectionInput() : hitrate(0.0), elementId(0)
+            {};
+
             DetectionInput(double hitrate, uint64_t elementId) :
                 hitrate(hitrate), elementId(elementId)
             {};
@@ -31,22 +38,32 @@ namespace librbd {
          * DetectionModule is an object that takes the access stream and the hitrate at the correct
          * tick, and determines if there has been a phase shift in the workload. It then notifies
          * the SwitchModule to begin retraining. 
+         *
+         * Inputs are recorded into a lock-free ring from the I/O path; the queued jobs only
+         * ask a worker to drain the ring, which is then applied in batches.
          */
         class DetectionModule: public ThreadPool::WorkQueueVal<DetectionInput> {
             public:
                 DetectionModule(std::string n, time_t ti, ThreadPool* p,
                     std::function<void()> detectionCallback, CephContext* cct,
+                    PerfCounters* perfcounter = nullptr,
                     uint64_t ticksPerCycle = 100, uint64_t detectionBuckets = 50);
 
+                // Records an input without blocking; it is dropped if the ring is full
+                void record(const DetectionInput& input);
+
             protected:
                 void _process(DetectionInput input, ThreadPool::TPHandle &) override;
 
             private:
                 std::deque<DetectionInput> jobs_;
+                AccessRing<DetectionInput> inputRing_;
+                std::atomic<bool> drainQueued_ = {false};
                 std::function<void()> detectionCallback_;
 
                 mutable Mutex lock;
                 CephContext* cct_;
+                PerfCounters* perfcounter_;
 
                 // Number of times an element appeared in the access stream
                 std::map<uint64_t, uint64_t> accessCounts_;
@@ -77,7 +94,12 @@ namespace librbd {
                 void updateRecency(uint64_t recentElementId);
 
                 // Checks if a phase shift has occurred using Adwin
-                void checkPhase();
+                bool checkPhase();
+
+                // Applies one batch of recorded inputs
+                void processInputs();
+
+                void scheduleDrain();
 
                 // Functions for ceph::WorkQueueVal
                 bool _empty() override;
@@ -4,15 +4,22 @@
 #include "librbd/cache/ext/SwitchModule.h"
 
 #include "include/assert.h"
+#include "common/Formatter.h"
+#include "common/perf_counters.h"
+#include "include/encoding.h"
 #include "PredictionWorkQueue.h"
 #include "PrefetchImageCache.h"
+#include "PrefetchTypes.h"
+
+#include <set>
 
 #define dout_subsys ceph_subsys_rbd
 #undef dout_prefix
 #define dout_prefix *_dout << "librbd::PredictionWorkQueue: " << this << " " \
                            <<  __func__ << ": "
-#define VIRTCACHE_SIZE 5
-#define MAX_UNIQUE_ELEMENTS 20000
+
+// Maximum number of accesses applied to the model per lock hold
+#define MAX_ACCESS_BATCH 256
 
 namespace librbd {
 
@@ -20,17 +27,25 @@ namespace cache {
 
 PredictionWorkQueue::PredictionWorkQueue(std::string n, time_t ti,
     ThreadPool* p, std::function<void(uint64_t)> prefetch,
-    CephContext* cct) :
-        WorkQueueVal<PredictionInput>(n, ti, 0, p), prefetch(prefetch),
-        cct(cct),
+    CephContext* cct, PerfCounters* perfcounter) :
+        WorkQueueVal<PredictionInput>(n, ti, 0, p),
+        access_ring(cct->_conf->get_val<uint64_t>("rbd_prefetch_access_ring_size")),
+        prefetch(prefetch), cct(cct), perfcounter(perfcounter),
         lock("PredictionWorkQueue::lock",
             true, false)
 {
     ldout(cct, 20) << "Creating VirtCache" << dendl;
     //virt_cache = new predictcache::VirtCache(std::numeric_limits<uint64_t>::max());
     predictcache::CacheParameters params;
-    params.vcache_size = 5;
-    params.max_matrix_size = MAX_UNIQUE_ELEMENTS;
+    params.vcache_size = cct->_conf->get_val<uint64_t>("rbd_prefetch_vcache_size");
+
+    // The successor model works on chunk IDs directly and is bounded by
+    // its memory budget, not by the number of unique chunks
+    params.model_bytes = cct->_conf->get_val<uint64_t>("rbd_prefetch_model_size");
+    params.followers_per_element = cct->_conf->get_val<uint64_t>(
+        "rbd_prefetch_model_followers");
+    params.decay_interval = cct->_conf->get_val<uint64_t>(
+        "rbd_prefetch_model_decay_interval");
 
     virt_cache = new predictcache::VirtCache(params);
     virt_cache_secondary = new predictcache::VirtCache(params);
@@ -39,82 +54,210 @@ PredictionWorkQueue::PredictionWorkQueue(std::string n, time_t ti,
     switch_module = new predictcache::SwitchModule(caches);
 }
 
-uint64_t PredictionWorkQueue::encode_chunk(uint64_t chunk_id) {
-    auto found = unique_chunk_map.find(chunk_id);
+void PredictionWorkQueue::encode_model(bufferlist& bl) const {
+    Mutex::Locker locker(lock);
+
+    auto params = virt_cache->getParameters();
+    const auto& table = virt_cache->getSuccessorTable();
+
+    uint64_t num_rows = 0;
+    table.forEachRow([&](uint64_t, uint64_t, uint64_t) { num_rows++; });
+
+    ENCODE_START(1, 1, bl);
+    encode(params.cc_size, bl);
+    encode(params.thresh, bl);
+    encode(params.voter_size, bl);
+    encode(params.window_size, bl);
+    encode(params.minimum_history_to_consider, bl);
+
+    encode(num_rows, bl);
+    table.forEachRow([&](uint64_t id, uint64_t row_sum, uint64_t frequency) {
+        encode(id, bl);
+        encode(row_sum, bl);
+        encode(frequency, bl);
+
+        std::vector<std::pair<uint64_t, uint64_t>> followers;
+        table.forEachFollower(id, [&](uint64_t follower, uint64_t count) {
+            followers.emplace_back(follower, count);
+        });
+        encode(followers, bl);
+    });
+    ENCODE_FINISH(bl);
+
+    ldout(cct, 10) << "encoded " << num_rows << " model rows" << dendl;
+}
+
+void PredictionWorkQueue::decode_model(bufferlist::const_iterator& it) {
+    predictcache::CacheParameters params;
+    {
+        Mutex::Locker locker(lock);
+        params = virt_cache->getParameters();
+    }
 
-    if (found != unique_chunk_map.end()) {
-	    return found->second;
+    // Decode into a scratch model so a corrupt blob leaves the current one
+    // untouched
+    DECODE_START(1, it);
+    decode(params.cc_size, it);
+    decode(params.thresh, it);
+    decode(params.voter_size, it);
+    decode(params.window_size, it);
+    decode(params.minimum_history_to_consider, it);
+
+    params.cc_size = std::min(std::max<uint64_t>(params.cc_size, 1),
+                              params.vcache_size);
+    params.voter_size = std::max<uint64_t>(params.voter_size, 1);
+    params.window_size = std::max<uint64_t>(params.window_size, 1);
+
+    predictcache::VirtCache model(params);
+    auto& table = model.getSuccessorTable();
+
+    uint64_t num_rows;
+    decode(num_rows, it);
+    for (uint64_t i = 0; i < num_rows; i++) {
+        uint64_t id;
+        uint64_t row_sum;
+        uint64_t frequency;
+        std::vector<std::pair<uint64_t, uint64_t>> followers;
+        decode(id, it);
+        decode(row_sum, it);
+        decode(frequency, it);
+        decode(followers, it);
+
+        table.restoreRow(id, row_sum, frequency);
+        for (auto& follower : followers) {
+            table.restoreFollower(id, follower.first, follower.second);
+        }
     }
 
-    uint64_t id = unique_chunk_map.size();
-    unique_chunk_map.insert_or_assign(chunk_id, id);
-    return id;
+    {
+        Mutex::Locker locker(lock);
+        *virt_cache = model;
+        *virt_cache_secondary = model;
+    }
+
+    ldout(cct, 10) << "restored " << num_rows << " model rows, "
+                   << "thresh=" << params.thresh << ", "
+                   << "window_size=" << params.window_size << ", "
+                   << "cc_size=" << params.cc_size << ", "
+                   << "voter_size=" << params.voter_size << dendl;
+    DECODE_FINISH(it);
 }
 
-uint64_t PredictionWorkQueue::decode_chunk(uint64_t chunk_id) {
-    auto found = std::find_if(unique_chunk_map.begin(), unique_chunk_map.end(),
-	[=](auto x){ return x.second == chunk_id; });
+void PredictionWorkQueue::dump(ceph::Formatter* f) const {
+    Mutex::Locker locker(lock);
+
+    auto params = virt_cache->getParameters();
+    const auto& table = virt_cache->getSuccessorTable();
+
+    f->dump_bool("evaluating", switch_module->isEvaluating());
+    f->dump_unsigned("accesses", access_count);
+    f->dump_unsigned("vcache_size", params.vcache_size);
+    f->dump_unsigned("cc_size", params.cc_size);
+    f->dump_float("thresh", params.thresh);
+    f->dump_unsigned("voter_size", params.voter_size);
+    f->dump_unsigned("window_size", params.window_size);
+    f->dump_unsigned("minimum_history_to_consider",
+                     params.minimum_history_to_consider);
+    f->dump_unsigned("model_rows", table.getNumRows());
+    f->dump_unsigned("model_used_rows", table.getNumUsedRows());
+    f->dump_unsigned("model_followers_per_row", table.getFollowersPerRow());
+    f->dump_unsigned("model_bytes", table.getMemoryUsage());
+}
 
-    if (found != unique_chunk_map.end()) {
-	return found->second;
+void PredictionWorkQueue::record(uint64_t elementId) {
+    if (!access_ring.try_push(elementId)) {
+        if (perfcounter != nullptr) {
+            perfcounter->inc(l_librbd_prefetch_access_dropped);
+        }
+        return;
     }
 
-    ldout(cct, 20) << "Error - no chunk mapped to unique ID "
-		   << chunk_id << dendl;
+    schedule_drain();
+}
 
-    return 0;
+void PredictionWorkQueue::schedule_drain() {
+    // Only one drain job is queued at a time, so the thread pool lock is
+    // taken once per batch instead of once per access
+    if (!drain_queued.exchange(true)) {
+        queue(PredictionInput::Drain());
+    }
 }
 
 void PredictionWorkQueue::_process(PredictionInput job, ThreadPool::TPHandle &) {
     if (job.phaseChangeDetected) {
         // Start retraining!
+        Mutex::Locker locker(lock);
         switch_module->startEvaluation();
         return;
     }
 
-    ldout(cct, 20) << "Adding element " << job.elementId << " to VirtCache history" << dendl;
+    process_accesses();
 
-    lock.Lock();
-
-    ldout(cct, 20) << "Updating virtual cache history" << dendl;
-    uint64_t encoded_id = encode_chunk(job.elementId);
-
-    virt_cache->updateHistory(encoded_id);
+    // Accesses recorded after the last pop but before the flag was cleared
+    // would otherwise wait for the next access to be drained
+    drain_queued = false;
+    if (access_ring.size() > 0) {
+        schedule_drain();
+    }
+}
 
-    if (switch_module->isEvaluating()) {
-        ldout(cct, 20) << "Updating secondary virtual cache history "
-                       << "and retraining module" << dendl;
+void PredictionWorkQueue::process_accesses() {
+    std::vector<uint64_t> batch;
+    batch.reserve(MAX_ACCESS_BATCH);
 
-        virt_cache_secondary->updateHistory(encoded_id);
-        switch_module->updateHistory(encoded_id);
+    uint64_t elementId;
+    while (batch.size() < MAX_ACCESS_BATCH && access_ring.try_pop(&elementId)) {
+        batch.push_back(elementId);
+    }
+    if (perfcounter != nullptr) {
+        perfcounter->set(l_librbd_prefetch_prediction_queue, access_ring.size());
+    }
+    if (batch.empty()) {
+        return;
     }
-    
-    ldout(cct, 20) << "Virtual cache history updated" << dendl;
-    auto& prefetch_list = virt_cache->getPrefetchList();
 
-    ldout(cct, 20) << prefetch_list.size() << " elements in prefetch list" << dendl;
+    ldout(cct, 20) << "Adding " << batch.size() << " elements to VirtCache history" << dendl;
 
-    for (auto i : prefetch_list) {
-	    uint64_t decoded_id = decode_chunk(i.id);
-        ldout(cct, 20) << "chunk " << decoded_id << " appears in prefetch list" << dendl;
+    std::set<uint64_t> to_prefetch;
+    {
+        Mutex::Locker locker(lock);
 
-        ldout(cct, 20) << "Advising real cache to prefetch " << decoded_id << dendl;
-        prefetch(decoded_id);
-    }
+        auto start = ceph::mono_clock::now();
+        for (auto id : batch) {
+            virt_cache->updateHistory(id);
 
-    prefetch_list.clear();
+            if (switch_module->isEvaluating()) {
+                virt_cache_secondary->updateHistory(id);
+                switch_module->updateHistory(id);
 
-    auto& evict_list = virt_cache->getEvictionList();
-    ldout(cct, 20) << evict_list.size() << " elements in eviction list" << dendl;
+                // The secondary cache only competes on hit rate
+                virt_cache_secondary->getPrefetchList().clear();
+                virt_cache_secondary->getEvictionList().clear();
+            }
 
-    evict_list.clear();
+            auto& prefetch_list = virt_cache->getPrefetchList();
+            for (auto& i : prefetch_list) {
+                to_prefetch.insert(i.id);
+            }
+            prefetch_list.clear();
+            virt_cache->getEvictionList().clear();
+        }
 
-    ldout(cct, 20) << "Finished processing VirtCache job" << dendl;
+        if (perfcounter != nullptr) {
+            perfcounter->tinc(l_librbd_prefetch_model_latency,
+                              (ceph::mono_clock::now() - start) / batch.size());
+        }
 
-    access_count++;
-    ldout(cct, 20) << "Total requests: " << access_count << dendl;
-    
-    lock.Unlock();
+        access_count += batch.size();
+        ldout(cct, 20) << "Total requests: " << access_count << dendl;
+    }
+
+    // The scheduler dedups and batches the reads; advising it outside the
+    // model lock keeps the lock hold short
+    ldout(cct, 20) << to_prefetch.size() << " elements in prefetch list" << dendl;
+    for (auto id : to_prefetch) {
+        prefetch(id);
+    }
 }
 
 bool PredictionWorkQueue::_empty() {
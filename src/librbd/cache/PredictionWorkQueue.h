@@ -2,12 +2,21 @@
 #define CEPH_LIBRBD_PREDICTION_WORK_QUEUE
 
 #include "common/WorkQueue.h"
+#include "include/buffer_fwd.h"
+#include "AccessRing.h"
 
+#include <atomic>
 #include <vector>
 #include <string>
 #include <deque>
 #include <map>
 
+class PerfCounters;
+
+namespace ceph {
+    class Formatter;
+}
+
 namespace predictcache {
     class VirtCache;
     class SwitchModule;
@@ -17,31 +26,45 @@ namespace librbd {
 
 namespace cache {
 
+// Jobs of the prediction work queue. Accesses themselves are passed through
+// the access ring; a job only asks a worker to drain it.
 struct PredictionInput {
-    uint64_t elementId;
     bool phaseChangeDetected;
 
-    PredictionInput(uint64_t elementId) :
-        elementId(elementId), phaseChangeDetected(false)
+    explicit PredictionInput(bool phaseChangeDetected = false) :
+        phaseChangeDetected(phaseChangeDetected)
     {}
 
-    static PredictionInput PhaseChange() {
-        PredictionInput input(0);
-        input.phaseChangeDetected = true;
+    static PredictionInput Drain() {
+        return PredictionInput(false);
+    }
 
-        return input;
+    static PredictionInput PhaseChange() {
+        return PredictionInput(true);
     }
 };
 
-    // A prediction work queue processes elements as jobs, and updates the
-    // virtual cache asynchronously. When the BeliefCache calculations
-    // are done, it notifies the real cache of advised prefetch elements
-    // via the prefetch() callback function
+    // A prediction work queue consumes the access stream in batches, and
+    // updates the virtual cache asynchronously. When the BeliefCache
+    // calculations are done, it notifies the real cache of advised prefetch
+    // elements via the prefetch() callback function
 class PredictionWorkQueue: public ThreadPool::WorkQueueVal<PredictionInput> {
     public:
         PredictionWorkQueue(std::string n, time_t ti, ThreadPool* p,
             std::function<void(uint64_t)> prefetch,
-            CephContext* cct);
+            CephContext* cct, PerfCounters* perfcounter = nullptr);
+
+        // Record a chunk access from the I/O path. Never blocks: if the
+        // workers fall behind and the ring is full, the access is dropped.
+        void record(uint64_t elementId);
+
+        // Serialize the learned successor statistics and the tuned cache
+        // parameters so that a later open can start with a warm model
+        void encode_model(bufferlist& bl) const;
+        void decode_model(bufferlist::const_iterator& it);
+
+        // Dump the model parameters currently in use
+        void dump(ceph::Formatter* f) const;
 
     protected:
         void _process(PredictionInput job, ThreadPool::TPHandle &) override;
@@ -49,8 +72,12 @@ class PredictionWorkQueue: public ThreadPool::WorkQueueVal<PredictionInput> {
     private:
         std::deque<PredictionInput> jobs;
 
+        AccessRing<uint64_t> access_ring;
+        std::atomic<bool> drain_queued = {false};
+
         std::function<void(uint64_t)> prefetch;
         CephContext* cct;
+        PerfCounters* perfcounter;
         
         predictcache::VirtCache* virt_cache;
         predictcache::VirtCache* virt_cache_secondary;
@@ -58,18 +85,15 @@ class PredictionWorkQueue: public ThreadPool::WorkQueueVal<PredictionInput> {
 
         mutable Mutex lock;
 
-        std::map<uint64_t, uint64_t> unique_chunk_map;
         uint64_t access_count = 0;
 
-        uint64_t encode_chunk(uint64_t chunk_id);
-        uint64_t decode_chunk(uint64_t chunk_id);
-
         bool _empty() override;
         void _enqueue(PredictionInput val) override;
         void _enqueue_front(PredictionInput val) override;
         PredictionInput _dequeue() override;
 
-        
+        void process_accesses();
+        void schedule_drain();
 };
 
 }
@@ -4,26 +4,95 @@
 #include "PrefetchImageCache.h"
 #include "include/buffer.h"
 #include "common/dout.h"
+#include "common/errno.h"
+#include "common/Formatter.h"
+#include "common/perf_counters.h"
+#include "include/encoding.h"
+#include "include/intarith.h"
+#include "include/stringify.h"
 #include "librbd/ImageCtx.h"
+#include "librbd/Utils.h"
 #include "librbd/io/CacheReadResult.h"
 
 #include "PredictionWorkQueue.h"
 #include "DetectionModule.h"
+#include "PrefetchScheduler.h"
+#include "PrefetchTypes.h"
+#include "SSDCache.h"
+#include "StreamDetector.h"
+
+#include <map>
+#include <memory>
+#include <stdlib.h>
+#include <unistd.h>
 
 #define dout_subsys ceph_subsys_rbd
 #undef dout_prefix
 #define dout_prefix *_dout << "librbd::PrefetchImageCache: " << this << " " \
                            <<  __func__ << ": "
 
-#define writes_until_cache 389
 #define do_prefetching true
 
 namespace librbd {
 namespace cache {
 
+namespace {
+
+// Moves a chunk read back from the SSD tier into the real cache
+struct C_SSDPromote : public Context {
+  RealCache *real_cache;
+  ElementID id;
+  uint64_t epoch;
+  Context *on_finish;
+  bufferlist bl;
+
+  C_SSDPromote(RealCache *real_cache, ElementID id, uint64_t epoch,
+               Context *on_finish)
+    : real_cache(real_cache), id(id), epoch(epoch), on_finish(on_finish) {
+  }
+
+  void finish(int r) override {
+    if (r == 0) {
+      bl.rebuild();
+      real_cache->insert(id, bl.front(), false, false, epoch);
+    }
+    // a failed promotion is just a miss
+    on_finish->complete(0);
+  }
+};
+
+// Cut the requested extents out of the whole chunks that cover them
+void assemble_extents(const ImageCache::Extents &image_extents,
+                      uint64_t chunk_size,
+                      const std::map<uint64_t, bufferlist> &chunks,
+                      bufferlist *bl) {
+  for (auto &extent : image_extents) {
+    uint64_t offset = extent.first;
+    uint64_t end = extent.first + extent.second;
+    while (offset < end) {
+      uint64_t chunk_offset = offset - (offset % chunk_size);
+      auto it = chunks.find(chunk_offset);
+      assert(it != chunks.end());
+
+      uint64_t length = std::min(end, chunk_offset + chunk_size) - offset;
+      bufferlist piece;
+      piece.substr_of(it->second, offset - chunk_offset, length);
+      bl->claim_append(piece);
+      offset += length;
+    }
+  }
+}
+
+} // anonymous namespace
+
 template <typename I>
 PrefetchImageCache<I>::PrefetchImageCache(ImageCtx &image_ctx)
-  : m_image_ctx(image_ctx), m_image_writeback(image_ctx) 
+  : m_image_ctx(image_ctx), m_image_writeback(image_ctx),
+    m_chunk_size(image_ctx.cct->_conf->get_val<uint64_t>(
+      "rbd_prefetch_cache_chunk_size")),
+    warmup_writes(image_ctx.cct->_conf->get_val<uint64_t>(
+      "rbd_prefetch_cache_warmup_writes")),
+    caching(warmup_writes == 0)
    {
   CephContext *cct = m_image_ctx.cct;
 
@@ -31,34 +100,55 @@ PrefetchImageCache<I>::PrefetchImageCache(ImageCtx &image_ctx)
   ContextWQ* op_work_queue;
   ThreadPool* thread_pool;
   m_image_ctx.get_thread_pool_instance(cct, &thread_pool, &op_work_queue);
-  
-  real_cache = new RealCache(detection_wq, cct);
+
+  perf_create();
+
+  stream_detector = new StreamDetector(cct,
+    cct->_conf->get_val<uint64_t>("rbd_prefetch_stream_count"),
+    cct->_conf->get_val<uint64_t>("rbd_prefetch_stream_trigger"),
+    cct->_conf->get_val<uint64_t>("rbd_prefetch_stream_max_depth"),
+    cct->_conf->get_val<uint64_t>("rbd_prefetch_stream_max_stride"));
 
   ldout(m_image_ctx.cct, 20) << "Creating PredictionWorkQueue" << dendl;
 
   prediction_wq = new PredictionWorkQueue("librdb::prediction_work_queue",
     cct->_conf->get_val<int64_t>("rbd_op_thread_timeout"),
-    thread_pool, std::bind(&PrefetchImageCache::prefetch_chunk, this, std::placeholders::_1), cct);
+    thread_pool, std::bind(&PrefetchImageCache::prefetch_chunk, this, std::placeholders::_1), cct,
+    perfcounter);
 
   detection_wq = new DetectionModule("librbd::detection_module",
     cct->_conf->get_val<int64_t>("rbd_op_thread_timeout"),
     thread_pool,
     [&](){ prediction_wq->queue(PredictionInput::PhaseChange()); },
-    cct);
+    cct, perfcounter);
+
+  // the real cache feeds the detection module, so it is created last
+  real_cache = new RealCache(cct, detection_wq,
+    cct->_conf->get_val<uint64_t>("rbd_prefetch_cache_size"),
+    cct->_conf->get_val<uint64_t>("rbd_prefetch_cache_shards"), perfcounter);
+
+  prefetch_scheduler = new PrefetchScheduler<I>(m_image_ctx, *real_cache,
+                                                perfcounter);
 }
 
 template <typename I>
 PrefetchImageCache<I>::~PrefetchImageCache() {
   delete prediction_wq;
+  delete stream_detector;
+  delete prefetch_scheduler;
   delete real_cache;
+  delete ssd_cache;
   delete detection_wq;
+
+  perf_stop();
+  delete perfcounter;
 }
 
 
 /*  what PrefetchImageCache<I>::aio_read should do!! :
  *  get called (by ImageReadRequest::send_image_cache_request())
  *  get the image exents, and loop through, for each extent: split?? into 
- *    either each extent that comes in is split into its own sub list of offsets of CACHE_CHUNK_SIZE chunks, then these are all checked from the cache, or
+ *    either each extent that comes in is split into its own sub list of offsets of chunk-size chunks, then these are all checked from the cache, or
  *    maybe, the whole thing gets split into a new image_extents that's just all the incoming extents split into chunks in one big list, then that gets checked?
  *    kinda doesn't matter
  *  then we dispatch the async eviction list updater
@@ -114,98 +204,44 @@ void PrefetchImageCache<I>::aio_read(Extents &&image_extents, bufferlist *bl,
       unique_list_of_extents.push_back(fogRow);
     }
 
-    if(unique_list_of_extents[0].size() > 1) {
-      unique_list_of_extents[0].pop_back();
+    Extents correct_image_extents;
+    for (auto &row : unique_list_of_extents) {
+      correct_image_extents.insert(correct_image_extents.end(), row.begin(),
+                                   row.end());
     }
-    Extents correct_image_extents = unique_list_of_extents[0];
     ldout(cct, 20) << "fixed extent list: " << correct_image_extents << dendl;
 
-    // This bufferlist should hold the data that the user requested which was already
-    // in the cache
-    ceph::bufferlist* cached_data = new ceph::bufferlist();
-
-    // Figure out what isn't in the cache!
-    std::vector<ElementID> uncached_chunk_ids;
-    std::vector<Extent> uncached_chunk_extents;
-
-    uint64_t num_cached_chunks = 0;
-
-    for (auto i : correct_image_extents) {
-      ElementID chunk_id = RealCache::extent_to_unique_id(i.first);
-
-      if (do_prefetching) {
-        // Add each chunk ID to the prediction work queues
-        prediction_wq->queue(PredictionInput(chunk_id));
-
-        // Detection work queue will be triggered via the RealCache
-      }
-
-      // And try to get it from the cache
-      bufferptr cache_chunk_buffer = real_cache->get(chunk_id);
-
-      if (cache_chunk_buffer.length() > 0) {
-        // Cached chunks will get copied into the result buffer later
-        cached_data->push_back(cache_chunk_buffer);
-        num_cached_chunks ++;
-      } else {
-        // Uncached chunks will have to be requested from the cluster
-        uncached_chunk_ids.push_back(chunk_id);
-        uncached_chunk_extents.push_back(i);
+    // Chunks held by the SSD tier are promoted into the real cache first,
+    // so the read below finds them in memory
+    C_GatherBuilder gather(cct);
+    if (ssd_cache != nullptr) {
+      for (auto &i : correct_image_extents) {
+        ElementID id = this->chunk_id(i.first);
+        if (!real_cache->contains(id) && ssd_cache->contains(id)) {
+          auto ctx = new C_SSDPromote(real_cache, id, real_cache->get_epoch(id),
+                                      gather.new_sub());
+          auto on_promoted = util::create_async_context_callback(m_image_ctx,
+                                                                 ctx);
+          if (!ssd_cache->read(id, &ctx->bl, on_promoted)) {
+            on_promoted->complete(-ENOENT);
+          }
+        }
       }
     }
 
-
-    ldout(cct, 20) << "Number of requested chunks to be fetched= "
-      << uncached_chunk_ids.size()
-      << "Number of requested chunks in the cache= "
-      << num_cached_chunks << dendl;
-
-    // If any of the chunks aren't in the cache, we need to make an asynchronous request
-    // from the cluster
-    if (!uncached_chunk_ids.empty()) {
-      // Create a callback to notify the LRU list/cache the IDs of the chunks we added
-      Context* combined_on_finish = new CacheUpdate<I>(this, uncached_chunk_ids, cct, bl,
-        true, on_finish);
-
-      // If we have cached data that we need to copy into the result buffer, make sure
-      // it's added to the callback
-      ceph::bufferlist* copy_src = nullptr;
-      if (num_cached_chunks > 0) {
-        copy_src = cached_data;
-      }
-
-      auto aio_comp = io::AioCompletion::create_and_start(combined_on_finish, &m_image_ctx,
-                                                            io::AIO_TYPE_READ);
-      io::ImageReadRequest<I> req(m_image_ctx, aio_comp, std::move(uncached_chunk_extents),
-                                  io::ReadResult{bl, copy_src}, fadvise_flags, {});
-                                  
-      req.set_bypass_image_cache();
-      req.send();
+    if (gather.has_subs()) {
+      gather.set_finisher(util::create_async_context_callback(
+        m_image_ctx, new FunctionContext(
+          [this, image_extents, correct_image_extents, bl, fadvise_flags,
+           on_finish](int r) mutable {
+            read_chunks(std::move(image_extents),
+                        std::move(correct_image_extents), bl, fadvise_flags,
+                        on_finish);
+          })));
+      gather.activate();
     } else {
-      ldout(cct, 20) << "All requested chunks are in cache "
-                    << "Performing synchronous copy "
-                    << "Requested extents=" << image_extents << " "
-                    << "cached_data.length=" << cached_data->length() << " "
-                    << "bl.length=" << bl->length() << dendl;
-                
-
-      // Otherwise synchronously copy from our cache chunks to the result buffer
-      uint64_t total_request_size = cached_data->length();
-      
-      // ---NOTE: This appender isn't actually copying the data - fix it!
-      // (Forgot to remove this comment?)
-      {
-        auto appender = bl->get_contiguous_appender(total_request_size, true);
-        appender.append(*cached_data);
-      }
-
-      ldout(cct, 20) << "bl.length after copying from cache " << bl->length() << dendl;
-
-
-      // NOTE: not sure what parameter this should take
-      // -1 will cause ReadResult to not check the size of the buffer
-      // but also not to invoke destriper - (is this bad?)
-      on_finish->complete(bl->length());
+      read_chunks(std::move(image_extents), std::move(correct_image_extents),
+                  bl, fadvise_flags, on_finish);
     }
   } else {
     Extents extents_copy = image_extents;
@@ -225,43 +261,156 @@ void PrefetchImageCache<I>::aio_read(Extents &&image_extents, bufferlist *bl,
   ldout(cct, 20) << "read_count=" << read_count << dendl;
 }
 
+/**
+ * Serve the requested extents from whole chunks: the cached chunks come from
+ * the real cache, the missing ones are read from the cluster (and cached).
+ * The caller gets exactly the bytes of @image_extents, in order.
+ */
 template <typename I>
-ImageCache::Extents PrefetchImageCache<I>::extent_to_chunks(std::pair<uint64_t, uint64_t> one_extent) {
+void PrefetchImageCache<I>::read_chunks(Extents &&image_extents,
+                                        Extents &&chunk_extents,
+                                        bufferlist *bl, int fadvise_flags,
+                                        Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+
+  // chunk offset -> chunk data, for the chunks found in the cache now and,
+  // once they are read, for the missing ones
+  auto chunks = std::make_shared<std::map<uint64_t, bufferlist> >();
 
-  Extents chunkedExtent;
-  uint64_t changedOffset;
-  uint64_t changedLength;
+  // Figure out what isn't in the cache!
+  std::vector<ElementID> uncached_chunk_ids;
+  std::vector<uint64_t> uncached_chunk_epochs;
+  Extents uncached_chunk_extents;
+
+  uint64_t num_cached_chunks = 0;
+
+  uint64_t image_size;
+  ElementID max_chunk_id = 0;
+  {
+    RWLock::RLocker snap_locker(m_image_ctx.snap_lock);
+    image_size = m_image_ctx.get_image_size(m_image_ctx.snap_id);
+    if (image_size > 0) {
+      max_chunk_id = this->chunk_id(image_size - 1);
+    }
+  }
+  std::vector<ElementID> stream_prefetch_ids;
+
+  for (auto i : chunk_extents) {
+    ElementID chunk_id = this->chunk_id(i.first);
+
+    if (do_prefetching) {
+      // Sequential and strided streams are prefetched right away; only the
+      // irregular accesses go to the prediction work queues
+      if (stream_detector->update(chunk_id, max_chunk_id,
+                                  &stream_prefetch_ids)) {
+        if (perfcounter != nullptr) {
+          perfcounter->inc(l_librbd_prefetch_stream_access);
+        }
+      } else {
+        prediction_wq->record(chunk_id);
+      }
+
+      // Detection work queue will be triggered via the RealCache
+    }
+
+    // And try to get it from the cache; the last chunk of the image is
+    // short, and may have been cached before the image grew
+    bufferptr cache_chunk_buffer = real_cache->get(chunk_id);
+    uint64_t chunk_length = i.first < image_size ?
+      std::min(i.second, image_size - i.first) : i.second;
+
+    if (cache_chunk_buffer.length() > 0 &&
+        cache_chunk_buffer.length() >= chunk_length) {
+      (*chunks)[i.first].append(cache_chunk_buffer);
+      num_cached_chunks ++;
+    } else {
+      // Uncached chunks will have to be requested from the cluster
+      uncached_chunk_ids.push_back(chunk_id);
+      uncached_chunk_epochs.push_back(real_cache->get_epoch(chunk_id));
+      uncached_chunk_extents.push_back(i);
+    }
+  }
+
+
+  if (!stream_prefetch_ids.empty()) {
+    if (perfcounter != nullptr) {
+      perfcounter->inc(l_librbd_prefetch_stream_chunks,
+                       stream_prefetch_ids.size());
+    }
+    for (auto id : stream_prefetch_ids) {
+      prefetch_scheduler->schedule(id);
+    }
+  }
+
+  ldout(cct, 20) << "Number of requested chunks to be fetched= "
+    << uncached_chunk_ids.size()
+    << "Number of requested chunks in the cache= "
+    << num_cached_chunks << dendl;
+
+  if (uncached_chunk_ids.empty()) {
+    assemble_extents(image_extents, m_chunk_size, *chunks, bl);
+    ldout(cct, 20) << "All requested chunks are in cache, "
+                   << "extents=" << image_extents << ", "
+                   << "bl.length=" << bl->length() << dendl;
+    on_finish->complete(bl->length());
+    return;
+  }
+
+  // If any of the chunks aren't in the cache, we need to make an
+  // asynchronous request from the cluster
+  auto fetched = new bufferlist();
+  Extents fetch_extents = uncached_chunk_extents;
+  Context *ctx = new FunctionContext(
+    [this, chunks, fetched, uncached_chunk_ids, uncached_chunk_epochs,
+     uncached_chunk_extents, image_extents, bl, on_finish](int r) {
+      std::unique_ptr<bufferlist> fetched_bl(fetched);
+      if (r >= 0) {
+        // the chunks were read back to back; the last one of the image may
+        // be short
+        uint64_t offset = 0;
+        for (size_t i = 0; i < uncached_chunk_extents.size(); ++i) {
+          uint64_t length = std::min<uint64_t>(uncached_chunk_extents[i].second,
+                                               fetched->length() - offset);
+          bufferlist &chunk = (*chunks)[uncached_chunk_extents[i].first];
+          chunk.substr_of(*fetched, offset, length);
+          offset += length;
+
+          if (length == m_chunk_size) {
+            chunk.c_str();
+            real_cache->insert(uncached_chunk_ids[i], chunk.front(), true,
+                               false, uncached_chunk_epochs[i]);
+          }
+        }
+
+        assemble_extents(image_extents, m_chunk_size, *chunks, bl);
+        r = bl->length();
+      }
+      on_finish->complete(r);
+    });
+
+  auto aio_comp = io::AioCompletion::create_and_start(ctx, &m_image_ctx,
+                                                      io::AIO_TYPE_READ);
+  io::ImageReadRequest<I> req(m_image_ctx, aio_comp, std::move(fetch_extents),
+                              io::ReadResult{fetched}, fadvise_flags, {});
+  req.set_bypass_image_cache();
+  req.send();
+}
+
+template <typename I>
+ImageCache::Extents PrefetchImageCache<I>::extent_to_chunks(std::pair<uint64_t, uint64_t> one_extent) {
+  Extents chunked_extent;
   uint64_t offset = one_extent.first;
   uint64_t length = one_extent.second;
- 
-  if (offset%CACHE_CHUNK_SIZE != 0) {
-    changedOffset = offset-offset%CACHE_CHUNK_SIZE;
-    chunkedExtent.push_back(std::make_pair(changedOffset,CACHE_CHUNK_SIZE));
-  } else {
-    changedOffset = offset;
-    chunkedExtent.push_back(std::make_pair(changedOffset,CACHE_CHUNK_SIZE));
-  }         
-  if ((length%CACHE_CHUNK_SIZE + offset) < CACHE_CHUNK_SIZE) {
-    uint64_t remains2 = CACHE_CHUNK_SIZE - length%CACHE_CHUNK_SIZE;
-    changedLength = length + remains2;
-  } else if((offset%CACHE_CHUNK_SIZE + length) > CACHE_CHUNK_SIZE){
-    uint64_t remains = CACHE_CHUNK_SIZE - length%CACHE_CHUNK_SIZE;
-    changedLength = length+remains;
-  } else { 
-    changedOffset = offset;
-    changedLength = length;
-  }
-  if (changedLength > CACHE_CHUNK_SIZE) {
-    while (changedLength > CACHE_CHUNK_SIZE) {
-      changedOffset += CACHE_CHUNK_SIZE;
-      changedLength -= CACHE_CHUNK_SIZE;
-      chunkedExtent.push_back(std::make_pair(changedOffset,CACHE_CHUNK_SIZE));
-    }
-  } else {
-    chunkedExtent.push_back(std::make_pair(changedOffset,CACHE_CHUNK_SIZE));
+  if (length == 0) {
+    return chunked_extent;
+  }
+
+  uint64_t chunk_offset = offset - (offset % m_chunk_size);
+  uint64_t end = offset + length;
+  for (; chunk_offset < end; chunk_offset += m_chunk_size) {
+    chunked_extent.push_back(std::make_pair(chunk_offset, m_chunk_size));
   }
-  return chunkedExtent;
-                      
+  return chunked_extent;
 }
 
   
@@ -279,13 +428,14 @@ void PrefetchImageCache<I>::aio_write(Extents &&image_extents,
                  << "on_finish=" << on_finish << ", "
                  << "write_count=" << write_count << dendl;
 
-  if (write_count == writes_until_cache) {
-    ldout(cct, 5) << "Starting caching after " << writes_until_cache
+  if (!caching && !disabled && write_count >= warmup_writes) {
+    ldout(cct, 5) << "Starting caching after " << warmup_writes
                   << " writes" << dendl;
-    
+
     caching = true;
   }
 
+  on_finish = invalidate_on_write(Extents(image_extents), on_finish);
   m_image_writeback.aio_write(std::move(image_extents), std::move(bl),
                               fadvise_flags, on_finish);
 }
@@ -298,9 +448,43 @@ void PrefetchImageCache<I>::aio_discard(uint64_t offset, uint64_t length,
                  << "length=" << length << ", "
                  << "on_finish=" << on_finish << dendl;
 
+  on_finish = invalidate_on_write({{offset, length}}, on_finish);
   m_image_writeback.aio_discard(offset, length, skip_partial_discard, on_finish);
 }
 
+template <typename I>
+void PrefetchImageCache<I>::invalidate_chunks(const Extents &image_extents) {
+  for (auto &extent : image_extents) {
+    if (extent.second == 0) {
+      continue;
+    }
+
+    ElementID last_id = chunk_id(extent.first + extent.second - 1);
+    for (ElementID id = chunk_id(extent.first); id <= last_id; ++id) {
+      real_cache->invalidate(id);
+      if (ssd_cache != nullptr) {
+        ssd_cache->invalidate(id);
+      }
+    }
+  }
+}
+
+/**
+ * Drop the cached copies of the chunks a write touches, both before it is
+ * sent and once it completes: a read that raced with the write may return
+ * either version, so its result must not be cached.
+ */
+template <typename I>
+Context *PrefetchImageCache<I>::invalidate_on_write(Extents &&image_extents,
+                                                    Context *on_finish) {
+  invalidate_chunks(image_extents);
+  return new FunctionContext(
+    [this, image_extents, on_finish](int r) {
+      invalidate_chunks(image_extents);
+      on_finish->complete(r);
+    });
+}
+
 template <typename I>
 void PrefetchImageCache<I>::aio_flush(Context *on_finish) {
   CephContext *cct = m_image_ctx.cct;
@@ -319,6 +503,7 @@ void PrefetchImageCache<I>::aio_writesame(uint64_t offset, uint64_t length,
                  << "data_len=" << bl.length() << ", "
                  << "on_finish=" << on_finish << dendl;
 
+  on_finish = invalidate_on_write({{offset, length}}, on_finish);
   m_image_writeback.aio_writesame(offset, length, std::move(bl), fadvise_flags,
                                   on_finish);
 }
@@ -334,6 +519,7 @@ void PrefetchImageCache<I>::aio_compare_and_write(Extents &&image_extents,
   ldout(cct, 20) << "image_extents=" << image_extents << ", "
                  << "on_finish=" << on_finish << dendl;
 
+  on_finish = invalidate_on_write(Extents(image_extents), on_finish);
   m_image_writeback.aio_compare_and_write(
     std::move(image_extents), std::move(cmp_bl), std::move(bl), mismatch_offset,
     fadvise_flags, on_finish);
@@ -344,28 +530,349 @@ void PrefetchImageCache<I>::init(Context *on_finish) {
   CephContext *cct = m_image_ctx.cct;    //for logging purposes
   ldout(cct, 20) << dendl;
 
+  init_chunk_size();
+  init_ssd_cache();
+  load_model();
+  perf_start();
 
   on_finish->complete(0);
-
-  // init() called where? which context to use for on_finish?
-  // in other implementations, init() is called in OpenRequest, totally unrelated
-  // to constructor, which makes sense - image context is 'owned' by program
-  // using librbd, so lifecycle is not quite the same as the actual open image connection
-
-  // see librbd/Utils.h line 132 for create_context_callback which seems to be the kind of context that's needed for on_finish
 }
 
 template <typename I>
 void PrefetchImageCache<I>::init_blocking() {
   CephContext *cct = m_image_ctx.cct;    //for logging purposes
-  ldout(cct, 20) << "BLOCKING init without callback, being called from image cache constructor" << dendl;
+  ldout(cct, 20) << "BLOCKING init without callback, being called from image open" << dendl;
+
+  init_chunk_size();
+  init_ssd_cache();
+  load_model();
+  perf_start();
 }
-  
-  
+
+/**
+ * Pick the cache chunk size once the image layout is known. Chunks never
+ * straddle a stripe unit (and therefore never straddle an object), so each
+ * chunk read maps onto a single object extent. The configured size is an
+ * upper bound; 0 means "one chunk per stripe unit". A chunk also has to fit
+ * into a cache shard, or it would be evicted as soon as it is inserted; if
+ * that leaves chunks smaller than MIN_CHUNK_SIZE the cache stays off.
+ */
+template <typename I>
+void PrefetchImageCache<I>::init_chunk_size() {
+  CephContext *cct = m_image_ctx.cct;
+
+  uint64_t stripe_unit = m_image_ctx.get_stripe_unit();
+  if (stripe_unit == 0) {
+    stripe_unit = m_image_ctx.get_object_size();
+  }
+
+  uint64_t chunk_size = cct->_conf->get_val<uint64_t>(
+    "rbd_prefetch_cache_chunk_size");
+  if (chunk_size == 0 || chunk_size > stripe_unit) {
+    chunk_size = stripe_unit;
+  }
+  // halving a power of two reaches a divisor of the stripe unit without
+  // passing through odd sizes
+  chunk_size = 1ull << (cbits(chunk_size) - 1);
+  while (chunk_size > 1 && stripe_unit % chunk_size != 0) {
+    chunk_size >>= 1;
+  }
+  while (chunk_size > real_cache->get_shard_max_bytes() &&
+         chunk_size > MIN_CHUNK_SIZE) {
+    chunk_size >>= 1;
+  }
+
+  uint64_t min_chunk_size = std::min<uint64_t>(MIN_CHUNK_SIZE, stripe_unit);
+  if (chunk_size < min_chunk_size ||
+      chunk_size > real_cache->get_shard_max_bytes()) {
+    lderr(cct) << "stripe_unit=" << stripe_unit << " and "
+               << "shard_max_bytes=" << real_cache->get_shard_max_bytes()
+               << " leave no usable chunk size, disabling the prefetch cache"
+               << dendl;
+    disabled = true;
+    caching = false;
+  } else {
+    disabled = false;
+  }
+
+  // chunk IDs are only meaningful for a fixed chunk size
+  if (chunk_size != m_chunk_size) {
+    real_cache->clear();
+    stream_detector->reset();
+  }
+  m_chunk_size = chunk_size;
+  prefetch_scheduler->set_chunk_size(m_chunk_size);
+
+  ldout(cct, 5) << "stripe_unit=" << stripe_unit << ", "
+                << "chunk_size=" << m_chunk_size << ", "
+                << "cache_bytes=" << real_cache->get_max_bytes() << dendl;
+}
+
+/**
+ * Create the SSD tier, if configured. Every open gets its own file, so two
+ * handles of the same image never share (and never trust) cached data.
+ */
+template <typename I>
+void PrefetchImageCache<I>::init_ssd_cache() {
+  CephContext *cct = m_image_ctx.cct;
+  std::string dir = cct->_conf->template get_val<std::string>(
+    "rbd_prefetch_ssd_cache_dir");
+  if (dir.empty() || ssd_cache != nullptr) {
+    return;
+  }
+
+  std::string image_id = m_image_ctx.id.empty() ? m_image_ctx.name :
+                                                  m_image_ctx.id;
+  std::string path = dir + "/rbd_prefetch_ssd." +
+                     stringify(m_image_ctx.md_ctx.get_id()) + "." + image_id +
+                     "." + stringify(getpid()) + "." + stringify(this);
+
+  auto cache = new SSDCache(cct, path,
+    cct->_conf->template get_val<uint64_t>("rbd_prefetch_ssd_cache_size"),
+    perfcounter);
+  int r = cache->init(m_chunk_size);
+  if (r < 0) {
+    lderr(cct) << "failed to create SSD tier in " << dir << ": "
+               << cpp_strerror(r) << dendl;
+    delete cache;
+    return;
+  }
+
+  ssd_cache = cache;
+  real_cache->set_evict_handler([this](ElementID id, const bufferptr &bp) {
+      ssd_cache->write(id, bp);
+    });
+  prefetch_scheduler->set_ssd_cache(ssd_cache);
+}
+
 template <typename I>
 void PrefetchImageCache<I>::shut_down(Context *on_finish) {
   CephContext *cct = m_image_ctx.cct;
   ldout(cct, 20) << dendl;
+
+  save_model();
+  perf_stop();
+
+  // wait for in-flight prefetch reads before the image is torn down; they
+  // may still spill chunks into the SSD tier
+  prefetch_scheduler->shut_down(new FunctionContext(
+    [this, on_finish](int r) {
+      if (ssd_cache != nullptr) {
+        ssd_cache->shut_down();
+      }
+      on_finish->complete(r);
+    }));
+}
+
+template <typename I>
+void PrefetchImageCache<I>::perf_create() {
+  CephContext *cct = m_image_ctx.cct;
+  std::string image_name = m_image_ctx.name.empty() ? m_image_ctx.id :
+                                                      m_image_ctx.name;
+  std::string name = "librbd-prefetch-" + m_image_ctx.md_ctx.get_pool_name() +
+                     "-" + image_name;
+
+  PerfCountersBuilder plb(cct, name, l_librbd_prefetch_first,
+                          l_librbd_prefetch_last);
+  plb.add_u64_counter(l_librbd_prefetch_hit, "hit", "Chunk reads hit");
+  plb.add_u64_counter(l_librbd_prefetch_miss, "miss", "Chunk reads missed");
+  plb.add_u64_counter(l_librbd_prefetch_read, "prefetch_read",
+                      "Prefetch read requests issued");
+  plb.add_u64_counter(l_librbd_prefetch_chunks, "prefetch_chunks",
+                      "Chunks prefetched");
+  plb.add_u64_counter(l_librbd_prefetch_bytes, "prefetch_bytes",
+                      "Data prefetched", NULL, 0, unit_t(UNIT_BYTES));
+  plb.add_u64_counter(l_librbd_prefetch_used, "prefetch_used",
+                      "Prefetched chunks read before eviction");
+  plb.add_u64_counter(l_librbd_prefetch_unused, "prefetch_unused",
+                      "Prefetched chunks evicted unread");
+  plb.add_u64_counter(l_librbd_prefetch_unused_bytes, "prefetch_unused_bytes",
+                      "Prefetched data evicted unread", NULL, 0,
+                      unit_t(UNIT_BYTES));
+  plb.add_u64_counter(l_librbd_prefetch_dropped, "prefetch_dropped",
+                      "Stale or redundant predictions dropped");
+  plb.add_u64(l_librbd_prefetch_in_flight_bytes, "prefetch_in_flight_bytes",
+              "Prefetch data in flight", NULL, 0, unit_t(UNIT_BYTES));
+  plb.add_u64(l_librbd_prefetch_prediction_queue, "prediction_queue",
+              "Accesses waiting for the prediction model");
+  plb.add_u64(l_librbd_prefetch_detection_queue, "detection_queue",
+              "Accesses waiting for phase detection");
+  plb.add_u64_counter(l_librbd_prefetch_phase_change, "phase_change",
+                      "Workload phase changes detected");
+  plb.add_time_avg(l_librbd_prefetch_model_latency, "model_latency",
+                   "Time to update the prediction model per access");
+  plb.add_u64_counter(l_librbd_prefetch_access_dropped, "access_dropped",
+                      "Accesses not recorded because the workers fell behind");
+  plb.add_u64_counter(l_librbd_prefetch_stream_access, "stream_access",
+                      "Chunk reads handled by the stream detector");
+  plb.add_u64_counter(l_librbd_prefetch_stream_chunks, "stream_chunks",
+                      "Chunks prefetched for sequential and strided streams");
+  plb.add_u64_counter(l_librbd_prefetch_ssd_hit, "ssd_hit",
+                      "Chunks read from the SSD tier");
+  plb.add_u64_counter(l_librbd_prefetch_ssd_write, "ssd_write",
+                      "Chunks written to the SSD tier");
+  plb.add_u64_counter(l_librbd_prefetch_ssd_write_bytes, "ssd_write_bytes",
+                      "Data written to the SSD tier", NULL, 0,
+                      unit_t(UNIT_BYTES));
+  plb.add_u64_counter(l_librbd_prefetch_ssd_invalidate, "ssd_invalidate",
+                      "SSD tier chunks invalidated by writes");
+  plb.add_u64(l_librbd_prefetch_ssd_bytes, "ssd_bytes",
+              "Data stored in the SSD tier", NULL, 0, unit_t(UNIT_BYTES));
+  perfcounter = plb.create_perf_counters();
+}
+
+template <typename I>
+void PrefetchImageCache<I>::perf_start() {
+  if (!perf_registered) {
+    m_image_ctx.cct->get_perfcounters_collection()->add(perfcounter);
+    perf_registered = true;
+  }
+}
+
+template <typename I>
+void PrefetchImageCache<I>::perf_stop() {
+  if (perf_registered) {
+    m_image_ctx.cct->get_perfcounters_collection()->remove(perfcounter);
+    perf_registered = false;
+  }
+}
+
+template <typename I>
+void PrefetchImageCache<I>::dump(Formatter *f) const {
+  f->open_object_section("cache");
+  f->dump_unsigned("chunk_size", m_chunk_size);
+  f->dump_unsigned("max_bytes", real_cache->get_max_bytes());
+  f->dump_unsigned("bytes", real_cache->get_bytes());
+  f->dump_unsigned("entries", real_cache->get_num_entries());
+  f->dump_float("hit_rate", real_cache->get_hit_rate());
+  f->dump_bool("caching", caching);
+  f->close_section();
+
+  if (ssd_cache != nullptr) {
+    f->open_object_section("ssd_cache");
+    f->dump_unsigned("max_bytes", ssd_cache->get_max_bytes());
+    f->dump_unsigned("bytes", ssd_cache->get_bytes());
+    f->dump_unsigned("entries", ssd_cache->get_num_entries());
+    f->close_section();
+  }
+
+  f->open_object_section("scheduler");
+  f->dump_float("batch_window", prefetch_scheduler->get_batch_window());
+  f->dump_unsigned("max_in_flight_bytes",
+                   prefetch_scheduler->get_max_in_flight_bytes());
+  f->dump_unsigned("in_flight_bytes", prefetch_scheduler->get_in_flight_bytes());
+  f->dump_unsigned("pending", prefetch_scheduler->get_num_pending());
+  f->close_section();
+
+  f->open_object_section("streams");
+  stream_detector->dump(f);
+  f->close_section();
+
+  f->open_object_section("model");
+  prediction_wq->dump(f);
+  f->close_section();
+}
+
+/**
+ * The learned model is kept in a local file per image (not in the image
+ * itself) so that read-only and snapshot opens can save it too and large
+ * models never end up in the image header's omap.
+ */
+template <typename I>
+std::string PrefetchImageCache<I>::get_model_path() const {
+  std::string dir = m_image_ctx.cct->_conf->template get_val<std::string>(
+    "rbd_prefetch_model_dir");
+  if (dir.empty()) {
+    return "";
+  }
+
+  std::string image_id = m_image_ctx.id.empty() ? m_image_ctx.name :
+                                                  m_image_ctx.id;
+  return dir + "/rbd_prefetch_model." + stringify(m_image_ctx.md_ctx.get_id()) +
+         "." + image_id;
+}
+
+template <typename I>
+void PrefetchImageCache<I>::load_model() {
+  CephContext *cct = m_image_ctx.cct;
+  std::string path = get_model_path();
+  if (path.empty()) {
+    return;
+  }
+
+  bufferlist bl;
+  std::string err;
+  int r = bl.read_file(path.c_str(), &err);
+  if (r == -ENOENT) {
+    ldout(cct, 10) << "no saved model at " << path << dendl;
+    return;
+  } else if (r < 0) {
+    lderr(cct) << "failed to read model " << path << ": " << err << dendl;
+    return;
+  }
+
+  try {
+    auto it = bl.cbegin();
+    DECODE_START(1, it);
+    uint64_t chunk_size;
+    decode(chunk_size, it);
+
+    // chunk IDs in the model are only valid for the same chunk size
+    if (chunk_size == m_chunk_size) {
+      prediction_wq->decode_model(it);
+      ldout(cct, 5) << "loaded model from " << path << dendl;
+    } else {
+      ldout(cct, 5) << "ignoring model " << path << " saved with "
+                    << "chunk_size=" << chunk_size << dendl;
+    }
+    DECODE_FINISH(it);
+  } catch (const buffer::error &e) {
+    lderr(cct) << "failed to decode model " << path << ": " << e.what()
+               << dendl;
+  }
+}
+
+template <typename I>
+void PrefetchImageCache<I>::save_model() {
+  CephContext *cct = m_image_ctx.cct;
+  std::string path = get_model_path();
+  if (path.empty()) {
+    return;
+  }
+
+  bufferlist bl;
+  ENCODE_START(1, 1, bl);
+  encode(m_chunk_size, bl);
+  prediction_wq->encode_model(bl);
+  ENCODE_FINISH(bl);
+
+  // write to a temporary file first so a crash never leaves a torn model;
+  // the name is unique since several images may share a model directory
+  std::string tmp_path = path + ".tmp.XXXXXX";
+  int r = 0;
+  int fd = ::mkstemp(&tmp_path[0]);
+  if (fd < 0) {
+    r = -errno;
+  } else {
+    r = bl.write_fd(fd);
+    if (::close(fd) < 0 && r == 0) {
+      r = -errno;
+    }
+    if (r == 0 && ::rename(tmp_path.c_str(), path.c_str()) < 0) {
+      r = -errno;
+    }
+    if (r < 0) {
+      ::unlink(tmp_path.c_str());
+    }
+  }
+  if (r < 0) {
+    lderr(cct) << "failed to save model " << path << ": " << cpp_strerror(r)
+               << dendl;
+    return;
+  }
+
+  ldout(cct, 5) << "saved " << bl.length() << " byte model to " << path
+                << dendl;
 }
   
   
@@ -374,7 +881,10 @@ void PrefetchImageCache<I>::invalidate(Context *on_finish) {
   CephContext *cct = m_image_ctx.cct;
   ldout(cct, 20) << dendl;
 
-  // dump cache contents (don't have anything)
+  real_cache->clear();
+  if (ssd_cache != nullptr) {
+    ssd_cache->clear();
+  }
   on_finish->complete(0);
 }
 
@@ -397,7 +907,8 @@ void PrefetchImageCache<I>::flush(Context *on_finish) {
  */
 template <typename I>
 void PrefetchImageCache<I>::aio_cache_returned_data( // const Extents& image_extents,
-  ceph::bufferlist *bl, std::vector<cache::ElementID> chunk_ids, bool copy_result) {
+  ceph::bufferlist *bl, std::vector<cache::ElementID> chunk_ids,
+  bool copy_result, const std::vector<uint64_t> &epochs) {
 
   CephContext *cct = m_image_ctx.cct;
   ldout(cct, 20) << "caching the returned data "
@@ -412,11 +923,14 @@ void PrefetchImageCache<I>::aio_cache_returned_data( // const Extents& image_ext
   ldout(cct, 20) << "length=" << chunk_ids.size() << ", bl.length=" << bl1.length()
                  << ", buffers=" << bl1.get_num_buffers() << dendl;
 
-  if (chunk_ids.size() == bl1.get_num_buffers()) {
+  if (chunk_ids.size() == bl1.get_num_buffers() &&
+      chunk_ids.size() == epochs.size()) {
     uint64_t i = 0;
     for (auto& buffer : bl1.buffers()) {
       // if (in_prefetch_list(chunk_ids[i])) {
-        real_cache->insert(chunk_ids[i], buffer, copy_result);
+        // data read before an overlapping write completed is dropped
+        real_cache->insert(chunk_ids[i], buffer, copy_result, false,
+                           epochs[i]);
       // }
       i ++;
     }
@@ -428,6 +942,17 @@ void PrefetchImageCache<I>::aio_cache_returned_data( // const Extents& image_ext
   }
 }
 
+template <typename I>
+std::vector<uint64_t> PrefetchImageCache<I>::get_chunk_epochs(
+    const std::vector<cache::ElementID> &chunk_ids) const {
+  std::vector<uint64_t> epochs;
+  epochs.reserve(chunk_ids.size());
+  for (auto id : chunk_ids) {
+    epochs.push_back(real_cache->get_epoch(id));
+  }
+  return epochs;
+}
+
 template <typename I>
 void PrefetchImageCache<I>::update_cache(std::vector<uint64_t> elements) {
   // Actually update the LRU/cache list here
@@ -441,37 +966,11 @@ template <typename I>
 void PrefetchImageCache<I>::prefetch_chunk(uint64_t id) {
   ldout(m_image_ctx.cct, 20) << "Prefetching chunk " << id << dendl;
 
-  bufferlist* cache_storage = new bufferlist();
-
-  Extents extents {std::make_pair((id - 1) * CACHE_CHUNK_SIZE, CACHE_CHUNK_SIZE)};
-  Context* on_completion = new CacheUpdate<I>(this, std::vector<uint64_t>{id}, m_image_ctx.cct,
-                                              cache_storage, false);
-  auto aio_comp = io::AioCompletion::create_and_start(on_completion, &m_image_ctx,
-                                                        io::AIO_TYPE_READ);
-  io::ImageReadRequest<I> req(m_image_ctx, aio_comp, std::move(extents),
-                              io::ReadResult{cache_storage}, 0, {});
-                              
-  req.set_bypass_image_cache();
-  req.send();
+  // The scheduler batches predictions and skips chunks already cached
+  prefetch_scheduler->schedule(id);
 }
 
 
-template <typename T>
-CacheUpdate<T>::CacheUpdate(PrefetchImageCache<T>* cache, const std::vector<uint64_t>& elements,
-    CephContext* cct, ceph::bufferlist* bl, bool copy_result, Context* to_run) :
-  cache(cache), elements(elements), cct(cct), bl(bl), copy_result(copy_result), to_run(to_run)
-{}
-
-
-template <typename T>
-void CacheUpdate<T>::finish(int r) {
-  cache->aio_cache_returned_data(bl, elements, copy_result);
-
-  if (to_run) {
-    to_run->complete(r);
-  }
-}
-
 } // namespace cache
 } // namespace librbd
 
@@ -3,8 +3,6 @@
 
 #ifndef CEPH_LIBRBD_CACHE_PREFETCH_IMAGE_CACHE
 #define CEPH_LIBRBD_CACHE_PREFETCH_IMAGE_CACHE
-#define HASH_SIZE 1048576
-#define CACHE_CHUNK_SIZE 1024//131072
 
 #include "ImageCache.h"
 #include "ImageWriteback.h"
@@ -16,6 +14,12 @@
 #include <unordered_map>
 #include <vector>
 
+class PerfCounters;
+
+namespace ceph {
+class Formatter;
+}
+
 namespace librbd {
 
 struct ImageCtx;
@@ -24,6 +28,9 @@ namespace cache {
 
 class PredictionWorkQueue;
 class DetectionModule;
+class SSDCache;
+class StreamDetector;
+template <typename> class PrefetchScheduler;
 
 /**
  * Example passthrough client-side, image extent cache
@@ -54,6 +61,17 @@ public:
   void update_cache(std::vector<uint64_t> ids);
   void prefetch_chunk(uint64_t id);
 
+  /// chunk <-> image offset mapping, fixed once the image is opened
+  ElementID chunk_id(uint64_t image_offset) const {
+    return (image_offset / m_chunk_size) + 1;
+  }
+  Extent chunk_extent(ElementID id) const {
+    return std::make_pair((id - 1) * m_chunk_size, m_chunk_size);
+  }
+  uint64_t get_chunk_size() const {
+    return m_chunk_size;
+  }
+
   /// internal state methods
   void init(Context *on_finish) override;
   void init_blocking() override;
@@ -62,17 +80,51 @@ public:
   void invalidate(Context *on_finish) override;
   void flush(Context *on_finish) override;
 
+  /// @epochs from get_chunk_epochs() when the read was issued, so data
+  /// that raced with a write is dropped instead of cached
   void aio_cache_returned_data( // const Extents& image_extents,
     ceph::bufferlist *bl,
-    std::vector<cache::ElementID> chunk_ids, bool copy_result);
-  
+    std::vector<cache::ElementID> chunk_ids, bool copy_result,
+    const std::vector<uint64_t> &epochs);
+  std::vector<uint64_t> get_chunk_epochs(
+    const std::vector<cache::ElementID> &chunk_ids) const;
+
+  RealCache::Stats get_cache_stats() const {
+    return real_cache->get_stats();
+  }
+
+  /// dump cache, scheduler and model parameters (admin socket)
+  void dump(ceph::Formatter *f) const;
+
   
 
 private:
   ImageCtxT &m_image_ctx;
   ImageWriteback<ImageCtxT> m_image_writeback;
 
-  Extents extent_to_chunks(std::pair<uint64_t, uint64_t> image_extents); 
+  Extents extent_to_chunks(std::pair<uint64_t, uint64_t> image_extents);
+  void init_chunk_size();
+  void init_ssd_cache();
+
+  void read_chunks(Extents &&image_extents, Extents &&chunk_extents,
+                   ceph::bufferlist *bl, int fadvise_flags,
+                   Context *on_finish);
+  void invalidate_chunks(const Extents &image_extents);
+  Context *invalidate_on_write(Extents &&image_extents, Context *on_finish);
+
+  void perf_create();
+  void perf_start();
+  void perf_stop();
+
+  std::string get_model_path() const;
+  void load_model();
+  void save_model();
+
+  PerfCounters* perfcounter = nullptr;
+  bool perf_registered = false;
+
+  // Cheap fast path for sequential and strided streams
+  StreamDetector* stream_detector;
 
   // Work queue to handle Belief value calculations
   PredictionWorkQueue* prediction_wq;
@@ -82,30 +134,23 @@ private:
 
   RealCache* real_cache;
 
+  // Optional local SSD tier below the real cache
+  SSDCache* ssd_cache = nullptr;
+
+  // Coalesces predicted chunks into prefetch reads
+  PrefetchScheduler<ImageCtxT>* prefetch_scheduler;
+
+  uint64_t m_chunk_size;
+
   uint64_t write_count = 0;
   uint64_t read_count = 0;
+  uint64_t warmup_writes;
   bool caching = false;
-};
+  // no usable chunk size for this image and cache size
+  bool disabled = false;
 
-// CacheUpdate is a callback function (otherwise known as a Context in Ceph)
-// that tells the image cache to update its cache/LRU list, as well as run
-// the additional callback specified in its construction
-template <typename T>
-class CacheUpdate: public Context {
-  public:
-    CacheUpdate(PrefetchImageCache<T>* cache, const std::vector<uint64_t>& elements,
-    CephContext* cct, ceph::bufferlist* bl, bool copy_result, Context* to_run = nullptr);
-    void finish(int r) override;
-
-  private:
-    PrefetchImageCache<T>* cache;
-    std::vector<uint64_t> elements;
-    CephContext* cct;
-    ceph::bufferlist* bl;
-    bool copy_result;
-    Context* to_run;
+  static constexpr uint64_t MIN_CHUNK_SIZE = 4096;
 };
-	
 
 } // namespace cache
 } // namespace librbd
@@ -0,0 +1,370 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "librbd/cache/PrefetchScheduler.h"
+#include "common/dout.h"
+#include "common/errno.h"
+#include "common/perf_counters.h"
+#include "common/Timer.h"
+#include "common/WorkQueue.h"
+#include "include/Context.h"
+#include "librbd/ImageCtx.h"
+#include "librbd/io/AioCompletion.h"
+#include "librbd/io/ImageRequest.h"
+#include "librbd/io/ReadResult.h"
+#include "librbd/Utils.h"
+#include "librbd/cache/PrefetchTypes.h"
+#include "librbd/cache/SSDCache.h"
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::cache::PrefetchScheduler: " << this \
+                           << " " << __func__ << ": "
+
+namespace librbd {
+namespace cache {
+
+template <typename I>
+struct PrefetchScheduler<I>::C_PrefetchRead : public Context {
+  PrefetchScheduler *scheduler;
+  ReadRequest request;
+  bufferlist bl;
+
+  C_PrefetchRead(PrefetchScheduler *scheduler, ReadRequest &&request)
+    : scheduler(scheduler), request(std::move(request)) {
+  }
+
+  void finish(int r) override {
+    scheduler->handle_read(r, request, bl);
+  }
+};
+
+template <typename I>
+struct PrefetchScheduler<I>::C_PromoteRead : public Context {
+  PrefetchScheduler *scheduler;
+  Promotion promotion;
+  bufferlist bl;
+
+  C_PromoteRead(PrefetchScheduler *scheduler, const Promotion &promotion)
+    : scheduler(scheduler), promotion(promotion) {
+  }
+
+  void finish(int r) override {
+    scheduler->handle_promote(r, promotion, bl);
+  }
+};
+
+template <typename I>
+PrefetchScheduler<I>::PrefetchScheduler(I &image_ctx, RealCache &real_cache,
+                                        PerfCounters *perfcounter)
+  : m_image_ctx(image_ctx), m_real_cache(real_cache),
+    m_perfcounter(perfcounter),
+    m_batch_window(image_ctx.cct->_conf->template get_val<double>(
+      "rbd_prefetch_batch_window")),
+    m_max_age(ceph::make_timespan(image_ctx.cct->_conf->template get_val<double>(
+      "rbd_prefetch_max_age"))),
+    m_max_in_flight_bytes(image_ctx.cct->_conf->template get_val<uint64_t>(
+      "rbd_prefetch_max_in_flight_bytes")),
+    m_lock("librbd::cache::PrefetchScheduler::m_lock") {
+  I::get_timer_instance(m_image_ctx.cct, &m_timer, &m_timer_lock);
+}
+
+template <typename I>
+void PrefetchScheduler<I>::set_chunk_size(uint64_t chunk_size) {
+  Mutex::Locker locker(m_lock);
+  if (chunk_size != m_chunk_size) {
+    // pending IDs were computed for the old chunk size
+    m_pending.clear();
+    m_chunk_size = chunk_size;
+  }
+}
+
+template <typename I>
+void PrefetchScheduler<I>::set_ssd_cache(SSDCache *ssd_cache) {
+  Mutex::Locker locker(m_lock);
+  m_ssd_cache = ssd_cache;
+}
+
+template <typename I>
+void PrefetchScheduler<I>::schedule(ElementID id) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "id=" << id << dendl;
+
+  {
+    Mutex::Locker locker(m_lock);
+    if (m_shutting_down || m_chunk_size == 0 || m_in_flight.count(id) > 0) {
+      return;
+    }
+
+    // a repeated prediction refreshes the age of a pending chunk
+    m_pending[id] = ceph::mono_clock::now();
+    if (m_dispatch_scheduled) {
+      return;
+    }
+    m_dispatch_scheduled = true;
+  }
+
+  Mutex::Locker timer_locker(*m_timer_lock);
+  Mutex::Locker locker(m_lock);
+  if (m_shutting_down) {
+    return;
+  }
+
+  m_timer_task = new FunctionContext([this](int r) {
+      assert(m_timer_lock->is_locked());
+      m_timer_task = nullptr;
+      queue_dispatch();
+    });
+  m_timer->add_event_after(m_batch_window, m_timer_task);
+}
+
+template <typename I>
+void PrefetchScheduler<I>::shut_down(Context *on_finish) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << dendl;
+
+  {
+    Mutex::Locker timer_locker(*m_timer_lock);
+    Mutex::Locker locker(m_lock);
+    assert(!m_shutting_down);
+    m_shutting_down = true;
+    m_pending.clear();
+
+    if (m_timer_task != nullptr) {
+      m_timer->cancel_event(m_timer_task);
+      m_timer_task = nullptr;
+    }
+
+    if (!m_in_flight.empty()) {
+      ldout(cct, 20) << "waiting for " << m_in_flight.size() << " in-flight "
+                     << "prefetch chunks" << dendl;
+      m_on_shut_down = on_finish;
+      return;
+    }
+  }
+
+  on_finish->complete(0);
+}
+
+template <typename I>
+uint64_t PrefetchScheduler<I>::get_object_no(ElementID id) const {
+  assert(m_lock.is_locked());
+
+  // chunks never straddle a stripe unit, and with the default layout a
+  // whole object is a single stripe unit
+  uint64_t period = m_image_ctx.get_stripe_count() > 1 ?
+    m_image_ctx.get_stripe_unit() : m_image_ctx.get_object_size();
+  return ((id - 1) * m_chunk_size) / period;
+}
+
+template <typename I>
+void PrefetchScheduler<I>::queue_dispatch() {
+  m_image_ctx.op_work_queue->queue(new FunctionContext([this](int r) {
+      dispatch();
+    }), 0);
+}
+
+template <typename I>
+void PrefetchScheduler<I>::dispatch() {
+  CephContext *cct = m_image_ctx.cct;
+
+  std::vector<ReadRequest> requests;
+  std::vector<Promotion> promotions;
+  {
+    Mutex::Locker locker(m_lock);
+    m_dispatch_scheduled = false;
+    if (m_shutting_down) {
+      return;
+    }
+
+    auto now = ceph::mono_clock::now();
+    uint64_t dropped = 0;
+    uint64_t in_flight_bytes = m_in_flight_bytes;
+    ElementID last_id = 0;
+    uint64_t object_no = 0;
+
+    for (auto it = m_pending.begin(); it != m_pending.end(); ) {
+      ElementID id = it->first;
+      if (now - it->second > m_max_age || m_in_flight.count(id) > 0 ||
+          m_real_cache.contains(id)) {
+        ++dropped;
+        it = m_pending.erase(it);
+        continue;
+      }
+
+      if (m_ssd_cache != nullptr && m_ssd_cache->contains(id)) {
+        promotions.push_back({id, m_real_cache.get_epoch(id)});
+        m_in_flight.insert(id);
+        it = m_pending.erase(it);
+        continue;
+      }
+
+      // always allow one request so a small budget cannot stall prefetching
+      if (in_flight_bytes > 0 &&
+          in_flight_bytes + m_chunk_size > m_max_in_flight_bytes) {
+        break;
+      }
+
+      uint64_t chunk_object_no = get_object_no(id);
+      if (requests.empty() || chunk_object_no != object_no) {
+        requests.emplace_back();
+        last_id = 0;
+        object_no = chunk_object_no;
+      }
+
+      auto &request = requests.back();
+      if (last_id != 0 && id == last_id + 1) {
+        request.image_extents.back().second += m_chunk_size;
+      } else {
+        request.image_extents.emplace_back((id - 1) * m_chunk_size,
+                                           m_chunk_size);
+      }
+      request.chunk_ids.push_back(id);
+      request.epochs.push_back(m_real_cache.get_epoch(id));
+      request.length += m_chunk_size;
+      last_id = id;
+
+      m_in_flight.insert(id);
+      in_flight_bytes += m_chunk_size;
+      it = m_pending.erase(it);
+    }
+    m_in_flight_bytes = in_flight_bytes;
+
+    if (m_perfcounter != nullptr) {
+      m_perfcounter->inc(l_librbd_prefetch_read, requests.size());
+      m_perfcounter->inc(l_librbd_prefetch_dropped, dropped);
+      m_perfcounter->set(l_librbd_prefetch_in_flight_bytes, m_in_flight_bytes);
+    }
+
+    ldout(cct, 20) << "requests=" << requests.size() << ", "
+                   << "promotions=" << promotions.size() << ", "
+                   << "dropped=" << dropped << ", "
+                   << "pending=" << m_pending.size() << ", "
+                   << "in_flight_bytes=" << m_in_flight_bytes << dendl;
+  }
+
+  for (auto &promotion : promotions) {
+    send_promote(promotion);
+  }
+  for (auto &request : requests) {
+    send_read(std::move(request));
+  }
+}
+
+template <typename I>
+void PrefetchScheduler<I>::send_read(ReadRequest &&request) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "image_extents=" << request.image_extents << ", "
+                 << "chunks=" << request.chunk_ids.size() << dendl;
+
+  auto ctx = new C_PrefetchRead(this, std::move(request));
+  auto extents = ctx->request.image_extents;
+  auto aio_comp = io::AioCompletion::create_and_start<Context>(
+    ctx, &m_image_ctx, io::AIO_TYPE_READ);
+  io::ImageReadRequest<I> req(m_image_ctx, aio_comp, std::move(extents),
+                              io::ReadResult{&ctx->bl}, 0, {});
+  req.set_bypass_image_cache();
+  req.send();
+}
+
+template <typename I>
+void PrefetchScheduler<I>::handle_read(int r, const ReadRequest &request,
+                                       bufferlist &bl) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "r=" << r << ", length=" << bl.length() << dendl;
+
+  uint64_t chunk_size;
+  {
+    Mutex::Locker locker(m_lock);
+    chunk_size = m_chunk_size;
+  }
+
+  if (r < 0) {
+    lderr(cct) << "prefetch read failed: " << cpp_strerror(r) << dendl;
+  } else if (request.length == chunk_size * request.chunk_ids.size()) {
+    // the result holds the chunks back-to-back in ID order; the last one
+    // may be short if the image ends inside it
+    uint64_t offset = 0;
+    for (size_t i = 0; i < request.chunk_ids.size(); ++i) {
+      if (offset >= bl.length()) {
+        break;
+      }
+      bufferlist chunk_bl;
+      chunk_bl.substr_of(bl, offset, std::min(chunk_size,
+                                              bl.length() - offset));
+      chunk_bl.c_str();
+      m_real_cache.insert(request.chunk_ids[i], chunk_bl.front(), false, true,
+                          request.epochs[i]);
+      offset += chunk_size;
+    }
+  }
+
+  finish_in_flight(request.chunk_ids, request.length);
+}
+
+template <typename I>
+void PrefetchScheduler<I>::send_promote(const Promotion &promotion) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "id=" << promotion.id << dendl;
+
+  // SSD completions run on the tier's aio thread; inserting may evict and
+  // write back to the tier, so finish on the op work queue
+  auto ctx = new C_PromoteRead(this, promotion);
+  auto on_finish = util::create_async_context_callback(m_image_ctx, ctx);
+  if (!m_ssd_cache->read(promotion.id, &ctx->bl, on_finish)) {
+    // evicted from the tier since dispatch looked at it
+    on_finish->complete(-ENOENT);
+  }
+}
+
+template <typename I>
+void PrefetchScheduler<I>::handle_promote(int r, const Promotion &promotion,
+                                          bufferlist &bl) {
+  CephContext *cct = m_image_ctx.cct;
+  ldout(cct, 20) << "id=" << promotion.id << ", r=" << r << dendl;
+
+  if (r == 0) {
+    bl.rebuild();
+    m_real_cache.insert(promotion.id, bl.front(), false, true,
+                        promotion.epoch);
+  }
+
+  finish_in_flight({promotion.id}, 0);
+}
+
+template <typename I>
+void PrefetchScheduler<I>::finish_in_flight(
+    const std::vector<ElementID> &chunk_ids, uint64_t length) {
+  Context *on_shut_down = nullptr;
+  {
+    Mutex::Locker locker(m_lock);
+    for (auto id : chunk_ids) {
+      m_in_flight.erase(id);
+    }
+    assert(m_in_flight_bytes >= length);
+    m_in_flight_bytes -= length;
+    if (m_perfcounter != nullptr) {
+      m_perfcounter->set(l_librbd_prefetch_in_flight_bytes, m_in_flight_bytes);
+    }
+
+    if (m_shutting_down) {
+      if (m_in_flight.empty()) {
+        std::swap(on_shut_down, m_on_shut_down);
+      }
+    } else if (!m_pending.empty() && !m_dispatch_scheduled) {
+      // predictions held back by the in-flight budget already waited out
+      // their batch window
+      m_dispatch_scheduled = true;
+      queue_dispatch();
+    }
+  }
+
+  if (on_shut_down != nullptr) {
+    on_shut_down->complete(0);
+  }
+}
+
+} // namespace cache
+} // namespace librbd
+
+template class librbd::cache::PrefetchScheduler<librbd::ImageCtx>;
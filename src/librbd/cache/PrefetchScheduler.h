@@ -0,0 +1,125 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_LIBRBD_CACHE_PREFETCH_SCHEDULER
+#define CEPH_LIBRBD_CACHE_PREFETCH_SCHEDULER
+
+#include "common/Mutex.h"
+#include "common/ceph_time.h"
+#include "include/buffer.h"
+#include "RealCache.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+class Context;
+class PerfCounters;
+class SafeTimer;
+
+namespace librbd {
+
+struct ImageCtx;
+
+namespace cache {
+
+/**
+ * PrefetchScheduler turns the chunk IDs predicted by the PredictionWorkQueue
+ * into prefetch reads. Predictions are collected for a short window, then
+ * chunks that are already cached or being read are skipped, predictions
+ * that waited longer than the maximum age are dropped, and the rest are
+ * merged into one read request per object, with contiguous chunks merged
+ * into a single extent. The bytes of prefetch reads in flight are bounded
+ * independently of foreground I/O; predictions that do not fit wait for
+ * in-flight prefetches to complete. Chunks held by the SSD tier are read
+ * back from it instead of the cluster and do not count against the budget.
+ */
+class SSDCache;
+
+template <typename ImageCtxT = librbd::ImageCtx>
+class PrefetchScheduler {
+public:
+  PrefetchScheduler(ImageCtxT &image_ctx, RealCache &real_cache,
+                    PerfCounters *perfcounter = nullptr);
+  PrefetchScheduler(const PrefetchScheduler&) = delete;
+  PrefetchScheduler& operator=(const PrefetchScheduler&) = delete;
+
+  void set_chunk_size(uint64_t chunk_size);
+  void set_ssd_cache(SSDCache *ssd_cache);
+
+  void schedule(ElementID id);
+  void shut_down(Context *on_finish);
+
+  uint64_t get_in_flight_bytes() const {
+    Mutex::Locker locker(m_lock);
+    return m_in_flight_bytes;
+  }
+  uint64_t get_num_pending() const {
+    Mutex::Locker locker(m_lock);
+    return m_pending.size();
+  }
+  uint64_t get_max_in_flight_bytes() const {
+    return m_max_in_flight_bytes;
+  }
+  double get_batch_window() const {
+    return m_batch_window;
+  }
+
+private:
+  typedef std::map<ElementID, ceph::mono_time> Pending;
+
+  struct ReadRequest {
+    std::vector<std::pair<uint64_t, uint64_t> > image_extents;
+    std::vector<ElementID> chunk_ids;
+    std::vector<uint64_t> epochs;
+    uint64_t length = 0;
+  };
+
+  struct Promotion {
+    ElementID id;
+    uint64_t epoch;
+  };
+
+  struct C_PrefetchRead;
+  struct C_PromoteRead;
+
+  ImageCtxT &m_image_ctx;
+  RealCache &m_real_cache;
+  PerfCounters *m_perfcounter;
+  SSDCache *m_ssd_cache = nullptr;
+
+  SafeTimer *m_timer;
+  Mutex *m_timer_lock;
+  Context *m_timer_task = nullptr;
+
+  double m_batch_window;
+  ceph::timespan m_max_age;
+  uint64_t m_max_in_flight_bytes;
+
+  mutable Mutex m_lock;
+  uint64_t m_chunk_size = 0;
+  Pending m_pending;
+  std::set<ElementID> m_in_flight;
+  uint64_t m_in_flight_bytes = 0;
+  bool m_dispatch_scheduled = false;
+  bool m_shutting_down = false;
+  Context *m_on_shut_down = nullptr;
+
+  uint64_t get_object_no(ElementID id) const;
+
+  void queue_dispatch();
+  void dispatch();
+  void send_read(ReadRequest &&request);
+  void handle_read(int r, const ReadRequest &request, bufferlist &bl);
+  void send_promote(const Promotion &promotion);
+  void handle_promote(int r, const Promotion &promotion, bufferlist &bl);
+  void finish_in_flight(const std::vector<ElementID> &chunk_ids,
+                        uint64_t length);
+};
+
+} // namespace cache
+} // namespace librbd
+
+extern template class librbd::cache::PrefetchScheduler<librbd::ImageCtx>;
+
+#endif // CEPH_LIBRBD_CACHE_PREFETCH_SCHEDULER
@@ -0,0 +1,43 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_LIBRBD_CACHE_PREFETCH_TYPES_H
+#define CEPH_LIBRBD_CACHE_PREFETCH_TYPES_H
+
+namespace librbd {
+namespace cache {
+
+// Prefetch image cache performance counters
+enum {
+  l_librbd_prefetch_first = 26100,
+
+  l_librbd_prefetch_hit,             // chunk reads served from the cache
+  l_librbd_prefetch_miss,            // chunk reads sent to the cluster
+  l_librbd_prefetch_read,            // prefetch read requests issued
+  l_librbd_prefetch_chunks,          // chunks inserted by prefetching
+  l_librbd_prefetch_bytes,           // bytes inserted by prefetching
+  l_librbd_prefetch_used,            // prefetched chunks read at least once
+  l_librbd_prefetch_unused,          // prefetched chunks dropped unread
+  l_librbd_prefetch_unused_bytes,
+  l_librbd_prefetch_dropped,         // stale or redundant predictions
+  l_librbd_prefetch_in_flight_bytes,
+  l_librbd_prefetch_prediction_queue,
+  l_librbd_prefetch_detection_queue,
+  l_librbd_prefetch_phase_change,
+  l_librbd_prefetch_model_latency,   // time to update the model per access
+  l_librbd_prefetch_access_dropped,  // accesses not recorded, ring full
+  l_librbd_prefetch_ssd_hit,         // chunks read from the SSD tier
+  l_librbd_prefetch_ssd_write,       // chunks written to the SSD tier
+  l_librbd_prefetch_ssd_write_bytes,
+  l_librbd_prefetch_ssd_invalidate,  // SSD chunks invalidated by writes
+  l_librbd_prefetch_ssd_bytes,
+  l_librbd_prefetch_stream_access,   // accesses in a detected stream
+  l_librbd_prefetch_stream_chunks,   // chunks prefetched for streams
+
+  l_librbd_prefetch_last,
+};
+
+} // namespace cache
+} // namespace librbd
+
+#endif // CEPH_LIBRBD_CACHE_PREFETCH_TYPES_H
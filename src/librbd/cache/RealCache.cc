@@ -1,125 +1,284 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
 #include "RealCache.h"
 
 #include "common/dout.h"
+#include "common/perf_counters.h"
 #include "include/buffer.h"
 #include "DetectionModule.h"
+#include "PrefetchTypes.h"
 
 #define dout_subsys ceph_subsys_rbd
 #undef dout_prefix
-#define dout_prefix                                                            \
-  *_dout << "librbd::cache::RealCache: "                                       \
-         << " " << __func__ << ": "
+#define dout_prefix *_dout << "librbd::cache::RealCache: " << this << " " \
+                           << __func__ << ": "
+
 namespace librbd {
-  namespace cache {
-    RealCache::RealCache(DetectionModule* detection_wq, CephContext *m_cct) :
-      detection_wq(detection_wq), m_cct(m_cct), lock("RealCache::lock", true, false)
-    {
-    }
- 
-    void RealCache::insert(uint64_t image_extents_addr, bufferptr bl, bool copy_result) {
-  		ldout(m_cct, 20) << "inserting the image extent :: " << image_extents_addr << " bufferlist :: " << bl << " to cache " << dendl;
-
-				if (copy_result) {
-					ldout(m_cct, 20) << "copying " << bl.length() << " bytes of " << bl
-													 << " to cache" << dendl;
-					bufferptr b_copy(buffer::copy(bl.raw_c_str(), bl.length()));
-
-					lock.Lock();
-					updateLRUList(m_cct, image_extents_addr);
-					cache_entries.insert_or_assign(image_extents_addr, b_copy);
-					lock.Unlock();
-				} else {
-					ldout(m_cct, 20) << "storing " << bl.length() << " bytes of " << bl
-													 << " in cache" << dendl;
-
-					lock.Lock();
-					updateLRUList(m_cct, image_extents_addr);
-					cache_entries.insert_or_assign(image_extents_addr, bl);
-					lock.Unlock();
-				}
-				
-	
-  		ldout(m_cct, 20) << "cache size after insert :: " << cache_entries.size() << dendl;
-			ldout(m_cct, 20) << "Cache elements after insert :: " << dendl;
-
-			for (auto i : cache_entries) {
-				ldout(m_cct, 20) << i << dendl;
-			}
-    }
+namespace cache {
+
+RealCache::RealCache(CephContext *cct, DetectionModule *detection_wq,
+                     uint64_t max_bytes, uint32_t num_shards,
+                     PerfCounters *perfcounter)
+  : m_cct(cct), m_detection_wq(detection_wq), m_perfcounter(perfcounter),
+    m_max_bytes(max_bytes),
+    m_num_shards(std::max<uint32_t>(num_shards, 1)),
+    m_shard_max_bytes(m_max_bytes / m_num_shards),
+    m_shards(new Shard[m_num_shards]) {
+  ldout(m_cct, 5) << "max_bytes=" << m_max_bytes << ", "
+                  << "num_shards=" << m_num_shards << dendl;
+}
 
-    bufferptr RealCache::get(uint64_t image_extent_addr){
-  	ldout(m_cct, 20) << "reading from cache for the image extent :: " << image_extent_addr << dendl;
+void RealCache::insert(ElementID id, bufferptr bp, bool copy_result,
+                       bool prefetched, uint64_t epoch) {
+  ldout(m_cct, 20) << "id=" << id << ", length=" << bp.length() << ", "
+                   << "copy_result=" << copy_result << ", "
+                   << "prefetched=" << prefetched << ", "
+                   << "epoch=" << epoch << dendl;
 
-		total_requests ++;
-		ldout(m_cct, 20) << "Total requests: " << total_requests << dendl;
+  if (copy_result) {
+    bp = buffer::copy(bp.c_str(), bp.length());
+  }
+  if (prefetched) {
+    ++m_prefetched;
+    m_prefetched_bytes += bp.length();
+    if (m_perfcounter != nullptr) {
+      m_perfcounter->inc(l_librbd_prefetch_chunks);
+      m_perfcounter->inc(l_librbd_prefetch_bytes, bp.length());
+    }
+  }
 
-    bufferptr bl;
-  	auto cache_entry = cache_entries.find(image_extent_addr);
-  	if(cache_entry == cache_entries.end()){
-  		ldout(m_cct, 20) << "No match in cache for :: " << image_extent_addr << dendl;
+  if (bp.length() > m_shard_max_bytes) {
+    // it would only flush the whole shard and then be evicted itself
+    ldout(m_cct, 5) << "chunk too large for a shard: id=" << id << ", "
+                    << "length=" << bp.length() << dendl;
+    if (prefetched) {
+      account_unused(bp.length());
+    }
+    return;
+  }
 
-			misses ++;
+  std::vector<std::pair<ElementID, bufferptr> > evicted;
+  {
+    Shard &shard = get_shard(id);
+    Mutex::Locker locker(shard.lock);
 
-  		return bl;
-  	} else {
-  		bl = cache_entry->second;
-  		bufferptr bl1 = bl;
-  		ldout(m_cct, 20) << "Bufferlist from cache :: " << bl1 << dendl;
-  		ldout(m_cct, 20) << "Image Extent :: " << cache_entry->first << " BufferList :: " << bl << dendl;
-      updateLRUList(m_cct, cache_entry->first);
+    if (epoch != 0 && epoch != shard.epoch) {
+      // the chunk may have been overwritten since it was read
+      ldout(m_cct, 20) << "dropping stale id=" << id << dendl;
+      if (prefetched) {
+        account_unused(bp.length());
+      }
+      return;
+    }
 
-			hits ++;
+    auto it = shard.entries.find(id);
+    if (it != shard.entries.end()) {
+      Entry &entry = it->second;
+      if (prefetched) {
+        // the chunk was already cached, so the prefetch read was wasted
+        account_unused(bp.length());
+      }
 
-  		return bl;
-  	  }
+      assert(shard.bytes >= entry.data.length());
+      shard.bytes -= entry.data.length();
+      entry.data = std::move(bp);
+      shard.bytes += entry.data.length();
 
-		hit_rate = static_cast<double>(hits) / static_cast<double>(total_requests);
-		detection_wq->queue(DetectionInput(image_extent_addr, hit_rate));
+      shard.lru.erase(shard.lru.iterator_to(entry));
+      shard.lru.push_front(entry);
+    } else {
+      auto r = shard.entries.emplace(std::piecewise_construct,
+                                     std::forward_as_tuple(id),
+                                     std::forward_as_tuple(id, std::move(bp),
+                                                           prefetched));
+      Entry &entry = r.first->second;
+      shard.bytes += entry.data.length();
+      shard.lru.push_front(entry);
     }
 
+    trim(shard, &evicted);
+  }
 
-    ElementID RealCache::extent_to_unique_id(uint64_t extent_offset) {
-			return (extent_offset / CACHE_CHUNK_SIZE) + 1;
+  if (m_evict_handler) {
+    for (auto &victim : evicted) {
+      m_evict_handler(victim.first, victim.second);
     }
+  }
+}
 
-    ElementID RealCache::extent_to_unique_id(Extent extent) {
-			return extent_to_unique_id(extent.first);
-    }
+bufferptr RealCache::get(ElementID id) {
+  bufferptr bp;
+  {
+    Shard &shard = get_shard(id);
+    Mutex::Locker locker(shard.lock);
 
-    Extent RealCache::id_to_extent(ElementID id) {
-			return std::make_pair((id + 1) * CACHE_CHUNK_SIZE, CACHE_CHUNK_SIZE);
+    auto it = shard.entries.find(id);
+    if (it != shard.entries.end()) {
+      Entry &entry = it->second;
+      shard.lru.erase(shard.lru.iterator_to(entry));
+      shard.lru.push_front(entry);
+      bp = entry.data;
+
+      if (entry.prefetched && !entry.used) {
+        ++m_prefetch_used;
+        if (m_perfcounter != nullptr) {
+          m_perfcounter->inc(l_librbd_prefetch_used);
+        }
+      }
+      entry.used = true;
     }
+  }
+
+  if (bp.length() > 0) {
+    ++m_hits;
+  } else {
+    ++m_misses;
+  }
+  if (m_perfcounter != nullptr) {
+    m_perfcounter->inc(bp.length() > 0 ? l_librbd_prefetch_hit :
+                                         l_librbd_prefetch_miss);
+  }
+
+  double hit_rate = get_hit_rate();
+  ldout(m_cct, 20) << "id=" << id << ", hit=" << (bp.length() > 0) << ", "
+                   << "hit_rate=" << hit_rate << dendl;
 
+  if (m_detection_wq != nullptr) {
+    m_detection_wq->record(DetectionInput(hit_rate, id));
+  }
+  return bp;
+}
 
-    void RealCache::updateLRUList(CephContext* m_cct, uint64_t cacheKey){
-    	ldout(m_cct, 20) << "inside updateLRUList method" << dendl;
+bool RealCache::contains(ElementID id) const {
+  Shard &shard = get_shard(id);
+  Mutex::Locker locker(shard.lock);
+  return shard.entries.count(id) > 0;
+}
 
-				auto result = std::find(lru_list.begin(), lru_list.end(), cacheKey);
+void RealCache::erase(ElementID id) {
+  Shard &shard = get_shard(id);
+  Mutex::Locker locker(shard.lock);
 
-				// If the LRU list is full and the element isn't already there...
-      	if (result == lru_list.end() && lru_list.size() == CACHE_SIZE) {
-        	uint64_t last = lru_list.back();
+  auto it = shard.entries.find(id);
+  if (it != shard.entries.end()) {
+    ldout(m_cct, 20) << "id=" << id << dendl;
+    remove_entry(shard, it->second);
+  }
+}
 
-					// Remove last
-        	lru_list.pop_back();
-        	cache_entries.erase(last);
+void RealCache::invalidate(ElementID id) {
+  Shard &shard = get_shard(id);
+  Mutex::Locker locker(shard.lock);
 
-					// Insert the new element
-					lru_list.push_front(cacheKey);
-      	} else {
-					
-					// We're just moving it to the front if the element is already there
-					if (result != lru_list.end()) {
-        				lru_list.remove(cacheKey);
-					}
+  ++shard.epoch;
+  auto it = shard.entries.find(id);
+  if (it != shard.entries.end()) {
+    ldout(m_cct, 20) << "id=" << id << dendl;
+    remove_entry(shard, it->second);
+  }
+}
 
-        	lru_list.push_front(cacheKey);
-      	}
-      	ldout(m_cct, 20) << "new lru_list order :: " << lru_list << dendl;
+uint64_t RealCache::get_epoch(ElementID id) const {
+  Shard &shard = get_shard(id);
+  Mutex::Locker locker(shard.lock);
+  return shard.epoch;
+}
+
+void RealCache::clear() {
+  ldout(m_cct, 20) << dendl;
+
+  for (uint32_t i = 0; i < m_num_shards; ++i) {
+    Shard &shard = m_shards[i];
+    Mutex::Locker locker(shard.lock);
+    for (auto &entry : shard.lru) {
+      account_unused(entry);
     }
+    shard.lru.clear();
+    shard.entries.clear();
+    shard.bytes = 0;
+    ++shard.epoch;
+  }
+}
+
+uint64_t RealCache::get_bytes() const {
+  uint64_t bytes = 0;
+  for (uint32_t i = 0; i < m_num_shards; ++i) {
+    Mutex::Locker locker(m_shards[i].lock);
+    bytes += m_shards[i].bytes;
+  }
+  return bytes;
+}
+
+uint64_t RealCache::get_num_entries() const {
+  uint64_t entries = 0;
+  for (uint32_t i = 0; i < m_num_shards; ++i) {
+    Mutex::Locker locker(m_shards[i].lock);
+    entries += m_shards[i].entries.size();
+  }
+  return entries;
+}
+
+double RealCache::get_hit_rate() const {
+  uint64_t hits = m_hits;
+  uint64_t total = hits + m_misses;
+  if (total == 0) {
+    return 0.0;
+  }
+  return static_cast<double>(hits) / static_cast<double>(total);
+}
+
+RealCache::Stats RealCache::get_stats() const {
+  Stats stats;
+  stats.hits = m_hits;
+  stats.misses = m_misses;
+  stats.prefetched = m_prefetched;
+  stats.prefetched_bytes = m_prefetched_bytes;
+  stats.prefetch_used = m_prefetch_used;
+  stats.prefetch_unused = m_prefetch_unused;
+  stats.prefetch_unused_bytes = m_prefetch_unused_bytes;
+  return stats;
+}
 
-    void RealCache::evictCache(CephContext* m_cct, uint64_t cacheKey){
-      	ldout(m_cct, 20) << "inside evictCache method" << dendl;
+void RealCache::account_unused(const Entry &entry) {
+  if (entry.prefetched && !entry.used) {
+    account_unused(entry.data.length());
+  }
+}
+
+void RealCache::account_unused(uint64_t length) {
+  ++m_prefetch_unused;
+  m_prefetch_unused_bytes += length;
+  if (m_perfcounter != nullptr) {
+    m_perfcounter->inc(l_librbd_prefetch_unused);
+    m_perfcounter->inc(l_librbd_prefetch_unused_bytes, length);
+  }
+}
+
+void RealCache::remove_entry(Shard &shard, Entry &entry) {
+  assert(shard.lock.is_locked_by_me());
+  assert(shard.bytes >= entry.data.length());
+
+  account_unused(entry);
+  shard.bytes -= entry.data.length();
+  shard.lru.erase(shard.lru.iterator_to(entry));
+  shard.entries.erase(entry.id);
+}
+
+void RealCache::trim(Shard &shard,
+                     std::vector<std::pair<ElementID, bufferptr> > *evicted) {
+  assert(shard.lock.is_locked_by_me());
+
+  while (shard.bytes > m_shard_max_bytes && !shard.lru.empty()) {
+    Entry &victim = shard.lru.back();
+    ldout(m_cct, 20) << "evicting id=" << victim.id << ", "
+                     << "length=" << victim.data.length() << dendl;
+    if (m_evict_handler) {
+      evicted->emplace_back(victim.id, victim.data);
     }
-  } // namespace cache
+    remove_entry(shard, victim);
+  }
+}
+
+} // namespace cache
 } // namespace librbd
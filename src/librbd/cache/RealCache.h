@@ -1,54 +1,161 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
 #ifndef CEPH_LIBRBD_CACHE_PREFETCH_REAL_CACHE
 #define CEPH_LIBRBD_CACHE_PREFETCH_REAL_CACHE
 
-#define CACHE_SIZE 5
-#define CACHE_CHUNK_SIZE 1024//131072
-
-#include "common/dout.h"
+#include "common/Mutex.h"
 #include "include/buffer.h"
-#include <deque>
+#include "include/hash.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <unordered_map>
+#include <vector>
+#include <boost/intrusive/list.hpp>
+
+class PerfCounters;
+
+namespace librbd {
+namespace cache {
+
+class DetectionModule;
+
+using ElementID = uint64_t;
+using Extent = std::pair<uint64_t, uint64_t>;
+
+/**
+ * RealCache holds the image chunks that have been read or prefetched from
+ * the cluster. Chunks are spread over a fixed number of shards by a hash
+ * of the element ID, so neighbouring chunks land on unrelated shards; each
+ * shard has its own lock, an index and an intrusive LRU list, so
+ * lookups, inserts and evictions are all O(1) and readers of different
+ * chunks rarely contend. The capacity is a byte budget split evenly between
+ * the shards.
+ *
+ * Every shard carries an epoch that is bumped whenever one of its chunks is
+ * invalidated by a write. Readers sample the epoch before going to the
+ * cluster and pass it to insert(), which drops data read before an
+ * overlapping write completed.
+ */
+class RealCache {
+public:
+  struct Stats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t prefetched = 0;        ///< chunks inserted by a prefetch
+    uint64_t prefetched_bytes = 0;
+    uint64_t prefetch_used = 0;     ///< prefetched chunks hit at least once
+    uint64_t prefetch_unused = 0;   ///< prefetched chunks dropped unread
+    uint64_t prefetch_unused_bytes = 0;
+  };
 
-namespace librbd{
-  namespace cache{
-    class DetectionModule;
+  RealCache(CephContext *cct, DetectionModule *detection_wq,
+            uint64_t max_bytes, uint32_t num_shards,
+            PerfCounters *perfcounter = nullptr);
+  RealCache(const RealCache&) = delete;
+  RealCache& operator=(const RealCache&) = delete;
 
-    using ElementID = uint64_t;
-    using Extent = std::pair<uint64_t, uint64_t>;
+  typedef std::function<void(ElementID, const bufferptr&)> EvictHandler;
 
-    // map for cache entries
-    using ImageCacheEntries = std::map<ElementID, bufferptr>;
- 
-    // list for handling LRU eviction 
-    using LRUList = std::list<ElementID>;
+  /// @epoch from get_epoch() when the data was requested, 0 to always insert
+  void insert(ElementID id, bufferptr bp, bool copy_result,
+              bool prefetched = false, uint64_t epoch = 0);
+  bufferptr get(ElementID id);
+  bool contains(ElementID id) const;
+  void erase(ElementID id);
+  void invalidate(ElementID id);
+  void clear();
 
-    class RealCache{
-      public:
-        RealCache(DetectionModule* detection_wq, CephContext *m_cct);
+  uint64_t get_epoch(ElementID id) const;
 
-        void insert(uint64_t image_extents_addr, bufferptr bl, bool copy_result);
-  	bufferptr get(uint64_t image_extent_addr);
+  /// called outside the shard lock for every chunk evicted by capacity
+  void set_evict_handler(EvictHandler &&handler) {
+    m_evict_handler = std::move(handler);
+  }
 
-	static ElementID extent_to_unique_id(uint64_t extent_offset);
-	static ElementID extent_to_unique_id(Extent extent);
-	static Extent id_to_extent(ElementID id);
+  uint64_t get_max_bytes() const {
+    return m_max_bytes;
+  }
+  /// the largest chunk the cache can hold
+  uint64_t get_shard_max_bytes() const {
+    return m_shard_max_bytes;
+  }
+  uint64_t get_bytes() const;
+  uint64_t get_num_entries() const;
 
-      private:
-        DetectionModule* detection_wq;
-        CephContext *m_cct;
-        ImageCacheEntries cache_entries;
-        LRUList lru_list;
+  uint64_t get_hits() const {
+    return m_hits;
+  }
+  uint64_t get_misses() const {
+    return m_misses;
+  }
+  double get_hit_rate() const;
+  Stats get_stats() const;
 
-        mutable Mutex lock;
+private:
+  struct Entry {
+    ElementID id;
+    bufferptr data;
+    bool prefetched;
+    bool used = false;
+    boost::intrusive::list_member_hook<> lru_item;
 
-        uint64_t hits = 0;
-        uint64_t misses = 0;
-        uint64_t total_requests = 0;
-        double hit_rate = 0.0;
+    Entry(ElementID id, bufferptr&& data, bool prefetched)
+      : id(id), data(std::move(data)), prefetched(prefetched) {
+    }
+  };
 
-        void updateLRUList(CephContext* m_cct, uint64_t cacheKey);
-        void evictCache(CephContext* m_cct, uint64_t cacheKey);
-    };
-  } // namespace cache
+  typedef boost::intrusive::list<
+    Entry,
+    boost::intrusive::member_hook<
+      Entry,
+      boost::intrusive::list_member_hook<>,
+      &Entry::lru_item> > LRUList;
+
+  struct Shard {
+    mutable Mutex lock;
+    std::unordered_map<ElementID, Entry> entries;
+    LRUList lru;
+    uint64_t bytes = 0;
+    uint64_t epoch = 1;
+
+    Shard() : lock("librbd::cache::RealCache::Shard::lock") {
+    }
+    ~Shard() {
+      lru.clear();
+    }
+  };
+
+  CephContext *m_cct;
+  DetectionModule *m_detection_wq;
+  PerfCounters *m_perfcounter;
+  uint64_t m_max_bytes;
+  uint32_t m_num_shards;
+  uint64_t m_shard_max_bytes;
+  std::unique_ptr<Shard[]> m_shards;
+  EvictHandler m_evict_handler;
+
+  std::atomic<uint64_t> m_hits = {0};
+  std::atomic<uint64_t> m_misses = {0};
+  std::atomic<uint64_t> m_prefetched = {0};
+  std::atomic<uint64_t> m_prefetched_bytes = {0};
+  std::atomic<uint64_t> m_prefetch_used = {0};
+  std::atomic<uint64_t> m_prefetch_unused = {0};
+  std::atomic<uint64_t> m_prefetch_unused_bytes = {0};
+
+  Shard &get_shard(ElementID id) const {
+    return m_shards[rjhash64(id) % m_num_shards];
+  }
+
+  void account_unused(const Entry &entry);
+  void account_unused(uint64_t length);
+  void remove_entry(Shard &shard, Entry &entry);
+  void trim(Shard &shard, std::vector<std::pair<ElementID, bufferptr> > *evicted);
+};
+
+} // namespace cache
 } // namespace librbd
-#endif
+
+#endif // CEPH_LIBRBD_CACHE_PREFETCH_REAL_CACHE
@@ -0,0 +1,431 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "librbd/cache/SSDCache.h"
+#include "common/dout.h"
+#include "common/errno.h"
+#include "common/perf_counters.h"
+#include "include/Context.h"
+#include "librbd/cache/PrefetchTypes.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits>
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::cache::SSDCache: " << this << " " \
+                           << __func__ << ": "
+
+namespace librbd {
+namespace cache {
+
+struct SSDCache::AioOp {
+  uint32_t slot;
+  bool is_write;
+  bufferlist *out = nullptr;
+  Context *on_finish = nullptr;
+#ifdef HAVE_LIBAIO
+  struct iocb iocb;
+  bufferlist bl;
+#endif
+
+  AioOp(uint32_t slot, bool is_write) : slot(slot), is_write(is_write) {
+  }
+};
+
+SSDCache::SSDCache(CephContext *cct, const std::string &path,
+                   uint64_t max_bytes, PerfCounters *perfcounter)
+  : m_aio_thread(this), m_cct(cct), m_path(path), m_max_bytes(max_bytes),
+    m_perfcounter(perfcounter),
+#ifdef HAVE_LIBAIO
+    m_aio_queue_depth(cct->_conf->get_val<uint64_t>(
+      "rbd_prefetch_ssd_cache_queue_depth")),
+#endif
+    m_lock("librbd::cache::SSDCache::m_lock") {
+}
+
+SSDCache::~SSDCache() {
+  assert(m_fd < 0);
+}
+
+int SSDCache::init(uint64_t chunk_size) {
+#ifdef HAVE_LIBAIO
+  assert(m_fd < 0);
+
+  // O_DIRECT needs page aligned offsets and lengths
+  if (chunk_size == 0 || chunk_size % CEPH_PAGE_SIZE != 0) {
+    lderr(m_cct) << "chunk_size " << chunk_size << " is not page aligned"
+                 << dendl;
+    return -EINVAL;
+  }
+  uint64_t num_slots = m_max_bytes / chunk_size;
+  if (num_slots == 0) {
+    lderr(m_cct) << "size " << m_max_bytes << " is smaller than a chunk"
+                 << dendl;
+    return -EINVAL;
+  }
+
+  int fd = ::open(m_path.c_str(),
+                  O_RDWR | O_CREAT | O_EXCL | O_DIRECT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    int r = -errno;
+    lderr(m_cct) << "failed to create " << m_path << ": " << cpp_strerror(r)
+                 << dendl;
+    return r;
+  }
+
+  // nothing in the file is valid once this handle goes away
+  ::unlink(m_path.c_str());
+
+  int r = ::ftruncate(fd, num_slots * chunk_size);
+  if (r < 0) {
+    r = -errno;
+    lderr(m_cct) << "failed to size " << m_path << ": " << cpp_strerror(r)
+                 << dendl;
+    VOID_TEMP_FAILURE_RETRY(::close(fd));
+    return r;
+  }
+
+  r = io_setup(m_aio_queue_depth, &m_aio_ctx);
+  if (r < 0) {
+    m_aio_ctx = 0;
+    lderr(m_cct) << "io_setup failed: " << cpp_strerror(r) << dendl;
+    VOID_TEMP_FAILURE_RETRY(::close(fd));
+    return r;
+  }
+
+  {
+    Mutex::Locker locker(m_lock);
+    m_fd = fd;
+    m_chunk_size = chunk_size;
+    m_slots.resize(num_slots);
+    m_free_slots.reserve(num_slots);
+    for (uint64_t i = num_slots; i > 0; --i) {
+      m_free_slots.push_back(i - 1);
+    }
+  }
+
+  m_aio_thread.create("rbd_ssd_aio");
+
+  ldout(m_cct, 5) << "path=" << m_path << ", "
+                  << "chunk_size=" << chunk_size << ", "
+                  << "slots=" << num_slots << dendl;
+  return 0;
+#else
+  lderr(m_cct) << "built without libaio" << dendl;
+  return -EOPNOTSUPP;
+#endif
+}
+
+void SSDCache::shut_down() {
+  if (m_fd < 0) {
+    return;
+  }
+
+  ldout(m_cct, 20) << dendl;
+  {
+    Mutex::Locker locker(m_lock);
+    while (m_in_flight > 0) {
+      m_cond.Wait(m_lock);
+    }
+  }
+
+#ifdef HAVE_LIBAIO
+  m_aio_stop = true;
+  m_aio_thread.join();
+  io_destroy(m_aio_ctx);
+  m_aio_ctx = 0;
+#endif
+
+  Mutex::Locker locker(m_lock);
+  VOID_TEMP_FAILURE_RETRY(::close(m_fd));
+  m_fd = -1;
+  m_index.clear();
+  m_slots.clear();
+  m_free_slots.clear();
+  m_num_valid = 0;
+}
+
+bool SSDCache::contains(ElementID id) const {
+  Mutex::Locker locker(m_lock);
+  auto it = m_index.find(id);
+  return it != m_index.end() && m_slots[it->second].state == SLOT_VALID;
+}
+
+void SSDCache::write(ElementID id, const bufferptr &bp) {
+  uint32_t slot;
+  {
+    Mutex::Locker locker(m_lock);
+    // the short chunk at the end of an image stays memory-only
+    if (m_fd < 0 || bp.length() != m_chunk_size || m_index.count(id) > 0) {
+      return;
+    }
+    if (!allocate_slot(&slot)) {
+      ldout(m_cct, 20) << "no free slot for id=" << id << dendl;
+      return;
+    }
+
+    Slot &s = m_slots[slot];
+    s.id = id;
+    s.state = SLOT_WRITING;
+    m_index[id] = slot;
+    ++m_in_flight;
+  }
+
+  ldout(m_cct, 20) << "id=" << id << ", slot=" << slot << dendl;
+  if (m_perfcounter != nullptr) {
+    m_perfcounter->inc(l_librbd_prefetch_ssd_write);
+    m_perfcounter->inc(l_librbd_prefetch_ssd_write_bytes, bp.length());
+  }
+
+  auto op = new AioOp(slot, true);
+#ifdef HAVE_LIBAIO
+  op->bl.append(bp);
+  op->bl.rebuild_aligned(CEPH_PAGE_SIZE);
+  io_prep_pwrite(&op->iocb, m_fd, op->bl.c_str(), m_chunk_size,
+                 slot * m_chunk_size);
+#endif
+  submit(op);
+}
+
+bool SSDCache::read(ElementID id, bufferlist *out, Context *on_finish) {
+  uint32_t slot;
+  {
+    Mutex::Locker locker(m_lock);
+    auto it = m_index.find(id);
+    if (it == m_index.end() || m_slots[it->second].state != SLOT_VALID) {
+      return false;
+    }
+
+    slot = it->second;
+    Slot &s = m_slots[slot];
+    assert(s.readers < std::numeric_limits<uint16_t>::max());
+    ++s.readers;
+    s.referenced = true;
+    ++m_in_flight;
+  }
+
+  ldout(m_cct, 20) << "id=" << id << ", slot=" << slot << dendl;
+  if (m_perfcounter != nullptr) {
+    m_perfcounter->inc(l_librbd_prefetch_ssd_hit);
+  }
+
+  auto op = new AioOp(slot, false);
+  op->out = out;
+  op->on_finish = on_finish;
+#ifdef HAVE_LIBAIO
+  op->bl.append(buffer::create_page_aligned(m_chunk_size));
+  io_prep_pread(&op->iocb, m_fd, op->bl.c_str(), m_chunk_size,
+                slot * m_chunk_size);
+#endif
+  submit(op);
+  return true;
+}
+
+void SSDCache::invalidate(ElementID id) {
+  Mutex::Locker locker(m_lock);
+  auto it = m_index.find(id);
+  if (it == m_index.end()) {
+    return;
+  }
+
+  uint32_t slot = it->second;
+  ldout(m_cct, 20) << "id=" << id << ", slot=" << slot << dendl;
+  if (m_perfcounter != nullptr) {
+    m_perfcounter->inc(l_librbd_prefetch_ssd_invalidate);
+  }
+
+  Slot &s = m_slots[slot];
+  unindex(slot);
+  if (s.state == SLOT_WRITING || s.readers > 0) {
+    // the slot is reused once the I/O completes
+    s.stale = true;
+  } else {
+    release_slot(slot);
+  }
+}
+
+void SSDCache::clear() {
+  ldout(m_cct, 20) << dendl;
+
+  std::vector<ElementID> ids;
+  {
+    Mutex::Locker locker(m_lock);
+    ids.reserve(m_index.size());
+    for (auto &it : m_index) {
+      ids.push_back(it.first);
+    }
+  }
+  for (auto id : ids) {
+    invalidate(id);
+  }
+}
+
+uint64_t SSDCache::get_bytes() const {
+  Mutex::Locker locker(m_lock);
+  return m_num_valid * m_chunk_size;
+}
+
+uint64_t SSDCache::get_num_entries() const {
+  Mutex::Locker locker(m_lock);
+  return m_num_valid;
+}
+
+bool SSDCache::allocate_slot(uint32_t *slot) {
+  assert(m_lock.is_locked());
+  if (!m_free_slots.empty()) {
+    *slot = m_free_slots.back();
+    m_free_slots.pop_back();
+    return true;
+  }
+
+  // CLOCK: give every referenced slot a second chance, skipping slots with
+  // I/O in flight
+  uint64_t num_slots = m_slots.size();
+  for (uint64_t i = 0; i < 2 * num_slots; ++i) {
+    uint32_t victim = m_clock_hand;
+    m_clock_hand = (m_clock_hand + 1) % num_slots;
+
+    Slot &s = m_slots[victim];
+    if (s.state != SLOT_VALID || s.readers > 0 || s.stale) {
+      continue;
+    }
+    if (s.referenced) {
+      s.referenced = false;
+      continue;
+    }
+
+    ldout(m_cct, 20) << "evicting id=" << s.id << ", slot=" << victim
+                     << dendl;
+    unindex(victim);
+    s = Slot();
+    *slot = victim;
+    return true;
+  }
+  return false;
+}
+
+void SSDCache::release_slot(uint32_t slot) {
+  assert(m_lock.is_locked());
+  m_slots[slot] = Slot();
+  m_free_slots.push_back(slot);
+}
+
+void SSDCache::unindex(uint32_t slot) {
+  assert(m_lock.is_locked());
+  Slot &s = m_slots[slot];
+  m_index.erase(s.id);
+  if (s.state == SLOT_VALID) {
+    assert(m_num_valid > 0);
+    --m_num_valid;
+    if (m_perfcounter != nullptr) {
+      m_perfcounter->set(l_librbd_prefetch_ssd_bytes,
+                         m_num_valid * m_chunk_size);
+    }
+  }
+}
+
+void SSDCache::submit(AioOp *op) {
+#ifdef HAVE_LIBAIO
+  op->iocb.data = op;
+  struct iocb *piocb = &op->iocb;
+
+  // back off while the queue is full, as BlueStore's aio queue does
+  int attempts = 16;
+  int delay = 125;
+  int r;
+  while ((r = io_submit(m_aio_ctx, 1, &piocb)) == -EAGAIN && attempts-- > 0) {
+    usleep(delay);
+    delay *= 2;
+  }
+  if (r < 0) {
+    lderr(m_cct) << "aio submit failed: " << cpp_strerror(r) << dendl;
+    handle_aio(op, r);
+  }
+#else
+  handle_aio(op, -EOPNOTSUPP);
+#endif
+}
+
+void SSDCache::aio_thread() {
+#ifdef HAVE_LIBAIO
+  ldout(m_cct, 10) << "start" << dendl;
+  const int max = 16;
+  struct io_event events[max];
+  while (!m_aio_stop) {
+    struct timespec timeout = {0, 250 * 1000 * 1000};
+    int r = io_getevents(m_aio_ctx, 1, max, events, &timeout);
+    if (r == -EINTR) {
+      continue;
+    }
+    if (r < 0) {
+      lderr(m_cct) << "io_getevents failed: " << cpp_strerror(r) << dendl;
+      continue;
+    }
+    for (int i = 0; i < r; ++i) {
+      long rval = static_cast<long>(events[i].res);
+      if (rval >= 0 && static_cast<uint64_t>(rval) != m_chunk_size) {
+        rval = -EIO;
+      }
+      handle_aio(static_cast<AioOp*>(events[i].data), rval);
+    }
+  }
+  ldout(m_cct, 10) << "end" << dendl;
+#endif
+}
+
+void SSDCache::handle_aio(AioOp *op, long r) {
+  ldout(m_cct, 20) << "slot=" << op->slot << ", write=" << op->is_write
+                   << ", r=" << r << dendl;
+
+  Context *on_finish = nullptr;
+  {
+    Mutex::Locker locker(m_lock);
+    Slot &s = m_slots[op->slot];
+    if (op->is_write) {
+      assert(s.state == SLOT_WRITING);
+      if (r < 0 || s.stale) {
+        if (!s.stale) {
+          unindex(op->slot);
+        }
+        release_slot(op->slot);
+      } else {
+        s.state = SLOT_VALID;
+        ++m_num_valid;
+        if (m_perfcounter != nullptr) {
+          m_perfcounter->set(l_librbd_prefetch_ssd_bytes,
+                             m_num_valid * m_chunk_size);
+        }
+      }
+    } else {
+      assert(s.readers > 0);
+      --s.readers;
+      if (r >= 0 && s.stale) {
+        r = -ESTALE;
+      }
+#ifdef HAVE_LIBAIO
+      if (r >= 0) {
+        op->out->claim_append(op->bl);
+      }
+#endif
+      if (s.stale && s.readers == 0) {
+        release_slot(op->slot);
+      }
+      on_finish = op->on_finish;
+    }
+
+    assert(m_in_flight > 0);
+    if (--m_in_flight == 0) {
+      m_cond.Signal();
+    }
+  }
+  delete op;
+
+  if (on_finish != nullptr) {
+    on_finish->complete(r < 0 ? r : 0);
+  }
+}
+
+} // namespace cache
+} // namespace librbd
@@ -0,0 +1,134 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_LIBRBD_CACHE_SSD_CACHE
+#define CEPH_LIBRBD_CACHE_SSD_CACHE
+
+#include "acconfig.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "include/buffer.h"
+#include "RealCache.h"
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef HAVE_LIBAIO
+#include <libaio.h>
+#endif
+
+class Context;
+class PerfCounters;
+
+namespace librbd {
+namespace cache {
+
+/**
+ * SSDCache is the second tier of the prefetch cache: chunks evicted from
+ * the RealCache are written to a file on a local SSD, and chunks found
+ * there are read back instead of being fetched from the cluster. The file
+ * is split into fixed, chunk-sized slots; the in-memory index only maps
+ * element IDs to slot numbers and keeps a few bytes of state per slot.
+ * Victims are picked with CLOCK. All I/O is asynchronous (libaio, O_DIRECT)
+ * and completes on a dedicated thread.
+ *
+ * The file is unlinked as soon as it is created, so the tier never
+ * outlives the image handle that owns it.
+ */
+class SSDCache {
+public:
+  SSDCache(CephContext *cct, const std::string &path, uint64_t max_bytes,
+           PerfCounters *perfcounter = nullptr);
+  ~SSDCache();
+  SSDCache(const SSDCache&) = delete;
+  SSDCache& operator=(const SSDCache&) = delete;
+
+  int init(uint64_t chunk_size);
+  void shut_down();
+
+  bool contains(ElementID id) const;
+
+  /// asynchronously store a chunk; dropped if no slot can be freed
+  void write(ElementID id, const bufferptr &bp);
+
+  /**
+   * Asynchronously read a chunk into @out. Returns false (and never calls
+   * @on_finish) if the chunk is not stored. @on_finish gets -ESTALE if the
+   * chunk was invalidated while the read was in flight.
+   */
+  bool read(ElementID id, bufferlist *out, Context *on_finish);
+
+  void invalidate(ElementID id);
+  void clear();
+
+  uint64_t get_max_bytes() const {
+    return m_max_bytes;
+  }
+  uint64_t get_bytes() const;
+  uint64_t get_num_entries() const;
+
+private:
+  enum SlotState : uint8_t {
+    SLOT_FREE,
+    SLOT_WRITING,
+    SLOT_VALID,
+  };
+
+  struct Slot {
+    ElementID id = 0;
+    uint16_t readers = 0;
+    SlotState state = SLOT_FREE;
+    bool referenced = false;  ///< CLOCK reference bit
+    bool stale = false;       ///< invalidated while I/O was in flight
+  };
+
+  struct AioOp;
+
+  struct AioCompletionThread : public Thread {
+    SSDCache *ssd_cache;
+    explicit AioCompletionThread(SSDCache *ssd_cache) : ssd_cache(ssd_cache) {
+    }
+    void *entry() override {
+      ssd_cache->aio_thread();
+      return NULL;
+    }
+  } m_aio_thread;
+
+  CephContext *m_cct;
+  std::string m_path;
+  uint64_t m_max_bytes;
+  PerfCounters *m_perfcounter;
+
+  int m_fd = -1;
+  uint64_t m_chunk_size = 0;
+#ifdef HAVE_LIBAIO
+  uint64_t m_aio_queue_depth;
+  io_context_t m_aio_ctx = 0;
+#endif
+  std::atomic<bool> m_aio_stop = {false};
+
+  mutable Mutex m_lock;
+  Cond m_cond;
+  std::unordered_map<ElementID, uint32_t> m_index;
+  std::vector<Slot> m_slots;
+  std::vector<uint32_t> m_free_slots;
+  uint32_t m_clock_hand = 0;
+  uint64_t m_num_valid = 0;
+  uint64_t m_in_flight = 0;
+
+  bool allocate_slot(uint32_t *slot);
+  void release_slot(uint32_t slot);
+  void unindex(uint32_t slot);
+
+  void submit(AioOp *op);
+  void aio_thread();
+  void handle_aio(AioOp *op, long r);
+};
+
+} // namespace cache
+} // namespace librbd
+
+#endif // CEPH_LIBRBD_CACHE_SSD_CACHE
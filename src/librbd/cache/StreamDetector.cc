@@ -0,0 +1,164 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "librbd/cache/StreamDetector.h"
+#include "common/dout.h"
+#include "common/Formatter.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+#define dout_subsys ceph_subsys_rbd
+#undef dout_prefix
+#define dout_prefix *_dout << "librbd::cache::StreamDetector: " << this << " " \
+                           << __func__ << ": "
+
+namespace librbd {
+namespace cache {
+
+// Prefetch depth of a newly confirmed stream, in strides
+static const uint32_t INITIAL_DEPTH = 2;
+
+StreamDetector::StreamDetector(CephContext *cct, uint32_t max_streams,
+                               uint32_t trigger, uint32_t max_depth,
+                               uint32_t max_stride)
+  : m_cct(cct), m_trigger(std::max<uint32_t>(trigger, 1)),
+    m_max_depth(std::max<uint32_t>(max_depth, 1)),
+    m_max_stride(std::max<uint32_t>(max_stride, 1)),
+    m_lock("librbd::cache::StreamDetector::m_lock"),
+    m_streams(std::max<uint32_t>(max_streams, 1)) {
+}
+
+bool StreamDetector::update(ElementID id, ElementID max_id,
+                            std::vector<ElementID> *prefetch_ids) {
+  Mutex::Locker locker(m_lock);
+  ++m_tick;
+
+  Stream *match = nullptr;
+  Stream *nearest = nullptr;
+  Stream *victim = &m_streams[0];
+  int64_t nearest_distance = std::numeric_limits<int64_t>::max();
+  for (auto &stream : m_streams) {
+    if (stream.last_used < victim->last_used) {
+      victim = &stream;
+    }
+    if (stream.last == 0) {
+      continue;
+    }
+
+    int64_t distance = static_cast<int64_t>(id) -
+                       static_cast<int64_t>(stream.last);
+    if (distance == 0) {
+      // several small reads within one chunk
+      stream.last_used = m_tick;
+      return stream.hits >= m_trigger;
+    }
+    if (stream.stride != 0 && distance == stream.stride) {
+      match = &stream;
+      break;
+    }
+    if (std::abs(distance) <= m_max_stride &&
+        std::abs(distance) < nearest_distance) {
+      nearest = &stream;
+      nearest_distance = std::abs(distance);
+    }
+  }
+
+  if (match != nullptr) {
+    match->last = id;
+    match->last_used = m_tick;
+    if (++match->hits < m_trigger) {
+      return false;
+    }
+
+    if (match->hits == m_trigger) {
+      ldout(m_cct, 20) << "confirmed stream at id=" << id << ", "
+                       << "stride=" << match->stride << dendl;
+      match->depth = std::min(INITIAL_DEPTH, m_max_depth);
+      match->next = 0;
+    }
+    ++m_confirmed;
+    readahead(*match, max_id, prefetch_ids);
+    return true;
+  }
+
+  if (nearest != nullptr) {
+    // a new stride for a nearby stream: start counting again
+    nearest->stride = static_cast<int64_t>(id) -
+                      static_cast<int64_t>(nearest->last);
+    nearest->last = id;
+    nearest->hits = 1;
+    nearest->depth = 0;
+    nearest->next = 0;
+    nearest->last_used = m_tick;
+    return false;
+  }
+
+  *victim = Stream();
+  victim->last = id;
+  victim->last_used = m_tick;
+  return false;
+}
+
+void StreamDetector::reset() {
+  Mutex::Locker locker(m_lock);
+  for (auto &stream : m_streams) {
+    stream = Stream();
+  }
+}
+
+void StreamDetector::dump(Formatter *f) const {
+  Mutex::Locker locker(m_lock);
+
+  uint32_t active = 0;
+  for (auto &stream : m_streams) {
+    if (stream.hits >= m_trigger) {
+      ++active;
+    }
+  }
+  f->dump_unsigned("max_streams", m_streams.size());
+  f->dump_unsigned("active_streams", active);
+  f->dump_unsigned("stream_accesses", m_confirmed);
+}
+
+void StreamDetector::readahead(Stream &stream, ElementID max_id,
+                               std::vector<ElementID> *prefetch_ids) {
+  assert(m_lock.is_locked());
+
+  int64_t last = static_cast<int64_t>(stream.last);
+  int64_t next = static_cast<int64_t>(stream.next);
+  int64_t issued = 0;
+  if (stream.next == 0) {
+    next = last + stream.stride;
+  } else {
+    // chunks already prefetched ahead of the reader
+    issued = (next - last) / stream.stride - 1;
+    if (issued < 0) {
+      next = last + stream.stride;
+      issued = 0;
+    }
+    if (2 * issued > static_cast<int64_t>(stream.depth)) {
+      return;
+    }
+
+    // the reader caught up with half the window: go deeper
+    stream.depth = std::min(stream.depth * 2, m_max_depth);
+  }
+
+  for (; issued < static_cast<int64_t>(stream.depth); ++issued) {
+    if (next < 1 || next > static_cast<int64_t>(max_id)) {
+      break;
+    }
+    prefetch_ids->push_back(static_cast<ElementID>(next));
+    next += stream.stride;
+  }
+  stream.next = static_cast<ElementID>(std::max<int64_t>(next, 1));
+
+  ldout(m_cct, 20) << "id=" << stream.last << ", stride=" << stream.stride
+                   << ", depth=" << stream.depth << ", "
+                   << "next=" << stream.next << dendl;
+}
+
+} // namespace cache
+} // namespace librbd
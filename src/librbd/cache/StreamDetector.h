@@ -0,0 +1,79 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_LIBRBD_CACHE_STREAM_DETECTOR
+#define CEPH_LIBRBD_CACHE_STREAM_DETECTOR
+
+#include "common/Mutex.h"
+#include "RealCache.h"
+
+#include <vector>
+
+class CephContext;
+
+namespace ceph {
+class Formatter;
+}
+
+namespace librbd {
+namespace cache {
+
+/**
+ * StreamDetector recognizes sequential and strided chunk access streams,
+ * like common/Readahead but for several interleaved streams per image.
+ * Each stream remembers its last chunk and stride; once the same stride has
+ * been seen often enough the stream is confirmed and prefetching runs ahead
+ * of it. The prefetch depth starts small and doubles whenever the reader
+ * consumes half of what was prefetched, up to a maximum. The least recently
+ * used stream is recycled when a new one starts.
+ *
+ * Accesses that belong to a confirmed stream need no further prediction;
+ * all others are left to the belief predictor.
+ */
+class StreamDetector {
+public:
+  StreamDetector(CephContext *cct, uint32_t max_streams, uint32_t trigger,
+                 uint32_t max_depth, uint32_t max_stride);
+  StreamDetector(const StreamDetector&) = delete;
+  StreamDetector& operator=(const StreamDetector&) = delete;
+
+  /**
+   * Record an access to chunk @id. Returns true if the access is part of a
+   * confirmed stream, appending the chunks to prefetch (never past
+   * @max_id) to @prefetch_ids.
+   */
+  bool update(ElementID id, ElementID max_id,
+              std::vector<ElementID> *prefetch_ids);
+
+  void reset();
+
+  void dump(ceph::Formatter *f) const;
+
+private:
+  struct Stream {
+    ElementID last = 0;
+    int64_t stride = 0;
+    uint32_t hits = 0;         ///< consecutive accesses with the same stride
+    uint32_t depth = 0;        ///< strides to keep prefetched ahead
+    ElementID next = 0;        ///< next chunk to prefetch
+    uint64_t last_used = 0;
+  };
+
+  CephContext *m_cct;
+  uint32_t m_trigger;
+  uint32_t m_max_depth;
+  int64_t m_max_stride;
+
+  mutable Mutex m_lock;
+  std::vector<Stream> m_streams;
+  uint64_t m_tick = 0;
+  uint64_t m_confirmed = 0;
+
+  void readahead(Stream &stream, ElementID max_id,
+                 std::vector<ElementID> *prefetch_ids);
+};
+
+} // namespace cache
+} // namespace librbd
+
+#endif // CEPH_LIBRBD_CACHE_STREAM_DETECTOR
@@ -17,7 +17,9 @@ namespace predictcache {
 		double thresh = 0.12;
 		uint64_t voter_size = 5;
 		uint64_t window_size = 5;
-		uint64_t max_matrix_size = 5000;
+		uint64_t model_bytes = 4 << 20;
+		uint64_t followers_per_element = 8;
+		uint64_t decay_interval = 100000;
 		uint64_t minimum_history_to_consider = 2;
 	};
 
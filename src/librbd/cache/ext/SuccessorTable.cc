@@ -0,0 +1,222 @@
+#include "SuccessorTable.h"
+
+// STL includes
+#include <algorithm>
+#include <climits>
+
+namespace predictcache {
+
+  SuccessorTable::SuccessorTable(uint64_t memoryBytes, uint64_t followersPerRow,
+    uint64_t decayInterval) :
+    followersPerRow_(std::max<uint64_t>(followersPerRow, 1)),
+    decayInterval_(std::max<uint64_t>(decayInterval, 1))
+  {
+    // Size the table to the largest power of two number of rows that fits
+    // in the memory budget, but never below a single probe window
+    uint64_t rowBytes = sizeof(Row) + followersPerRow_ * sizeof(Follower);
+    uint64_t numRows = MAX_PROBE;
+    while (numRows * 2 * rowBytes <= memoryBytes) {
+      numRows *= 2;
+    }
+
+    mask_ = numRows - 1;
+    rows_.resize(numRows);
+    followers_.resize(numRows * followersPerRow_);
+  }
+
+  uint64_t SuccessorTable::hash(ObjectID obj) {
+    // splitmix64 finalizer - sequential chunk IDs must not cluster
+    obj += 0x9e3779b97f4a7c15ull;
+    obj = (obj ^ (obj >> 30)) * 0xbf58476d1ce4e5b9ull;
+    obj = (obj ^ (obj >> 27)) * 0x94d049bb133111ebull;
+    return obj ^ (obj >> 31);
+  }
+
+  int64_t SuccessorTable::find(ObjectID obj) const {
+    uint64_t start = hash(obj);
+
+    for (uint64_t i = 0; i < MAX_PROBE; i++) {
+      uint64_t slot = (start + i) & mask_;
+      const Row& row = rows_[slot];
+
+      // Rows are recycled but never emptied, so an unused slot ends the probe
+      if (!row.used) {
+        return -1;
+      }
+      if (row.key == obj) {
+        return static_cast<int64_t>(slot);
+      }
+    }
+
+    return -1;
+  }
+
+  uint64_t SuccessorTable::findOrInsert(ObjectID obj) {
+    uint64_t start = hash(obj);
+    uint64_t victim = start & mask_;
+    uint64_t victimWeight = UINT64_MAX;
+
+    for (uint64_t i = 0; i < MAX_PROBE; i++) {
+      uint64_t slot = (start + i) & mask_;
+      Row& row = rows_[slot];
+
+      if (!row.used) {
+        usedRows_++;
+        resetRow(slot, obj);
+        return slot;
+      }
+      if (row.key == obj) {
+        decay(slot);
+        return slot;
+      }
+
+      uint32_t shift = decayShift(row);
+      uint64_t weight = static_cast<uint64_t>(row.rowSum >> shift) +
+        (row.frequency >> shift);
+      if (weight < victimWeight) {
+        victim = slot;
+        victimWeight = weight;
+      }
+    }
+
+    // Probe window is full - recycle its coldest row
+    resetRow(victim, obj);
+    return victim;
+  }
+
+  uint32_t SuccessorTable::decayShift(const Row& row) const {
+    return std::min<uint32_t>(epoch_ - row.epoch, 31);
+  }
+
+  void SuccessorTable::decay(uint64_t row) {
+    Row& r = rows_[row];
+    uint32_t shift = decayShift(r);
+    if (shift == 0) {
+      return;
+    }
+
+    r.rowSum >>= shift;
+    r.frequency >>= shift;
+    r.epoch = epoch_;
+
+    Follower* followers = &followers_[row * followersPerRow_];
+    for (uint64_t i = 0; i < followersPerRow_; i++) {
+      followers[i].count >>= shift;
+    }
+  }
+
+  void SuccessorTable::resetRow(uint64_t row, ObjectID obj) {
+    Row& r = rows_[row];
+    r.key = obj;
+    r.epoch = epoch_;
+    r.rowSum = 0;
+    r.frequency = 0;
+    r.used = true;
+
+    std::fill(followers_.begin() + row * followersPerRow_,
+      followers_.begin() + (row + 1) * followersPerRow_, Follower());
+  }
+
+  void SuccessorTable::updateCounts(ObjectID obj, ObjectID next) {
+    if (++transitions_ % decayInterval_ == 0) {
+      epoch_++;
+    }
+
+    uint64_t row = findOrInsert(obj);
+    rows_[row].rowSum++;
+
+    // Space-Saving: bump a tracked follower, take a free slot, or replace
+    // the least frequent follower and inherit its count
+    Follower* followers = &followers_[row * followersPerRow_];
+    Follower* minFollower = followers;
+    bool updated = false;
+
+    for (uint64_t i = 0; i < followersPerRow_; i++) {
+      if (followers[i].count != 0 && followers[i].id == next) {
+        followers[i].count++;
+        updated = true;
+        break;
+      }
+      if (followers[i].count < minFollower->count) {
+        minFollower = &followers[i];
+      }
+    }
+
+    if (!updated) {
+      minFollower->id = next;
+      minFollower->count++;
+    }
+
+    // Only touch the follower's row once obj's row is done with, since
+    // inserting next may recycle obj's row
+    rows_[findOrInsert(next)].frequency++;
+  }
+
+  void SuccessorTable::restoreRow(ObjectID obj, uint64_t rowSum,
+    uint64_t frequency) {
+    uint64_t row = findOrInsert(obj);
+    rows_[row].rowSum = static_cast<uint32_t>(
+      std::min<uint64_t>(rowSum, UINT32_MAX));
+    rows_[row].frequency = static_cast<uint32_t>(
+      std::min<uint64_t>(frequency, UINT32_MAX));
+  }
+
+  void SuccessorTable::restoreFollower(ObjectID obj, ObjectID next,
+    uint64_t count) {
+    int64_t row = find(obj);
+    if (row < 0 || count == 0) {
+      return;
+    }
+    decay(row);
+
+    // Keep the most frequent followers if more were saved than fit
+    Follower* followers = &followers_[row * followersPerRow_];
+    Follower* minFollower = followers;
+    for (uint64_t i = 0; i < followersPerRow_; i++) {
+      if (followers[i].count < minFollower->count) {
+        minFollower = &followers[i];
+      }
+    }
+
+    uint32_t restored = static_cast<uint32_t>(
+      std::min<uint64_t>(count, UINT32_MAX));
+    if (restored > minFollower->count) {
+      minFollower->id = next;
+      minFollower->count = restored;
+    }
+  }
+
+  uint64_t SuccessorTable::getRowSum(ObjectID obj) const {
+    int64_t row = find(obj);
+    if (row < 0) {
+      return 0;
+    }
+
+    return rows_[row].rowSum >> decayShift(rows_[row]);
+  }
+
+  uint64_t SuccessorTable::getFrequency(ObjectID obj) const {
+    int64_t row = find(obj);
+    if (row < 0) {
+      return 0;
+    }
+
+    return rows_[row].frequency >> decayShift(rows_[row]);
+  }
+
+  uint64_t SuccessorTable::getCount(ObjectID obj, ObjectID next) const {
+    uint64_t result = 0;
+
+    forEachFollower(obj, [&](ObjectID id, uint64_t count) {
+      if (id == next) {
+        result = count;
+      }
+    });
+
+    return result;
+  }
+
+  uint64_t SuccessorTable::getMemoryUsage() const {
+    return rows_.size() * sizeof(Row) + followers_.size() * sizeof(Follower);
+  }
+}
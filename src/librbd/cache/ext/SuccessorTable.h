@@ -0,0 +1,122 @@
+#ifndef SUCCESSOR_TABLE_H
+#define SUCCESSOR_TABLE_H
+
+// STL includes
+#include <cstdint>
+#include <vector>
+
+namespace predictcache {
+
+	using ObjectID = uint64_t;
+
+	// SuccessorTable is a fixed-memory replacement for a full co-occurrence
+	// matrix. It is a flat open-addressing table keyed by element ID; every
+	// row keeps the element's access statistics plus its top-K followers,
+	// tracked with the Space-Saving scheme. When the probe window for a new
+	// element is full, the coldest row in the window is recycled. All counts
+	// decay exponentially (halved every decayInterval recorded transitions),
+	// applied lazily when a row is touched, so stale history fades out
+	// without a periodic sweep.
+	class SuccessorTable {
+		public:
+			// Maximum number of slots probed for a key before recycling a row
+			static constexpr uint64_t MAX_PROBE = 8;
+
+			SuccessorTable(uint64_t memoryBytes, uint64_t followersPerRow,
+				uint64_t decayInterval);
+
+			// Records that next followed obj inside the look-ahead window
+			void updateCounts(ObjectID obj, ObjectID next);
+
+			// Number of transitions recorded with obj as the predecessor
+			uint64_t getRowSum(ObjectID obj) const;
+
+			// Number of transitions recorded with obj as the follower
+			uint64_t getFrequency(ObjectID obj) const;
+
+			// Number of times next followed obj (0 if not tracked)
+			uint64_t getCount(ObjectID obj, ObjectID next) const;
+
+			// Calls f(followerId, count) for every tracked follower of obj
+			template <typename F>
+			void forEachFollower(ObjectID obj, F&& f) const {
+				int64_t row = find(obj);
+				if (row < 0) {
+					return;
+				}
+
+				uint32_t shift = decayShift(rows_[row]);
+				const Follower* followers = &followers_[row * followersPerRow_];
+				for (uint64_t i = 0; i < followersPerRow_; i++) {
+					uint64_t count = followers[i].count >> shift;
+					if (count != 0) {
+						f(followers[i].id, count);
+					}
+				}
+			}
+
+			// Calls f(obj, rowSum, frequency) for every tracked element
+			template <typename F>
+			void forEachRow(F&& f) const {
+				for (const Row& row : rows_) {
+					if (!row.used) {
+						continue;
+					}
+
+					uint32_t shift = decayShift(row);
+					uint64_t rowSum = row.rowSum >> shift;
+					uint64_t frequency = row.frequency >> shift;
+					if (rowSum != 0 || frequency != 0) {
+						f(row.key, rowSum, frequency);
+					}
+				}
+			}
+
+			// Restore statistics saved with forEachRow()/forEachFollower(),
+			// e.g. from a persisted model. A follower is only restored while
+			// its predecessor's row is still in the table.
+			void restoreRow(ObjectID obj, uint64_t rowSum, uint64_t frequency);
+			void restoreFollower(ObjectID obj, ObjectID next, uint64_t count);
+
+			uint64_t getNumRows() const { return rows_.size(); }
+			uint64_t getNumUsedRows() const { return usedRows_; }
+			uint64_t getFollowersPerRow() const { return followersPerRow_; }
+			uint64_t getMemoryUsage() const;
+
+		private:
+			struct Row {
+				ObjectID key = 0;
+				uint32_t epoch = 0;
+				uint32_t rowSum = 0;
+				uint32_t frequency = 0;
+				bool used = false;
+			};
+
+			struct Follower {
+				ObjectID id = 0;
+				uint32_t count = 0;
+			};
+
+			uint64_t followersPerRow_;
+			uint64_t decayInterval_;
+			uint64_t mask_;
+			uint64_t usedRows_ = 0;
+			uint64_t transitions_ = 0;
+			uint32_t epoch_ = 0;
+
+			std::vector<Row> rows_;
+			std::vector<Follower> followers_;
+
+			static uint64_t hash(ObjectID obj);
+
+			int64_t find(ObjectID obj) const;
+			uint64_t findOrInsert(ObjectID obj);
+
+			uint32_t decayShift(const Row& row) const;
+			void decay(uint64_t row);
+			void resetRow(uint64_t row, ObjectID obj);
+	};
+
+} // namespace predictcache
+
+#endif // SUCCESSOR_TABLE_H
@@ -1,6 +1,7 @@
 #include "SwitchModule.h"
 
 // STL includes
+#include <algorithm>
 #include <iostream>
 
 namespace predictcache {
@@ -6,27 +6,33 @@
 
 namespace predictcache{
 	VirtCache::VirtCache() :
-		cacheSize_(vcacheGlobals.vcache_size), stat_(), params_(vcacheGlobals)
+		cacheSize_(vcacheGlobals.vcache_size), stat_(vcacheGlobals), params_(vcacheGlobals)
 	{
 		elements_.reserve(cacheSize_);
+		slots_.reserve(cacheSize_);
 	}
 
 	VirtCache::VirtCache(CacheParameters params) :
-		cacheSize_(params.vcache_size), stat_(), params_(params)
+		cacheSize_(params.vcache_size), stat_(params), params_(params)
 	{
 		elements_.reserve(cacheSize_);
+		slots_.reserve(cacheSize_);
 	}
 
 	//copy constructor
-	VirtCache::VirtCache(const VirtCache& temp)
+	VirtCache::VirtCache(const VirtCache& temp) :
+		stat_(temp.stat_)
 	{
 		cacheSize_ = temp.cacheSize_;
 		unused_ = temp.unused_;
 		insertions_ = temp.insertions_;
 		elements_ = temp.elements_;
+		ranking_ = temp.ranking_;
+		slots_ = temp.slots_;
+		refreshCursor_ = temp.refreshCursor_;
+		mergeCount_ = temp.mergeCount_;
 		usageHistogram_ = temp.usageHistogram_;
 
-		stat_ = temp.stat_;
 		params_ = temp.params_;
 	}
 
@@ -35,6 +41,10 @@ namespace predictcache{
 		unused_ = other.unused_;
 		insertions_ = other.insertions_;
 		elements_ = other.elements_;
+		ranking_ = other.ranking_;
+		slots_ = other.slots_;
+		refreshCursor_ = other.refreshCursor_;
+		mergeCount_ = other.mergeCount_;
 		usageHistogram_ = other.usageHistogram_;
 
 		stat_ = other.stat_;
@@ -44,125 +54,121 @@ namespace predictcache{
 		return *this;
 	}
 
+	// Re-key an element in the belief ranking
+	void VirtCache::setBelief(Entry& entry, double belief) {
+		if (entry.element.belief == belief) {
+			return;
+		}
+
+		ranking_.erase(std::make_pair(entry.element.belief, entry.element.id));
+		entry.element.belief = belief;
+		ranking_.emplace(belief, entry.element.id);
+	}
+
+	// Drop an element from all indexes; the last slot fills the hole
+	void VirtCache::remove(std::unordered_map<uint64_t, Entry>::iterator it) {
+		size_t slot = it->second.slot;
+		if (slot != slots_.size() - 1) {
+			uint64_t moved = slots_.back();
+			slots_[slot] = moved;
+			elements_.at(moved).slot = slot;
+		}
+		slots_.pop_back();
+
+		ranking_.erase(std::make_pair(it->second.element.belief, it->first));
+		elements_.erase(it);
+	}
+
 	// Merge cache candidates and their updated values into the virtual cache
 	// Generate prefetch list, eviction list, and compute statistics
     void VirtCache::merge(const std::vector<predictcache::Element>& cacheCandidates) {
-		std::vector<Element> removedElements;
+		uint64_t admitted = 0;
 
-		std::vector<uint64_t> previousCacheElementIds, currentCacheElementIds, removedIds,
-			prefetchIds;
-		for (auto& i : elements_) {
-			previousCacheElementIds.push_back(i.id);
-		}
+		// Lock elements_ access
+		std::lock_guard<std::mutex> lock(elementMutex_);
+		++mergeCount_;
 
-		{
-			// Lock elements_ access
-			std::lock_guard<std::mutex> lock(elementMutex_);
-
-			for (auto& i : cacheCandidates) {
-				// If already in elements, just update the belief value
-				auto found = std::find_if(elements_.begin(), elements_.end(), [=](Element x){ return x.id == i.id; });
-				if (found != elements_.end()) {
-					found->belief = i.belief;
-				} else {
-					elements_.push_back(i);
-				}
-			}
-			
-			// Sort all cache elements by belief, highest to lowest
-			std::sort(elements_.begin(), elements_.end(), [](Element a, Element b) { return a.belief > b.belief; });
-
-			// Remove all but first cacheSize_ elements from the cache
-			if (elements_.size() > cacheSize_) {
-				std::copy(elements_.begin() + cacheSize_, elements_.end(), std::back_inserter(removedElements));
-				elements_.erase(elements_.begin() + cacheSize_, elements_.end());
+		for (auto& i : cacheCandidates) {
+			// If already in elements, just update the belief value
+			auto found = elements_.find(i.id);
+			if (found != elements_.end()) {
+				setBelief(found->second, i.belief);
+			} else {
+				elements_.emplace(i.id, Entry(i, slots_.size(), mergeCount_));
+				slots_.push_back(i.id);
+				ranking_.emplace(i.belief, i.id);
 			}
 		}
 
-		for (auto& i : elements_) {
-			currentCacheElementIds.push_back(i.id);
-		}
-
-		for (auto& i : removedElements) {
-			removedIds.push_back(i.id);
-		}
-
-		std::copy_if(currentCacheElementIds.begin(), currentCacheElementIds.end(),
-			std::back_inserter(prefetchIds),
-			[=](uint64_t element){
-				return std::find(previousCacheElementIds.begin(), previousCacheElementIds.end(),
-					element) == previousCacheElementIds.end(); });
+		// Remove the lowest beliefs until only cacheSize_ elements remain
+		while (elements_.size() > cacheSize_) {
+			auto found = elements_.find(ranking_.begin()->second);
+			const Element& removed = found->second.element;
 
-		std::copy_if(removedIds.begin(), removedIds.end(),
-			std::back_inserter(evict_),
-			[=](uint64_t element){
-				return std::find(previousCacheElementIds.begin(), previousCacheElementIds.end(),
-					element) != previousCacheElementIds.end(); });
+			// Candidates that never made it into the cache are not evictions,
+			// everything else counts for usage statistics
+			if (found->second.admitted != mergeCount_) {
+				evict_.push_back(removed.id);
 
-		// Any removal candidates who end up in the evict ID list count for usage statistics
-		for (auto& i : removedElements) {
-			auto found = std::find(evict_.begin(), evict_.end(), i.id);
-
-			if (found != evict_.end()) {
-				if (i.hits == 0.0) {
+				if (removed.hits == 0.0) {
 					unused_++;
 				}
 
-				usageHistogram_[i.hits]++;
+				usageHistogram_[removed.hits]++;
 			}
+
+			remove(found);
 		}
 
-		/*
-		// If any candidates have their IDs in the prefetch ID list, add them to the prefetch list
+		// Only the candidates of this access can have been admitted or had
+		// their belief changed
 		for (auto& i : cacheCandidates) {
-			auto found = std::find(prefetchIds.begin(), prefetchIds.end(), i.id);
-
-			if (found != prefetchIds.end()) {
-				std::lock_guard<std::mutex> lock(prefetch_.mutex);
-				prefetch_.elements.push_back(i);
+			auto found = elements_.find(i.id);
+			if (found == elements_.end()) {
+				continue;
 			}
-		}*/
 
-		// Update all elements
-		{
-			std::copy(elements_.begin(), elements_.end(),
-				std::back_inserter(prefetch_));
+			if (found->second.admitted == mergeCount_) {
+				// Count each new element once even if it was a candidate twice
+				found->second.admitted = 0;
+				admitted++;
+			}
+			prefetch_.push_back(found->second.element);
 		}
 
-		insertions_ += prefetchIds.size();
+		insertions_ += admitted;
 	}
 
 	bool VirtCache::hit(const uint64_t objId, const bool changeHitrate) {
 		std::lock_guard<std::mutex> lock(elementMutex_);
 
-		auto found = std::find_if(elements_.begin(), elements_.end(), [=](Element x){ return x.id == objId; });
+		auto found = elements_.find(objId);
 
 		if (found == elements_.end()) {
 			return false;
 		} else {
 			if (changeHitrate) {
-				found->hits++;
+				found->second.element.hits++;
 			}
 			return true;
 		}
 	}
 
 	void VirtCache::finalizeHistogram() {
-		for (auto i : elements_) {
-			if (i.hits == 0.0) {
+		for (auto& i : elements_) {
+			if (i.second.element.hits == 0.0) {
 				unused_++;
 			} else {
-				usageHistogram_[i.hits]++;
+				usageHistogram_[i.second.element.hits]++;
 			}
 		}
 	}
 	double VirtCache::getBelief(uint64_t elementId) const {
 		double belief = 0.0;
-		auto found = std::find_if(elements_.begin(), elements_.end(),
-			[=](Element a){ return a.id == elementId; });
+		auto found = elements_.find(elementId);
 		
 		if(found != elements_.end())
-			belief = found->belief;
+			belief = found->second.element.belief;
 
 		return belief;
 	}
@@ -173,12 +179,31 @@ namespace predictcache{
 
 	CacheParameters VirtCache::getParameters() const {return params_;}
 
+	void VirtCache::setParameters(CacheParameters params) {
+		params_ = params;
+		updateParameters();
+	}
+
+	const SuccessorTable& VirtCache::getSuccessorTable() const {
+		return stat_.getSuccessorTable();
+	}
+
+	SuccessorTable& VirtCache::getSuccessorTable() {
+		return stat_.getSuccessorTable();
+	}
+
 	void VirtCache::updateHistory(const uint64_t obj) {
+		// Re-score the next cc_size cached elements in round-robin order, so
+		// the cost per access does not grow with the size of the cache
 		std::vector<Element> currentElements;
-		currentElements.reserve(elements_.size());
+		uint64_t refresh = std::min<uint64_t>(params_.cc_size, slots_.size());
+		currentElements.reserve(refresh);
 
-		for (auto i : elements_) {
-			currentElements.emplace_back(i.id, 0.0);
+		for (uint64_t i = 0; i < refresh; i++) {
+			if (refreshCursor_ >= slots_.size()) {
+				refreshCursor_ = 0;
+			}
+			currentElements.emplace_back(slots_[refreshCursor_++], 0.0);
 		}
 
 		auto result = stat_.updateHistory(obj, currentElements);
@@ -186,6 +211,10 @@ namespace predictcache{
 		merge(result);
 	}
 
+	std::vector<Element>& VirtCache::getPrefetchList() {
+		return prefetch_;
+	}
+
 	std::vector<uint64_t>& VirtCache::getEvictionList() {
 		return evict_;
 	}
@@ -4,6 +4,9 @@
 // STL includes
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <utility>
 #include <cstdint>
 #include <mutex>
 
@@ -18,6 +21,12 @@ namespace predictcache
 	class SwitchModule;
 
 	// For now, VirtCache is standalone class, will later make base Cache class
+	//
+	// Elements are indexed by ID and kept in an ordered set by belief, so a
+	// merge only touches the candidates of the current access and trimming the
+	// cache to cacheSize_ pops the lowest beliefs. A dense slot array gives the
+	// round-robin order in which cached beliefs are re-scored, cc_size elements
+	// per access, instead of re-scoring the whole cache every time.
 	class VirtCache {
 		// TODO: Fix to public access
 		// Right now SwitchModule just changes parameters directly
@@ -46,12 +55,31 @@ namespace predictcache
 		std::vector<Element>& getPrefetchList();
 		std::vector<uint64_t>& getEvictionList();
 		CacheParameters getParameters() const;
+		void setParameters(CacheParameters params);
+
+		// Successor statistics learned so far, e.g. to persist the model
+		const SuccessorTable& getSuccessorTable() const;
+		SuccessorTable& getSuccessorTable();
 
 	private:
+		struct Entry {
+			Entry(const Element& element, size_t slot, uint64_t admitted) :
+				element(element), slot(slot), admitted(admitted)
+			{}
+
+			Element element;
+			size_t slot;		// position in slots_
+			uint64_t admitted;	// merge that inserted the element
+		};
+
 		uint64_t cacheSize_;
 		uint64_t unused_ = 0;
 		uint64_t insertions_ = 0;
-		std::vector<Element> elements_;
+		std::unordered_map<uint64_t, Entry> elements_;
+		std::set<std::pair<double, uint64_t>> ranking_;	// (belief, id), lowest first
+		std::vector<uint64_t> slots_;
+		size_t refreshCursor_ = 0;
+		uint64_t mergeCount_ = 0;
 		std::vector<Element> prefetch_;
 		std::vector<uint64_t> evict_;
 		std::map<uint64_t, uint64_t> usageHistogram_;
@@ -63,6 +91,9 @@ namespace predictcache
 
 		// Notifies VirtStat of a parameter change
 		void updateParameters();
+
+		void setBelief(Entry& entry, double belief);
+		void remove(std::unordered_map<uint64_t, Entry>::iterator it);
 	}; 
 } //namespace cache
 
@@ -1,34 +1,38 @@
-// Include boost libraries first to avoid Ceph conflicts
-#include <boost/numeric/ublas/matrix_proxy.hpp>
-
 #include "VirtStat.h"
 
 // STL includes
 #include <algorithm>
 #include <iostream>
+#include <utility>
 
 // Project includes
 #include "Globals.h"
 
-using namespace boost::numeric::ublas;
-
 namespace predictcache {
 	//void VirtStat::get_main_key(const uint64_t key, uint64_t &id);
 
   VirtStat::VirtStat() :
-    params_(vcacheGlobals),
-    accessStats_(params_.max_matrix_size, params_.max_matrix_size),
-    probabilities_(params_.max_matrix_size, params_.max_matrix_size),
-    columnSums_(params_.max_matrix_size, 0), rowSums_(params_.max_matrix_size, 0)
+    VirtStat(vcacheGlobals)
+  {
+  }
+
+  VirtStat::VirtStat(CacheParameters params) :
+    params_(params),
+    table_(params_.model_bytes, params_.followers_per_element,
+      params_.decay_interval)
   {
-    // Construct VirtStat with two max_elem x max_elem sparse matrices
+    // Construct VirtStat with a fixed-size successor table
+  }
+
+  uint64_t VirtStat::historyLimit() const {
+    return std::max(params_.window_size + 1, params_.voter_size);
   }
 
   std::vector<Element> VirtStat::updateHistory(ObjectID obj, std::vector<Element>& cacheElements)
   {
-    // If we don't have any other elements in the history, don't do anything! 
+    // If we don't have any other elements in the history, don't do anything!
     if (history_.empty()) {
-      history_.push_back(obj);     
+      history_.push_back(obj);
       return std::vector<Element>();
     }
 
@@ -48,8 +52,13 @@ namespace predictcache {
       updateCounts(*i, obj);
     }
 
+    // Drop history that can no longer be part of a window or a vote
+    while (history_.size() > historyLimit()) {
+      history_.pop_front();
+    }
+
     // Find belief values for element in the window n
-    // n, obj  
+    // n, obj
 
     uint64_t votersStart;
 
@@ -59,8 +68,6 @@ namespace predictcache {
       votersStart = history_.size() - params_.voter_size;
     }
 
-    calculateSignificance(obj);
-
     auto candidates = findCacheCandidates(obj, params_.cc_size);
 
     if (candidates.empty()) {
@@ -68,8 +75,6 @@ namespace predictcache {
     }
 
     std::copy(cacheElements.begin(), cacheElements.end(), std::back_inserter(candidates));
-    calculateSignificance(history_.begin() + votersStart, history_.end() - 1,
-      candidates.begin(), candidates.end());
 
     findMaxBelief(candidates, history_.begin() + votersStart, history_.end(), params_.thresh);
 
@@ -78,72 +83,25 @@ namespace predictcache {
 
   // Increments the access counts for next after obj
   void VirtStat::updateCounts(ObjectID obj, ObjectID next) {
-    accessStats_(obj, next) += 1;
-    rowSums_[obj] += 1;
-    columnSums_[next] += 1;
-  }
-
-  void VirtStat::calculateSignificance(ObjectID start)
-  {
-    // Calculate probabilities and belief values from access history
-
-    // Get row and column corresponding to the first object
-    matrix_row<SparseMatrix<uint64_t>> objRow(accessStats_, start);
-    double rowSum = static_cast<double>(rowSums_[start]);
-
-
-    if (rowSum > (params_.minimum_history_to_consider * params_.window_size)) {
-      for (auto i = objRow.begin(); i != objRow.end(); i++) {
-        if (*i != 0) {
-          uint64_t col = i.index();
-          double oFrequency = static_cast<double>(columnSums_[start]);
-          double xFrequency = static_cast<double>(columnSums_[col]);
-
-          if (oFrequency != 0.0) {
-            probabilities_(start, col) = (*i * xFrequency) / (rowSum * oFrequency);
-          }
-        }
-      }
-    }
-  }
-
-  void VirtStat::calculateSignificance(std::vector<ObjectID>::iterator votersStart,
-    std::vector<ObjectID>::iterator votersEnd,
-    std::vector<Element>::iterator candidatesStart,
-    std::vector<Element>::iterator candidatesEnd)
-  {
-    for (auto i = votersStart; i != votersEnd; i++) {
-      double rowSum = static_cast<double>(rowSums_[*i]);
-      double oFrequency = static_cast<double>(columnSums_[*i]);
-
-      if (rowSum > (params_.minimum_history_to_consider * params_.window_size) &&
-        oFrequency != 0)
-      {
-        for (auto j = candidatesStart; j != candidatesEnd; j++) {
-          double xFrequency = static_cast<double>(columnSums_[j->id]);
-
-          probabilities_(*i, j->id) = (accessStats_(*i, j->id) * xFrequency) / (rowSum * oFrequency);
-        }
-      }
-    }
+    table_.updateCounts(obj, next);
   }
 
   std::vector<Element> VirtStat::findCacheCandidates(const ObjectID obj, uint64_t numCandidates)
   {
     // Allocate a vector of objects and probabilities with initial size equal to numCandidates
     std::vector<std::pair<ObjectID, double>> cacheCandidates;
-    matrix_row<SparseMatrix<double>> objProbabilities(probabilities_, obj);
+    cacheCandidates.reserve(table_.getFollowersPerRow());
 
     std::vector<Element> result;
-  
-    for (auto i = objProbabilities.begin(); i != objProbabilities.end(); i++) {
+
+    table_.forEachFollower(obj, [&](ObjectID follower, uint64_t) {
+      double probability = getProbability(obj, follower);
+
       // Skip elements with a probability of 0
-      if (*i == 0.0) {
-        continue;
+      if (probability != 0.0) {
+        cacheCandidates.emplace_back(follower, probability);
       }
-
-      cacheCandidates.emplace_back(i.index(), *i);
-    }
+    });
 
     // Sort id/probability pairs using STL sort on probabilites
     std::sort(cacheCandidates.begin(), cacheCandidates.end(),
@@ -167,40 +125,72 @@ namespace predictcache {
   }
 
   void VirtStat::setParameters(CacheParameters params) {
+    bool resize = params.model_bytes != params_.model_bytes ||
+      params.followers_per_element != params_.followers_per_element ||
+      params.decay_interval != params_.decay_interval;
     params_ = params;
+    if (!resize) {
+      return;
+    }
+
+    // Rebuild the table for the new budget, carrying over the statistics
+    // that still fit; rows go first since followers need their row
+    SuccessorTable table(params_.model_bytes, params_.followers_per_element,
+      params_.decay_interval);
+    table_.forEachRow([&](ObjectID obj, uint64_t rowSum, uint64_t frequency) {
+      table.restoreRow(obj, rowSum, frequency);
+    });
+    table_.forEachRow([&](ObjectID obj, uint64_t, uint64_t) {
+      table_.forEachFollower(obj, [&](ObjectID next, uint64_t count) {
+        table.restoreFollower(obj, next, count);
+      });
+    });
+    table_ = std::move(table);
   }
 
   void VirtStat::findMaxBelief(std::vector<Element>& candidates,
-    std::vector<ObjectID>::iterator votersStart,
-    std::vector<ObjectID>::iterator votersEnd, double threshold)
+    std::deque<ObjectID>::iterator votersStart,
+    std::deque<ObjectID>::iterator votersEnd, double threshold)
   {
-    for (auto i = candidates.begin(); i != candidates.end(); ) {
+    for (auto& i : candidates) {
       // Find the max belief for each candidate by traversing the list of voters
       for (auto j = votersStart; j != votersEnd; j++) {
-        double voterProb = probabilities_(*j, i->id);
-        if (voterProb > i->belief) {
-          i->belief = voterProb;
+        double voterProb = getProbability(*j, i.id);
+        if (voterProb > i.belief) {
+          i.belief = voterProb;
         }
       }
-
-      // If i's belief is less than the threshold, remove it
-      if (i->belief <= threshold) {
-        i = candidates.erase(i);
-      } else {
-        i++;
-      }
     }
+
+    // Remove all candidates whose belief is not above the threshold
+    candidates.erase(std::remove_if(candidates.begin(), candidates.end(),
+      [=](const Element& e) { return e.belief <= threshold; }),
+      candidates.end());
   }
 
-  const SparseMatrix<uint64_t>& VirtStat::getAccessStats() const {
-    return accessStats_;
+  const SuccessorTable& VirtStat::getSuccessorTable() const {
+    return table_;
   }
 
-  const SparseMatrix<double>& VirtStat::getProbabilities() const {
-    return probabilities_;
+  SuccessorTable& VirtStat::getSuccessorTable() {
+    return table_;
   }
 
   double VirtStat::getProbability(ObjectID obj, ObjectID follower) const {
-    return probabilities_(obj, follower);
+    // Elements without enough history are not trusted to vote
+    double rowSum = static_cast<double>(table_.getRowSum(obj));
+    if (rowSum <= (params_.minimum_history_to_consider * params_.window_size)) {
+      return 0.0;
+    }
+
+    double oFrequency = static_cast<double>(table_.getFrequency(obj));
+    if (oFrequency == 0.0) {
+      return 0.0;
+    }
+
+    double count = static_cast<double>(table_.getCount(obj, follower));
+    double xFrequency = static_cast<double>(table_.getFrequency(follower));
+
+    return (count * xFrequency) / (rowSum * oFrequency);
   }
 }
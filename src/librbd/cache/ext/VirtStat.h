@@ -4,26 +4,25 @@
 // STL includes
 #include <string>
 #include <cstdint>
+#include <deque>
 #include <vector>
 
-// Boost includes
-#include <boost/numeric/ublas/matrix_sparse.hpp>
-
 // Project includes
 
 #include "Element.h"
 #include "Globals.h"
+#include "SuccessorTable.h"
 
 namespace predictcache {
 
-	using ObjectID = uint64_t;
-
-	template <typename T>
-	using SparseMatrix = boost::numeric::ublas::mapped_matrix<T>;
-
+	// VirtStat keeps the co-occurrence statistics of the access stream in a
+	// SuccessorTable, so its memory is fixed by CacheParameters::model_bytes
+	// no matter how many unique elements the stream touches. Only the last
+	// max(window_size + 1, voter_size) accesses of history are retained.
 	class VirtStat{
 		public:
 			VirtStat();
+			VirtStat(CacheParameters params);
 
 			// Calling update history will add obj to VirtStat's stored history
 			// and perform all the belief calculations as needed
@@ -34,33 +33,26 @@ namespace predictcache {
 			std::vector<Element> updateHistory(ObjectID obj, std::vector<Element>& cacheElements);
 
 			void updateCounts(ObjectID obj, ObjectID next);
-			void calculateSignificance(ObjectID first);
 
-			// Calculates significance, but only for P[voter,candidate]
-			void calculateSignificance(std::vector<ObjectID>::iterator votersStart,
-				std::vector<ObjectID>::iterator votersEnd,
-				std::vector<Element>::iterator candidatesStart,
-				std::vector<Element>::iterator candidatesEnd);
-
-			void findMaxBelief(std::vector<Element>& candidates, std::vector<ObjectID>::iterator votersStart,
-				std::vector<ObjectID>::iterator votersEnd, double threshold);
+			void findMaxBelief(std::vector<Element>& candidates, std::deque<ObjectID>::iterator votersStart,
+				std::deque<ObjectID>::iterator votersEnd, double threshold);
 			std::vector<Element> findCacheCandidates(const ObjectID obj, uint64_t numCandidates);
 
 			void setParameters(CacheParameters params);
-			
-			const SparseMatrix<uint64_t>& getAccessStats() const;
-			const SparseMatrix<double>& getProbabilities() const;
+
+			const SuccessorTable& getSuccessorTable() const;
+			SuccessorTable& getSuccessorTable();
 
 			// Returns probability/belief that follower is contained in obj's window
 			double getProbability(ObjectID obj, ObjectID follower) const;
 		
 		private:
 			CacheParameters params_;
-			SparseMatrix<uint64_t> accessStats_;
-			SparseMatrix<double> probabilities_;
-			std::vector<ObjectID> history_;
-			std::vector<uint64_t> columnSums_;
-			std::vector<uint64_t> rowSums_;
+			SuccessorTable table_;
+			std::deque<ObjectID> history_;
+
+			// Number of history entries needed for the window and the voters
+			uint64_t historyLimit() const;
 
 			#ifdef BELIEFCACHE_CEPH
 			CephContext* cct_;
@@ -1,11 +0,0 @@
-#ifndef CSV_READ
-#define CSV_READ
-
-// STL includes
-#include <iostream>
-#include <vector>
-
-// Quick and dirty workload reading
-std::vector<uint64_t> readWorkload(const std::string& path);
-
-#endif
@@ -448,6 +448,11 @@ Context *OpenRequest<I>::handle_refresh(int *result) {
 
 template <typename I>
 Context *OpenRequest<I>::send_init_cache(int *result) {
+  // the image cache sizes itself from the (now known) image layout
+  if (m_image_ctx->image_cache != nullptr) {
+    m_image_ctx->image_cache->init_blocking();
+  }
+
   // cache is disabled or parent image context
   if (!m_image_ctx->cache || m_image_ctx->child != nullptr) {
     return send_register_watch(result);
@@ -33,6 +33,11 @@ CacheReadResult::C_ImageCacheReadRequest::C_ImageCacheReadRequest(
 		  << dendl;
 
   aio_completion->add_request();
+  if (!chunk_ids.empty()) {
+    auto image_cache = static_cast<librbd::cache::PrefetchImageCache<ImageCtx>*>(
+      aio_completion->ictx->image_cache);
+    epochs = image_cache->get_chunk_epochs(chunk_ids);
+  }
 
   ldout(cct, 10) << "Exiting CacheReadResult::C_ImageCacheReadRequest"
 		 << dendl;
@@ -62,8 +67,9 @@ void CacheReadResult::C_ImageCacheReadRequest::finish(int r) {
     // If we're given chunk_ids, then we must write something to the cache
     if (chunk_ids.size() > 0) {
       ldout(cct, 20) << "updating real cache with chunk_ids=" << chunk_ids << dendl;
-      auto imageCache = *(static_cast<librbd::cache::PrefetchImageCache<ImageCtx>*>((aio_completion->ictx->image_cache)));
-      imageCache.aio_cache_returned_data(&bl, chunk_ids, true);
+      auto image_cache = static_cast<librbd::cache::PrefetchImageCache<ImageCtx>*>(
+        aio_completion->ictx->image_cache);
+      image_cache->aio_cache_returned_data(&bl, chunk_ids, true, epochs);
     } else {
       ldout(cct, 20) << "no chunk ids given - not updating real cache " << dendl;
     }
@@ -95,6 +101,11 @@ CacheReadResult::C_ObjectCacheReadRequest::C_ObjectCacheReadRequest(
     object_len(object_len), buffer_extents(std::move(buffer_extents)),
     chunk_ids(chunk_ids) {
   aio_completion->add_request();
+  if (!this->chunk_ids.empty()) {
+    auto image_cache = static_cast<librbd::cache::PrefetchImageCache<ImageCtx>*>(
+      aio_completion->ictx->image_cache);
+    epochs = image_cache->get_chunk_epochs(this->chunk_ids);
+  }
 }
 
 void CacheReadResult::C_ObjectCacheReadRequest::finish(int r) {
@@ -127,9 +138,9 @@ void CacheReadResult::C_ObjectCacheReadRequest::finish(int r) {
     r = object_len;
   }
 
-  auto imageCache =
-    *(static_cast<librbd::cache::PrefetchImageCache<ImageCtx>*>((aio_completion->ictx->image_cache)));
-    imageCache.aio_cache_returned_data(&bl, chunk_ids, true);
+  auto image_cache = static_cast<librbd::cache::PrefetchImageCache<ImageCtx>*>(
+    aio_completion->ictx->image_cache);
+  image_cache->aio_cache_returned_data(&bl, chunk_ids, true, epochs);
 
   aio_completion->complete_request(r);
 }
@@ -37,6 +37,7 @@ public:
     Extents image_extents;
     bufferlist bl;
     std::vector<cache::ElementID> chunk_ids;
+    std::vector<uint64_t> epochs;  ///< chunk epochs when the read was issued
 
     C_ImageCacheReadRequest(AioCompletion *aio_completion, const Extents image_extents,
       std::vector<cache::ElementID> chunk_ids);
@@ -50,6 +51,7 @@ public:
     uint64_t object_len;
     Extents buffer_extents;
     std::vector<uint64_t> chunk_ids;
+    std::vector<uint64_t> epochs;  ///< chunk epochs when the read was issued
 
     bufferlist bl;
     ExtentMap extent_map;
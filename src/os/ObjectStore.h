@@ -25,6 +25,7 @@
 
 #include <errno.h>
 #include <sys/stat.h>
+#include <algorithm>
 #include <vector>
 #include <map>
 
@@ -35,6 +36,10 @@
 #endif
 
 #define OPS_PER_PTR 32
+// beyond this many objects a Transaction indexes them with a map
+#define INDEX_SCAN_MAX 32
+// setattr() values up to this size are copied into the transaction
+#define SMALL_ATTR_MAX 256
 
 class CephContext;
 
@@ -435,11 +440,16 @@ public:
   private:
     TransactionData data;
 
-    map<coll_t, __le32> coll_index;
-    map<ghobject_t, __le32> object_index;
-
-    __le32 coll_id {0};
-    __le32 object_id {0};
+    // the collections and objects named by the ops, by id.  they go on
+    // the wire as the coll_t/ghobject_t -> id maps of old, but the ids
+    // are dense, so plain vectors hold them without a node per entry.
+    vector<coll_t> colls;
+    vector<ghobject_t> objects;
+    // lookups for transactions naming more than INDEX_SCAN_MAX
+    // collections or objects, which would make the linear scans in
+    // _get_coll_id() and _get_object_id() too slow
+    map<coll_t, __le32> coll_lookup;
+    map<ghobject_t, __le32> object_lookup;
 
     bufferlist data_bl;
     bufferlist op_bl;
@@ -464,43 +474,47 @@ public:
     // override default move operations to reset default values
     Transaction(Transaction&& other) noexcept :
       data(std::move(other.data)),
-      coll_index(std::move(other.coll_index)),
-      object_index(std::move(other.object_index)),
-      coll_id(other.coll_id),
-      object_id(other.object_id),
+      colls(std::move(other.colls)),
+      objects(std::move(other.objects)),
+      coll_lookup(std::move(other.coll_lookup)),
+      object_lookup(std::move(other.object_lookup)),
       data_bl(std::move(other.data_bl)),
       op_bl(std::move(other.op_bl)),
       op_ptr(std::move(other.op_ptr)),
       on_applied(std::move(other.on_applied)),
       on_commit(std::move(other.on_commit)),
       on_applied_sync(std::move(other.on_applied_sync)) {
-      other.coll_id = 0;
-      other.object_id = 0;
+      other.colls.clear();
+      other.objects.clear();
+      other.coll_lookup.clear();
+      other.object_lookup.clear();
     }
 
     Transaction& operator=(Transaction&& other) noexcept {
       data = std::move(other.data);
-      coll_index = std::move(other.coll_index);
-      object_index = std::move(other.object_index);
-      coll_id = other.coll_id;
-      object_id = other.object_id;
+      colls = std::move(other.colls);
+      objects = std::move(other.objects);
+      coll_lookup = std::move(other.coll_lookup);
+      object_lookup = std::move(other.object_lookup);
       data_bl = std::move(other.data_bl);
       op_bl = std::move(other.op_bl);
       op_ptr = std::move(other.op_ptr);
       on_applied = std::move(other.on_applied);
       on_commit = std::move(other.on_commit);
       on_applied_sync = std::move(other.on_applied_sync);
-      other.coll_id = 0;
-      other.object_id = 0;
+      other.colls.clear();
+      other.objects.clear();
+      other.coll_lookup.clear();
+      other.object_lookup.clear();
       return *this;
     }
 
     Transaction(const Transaction& other) = default;
     Transaction& operator=(const Transaction& other) = default;
 
-    // expose object_index for FileStore::Op's benefit
-    const map<ghobject_t, __le32>& get_object_index() const {
-      return object_index;
+    // expose the objects for FileStore::Op's benefit
+    const vector<ghobject_t>& get_objects() const {
+      return objects;
     }
 
     /* Operations on callback contexts */
@@ -587,10 +601,10 @@ public:
       std::swap(on_commit, other.on_commit);
       std::swap(on_applied_sync, other.on_applied_sync);
 
-      std::swap(coll_index, other.coll_index);
-      std::swap(object_index, other.object_index);
-      std::swap(coll_id, other.coll_id);
-      std::swap(object_id, other.object_id);
+      colls.swap(other.colls);
+      objects.swap(other.objects);
+      coll_lookup.swap(other.coll_lookup);
+      object_lookup.swap(other.object_lookup);
       op_bl.swap(other.op_bl);
       data_bl.swap(other.data_bl);
     }
@@ -719,22 +733,16 @@ public:
       on_commit.splice(on_commit.end(), other.on_commit);
       on_applied_sync.splice(on_applied_sync.end(), other.on_applied_sync);
 
-      //append coll_index & object_index
-      vector<__le32> cm(other.coll_index.size());
-      map<coll_t, __le32>::iterator coll_index_p;
-      for (coll_index_p = other.coll_index.begin();
-           coll_index_p != other.coll_index.end();
-           ++coll_index_p) {
-        cm[coll_index_p->second] = _get_coll_id(coll_index_p->first);
+      //append colls & objects
+      vector<__le32> cm(other.colls.size());
+      for (unsigned i = 0; i < other.colls.size(); ++i) {
+        cm[i] = _get_coll_id(other.colls[i]);
       }
 
-      vector<__le32> om(other.object_index.size());
-      map<ghobject_t, __le32>::iterator object_index_p;
-      for (object_index_p = other.object_index.begin();
-           object_index_p != other.object_index.end();
-           ++object_index_p) {
-        om[object_index_p->second] = _get_object_id(object_index_p->first);
-      }      
+      vector<__le32> om(other.objects.size());
+      for (unsigned i = 0; i < other.objects.size(); ++i) {
+        om[i] = _get_object_id(other.objects[i]);
+      }
 
       //the other.op_bl SHOULD NOT be changes during append operation,
       //we use additional bufferlist to avoid this problem
@@ -744,8 +752,8 @@ public:
       other_op_bl.append(other_op_bl_ptr);
 
       //update other_op_bl with cm & om
-      //When the other is appended to current transaction, all coll_index and
-      //object_index in other.op_buffer should be updated by new index of the
+      //When the other is appended to current transaction, all coll and
+      //object ids in other.op_buffer should be updated by new index of the
       //combined transaction
       _update_op_bl(other_op_bl, cm, om);
 
@@ -766,16 +774,16 @@ public:
       size_t final_size = sizeof(__u32) * 2 + sizeof(data);
 
       // coll_index second and object_index second
-      final_size += (coll_index.size() + object_index.size()) * sizeof(__le32);
+      final_size += (colls.size() + objects.size()) * sizeof(__le32);
 
       // coll_index first
-      for (auto p = coll_index.begin(); p != coll_index.end(); ++p) {
-	final_size += p->first.encoded_size();
+      for (auto& c : colls) {
+	final_size += c.encoded_size();
       }
 
       // object_index first
-      for (auto p = object_index.begin(); p != object_index.end(); ++p) {
-	final_size += p->first.encoded_size();
+      for (auto& o : objects) {
+	final_size += o.encoded_size();
       }
 
       return data_bl.length() +
@@ -788,6 +796,14 @@ public:
       using ceph::encode;
       //layout: data_bl + op_bl + coll_index + object_index + data
       bufferlist bl;
+      map<coll_t, __le32> coll_index;
+      for (unsigned i = 0; i < colls.size(); ++i) {
+	coll_index[colls[i]] = i;
+      }
+      map<ghobject_t, __le32> object_index;
+      for (unsigned i = 0; i < objects.size(); ++i) {
+	object_index[objects[i]] = i;
+      }
       encode(coll_index, bl);
       encode(object_index, bl);
 
@@ -848,32 +864,22 @@ public:
       bufferlist::const_iterator data_bl_p;
 
     public:
-      vector<coll_t> colls;
-      vector<ghobject_t> objects;
+      // the Transaction's own, already in id order
+      const vector<coll_t>& colls;
+      const vector<ghobject_t>& objects;
 
     private:
       explicit iterator(Transaction *t)
         : t(t),
 	  data_bl_p(t->data_bl.cbegin()),
-          colls(t->coll_index.size()),
-          objects(t->object_index.size()) {
+          colls(t->colls),
+          objects(t->objects) {
 
         ops = t->data.ops;
+        // op_bl is a single buffer unless the ops outgrew the first
+        // OPS_PER_PTR arena (or came from append()), so this is usually
+        // a pointer into it rather than a copy
         op_buffer_p = t->op_bl.get_contiguous(0, t->data.ops * sizeof(Op));
-
-        map<coll_t, __le32>::iterator coll_index_p;
-        for (coll_index_p = t->coll_index.begin();
-             coll_index_p != t->coll_index.end();
-             ++coll_index_p) {
-          colls[coll_index_p->second] = coll_index_p->first;
-        }
-
-        map<ghobject_t, __le32>::iterator object_index_p;
-        for (object_index_p = t->object_index.begin();
-             object_index_p != t->object_index.end();
-             ++object_index_p) {
-          objects[object_index_p->second] = object_index_p->first;
-        }
       }
 
       friend class Transaction;
@@ -957,32 +963,102 @@ private:
       if (op_ptr.length() == 0 || op_ptr.offset() >= op_ptr.length()) {
         op_ptr = bufferptr(sizeof(Op) * OPS_PER_PTR);
       }
-      bufferptr ptr(op_ptr, 0, sizeof(Op));
-      op_bl.append(ptr);
+      // ops are carved out of op_ptr back to back; each one extends the
+      // last bufferptr of op_bl rather than adding a new one
+      char* p = op_ptr.c_str();
+      op_bl.append(op_ptr, 0, sizeof(Op));
 
       op_ptr.set_offset(op_ptr.offset() + sizeof(Op));
 
-      char* p = ptr.c_str();
       memset(p, 0, sizeof(Op));
       return reinterpret_cast<Op*>(p);
     }
     __le32 _get_coll_id(const coll_t& coll) {
-      map<coll_t, __le32>::iterator c = coll_index.find(coll);
-      if (c != coll_index.end())
-        return c->second;
-
-      __le32 index_id = coll_id++;
-      coll_index[coll] = index_id;
-      return index_id;
+      if (colls.size() <= INDEX_SCAN_MAX) {
+        // a transaction rarely touches more than a couple of collections
+        for (unsigned i = 0; i < colls.size(); ++i) {
+          if (colls[i] == coll)
+            return i;
+        }
+      } else {
+        if (coll_lookup.empty()) {
+          for (unsigned i = 0; i < colls.size(); ++i) {
+            coll_lookup[colls[i]] = i;
+          }
+        }
+        map<coll_t, __le32>::iterator c = coll_lookup.find(coll);
+        if (c != coll_lookup.end())
+          return c->second;
+        coll_lookup[coll] = colls.size();
+      }
+      colls.push_back(coll);
+      return colls.size() - 1;
     }
     __le32 _get_object_id(const ghobject_t& oid) {
-      map<ghobject_t, __le32>::iterator o = object_index.find(oid);
-      if (o != object_index.end())
-        return o->second;
-
-      __le32 index_id = object_id++;
-      object_index[oid] = index_id;
-      return index_id;
+      if (objects.size() <= INDEX_SCAN_MAX) {
+        // the latest object is the likeliest; compare the hash first
+        uint32_t hash = oid.hobj.get_hash();
+        for (unsigned i = objects.size(); i-- > 0; ) {
+          if (objects[i].hobj.get_hash() == hash && objects[i] == oid)
+            return i;
+        }
+      } else {
+        if (object_lookup.empty()) {
+          for (unsigned i = 0; i < objects.size(); ++i) {
+            object_lookup[objects[i]] = i;
+          }
+        }
+        map<ghobject_t, __le32>::iterator o = object_lookup.find(oid);
+        if (o != object_lookup.end())
+          return o->second;
+        object_lookup[oid] = objects.size();
+      }
+      objects.push_back(oid);
+      return objects.size() - 1;
+    }
+    /// encode colls/objects exactly like the key -> id maps we used to keep
+    template<typename T>
+    static void _encode_index(const vector<T>& v, bufferlist& bl) {
+      using ceph::encode;
+      vector<unsigned> order(v.size());
+      for (unsigned i = 0; i < order.size(); ++i) {
+        order[i] = i;
+      }
+      std::sort(order.begin(), order.end(),
+                [&v](unsigned a, unsigned b) { return v[a] < v[b]; });
+      encode((__u32)v.size(), bl);
+      for (auto i : order) {
+        encode(v[i], bl);
+        __le32 id = i;
+        encode(id, bl);
+      }
+    }
+    template<typename T>
+    static void _decode_index(vector<T>& v, bufferlist::const_iterator& p) {
+      using ceph::decode;
+      __u32 n;
+      decode(n, p);
+      // every entry carries at least its id; don't let a corrupt count
+      // allocate more than the encoding could possibly hold
+      if (n > p.get_remaining() / sizeof(__le32))
+        throw buffer::malformed_input("transaction index larger than encoding");
+      v.clear();
+      v.resize(n);
+      // n distinct ids below n cover them all, so no op can refer to a
+      // slot that was never filled in
+      vector<bool> seen(n);
+      for (unsigned i = 0; i < n; ++i) {
+        T k;
+        decode(k, p);
+        __le32 id;
+        decode(id, p);
+        if (id >= n)
+          throw buffer::malformed_input("transaction index out of range");
+        if (seen[id])
+          throw buffer::malformed_input("transaction index id repeated");
+        seen[id] = true;
+        v[id] = std::move(k);
+      }
     }
 
 public:
@@ -1087,7 +1163,18 @@ public:
       _op->cid = _get_coll_id(cid);
       _op->oid = _get_object_id(oid);
       encode(s, data_bl);
-      encode(val, data_bl);
+      if (val.length() <= SMALL_ATTR_MAX) {
+        // copy small values into data_bl's append buffer, next to the
+        // name, instead of hanging a bufferptr per value off data_bl;
+        // the encoding is the same
+        __u32 len = val.length();
+        encode(len, data_bl);
+        for (auto& p : val.buffers()) {
+          data_bl.append(p.c_str(), p.length());
+        }
+      } else {
+        encode(val, data_bl);
+      }
       data.ops++;
     }
     /// Set multiple xattrs of an object
@@ -1401,8 +1488,8 @@ public:
       ENCODE_START(9, 9, bl);
       encode(data_bl, bl);
       encode(op_bl, bl);
-      encode(coll_index, bl);
-      encode(object_index, bl);
+      _encode_index(colls, bl);
+      _encode_index(objects, bl);
       data.encode(bl);
       ENCODE_FINISH(bl);
     }
@@ -1413,11 +1500,11 @@ public:
 
       decode(data_bl, bl);
       decode(op_bl, bl);
-      decode(coll_index, bl);
-      decode(object_index, bl);
+      _decode_index(colls, bl);
+      _decode_index(objects, bl);
+      coll_lookup.clear();
+      object_lookup.clear();
       data.decode(bl);
-      coll_id = coll_index.size();
-      object_id = object_index.size();
 
       DECODE_FINISH(bl);
     }
@@ -1456,6 +1543,8 @@ public:
   }
 
   virtual void get_db_statistics(Formatter *f) { }
+  /// dump (up to) num of the slowest recent transactions, slowest first
+  virtual void dump_slow_transactions(Formatter *f, int num) { }
   virtual void generate_db_histogram(Formatter *f) { }
   virtual void flush_cache() { }
   virtual void dump_perf_counters(Formatter *f) {}
@@ -1655,6 +1744,40 @@ public:
      bufferlist& bl,
      uint32_t op_flags = 0) = 0;
 
+  /**
+   * read_async -- read a byte range of data from an object, without
+   * blocking on the device
+   *
+   * Like read(), but the backend may start the i/o and return before it
+   * is done.  In that case -EINPROGRESS is returned and on_complete is
+   * called later, possibly from another thread, with the result read()
+   * would have returned; until then bl must stay around and the object
+   * must not be modified.  Otherwise the result is returned right away
+   * and on_complete is deleted without being called.
+   *
+   * The default implementation simply calls read().
+   *
+   * @param cid collection for object
+   * @param oid oid of object
+   * @param offset location offset of first byte to be read
+   * @param len number of bytes to be read
+   * @param bl output bufferlist
+   * @param op_flags is CEPH_OSD_OP_FLAG_*
+   * @param on_complete called with the result if -EINPROGRESS is returned
+   * @returns -EINPROGRESS, number of bytes read, or negative error code
+   */
+   virtual int read_async(
+     CollectionHandle &c,
+     const ghobject_t& oid,
+     uint64_t offset,
+     size_t len,
+     bufferlist& bl,
+     uint32_t op_flags,
+     Context *on_complete) {
+     delete on_complete;
+     return read(c, oid, offset, len, bl, op_flags);
+   }
+
   /**
    * fiemap -- get extent map of data of an object
    *
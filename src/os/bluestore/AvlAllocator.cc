@@ -0,0 +1,327 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "AvlAllocator.h"
+#include "bluestore_types.h"
+#include "common/debug.h"
+
+#define dout_context cct
+#define dout_subsys ceph_subsys_bluestore
+#undef dout_prefix
+#define dout_prefix *_dout << "avlalloc 0x" << this << " "
+
+MEMPOOL_DEFINE_OBJECT_FACTORY(range_seg_t, range_seg_t, bluestore_alloc_avl);
+
+namespace {
+  // key for the lookups in both trees
+  struct range_t {
+    uint64_t start;
+    uint64_t end;
+  };
+
+  // best-fit candidates checked before falling back to one that must fit
+  const unsigned MAX_BEST_FIT_SCAN = 16;
+}
+
+AvlAllocator::AvlAllocator(CephContext* cct)
+  : cct(cct)
+{
+}
+
+AvlAllocator::~AvlAllocator()
+{
+  shutdown();
+}
+
+void AvlAllocator::_add_to_tree(uint64_t start, uint64_t size)
+{
+  assert(size != 0);
+
+  uint64_t end = start + size;
+
+  auto rs_after = range_tree.upper_bound(range_t{start, end},
+					 range_tree.key_comp());
+
+  /* Make sure we don't overlap with either of our neighbors */
+  auto rs_before = range_tree.end();
+  if (rs_after != range_tree.begin()) {
+    rs_before = std::prev(rs_after);
+  }
+  assert(rs_before == range_tree.end() || rs_before->end <= start);
+  assert(rs_after == range_tree.end() || end <= rs_after->start);
+
+  bool merge_before = (rs_before != range_tree.end() && rs_before->end == start);
+  bool merge_after = (rs_after != range_tree.end() && rs_after->start == end);
+
+  if (merge_before && merge_after) {
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_before));
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_after));
+    rs_after->start = rs_before->start;
+    range_tree.erase_and_dispose(rs_before, dispose_rs{});
+    range_size_tree.insert(*rs_after);
+  } else if (merge_before) {
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_before));
+    rs_before->end = end;
+    range_size_tree.insert(*rs_before);
+  } else if (merge_after) {
+    range_size_tree.erase(range_size_tree.iterator_to(*rs_after));
+    rs_after->start = start;
+    range_size_tree.insert(*rs_after);
+  } else {
+    auto new_rs = new range_seg_t{start, end};
+    range_tree.insert_before(rs_after, *new_rs);
+    range_size_tree.insert(*new_rs);
+  }
+  num_free += size;
+}
+
+void AvlAllocator::_remove_from_segment(range_tree_t::iterator rs,
+					uint64_t start, uint64_t end)
+{
+  assert(rs->start <= start && end <= rs->end);
+
+  bool left_over = (rs->start != start);
+  bool right_over = (rs->end != end);
+
+  range_size_tree.erase(range_size_tree.iterator_to(*rs));
+
+  if (left_over && right_over) {
+    auto new_seg = new range_seg_t{end, rs->end};
+    rs->end = start;
+    range_tree.insert_before(std::next(rs), *new_seg);
+    range_size_tree.insert(*new_seg);
+    range_size_tree.insert(*rs);
+  } else if (left_over) {
+    rs->end = start;
+    range_size_tree.insert(*rs);
+  } else if (right_over) {
+    rs->start = end;
+    range_size_tree.insert(*rs);
+  } else {
+    range_tree.erase_and_dispose(rs, dispose_rs{});
+  }
+  num_free -= end - start;
+}
+
+void AvlAllocator::_remove_from_tree(uint64_t start, uint64_t size)
+{
+  uint64_t end = start + size;
+
+  assert(size != 0);
+
+  // the range may span several free extents (or include allocated space)
+  auto rs = range_tree.lower_bound(range_t{start, end}, range_tree.key_comp());
+  while (rs != range_tree.end() && rs->start < end) {
+    auto next = std::next(rs);
+    _remove_from_segment(rs, std::max(start, rs->start),
+			 std::min(end, rs->end));
+    rs = next;
+  }
+}
+
+bool AvlAllocator::_pick(uint64_t size, uint64_t unit, uint64_t hint,
+			 uint64_t *offset)
+{
+  // near fit: the extent holding the hint, or the next one
+  auto rs = range_tree.lower_bound(range_t{hint, hint + 1},
+				   range_tree.key_comp());
+  if (rs != range_tree.end()) {
+    uint64_t off = p2roundup(std::max(rs->start, hint), unit);
+    if (off + size <= rs->end) {
+      *offset = off;
+      return true;
+    }
+  }
+
+  // best fit: the smallest extent that is large enough.  An extent that is
+  // long enough may still not fit once its start is aligned up to the
+  // unit; rather than walking an unbounded run of such (small, misaligned)
+  // extents, give up after a few and take the smallest extent that fits
+  // whatever its alignment.
+  unsigned scanned = 0;
+  for (auto p = range_size_tree.lower_bound(range_t{0, size},
+					    range_size_tree.key_comp());
+       p != range_size_tree.end() && scanned < MAX_BEST_FIT_SCAN;
+       ++p, ++scanned) {
+    uint64_t off = p2roundup(p->start, unit);
+    if (off + size <= p->end) {
+      *offset = off;
+      return true;
+    }
+  }
+  if (scanned < MAX_BEST_FIT_SCAN) {
+    return false;
+  }
+  auto p = range_size_tree.lower_bound(range_t{0, size + unit - 1},
+				       range_size_tree.key_comp());
+  if (p == range_size_tree.end()) {
+    return false;
+  }
+  *offset = p2roundup(p->start, unit);
+  assert(*offset + size <= p->end);
+  return true;
+}
+
+int64_t AvlAllocator::_allocate(uint64_t want, uint64_t unit, uint64_t hint,
+				uint64_t *offset, uint64_t *length)
+{
+  if (_pick(want, unit, hint, offset)) {
+    *length = want;
+  } else {
+    // nothing is large enough; take what the largest extent can give
+    if (range_size_tree.empty()) {
+      return -ENOSPC;
+    }
+    auto& rs = *range_size_tree.rbegin();
+    uint64_t off = p2roundup(rs.start, unit);
+    if (off >= rs.end || rs.end - off < unit) {
+      return -ENOSPC;
+    }
+    *offset = off;
+    *length = p2align(rs.end - off, unit);
+  }
+  ldout(cct, 30) << __func__ << " got 0x" << std::hex << *offset << "~"
+		 << *length << std::dec << dendl;
+
+  _remove_from_tree(*offset, *length);
+  last_alloc = *offset + *length;
+  return 0;
+}
+
+int64_t AvlAllocator::allocate(
+  uint64_t want_size,
+  uint64_t alloc_unit,
+  uint64_t max_alloc_size,
+  int64_t hint,
+  PExtentVector *extents)
+{
+  ldout(cct, 10) << __func__ << " want_size 0x" << std::hex << want_size
+		 << " alloc_unit 0x" << alloc_unit
+		 << " max_alloc_size 0x" << max_alloc_size
+		 << " hint 0x" << hint << std::dec
+		 << dendl;
+  assert(alloc_unit);
+
+  if (max_alloc_size == 0) {
+    max_alloc_size = want_size;
+  }
+  max_alloc_size = std::max(alloc_unit, p2align(max_alloc_size, alloc_unit));
+
+  std::lock_guard<std::mutex> l(lock);
+  if (!hint) {
+    hint = last_alloc;
+  }
+
+  uint64_t allocated_size = 0;
+  while (allocated_size < want_size) {
+    uint64_t offset = 0, length = 0;
+    uint64_t want = p2roundup(
+      std::min(max_alloc_size, want_size - allocated_size), alloc_unit);
+    int r = _allocate(want, alloc_unit, hint, &offset, &length);
+    if (r < 0) {
+      break;
+    }
+    bool can_append = true;
+    if (!extents->empty()) {
+      bluestore_pextent_t &last_extent = extents->back();
+      if (last_extent.end() == offset &&
+	  last_extent.length + length <= max_alloc_size) {
+	can_append = false;
+	last_extent.length += length;
+      }
+    }
+    if (can_append) {
+      extents->emplace_back(bluestore_pextent_t(offset, length));
+    }
+    allocated_size += length;
+    hint = offset + length;
+  }
+
+  if (allocated_size == 0) {
+    return -ENOSPC;
+  }
+  return allocated_size;
+}
+
+void AvlAllocator::release(const interval_set<uint64_t>& release_set)
+{
+  std::lock_guard<std::mutex> l(lock);
+  for (auto p = release_set.begin(); p != release_set.end(); ++p) {
+    const auto offset = p.get_start();
+    const auto length = p.get_len();
+    ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		   << std::dec << dendl;
+    _add_to_tree(offset, length);
+  }
+}
+
+uint64_t AvlAllocator::get_free()
+{
+  std::lock_guard<std::mutex> l(lock);
+  return num_free;
+}
+
+double AvlAllocator::get_fragmentation(uint64_t alloc_unit)
+{
+  assert(alloc_unit);
+  uint64_t max_intervals = 0;
+  uint64_t intervals = 0;
+  {
+    std::lock_guard<std::mutex> l(lock);
+    max_intervals = num_free / alloc_unit;
+    intervals = range_tree.size();
+  }
+  ldout(cct, 30) << __func__ << " " << intervals << "/" << max_intervals
+		 << dendl;
+  if (!intervals || max_intervals <= 1) {
+    return 0.0;
+  }
+  intervals = std::min(intervals, max_intervals) - 1;
+  max_intervals--;
+  return (double)intervals / max_intervals;
+}
+
+void AvlAllocator::dump()
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 0) << __func__ << " " << range_tree.size() << " extents, "
+		<< "0x" << std::hex << num_free << std::dec << " bytes free"
+		<< dendl;
+  for (auto& rs : range_tree) {
+    ldout(cct, 0) << __func__ << "  0x" << std::hex << rs.start << "~"
+		  << rs.length() << std::dec << dendl;
+  }
+}
+
+void AvlAllocator::dump(
+  std::function<void(uint64_t offset, uint64_t length)> notify)
+{
+  std::lock_guard<std::mutex> l(lock);
+  for (auto& rs : range_tree) {
+    notify(rs.start, rs.length());
+  }
+}
+
+void AvlAllocator::init_add_free(uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		 << std::dec << dendl;
+  _add_to_tree(offset, length);
+}
+
+void AvlAllocator::init_rm_free(uint64_t offset, uint64_t length)
+{
+  std::lock_guard<std::mutex> l(lock);
+  ldout(cct, 10) << __func__ << " 0x" << std::hex << offset << "~" << length
+		 << std::dec << dendl;
+  _remove_from_tree(offset, length);
+}
+
+void AvlAllocator::shutdown()
+{
+  std::lock_guard<std::mutex> l(lock);
+  range_size_tree.clear();
+  range_tree.clear_and_dispose(dispose_rs{});
+  num_free = 0;
+}
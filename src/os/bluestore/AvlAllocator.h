@@ -0,0 +1,132 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_OS_BLUESTORE_AVLALLOCATOR_H
+#define CEPH_OS_BLUESTORE_AVLALLOCATOR_H
+
+#include <mutex>
+#include <boost/intrusive/avl_set.hpp>
+
+#include "Allocator.h"
+#include "os/bluestore/bluestore_types.h"
+#include "include/mempool.h"
+
+struct range_seg_t {
+  MEMPOOL_CLASS_HELPERS();  ///< memory monitoring
+  uint64_t start;  ///< starting offset of this segment
+  uint64_t end;	   ///< ending offset (non-inclusive)
+
+  range_seg_t(uint64_t start, uint64_t end)
+    : start{start},
+      end{end}
+  {}
+  inline uint64_t length() const {
+    return end - start;
+  }
+
+  // Tree is sorted by offset, greater offsets at the end of the tree.
+  struct before_t {
+    template<typename KeyLeft, typename KeyRight>
+    bool operator()(const KeyLeft& lhs, const KeyRight& rhs) const {
+      return lhs.end <= rhs.start;
+    }
+  };
+  boost::intrusive::avl_set_member_hook<> offset_hook;
+
+  // Tree is sorted by size, larger sizes at the end of the tree; equal
+  // sizes are sorted by offset.
+  struct shorter_t {
+    template<typename KeyType>
+    bool operator()(const range_seg_t& lhs, const KeyType& rhs) const {
+      auto lhs_size = lhs.end - lhs.start;
+      auto rhs_size = rhs.end - rhs.start;
+      if (lhs_size < rhs_size) {
+	return true;
+      } else if (lhs_size > rhs_size) {
+	return false;
+      } else {
+	return lhs.start < rhs.start;
+      }
+    }
+  };
+  boost::intrusive::avl_set_member_hook<> size_hook;
+};
+
+/**
+ * Allocator keeping the free extents in two AVL trees, one ordered by
+ * offset and one by size.
+ *
+ * An allocation first tries the extent at (or right after) the hint, which
+ * keeps sequential writers sequential, and otherwise takes the smallest
+ * extent that fits (best fit), the lowest one among equal sizes.
+ * Both lookups are O(log n) no matter how fragmented the free space is;
+ * released extents are merged with their neighbours right away.
+ */
+class AvlAllocator final : public Allocator {
+public:
+  AvlAllocator(CephContext* cct);
+  ~AvlAllocator() override;
+
+  int64_t allocate(
+    uint64_t want_size, uint64_t alloc_unit, uint64_t max_alloc_size,
+    int64_t hint, PExtentVector *extents) override;
+
+  void release(const interval_set<uint64_t>& release_set) override;
+
+  uint64_t get_free() override;
+  double get_fragmentation(uint64_t alloc_unit) override;
+
+  void dump() override;
+  void dump(std::function<void(uint64_t offset, uint64_t length)> notify)
+    override;
+
+  void init_add_free(uint64_t offset, uint64_t length) override;
+  void init_rm_free(uint64_t offset, uint64_t length) override;
+
+  void shutdown() override;
+
+private:
+  struct dispose_rs {
+    void operator()(range_seg_t* p)
+    {
+      delete p;
+    }
+  };
+
+  using range_tree_t =
+    boost::intrusive::avl_set<
+      range_seg_t,
+      boost::intrusive::compare<range_seg_t::before_t>,
+      boost::intrusive::member_hook<
+	range_seg_t,
+	boost::intrusive::avl_set_member_hook<>,
+	&range_seg_t::offset_hook>>;
+  range_tree_t range_tree;    ///< main range tree
+
+  using range_size_tree_t =
+    boost::intrusive::avl_multiset<
+      range_seg_t,
+      boost::intrusive::compare<range_seg_t::shorter_t>,
+      boost::intrusive::member_hook<
+	range_seg_t,
+	boost::intrusive::avl_set_member_hook<>,
+	&range_seg_t::size_hook>,
+      boost::intrusive::constant_time_size<true>>;
+  range_size_tree_t range_size_tree;
+
+  uint64_t num_free = 0;     ///< total bytes in freelist
+  uint64_t last_alloc = 0;   ///< end of the last allocation, default hint
+
+  CephContext* cct;
+  std::mutex lock;
+
+  bool _pick(uint64_t size, uint64_t unit, uint64_t hint, uint64_t *offset);
+  int64_t _allocate(uint64_t want, uint64_t unit, uint64_t hint,
+		    uint64_t *offset, uint64_t *length);
+  void _add_to_tree(uint64_t start, uint64_t size);
+  void _remove_from_tree(uint64_t start, uint64_t size);
+  void _remove_from_segment(range_tree_t::iterator rs,
+			    uint64_t start, uint64_t end);
+};
+
+#endif
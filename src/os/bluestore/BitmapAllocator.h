@@ -38,6 +38,11 @@ public:
   void dump() override
   {
   }
+  void dump(std::function<void(uint64_t offset, uint64_t length)> notify)
+    override
+  {
+    foreach_free(notify);
+  }
   double get_fragmentation(uint64_t) override
   {
     return _get_fragmentation();
@@ -118,6 +118,14 @@ void BlueFS::_init_logger()
   b.add_u64_counter(l_bluefs_bytes_written_slow, "bytes_written_slow",
 		    "Bytes written to WAL/SSTs at slow device", NULL,
 		    PerfCountersBuilder::PRIO_USEFUL, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluefs_readahead_bytes, "readahead_bytes",
+		    "Bytes read ahead asynchronously", NULL,
+		    PerfCountersBuilder::PRIO_USEFUL, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluefs_readahead_hit_bytes, "readahead_hit_bytes",
+		    "Bytes read ahead that were later used by a reader", NULL,
+		    PerfCountersBuilder::PRIO_USEFUL, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluefs_read_batch_ios, "read_batch_ios",
+		    "Device reads issued by batched random reads");
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 }
@@ -1035,6 +1043,76 @@ int BlueFS::_read_random(
   }
 
   int ret = 0;
+  if (len > 0 && h->prefetched.load()) {
+    // never wait for the readahead with prefetch_lock held: other readers
+    // of h may be hitting the part that has already landed
+    std::unique_ptr<IOContext> ra_ioc;
+    bufferlist ra_bl;
+    uint64_t ra_off = 0;
+    std::unique_lock<std::mutex> l(h->prefetch_lock);
+    FileReaderBuffer *buf = &h->buf;
+    if ((off < buf->bl_off || off + len > buf->get_buf_end()) &&
+	buf->ra_ioc &&
+	off >= buf->ra_off && off + len <= buf->ra_off + buf->ra_bl.length()) {
+      ra_ioc.swap(buf->ra_ioc);
+      ra_bl.swap(buf->ra_bl);
+      ra_off = buf->ra_off;
+      l.unlock();
+      ra_ioc->aio_wait();
+      int r = ra_ioc->get_return_value();
+      ra_ioc.reset();
+      l.lock();
+      if (r < 0) {
+	dout(10) << __func__ << " readahead 0x" << std::hex << ra_off
+		 << "~" << ra_bl.length() << std::dec
+		 << " failed: " << cpp_strerror(r) << dendl;
+      } else {
+	dout(20) << __func__ << " readahead hit 0x" << std::hex << ra_off
+		 << "~" << ra_bl.length() << std::dec << dendl;
+	logger->inc(l_bluefs_readahead_hit_bytes, ra_bl.length());
+	buf->bl.swap(ra_bl);
+	buf->bl_off = ra_off;
+      }
+      ra_bl.clear();
+    }
+    if (off >= buf->bl_off && off + len <= buf->get_buf_end()) {
+      dout(20) << __func__ << " read prefetched 0x"
+	       << std::hex << buf->bl_off << "~" << buf->bl.length()
+	       << std::dec << dendl;
+      buf->bl.copy(off - buf->bl_off, len, out);
+      if (off + len == buf->get_buf_end()) {
+	// consumed to the end; don't pin the memory
+	buf->bl.clear();
+      }
+      ret = len;
+      len = 0;
+    } else {
+      // the reader has moved on from the prefetched range
+      buf->bl.clear();
+      ra_ioc.swap(buf->ra_ioc);
+      ra_bl.swap(buf->ra_bl);
+    }
+    if (buf->bl.length() == 0 && !buf->ra_ioc) {
+      h->prefetched = false;
+    }
+    l.unlock();
+    if (ra_ioc) {
+      // the aio still references ra_bl's memory
+      ra_ioc->aio_wait();
+    }
+  }
+  if (len > 0 && !cct->_conf->bluefs_buffered_io) {
+    uint64_t x_off = 0;
+    auto p = h->file->fnode.seek(off, &x_off);
+    if (len > p->length - x_off) {
+      // spans several extents: read all of them at once
+      vector<read_req_t> reqs;
+      reqs.emplace_back(off, len, out);
+      _read_random_batch(h, reqs);
+      ret = reqs.front().r;
+      len = 0;
+    }
+  }
   while (len > 0) {
     uint64_t x_off = 0;
     auto p = h->file->fnode.seek(off, &x_off);
@@ -1056,6 +1134,230 @@ int BlueFS::_read_random(
   return ret;
 }
 
+int BlueFS::_read_random_batch(
+  FileReader *h,             ///< [in] read from here
+  vector<read_req_t>& reqs)  ///< [in,out] ranges to read
+{
+  dout(10) << __func__ << " h " << h << " " << reqs.size() << " ranges"
+	   << " from " << h->file->fnode << dendl;
+
+  ++h->file->num_reading;
+
+  // one aio per extent piece, widened to the device block size, all of
+  // them submitted together; the data is copied out once it has landed
+  struct piece_t {
+    bufferlist bl;
+    uint64_t skip;  ///< bytes in bl before the wanted data
+    uint64_t len;
+    char *out;
+  };
+  vector<piece_t> pieces;
+  std::array<std::unique_ptr<IOContext>, MAX_BDEV> iocs;
+  // aio is always direct; with buffered io the page cache may hold data
+  // that is newer than the device, so read through it one piece at a time
+  bool buffered = cct->_conf->bluefs_buffered_io;
+  for (auto& req : reqs) {
+    uint64_t off = req.off;
+    uint64_t len = req.len;
+    if (!h->ignore_eof &&
+	off + len > h->file->fnode.size) {
+      if (off > h->file->fnode.size)
+	len = 0;
+      else
+	len = h->file->fnode.size - off;
+    }
+    req.r = len;
+    char *out = req.out;
+    while (len > 0) {
+      uint64_t x_off = 0;
+      auto p = h->file->fnode.seek(off, &x_off);
+      uint64_t l = std::min(p->length - x_off, len);
+      uint64_t block_size = bdev[p->bdev]->get_block_size();
+      uint64_t dev_off = p->offset + x_off;
+      uint64_t a_off = p2align(dev_off, block_size);
+      uint64_t a_len = p2roundup(dev_off + l, block_size) - a_off;
+      if (buffered) {
+	dout(20) << __func__ << " read buffered 0x"
+		 << std::hex << x_off << "~" << l << std::dec
+		 << " of " << *p << dendl;
+	int r = bdev[p->bdev]->read_random(dev_off, l, out, true);
+	assert(r == 0);
+	off += l;
+	len -= l;
+	out += l;
+	continue;
+      }
+      dout(20) << __func__ << " read 0x"
+	       << std::hex << x_off << "~" << l
+	       << " as 0x" << a_off << "~" << a_len << std::dec
+	       << " of " << *p << dendl;
+      if (!iocs[p->bdev]) {
+	iocs[p->bdev].reset(new IOContext(cct, NULL));
+      }
+      pieces.emplace_back();
+      piece_t& pc = pieces.back();
+      pc.skip = dev_off - a_off;
+      pc.len = l;
+      pc.out = out;
+      int r = bdev[p->bdev]->aio_read(a_off, a_len, &pc.bl,
+				      iocs[p->bdev].get());
+      assert(r == 0);
+      off += l;
+      len -= l;
+      out += l;
+    }
+  }
+
+  for (unsigned i = 0; i < MAX_BDEV; ++i) {
+    if (iocs[i] && iocs[i]->has_pending_aios()) {
+      bdev[i]->aio_submit(iocs[i].get());
+    }
+  }
+  for (unsigned i = 0; i < MAX_BDEV; ++i) {
+    if (iocs[i]) {
+      iocs[i]->aio_wait();
+      assert(iocs[i]->get_return_value() >= 0);
+    }
+  }
+  for (auto& pc : pieces) {
+    pc.bl.copy(pc.skip, pc.len, pc.out);
+  }
+  logger->inc(l_bluefs_read_batch_ios, pieces.size());
+
+  dout(20) << __func__ << " done, " << pieces.size() << " ios" << dendl;
+  --h->file->num_reading;
+  return 0;
+}
+
+void BlueFS::_start_readahead(
+  FileReader *h,          ///< [in] file to read
+  FileReaderBuffer *buf,  ///< [in] reader state
+  uint64_t off,           ///< [in] offset, block aligned
+  uint64_t len)           ///< [in] at most this many bytes
+{
+  assert(!buf->ra_ioc);
+  if (cct->_conf->bluefs_buffered_io) {
+    // readahead is direct io, which could miss data that is still dirty
+    // in the page cache; the kernel reads ahead for buffered readers
+    return;
+  }
+  uint64_t eof_offset = round_up_to(h->file->fnode.size, super.block_size);
+  if (off >= eof_offset) {
+    return;
+  }
+  uint64_t x_off = 0;
+  auto p = h->file->fnode.seek(off, &x_off);
+  if (p == h->file->fnode.extents.end()) {
+    return;
+  }
+  // stop at the end of the extent; the next miss starts a new readahead
+  uint64_t l = std::min(p->length - x_off, len);
+  if (off + l > eof_offset) {
+    l = eof_offset - off;
+  }
+  uint64_t block_size = bdev[p->bdev]->get_block_size();
+  if (l == 0 ||
+      (p->offset + x_off) % block_size ||
+      l % block_size) {
+    return;
+  }
+  dout(20) << __func__ << " 0x" << std::hex << off << "~" << l
+	   << " (0x" << x_off << " of " << *p << ")" << std::dec << dendl;
+  buf->ra_ioc.reset(new IOContext(cct, NULL));
+  buf->ra_bl.clear();
+  int r = bdev[p->bdev]->aio_read(p->offset + x_off, l, &buf->ra_bl,
+				  buf->ra_ioc.get());
+  if (r < 0) {
+    dout(10) << __func__ << " failed: " << cpp_strerror(r) << dendl;
+    buf->ra_ioc.reset();
+    buf->ra_bl.clear();
+    return;
+  }
+  buf->ra_off = off;
+  if (buf->ra_ioc->has_pending_aios()) {
+    bdev[p->bdev]->aio_submit(buf->ra_ioc.get());
+  }
+  logger->inc(l_bluefs_readahead_bytes, l);
+}
+
+bool BlueFS::_take_readahead(
+  FileReaderBuffer *buf,  ///< [in] reader state
+  uint64_t off,           ///< [in] offset the reader wants
+  bool discard)           ///< [in] drop the readahead if it misses off
+{
+  if (!buf->ra_ioc) {
+    return false;
+  }
+  bool hit = off >= buf->ra_off && off < buf->ra_off + buf->ra_bl.length();
+  if (!hit && !discard) {
+    return false;
+  }
+  // even a readahead we drop has to land first, it owns the buffer
+  buf->ra_ioc->aio_wait();
+  int r = buf->ra_ioc->get_return_value();
+  buf->ra_ioc.reset();
+  if (r < 0) {
+    dout(10) << __func__ << " readahead 0x" << std::hex << buf->ra_off
+	     << "~" << buf->ra_bl.length() << std::dec
+	     << " failed: " << cpp_strerror(r) << dendl;
+    hit = false;
+  }
+  if (hit) {
+    dout(20) << __func__ << " hit 0x" << std::hex << buf->ra_off << "~"
+	     << buf->ra_bl.length() << std::dec << dendl;
+    buf->bl.swap(buf->ra_bl);
+    buf->bl_off = buf->ra_off;
+    logger->inc(l_bluefs_readahead_hit_bytes, buf->bl.length());
+  }
+  buf->ra_bl.clear();
+  return hit;
+}
+
+void BlueFS::_prefetch(
+  FileReader *h,  ///< [in] random reader
+  uint64_t off,   ///< [in] offset
+  uint64_t len)   ///< [in] this many bytes
+{
+  dout(10) << __func__ << " h " << h
+	   << " 0x" << std::hex << off << "~" << len << std::dec
+	   << " from " << h->file->fnode << dendl;
+  if (!cct->_conf->get_val<bool>("bluefs_async_readahead") ||
+      h->file->num_writers.load() > 0) {
+    return;
+  }
+  len = std::min<uint64_t>(len, cct->_conf->bluefs_max_prefetch);
+  uint64_t start = off & super.block_mask();
+  uint64_t end = round_up_to(off + len, super.block_size);
+  if (end <= start) {
+    return;
+  }
+
+  std::unique_ptr<IOContext> old_ioc;
+  bufferlist old_bl;
+  {
+    std::lock_guard<std::mutex> l(h->prefetch_lock);
+    FileReaderBuffer *buf = &h->buf;
+    if (buf->ra_ioc &&
+	start >= buf->ra_off && end <= buf->ra_off + buf->ra_bl.length()) {
+      return;
+    }
+    if (start >= buf->bl_off && end <= buf->get_buf_end()) {
+      return;
+    }
+    // replace whatever was prefetched before; the old readahead is waited
+    // for below, without the lock
+    buf->bl.clear();
+    old_ioc.swap(buf->ra_ioc);
+    old_bl.swap(buf->ra_bl);
+    _start_readahead(h, buf, start, end - start);
+    h->prefetched = buf->ra_ioc != nullptr;
+  }
+  if (old_ioc) {
+    // the aio still references old_bl's memory
+    old_ioc->aio_wait();
+  }
+}
+
 int BlueFS::_read(
   FileReader *h,         ///< [in] read from here
   FileReaderBuffer *buf, ///< [in] reader state
@@ -1086,25 +1388,36 @@ int BlueFS::_read(
   while (len > 0) {
     size_t left;
     if (off < buf->bl_off || off >= buf->get_buf_end()) {
-      buf->bl.clear();
-      buf->bl_off = off & super.block_mask();
-      uint64_t x_off = 0;
-      auto p = h->file->fnode.seek(buf->bl_off, &x_off);
-      uint64_t want = round_up_to(len + (off & ~super.block_mask()),
-				  super.block_size);
-      want = std::max(want, buf->max_prefetch);
-      uint64_t l = std::min(p->length - x_off, want);
-      uint64_t eof_offset = round_up_to(h->file->fnode.size, super.block_size);
-      if (!h->ignore_eof &&
-	  buf->bl_off + l > eof_offset) {
-	l = eof_offset - buf->bl_off;
+      if (!_take_readahead(buf, off, true)) {
+	buf->bl.clear();
+	buf->bl_off = off & super.block_mask();
+	uint64_t x_off = 0;
+	auto p = h->file->fnode.seek(buf->bl_off, &x_off);
+	uint64_t want = round_up_to(len + (off & ~super.block_mask()),
+				    super.block_size);
+	want = std::max(want, buf->max_prefetch);
+	uint64_t l = std::min(p->length - x_off, want);
+	uint64_t eof_offset = round_up_to(h->file->fnode.size,
+					  super.block_size);
+	if (!h->ignore_eof &&
+	    buf->bl_off + l > eof_offset) {
+	  l = eof_offset - buf->bl_off;
+	}
+	dout(20) << __func__ << " fetching 0x"
+		 << std::hex << x_off << "~" << l << std::dec
+		 << " of " << *p << dendl;
+	int r = bdev[p->bdev]->read(p->offset + x_off, l, &buf->bl,
+				    ioc[p->bdev],
+				    cct->_conf->bluefs_buffered_io);
+	assert(r == 0);
+      }
+      // sequential readers get the next window in flight while they
+      // consume this one
+      if (!h->random && !h->ignore_eof &&
+	  h->file->num_writers.load() == 0 &&
+	  cct->_conf->get_val<bool>("bluefs_async_readahead")) {
+	_start_readahead(h, buf, buf->get_buf_end(), buf->max_prefetch);
       }
-      dout(20) << __func__ << " fetching 0x"
-               << std::hex << x_off << "~" << l << std::dec
-               << " of " << *p << dendl;
-      int r = bdev[p->bdev]->read(p->offset + x_off, l, &buf->bl, ioc[p->bdev],
-				  cct->_conf->bluefs_buffered_io);
-      assert(r == 0);
     }
     left = buf->get_buf_remaining(off);
     dout(20) << __func__ << " left 0x" << std::hex << left
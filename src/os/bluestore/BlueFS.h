@@ -4,6 +4,7 @@
 #define CEPH_OS_BLUESTORE_BLUEFS_H
 
 #include <atomic>
+#include <memory>
 #include <mutex>
 
 #include "bluefs_types.h"
@@ -36,6 +37,9 @@ enum {
   l_bluefs_bytes_written_wal,
   l_bluefs_bytes_written_sst,
   l_bluefs_bytes_written_slow,
+  l_bluefs_readahead_bytes,
+  l_bluefs_readahead_hit_bytes,
+  l_bluefs_read_batch_ios,
   l_bluefs_last,
 };
 
@@ -169,10 +173,21 @@ public:
     uint64_t pos;           ///< current logical offset
     uint64_t max_prefetch;  ///< max allowed prefetch
 
+    // asynchronous readahead of the window following bl (sequential
+    // readers) or of a range hinted via prefetch() (random readers)
+    uint64_t ra_off = 0;    ///< readahead buffer logical offset
+    bufferlist ra_bl;       ///< readahead buffer, valid once ra_ioc is done
+    std::unique_ptr<IOContext> ra_ioc;  ///< in-flight readahead, if any
+
     explicit FileReaderBuffer(uint64_t mpf)
       : bl_off(0),
 	pos(0),
 	max_prefetch(mpf) {}
+    ~FileReaderBuffer() {
+      // the aio still references ra_bl's memory
+      if (ra_ioc)
+	ra_ioc->aio_wait();
+    }
 
     uint64_t get_buf_end() {
       return bl_off + bl.length();
@@ -199,6 +214,10 @@ public:
     bool random;
     bool ignore_eof;        ///< used when reading our log file
 
+    /// protects buf for random readers, which may be shared by threads
+    std::mutex prefetch_lock;
+    std::atomic<bool> prefetched = {false};  ///< buf holds prefetched data
+
     FileReader(FileRef f, uint64_t mpf, bool rand, bool ie)
       : file(f),
 	buf(mpf),
@@ -211,6 +230,17 @@ public:
     }
   };
 
+  /// one range of a read_random_batch()
+  struct read_req_t {
+    uint64_t off;   ///< [in] offset
+    size_t len;     ///< [in] this many bytes
+    char *out;      ///< [out] copy the result here
+    int r = 0;      ///< [out] bytes read (clipped at eof), or error
+
+    read_req_t(uint64_t o, size_t l, char *p)
+      : off(o), len(l), out(p) {}
+  };
+
   struct FileLock {
     MEMPOOL_CLASS_HELPERS();
 
@@ -312,6 +342,14 @@ private:
     uint64_t offset, ///< [in] offset
     size_t len,      ///< [in] this many bytes
     char *out);      ///< [out] optional: or copy it here
+  int _read_random_batch(
+    FileReader *h,   ///< [in] read from here
+    vector<read_req_t>& reqs); ///< [in,out] ranges to read
+
+  void _start_readahead(FileReader *h, FileReaderBuffer *buf,
+			uint64_t off, uint64_t len);
+  bool _take_readahead(FileReaderBuffer *buf, uint64_t off, bool discard);
+  void _prefetch(FileReader *h, uint64_t offset, uint64_t len);
 
   void _invalidate_cache(FileRef f, uint64_t offset, uint64_t length);
 
@@ -440,6 +478,18 @@ public:
     // atomics and asserts).
     return _read_random(h, offset, len, out);
   }
+  /// read several ranges of a file with a single round of device aio
+  int read_random_batch(FileReader *h, vector<read_req_t>& reqs) {
+    // same locking rules as read_random()
+    return _read_random_batch(h, reqs);
+  }
+  /// start reading a range of a random reader in the background
+  void prefetch(FileReader *h, uint64_t offset, uint64_t len) {
+    _prefetch(h, offset, len);
+  }
+  const PerfCounters* get_perf_counters() const {
+    return logger;
+  }
   void invalidate_cache(FileRef f, uint64_t offset, uint64_t len) {
     std::lock_guard<std::mutex> l(lock);
     _invalidate_cache(f, offset, len);
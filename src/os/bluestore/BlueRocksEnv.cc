@@ -101,6 +101,12 @@ class BlueRocksRandomAccessFile : public rocksdb::RandomAccessFile {
     return rocksdb::Status::OK();
   }
 
+  // Readahead the file starting from offset by n bytes for caching.
+  rocksdb::Status Prefetch(uint64_t offset, size_t n) override {
+    fs->prefetch(h, offset, n);
+    return rocksdb::Status::OK();
+  }
+
   // Tries to get an unique ID for this file that will be the same each time
   // the file is opened (and will stay the same while the file is open).
   // Furthermore, it tries to make this ID at most "max_size" bytes. If such an
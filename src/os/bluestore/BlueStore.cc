@@ -71,6 +71,7 @@ const string PREFIX_DEFERRED = "L";  // id -> deferred_transaction_t
 const string PREFIX_ALLOC = "B";   // u64 offset -> u64 length (freelist)
 const string PREFIX_ALLOC_BITMAP = "b"; // (see BitmapFreelistManager)
 const string PREFIX_SHARED_BLOB = "X"; // u64 offset -> shared_blob_t
+const string PREFIX_ALLOC_SNAPSHOT = "a"; // u64 chunk -> free extents
 
 // write a label in the first block.  always use this size.  note that
 // bluefs makes a matching assumption about the location of its
@@ -775,6 +776,8 @@ BlueStore::Cache *BlueStore::Cache::create(CephContext* cct, string type,
     c = new LRUCache(cct);
   else if (type == "2q")
     c = new TwoQCache(cct);
+  else if (type == "clock")
+    c = new ClockCache(cct);
   else
     assert(0 == "unrecognized cache type");
 
@@ -1213,6 +1216,318 @@ void BlueStore::TwoQCache::_audit(const char *when)
 #endif
 
 
+// ClockCache
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.ClockCache(" << this << ") "
+
+void BlueStore::ClockCache::_add_onode(OnodeRef& o, int level)
+{
+  size_t h = std::hash<ghobject_t>()(o->oid);
+  if (o->cache_private == ONODE_FREQUENT) {
+    // moved here from another shard, or renamed
+  } else if (onode_recent_ghost.erase(h)) {
+    // we evicted it too early from the recent clock; let that one grow
+    uint64_t delta = std::max<uint64_t>(
+      1, onode_frequent_ghost.size() / (onode_recent_ghost.size() + 1));
+    onode_recent_target = std::min(onode_recent_target + delta, onode_max);
+    o->cache_private = ONODE_FREQUENT;
+    ++onode_ghost_hits;
+  } else if (onode_frequent_ghost.erase(h)) {
+    // we evicted it too early from the frequent clock; shrink recent
+    uint64_t delta = std::max<uint64_t>(
+      1, onode_recent_ghost.size() / (onode_frequent_ghost.size() + 1));
+    onode_recent_target -= std::min(onode_recent_target, delta);
+    o->cache_private = ONODE_FREQUENT;
+    ++onode_ghost_hits;
+  } else {
+    o->cache_private = ONODE_RECENT;
+  }
+  dout(20) << __func__ << " " << o->oid << " level " << level
+	   << " cache_private " << (int)o->cache_private << dendl;
+  o->cache_ref = false;
+  if (o->cache_private == ONODE_FREQUENT) {
+    onode_frequent.push_back(*o);
+  } else if (level > 0) {
+    onode_recent.push_back(*o);
+  } else {
+    // right under the hand
+    onode_recent.push_front(*o);
+  }
+}
+
+void BlueStore::ClockCache::_rm_onode(OnodeRef& o)
+{
+  switch (o->cache_private) {
+  case ONODE_RECENT:
+    onode_recent.erase(onode_recent.iterator_to(*o));
+    break;
+  case ONODE_FREQUENT:
+    onode_frequent.erase(onode_frequent.iterator_to(*o));
+    break;
+  default:
+    assert(0 == "bad cache_private");
+  }
+}
+
+void BlueStore::ClockCache::_add_buffer(Buffer *b, int level, Buffer *near)
+{
+  dout(20) << __func__ << " level " << level << " near " << near
+	   << " on " << *b
+	   << " which has cache_private " << b->cache_private << dendl;
+  if (near) {
+    b->cache_private = near->cache_private;
+    if ((b->cache_private & BUFFER_TYPE_MASK) == BUFFER_RECENT_GHOST ||
+	(b->cache_private & BUFFER_TYPE_MASK) == BUFFER_FREQUENT_GHOST) {
+      assert(b->is_empty());
+    }
+    auto& l = _buffer_list(b->cache_private & BUFFER_TYPE_MASK);
+    l.insert(l.iterator_to(*near), *b);
+  } else {
+    // the hint from discard, if any, tells us where we have seen it before
+    switch (b->cache_private & BUFFER_TYPE_MASK) {
+    case BUFFER_NEW:
+      b->cache_private = BUFFER_RECENT;
+      if (level > 0) {
+	buffer_recent.push_back(*b);
+      } else {
+	// take caller hint to start right under the hand
+	buffer_recent.push_front(*b);
+      }
+      break;
+    case BUFFER_RECENT:
+      // a second access; the hand will move it to the frequent clock
+      b->cache_private = BUFFER_RECENT | BUFFER_REF;
+      buffer_recent.push_back(*b);
+      break;
+    case BUFFER_FREQUENT:
+      b->cache_private = BUFFER_FREQUENT | BUFFER_REF;
+      buffer_frequent.push_back(*b);
+      break;
+    case BUFFER_RECENT_GHOST:
+      {
+	// discard already took the ghost off its list
+	uint64_t ghost = buffer_list_bytes[BUFFER_RECENT_GHOST] + b->length;
+	uint64_t other = buffer_list_bytes[BUFFER_FREQUENT_GHOST];
+	uint64_t delta = std::max<uint64_t>(b->length,
+					    b->length * other / ghost);
+	buffer_recent_target = std::min(buffer_recent_target + delta,
+					buffer_max);
+	buffer_ghost_hit_bytes += b->length;
+	dout(20) << __func__ << " recent ghost hit, target "
+		 << buffer_recent_target << dendl;
+	b->cache_private = BUFFER_FREQUENT;
+	buffer_frequent.push_back(*b);
+      }
+      break;
+    case BUFFER_FREQUENT_GHOST:
+      {
+	// discard already took the ghost off its list
+	uint64_t ghost = buffer_list_bytes[BUFFER_FREQUENT_GHOST] + b->length;
+	uint64_t other = buffer_list_bytes[BUFFER_RECENT_GHOST];
+	uint64_t delta = std::max<uint64_t>(b->length,
+					    b->length * other / ghost);
+	buffer_recent_target -= std::min(buffer_recent_target, delta);
+	buffer_ghost_hit_bytes += b->length;
+	dout(20) << __func__ << " frequent ghost hit, target "
+		 << buffer_recent_target << dendl;
+	b->cache_private = BUFFER_FREQUENT;
+	buffer_frequent.push_back(*b);
+      }
+      break;
+    default:
+      assert(0 == "bad cache_private");
+    }
+  }
+  _buffer_account(b, b->length);
+}
+
+void BlueStore::ClockCache::_rm_buffer(Buffer *b)
+{
+  dout(20) << __func__ << " " << *b << dendl;
+  _buffer_account(b, -(int64_t)b->length);
+  auto& l = _buffer_list(b->cache_private & BUFFER_TYPE_MASK);
+  l.erase(l.iterator_to(*b));
+}
+
+void BlueStore::ClockCache::_move_buffer(Cache *srcc, Buffer *b)
+{
+  ClockCache *src = static_cast<ClockCache*>(srcc);
+  src->_rm_buffer(b);
+
+  // preserve which clock we're on (even if we can't preserve the order!)
+  _buffer_list(b->cache_private & BUFFER_TYPE_MASK).push_back(*b);
+  _buffer_account(b, b->length);
+}
+
+void BlueStore::ClockCache::_adjust_buffer_size(Buffer *b, int64_t delta)
+{
+  dout(20) << __func__ << " delta " << delta << " on " << *b << dendl;
+  _buffer_account(b, delta);
+}
+
+void BlueStore::ClockCache::_trim(uint64_t onode_max, uint64_t buffer_max)
+{
+  dout(20) << __func__ << " onodes " << _get_num_onodes() << " / " << onode_max
+	   << " buffers " << buffer_bytes << " / " << buffer_max
+	   << dendl;
+
+  _audit("trim start");
+  _trim_buffers(buffer_max);
+  _trim_onodes(onode_max);
+  _audit("trim end");
+}
+
+void BlueStore::ClockCache::_trim_buffers(uint64_t max)
+{
+  buffer_max = max;
+  buffer_recent_target = std::min(buffer_recent_target, max);
+
+  uint64_t evicted = 0;
+  while (buffer_bytes > max) {
+    bool recent = !buffer_recent.empty() &&
+      (buffer_frequent.empty() ||
+       buffer_list_bytes[BUFFER_RECENT] >=
+         std::max<uint64_t>(1, buffer_recent_target));
+    auto& l = recent ? buffer_recent : buffer_frequent;
+    assert(!l.empty());
+
+    // advance the hand
+    Buffer *b = &l.front();
+    assert(b->is_clean());
+    l.pop_front();
+    _buffer_account(b, -(int64_t)b->length);
+    if (b->cache_private & BUFFER_REF) {
+      dout(30) << __func__ << " referenced " << *b << dendl;
+      b->cache_private = BUFFER_FREQUENT;
+      buffer_frequent.push_back(*b);
+    } else {
+      dout(20) << __func__ << (recent ? " recent" : " frequent")
+	       << " -> ghost " << *b << dendl;
+      evicted += b->length;
+      b->state = Buffer::STATE_EMPTY;
+      b->data.clear();
+      if (recent) {
+	b->cache_private = BUFFER_RECENT_GHOST;
+	buffer_recent_ghost.push_back(*b);
+      } else {
+	b->cache_private = BUFFER_FREQUENT_GHOST;
+	buffer_frequent_ghost.push_back(*b);
+      }
+    }
+    _buffer_account(b, b->length);
+  }
+  if (evicted > 0) {
+    dout(20) << __func__ << " evicted " << byte_u_t(evicted) << dendl;
+  }
+
+  // remember no more than max bytes worth of each clock's history
+  while (!buffer_recent_ghost.empty() &&
+	 buffer_list_bytes[BUFFER_RECENT] +
+	 buffer_list_bytes[BUFFER_RECENT_GHOST] > max) {
+    Buffer *b = &buffer_recent_ghost.front();
+    dout(30) << __func__ << " recent ghost rm " << *b << dendl;
+    b->space->_rm_buffer(this, b);
+  }
+  while (!buffer_frequent_ghost.empty() &&
+	 buffer_bytes + buffer_list_bytes[BUFFER_RECENT_GHOST] +
+	 buffer_list_bytes[BUFFER_FREQUENT_GHOST] > 2 * max) {
+    Buffer *b = &buffer_frequent_ghost.front();
+    dout(30) << __func__ << " frequent ghost rm " << *b << dendl;
+    b->space->_rm_buffer(this, b);
+  }
+}
+
+void BlueStore::ClockCache::_trim_onodes(uint64_t max)
+{
+  onode_max = max;
+  onode_recent_target = std::min(onode_recent_target, max);
+
+  int skipped = 0;
+  int max_skipped = g_conf->bluestore_cache_trim_max_skip_pinned;
+  while (_get_num_onodes() > max) {
+    bool recent = !onode_recent.empty() &&
+      (onode_frequent.empty() ||
+       onode_recent.size() >= std::max<uint64_t>(1, onode_recent_target));
+    auto& l = recent ? onode_recent : onode_frequent;
+    assert(!l.empty());
+
+    // advance the hand
+    Onode *o = &l.front();
+    l.pop_front();
+    if (o->cache_ref) {
+      dout(30) << __func__ << " referenced " << o->oid << dendl;
+      o->cache_ref = false;
+      o->cache_private = ONODE_FREQUENT;
+      onode_frequent.push_back(*o);
+      continue;
+    }
+    int refs = o->nref.load();
+    if (refs > 1) {
+      dout(20) << __func__ << "  " << o->oid << " has " << refs
+	       << " refs; skipping" << dendl;
+      l.push_back(*o);
+      if (++skipped >= max_skipped) {
+        dout(20) << __func__ << " maximum skip pinned reached; stopping with "
+                 << _get_num_onodes() - max << " left to trim" << dendl;
+        break;
+      }
+      continue;
+    }
+    dout(30) << __func__ << (recent ? " recent " : " frequent ")
+	     << o->oid << dendl;
+    size_t h = std::hash<ghobject_t>()(o->oid);
+    if (recent) {
+      onode_recent_ghost.push(h);
+    } else {
+      onode_frequent_ghost.push(h);
+    }
+    o->get();  // paranoia
+    o->c->onode_map.remove(o->oid);
+    o->put();
+  }
+
+  while (onode_recent_ghost.size() &&
+	 onode_recent.size() + onode_recent_ghost.size() > max) {
+    onode_recent_ghost.pop();
+  }
+  while (onode_frequent_ghost.size() &&
+	 _get_num_onodes() + onode_recent_ghost.size() +
+	 onode_frequent_ghost.size() > 2 * max) {
+    onode_frequent_ghost.pop();
+  }
+}
+
+#ifdef DEBUG_CACHE
+void BlueStore::ClockCache::_audit(const char *when)
+{
+  dout(10) << __func__ << " " << when << " start" << dendl;
+  uint64_t s = 0;
+  for (int type = BUFFER_RECENT; type < BUFFER_TYPE_MAX; ++type) {
+    uint64_t bytes = 0;
+    for (auto& b : _buffer_list(type)) {
+      assert((b.cache_private & BUFFER_TYPE_MASK) == type);
+      bytes += b.length;
+    }
+    if (bytes != buffer_list_bytes[type]) {
+      derr << __func__ << " list " << type << " bytes "
+	   << buffer_list_bytes[type] << " != actual " << bytes << dendl;
+      assert(bytes == buffer_list_bytes[type]);
+    }
+    if (type == BUFFER_RECENT || type == BUFFER_FREQUENT) {
+      s += bytes;
+    }
+  }
+  if (s != buffer_bytes) {
+    derr << __func__ << " buffer_bytes " << buffer_bytes << " actual " << s
+	 << dendl;
+    assert(s == buffer_bytes);
+  }
+  dout(20) << __func__ << " " << when << " buffer_bytes " << buffer_bytes
+	   << " ok" << dendl;
+}
+#endif
+
+
 // BufferSpace
 
 #undef dout_prefix
@@ -3222,7 +3537,8 @@ void BlueStore::Collection::load_shared_blob(SharedBlobRef sb)
     string key;
     auto sbid = sb->get_sbid();
     get_shared_blob_key(sbid, &key);
-    int r = store->db->get(PREFIX_SHARED_BLOB, key, &v);
+    // nothing in bluestore_shared_blob_t points into v; decode in place
+    int r = store->db->get_in_place(PREFIX_SHARED_BLOB, key, &v);
     if (r < 0) {
 	lderr(store->cct) << __func__ << " sbid 0x" << std::hex << sbid
 			  << std::dec << " not found at key "
@@ -3301,6 +3617,8 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
   ldout(store->cct, 20) << __func__ << " oid " << oid << " key "
 			<< pretty_binary_string(key) << dendl;
 
+  // not in place: the attrs, the inline extent map and the blobs' csum_data
+  // keep pointing into v for as long as the onode is cached
   bufferlist v;
   int r = store->db->get(PREFIX_OBJ, key.c_str(), key.size(), &v);
   ldout(store->cct, 20) << " r " << r << " v.len " << v.length() << dendl;
@@ -3323,6 +3641,10 @@ BlueStore::OnodeRef BlueStore::Collection::get_onode(
     for (auto& i : on->onode.attrs) {
       i.second.reassign_to_mempool(mempool::mempool_bluestore_cache_other);
     }
+    if (on->onode.has_inline_data()) {
+      on->onode.inline_data.reassign_to_mempool(
+	mempool::mempool_bluestore_cache_other);
+    }
 
     // initialize extent_map
     on->extent_map.decode_spanning_blobs(p);
@@ -3435,6 +3757,7 @@ void *BlueStore::MempoolThread::entry()
     double autotune_interval = store->cache_autotune_interval;
     if (autotune_interval > 0 && next_balance < ceph_clock_now()) {
       if (store->cache_autotune) {
+        _update_ghost_demand();
         _balance_cache(caches);
       }
       next_balance = ceph_clock_now();
@@ -3460,6 +3783,24 @@ void BlueStore::MempoolThread::_adjust_cache_settings()
   data_cache.set_cache_ratio(store->cache_data_ratio);
 }
 
+void BlueStore::MempoolThread::_update_ghost_demand()
+{
+  uint64_t onode_ghost_hits = 0;
+  uint64_t buffer_ghost_hit_bytes = 0;
+  for (auto i : store->cache_shards) {
+    onode_ghost_hits += i->onode_ghost_hits;
+    buffer_ghost_hit_bytes += i->buffer_ghost_hit_bytes;
+  }
+  meta_cache.ghost_bytes = (onode_ghost_hits - last_onode_ghost_hits) *
+    meta_cache.get_bytes_per_onode();
+  data_cache.ghost_bytes = buffer_ghost_hit_bytes -
+    last_buffer_ghost_hit_bytes;
+  last_onode_ghost_hits = onode_ghost_hits;
+  last_buffer_ghost_hit_bytes = buffer_ghost_hit_bytes;
+  ldout(store->cct, 20) << __func__ << " meta " << meta_cache.ghost_bytes
+			<< " data " << data_cache.ghost_bytes << dendl;
+}
+
 void BlueStore::MempoolThread::_trim_shards(bool log_stats)
 {
   uint64_t cache_size = store->cache_size;
@@ -3610,6 +3951,103 @@ void BlueStore::MempoolThread::_balance_cache_pri(int64_t *mem_avail,
 
 // =======================================================
 
+// CompressThreadPool
+
+#undef dout_prefix
+#define dout_prefix *_dout << "bluestore.CompressThreadPool(" << this << ") "
+
+void BlueStore::CompressThreadPool::Batch::run()
+{
+  size_t n = 0;
+  for (size_t i = next++; i < num; i = next++) {
+    fn(i);
+    ++n;
+  }
+  if (n) {
+    std::lock_guard<std::mutex> l(lock);
+    done += n;
+    if (done == num) {
+      cond.notify_all();
+    }
+  }
+}
+
+void BlueStore::CompressThreadPool::init(unsigned num_threads)
+{
+  assert(threads.empty());
+  ldout(store->cct, 10) << __func__ << " " << num_threads << " threads"
+			<< dendl;
+  stop = false;
+  for (unsigned i = 0; i < num_threads; ++i) {
+    threads.push_back(make_named_thread("bstore_compress",
+					&CompressThreadPool::entry, this));
+  }
+}
+
+void BlueStore::CompressThreadPool::shutdown()
+{
+  {
+    std::lock_guard<std::mutex> l(lock);
+    stop = true;
+  }
+  cond.notify_all();
+  for (auto& t : threads) {
+    t.join();
+  }
+  threads.clear();
+  assert(queue.empty());
+}
+
+void BlueStore::CompressThreadPool::run(
+  size_t num, std::function<void(size_t)>&& fn)
+{
+  if (threads.empty() || num < 2) {
+    for (size_t i = 0; i < num; ++i) {
+      fn(i);
+    }
+    return;
+  }
+
+  // the batch outlives this call if a thread picks it up late; by then
+  // there is nothing left in it to run
+  auto b = std::make_shared<Batch>();
+  b->fn = std::move(fn);
+  b->num = num;
+  {
+    std::lock_guard<std::mutex> l(lock);
+    for (size_t i = 1; i < std::min(num, threads.size() + 1); ++i) {
+      queue.push_back(b);
+    }
+  }
+  cond.notify_all();
+  b->run();
+
+  std::unique_lock<std::mutex> l(b->lock);
+  b->cond.wait(l, [&] { return b->done == b->num; });
+}
+
+void BlueStore::CompressThreadPool::entry()
+{
+  std::unique_lock<std::mutex> l(lock);
+  while (true) {
+    if (queue.empty()) {
+      if (stop) {
+	break;
+      }
+      cond.wait(l);
+      continue;
+    }
+    auto b = std::move(queue.front());
+    queue.pop_front();
+    l.unlock();
+    b->run();
+    b.reset();
+    l.lock();
+  }
+}
+
+// =======================================================
+
 // OmapIteratorImpl
 
 #undef dout_prefix
@@ -3745,9 +4183,12 @@ BlueStore::BlueStore(CephContext *cct, const string& path)
 		       cct->_conf->bluestore_throttle_bytes +
 		       cct->_conf->bluestore_throttle_deferred_bytes),
     deferred_finisher(cct, "defered_finisher", "dfin"),
+    alloc_snapshot_finisher(cct, "alloc_snapshot_finisher", "asnap"),
+    read_finisher(cct, "read_finisher", "rfin"),
     kv_sync_thread(this),
     kv_finalize_thread(this),
-    mempool_thread(this)
+    mempool_thread(this),
+    compress_tp(this)
 {
   _init_logger();
   cct->_conf->add_observer(this);
@@ -3764,11 +4205,14 @@ BlueStore::BlueStore(CephContext *cct,
 		       cct->_conf->bluestore_throttle_bytes +
 		       cct->_conf->bluestore_throttle_deferred_bytes),
     deferred_finisher(cct, "defered_finisher", "dfin"),
+    alloc_snapshot_finisher(cct, "alloc_snapshot_finisher", "asnap"),
+    read_finisher(cct, "read_finisher", "rfin"),
     kv_sync_thread(this),
     kv_finalize_thread(this),
     min_alloc_size(_min_alloc_size),
     min_alloc_size_order(ctz(_min_alloc_size)),
-    mempool_thread(this)
+    mempool_thread(this),
+    compress_tp(this)
 {
   _init_logger();
   cct->_conf->add_observer(this);
@@ -3808,13 +4252,17 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_compression_max_blob_size_ssd",
     "bluestore_compression_max_blob_size_hdd",
     "bluestore_compression_required_ratio",
+    "bluestore_compression_sample_size",
     "bluestore_max_alloc_size",
     "bluestore_prefer_deferred_size",
     "bluestore_prefer_deferred_size_hdd",
     "bluestore_prefer_deferred_size_ssd",
+    "bluestore_inline_data_max_size",
     "bluestore_deferred_batch_ops",
     "bluestore_deferred_batch_ops_hdd",
     "bluestore_deferred_batch_ops_ssd",
+    "bluestore_deferred_combine_hdd",
+    "bluestore_deferred_combine_ssd",
     "bluestore_throttle_bytes",
     "bluestore_throttle_deferred_bytes",
     "bluestore_throttle_cost_per_io_hdd",
@@ -3823,6 +4271,8 @@ const char **BlueStore::get_tracked_conf_keys() const
     "bluestore_max_blob_size",
     "bluestore_max_blob_size_ssd",
     "bluestore_max_blob_size_hdd",
+    "bluestore_txc_slow_history_size",
+    "bluestore_txc_slow_history_duration",
     NULL
   };
   return KEYS;
@@ -3837,7 +4287,8 @@ void BlueStore::handle_conf_change(const md_config_t *conf,
   if (changed.count("bluestore_compression_mode") ||
       changed.count("bluestore_compression_algorithm") ||
       changed.count("bluestore_compression_min_blob_size") ||
-      changed.count("bluestore_compression_max_blob_size")) {
+      changed.count("bluestore_compression_max_blob_size") ||
+      changed.count("bluestore_compression_sample_size")) {
     if (bdev) {
       _set_compression();
     }
@@ -3853,10 +4304,13 @@ void BlueStore::handle_conf_change(const md_config_t *conf,
   if (changed.count("bluestore_prefer_deferred_size") ||
       changed.count("bluestore_prefer_deferred_size_hdd") ||
       changed.count("bluestore_prefer_deferred_size_ssd") ||
+      changed.count("bluestore_inline_data_max_size") ||
       changed.count("bluestore_max_alloc_size") ||
       changed.count("bluestore_deferred_batch_ops") ||
       changed.count("bluestore_deferred_batch_ops_hdd") ||
-      changed.count("bluestore_deferred_batch_ops_ssd")) {
+      changed.count("bluestore_deferred_batch_ops_ssd") ||
+      changed.count("bluestore_deferred_combine_hdd") ||
+      changed.count("bluestore_deferred_combine_ssd")) {
     if (bdev) {
       // only after startup
       _set_alloc_sizes();
@@ -3878,6 +4332,28 @@ void BlueStore::handle_conf_change(const md_config_t *conf,
     throttle_deferred_bytes.reset_max(
       conf->bluestore_throttle_bytes + conf->bluestore_throttle_deferred_bytes);
   }
+  if (changed.count("bluestore_txc_slow_history_size") ||
+      changed.count("bluestore_txc_slow_history_duration")) {
+    _set_txc_slow_history();
+  }
+}
+
+void BlueStore::_set_txc_slow_history()
+{
+  txc_slow_history_size =
+    cct->_conf->get_val<uint64_t>("bluestore_txc_slow_history_size");
+  txc_slow_history_duration =
+    cct->_conf->get_val<uint64_t>("bluestore_txc_slow_history_duration");
+  dout(10) << __func__ << " size " << txc_slow_history_size
+	   << " duration " << txc_slow_history_duration << dendl;
+
+  std::lock_guard<std::mutex> l(txc_slow_lock);
+  while (txc_slow.size() > txc_slow_history_size) {
+    txc_slow.erase(txc_slow.begin());
+  }
+  // recompute the thresholds with the next txc
+  txc_slow_min = 0;
+  txc_slow_expire = 0;
 }
 
 void BlueStore::_set_compression()
@@ -3923,6 +4399,9 @@ void BlueStore::_set_compression()
     }
   }
 
+  comp_sample_size =
+    cct->_conf->get_val<uint64_t>("bluestore_compression_sample_size");
+
   auto& alg_name = cct->_conf->bluestore_compression_algorithm;
   if (!alg_name.empty()) {
     compressor = Compressor::create(cct, alg_name);
@@ -3936,6 +4415,7 @@ void BlueStore::_set_compression()
 	   << " alg " << (compressor ? compressor->get_type_name() : "(none)")
 	   << " min_blob " << comp_min_blob_size
 	   << " max_blob " << comp_max_blob_size
+	   << " sample " << comp_sample_size
 	   << dendl;
 }
 
@@ -4122,6 +4602,66 @@ void BlueStore::_init_logger()
     "Average finishing state latency");
   b.add_time_avg(l_bluestore_state_done_lat, "state_done_lat",
     "Average done state latency");
+
+  // state latencies of each txc, by the number of bytes it writes
+  PerfHistogramCommon::axis_config_d state_hist_x_axis_config{
+    "Latency (usec)",
+    PerfHistogramCommon::SCALE_LOG2, ///< Latency in logarithmic scale
+    0,                               ///< Start at 0
+    10000,                           ///< Quantization unit is 10usec
+    32,                              ///< Enough to cover stalls of minutes
+  };
+  PerfHistogramCommon::axis_config_d state_hist_y_axis_config{
+    "Transaction size (bytes)",
+    PerfHistogramCommon::SCALE_LOG2, ///< Request size in logarithmic scale
+    0,                               ///< Start at 0
+    512,                             ///< Quantization unit is 512 bytes
+    32,                              ///< Enough to cover requests larger than GB
+  };
+  b.add_u64_counter_histogram(
+    l_bluestore_state_prepare_lat_hist, "state_prepare_lat_histogram",
+    state_hist_x_axis_config, state_hist_y_axis_config,
+    "Histogram of prepare state latency vs. transaction size");
+  b.add_u64_counter_histogram(
+    l_bluestore_state_aio_wait_lat_hist, "state_aio_wait_lat_histogram",
+    state_hist_x_axis_config, state_hist_y_axis_config,
+    "Histogram of aio_wait state latency vs. transaction size");
+  b.add_u64_counter_histogram(
+    l_bluestore_state_io_done_lat_hist, "state_io_done_lat_histogram",
+    state_hist_x_axis_config, state_hist_y_axis_config,
+    "Histogram of io_done state latency vs. transaction size");
+  b.add_u64_counter_histogram(
+    l_bluestore_state_kv_queued_lat_hist, "state_kv_queued_lat_histogram",
+    state_hist_x_axis_config, state_hist_y_axis_config,
+    "Histogram of kv_queued state latency vs. transaction size");
+  b.add_u64_counter_histogram(
+    l_bluestore_state_kv_committing_lat_hist, "state_kv_committing_lat_histogram",
+    state_hist_x_axis_config, state_hist_y_axis_config,
+    "Histogram of kv_committing state latency vs. transaction size");
+  b.add_u64_counter_histogram(
+    l_bluestore_state_kv_done_lat_hist, "state_kv_done_lat_histogram",
+    state_hist_x_axis_config, state_hist_y_axis_config,
+    "Histogram of kv_done state latency vs. transaction size");
+  b.add_u64_counter_histogram(
+    l_bluestore_state_deferred_queued_lat_hist, "state_deferred_queued_lat_histogram",
+    state_hist_x_axis_config, state_hist_y_axis_config,
+    "Histogram of deferred_queued state latency vs. transaction size");
+  b.add_u64_counter_histogram(
+    l_bluestore_state_deferred_aio_wait_lat_hist, "state_deferred_aio_wait_lat_histogram",
+    state_hist_x_axis_config, state_hist_y_axis_config,
+    "Histogram of deferred aio_wait state latency vs. transaction size");
+  b.add_u64_counter_histogram(
+    l_bluestore_state_deferred_cleanup_lat_hist, "state_deferred_cleanup_lat_histogram",
+    state_hist_x_axis_config, state_hist_y_axis_config,
+    "Histogram of deferred_cleanup state latency vs. transaction size");
+  b.add_u64_counter_histogram(
+    l_bluestore_state_finishing_lat_hist, "state_finishing_lat_histogram",
+    state_hist_x_axis_config, state_hist_y_axis_config,
+    "Histogram of finishing state latency vs. transaction size");
+  b.add_u64_counter_histogram(
+    l_bluestore_state_done_lat_hist, "state_done_lat_histogram",
+    state_hist_x_axis_config, state_hist_y_axis_config,
+    "Histogram of done state latency vs. transaction size");
   b.add_time_avg(l_bluestore_throttle_lat, "throttle_lat",
 		 "Average submit throttle latency",
 		 "th_l", PerfCountersBuilder::PRIO_CRITICAL);
@@ -4148,12 +4688,22 @@ void BlueStore::_init_logger()
     "Sum for beneficial compress ops");
   b.add_u64_counter(l_bluestore_compress_rejected_count, "compress_rejected_count",
     "Sum for compress ops rejected due to low net gain of space");
+  b.add_u64_counter(l_bluestore_compress_early_abort_count,
+		    "compress_early_abort_count",
+		    "Compressions skipped because a sample did not compress "
+		    "well enough");
+  b.add_time_avg(l_bluestore_compress_parallel_lat, "compress_parallel_lat",
+		 "Average time to compress all blobs of a multi-blob write");
   b.add_u64_counter(l_bluestore_write_pad_bytes, "write_pad_bytes",
 		    "Sum for write-op padded bytes", NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64_counter(l_bluestore_deferred_write_ops, "deferred_write_ops",
 		    "Sum for deferred write op");
   b.add_u64_counter(l_bluestore_deferred_write_bytes, "deferred_write_bytes",
 		    "Sum for deferred write bytes", "def", 0, unit_t(UNIT_BYTES));
+  b.add_u64_counter(l_bluestore_deferred_combined_batches,
+		    "deferred_combined_batches",
+		    "Deferred batches written out together with those of "
+		    "other sequencers");
   b.add_u64_counter(l_bluestore_write_penalty_read_ops, "write_penalty_read_ops",
 		    "Sum for write penalty read ops");
   b.add_u64(l_bluestore_allocated, "bluestore_allocated",
@@ -4173,6 +4723,9 @@ void BlueStore::_init_logger()
 		    "Sum for onode-lookups hit in the cache");
   b.add_u64_counter(l_bluestore_onode_misses, "bluestore_onode_misses",
 		    "Sum for onode-lookups missed in the cache");
+  b.add_u64(l_bluestore_onode_ghost_hits, "bluestore_onode_ghost_hits",
+	    "Sum for onode-lookups missed in the cache but found in its "
+	    "history of recent evictions");
   b.add_u64_counter(l_bluestore_onode_shard_hits, "bluestore_onode_shard_hits",
 		    "Sum for onode-shard lookups hit in the cache");
   b.add_u64_counter(l_bluestore_onode_shard_misses,
@@ -4190,6 +4743,10 @@ void BlueStore::_init_logger()
 	    "Sum for bytes of read hit in the cache", NULL, 0, unit_t(UNIT_BYTES));
   b.add_u64(l_bluestore_buffer_miss_bytes, "bluestore_buffer_miss_bytes",
 	    "Sum for bytes of read missed in the cache", NULL, 0, unit_t(UNIT_BYTES));
+  b.add_u64(l_bluestore_buffer_ghost_hit_bytes,
+	    "bluestore_buffer_ghost_hit_bytes",
+	    "Sum for bytes missed in the cache but found in its history of "
+	    "recent evictions", NULL, 0, unit_t(UNIT_BYTES));
 
   b.add_u64_counter(l_bluestore_write_big, "bluestore_write_big",
 		    "Large aligned writes into fresh blobs");
@@ -4213,6 +4770,10 @@ void BlueStore::_init_logger()
 		    "cached) to fill out the block");
   b.add_u64_counter(l_bluestore_write_small_new, "bluestore_write_small_new",
 		    "Small write into new (sparse) blob");
+  b.add_u64_counter(l_bluestore_write_inline, "bluestore_write_inline",
+		    "Writes kept inline in the onode");
+  b.add_u64_counter(l_bluestore_write_uninline, "bluestore_write_uninline",
+		    "Inline objects moved to a regular blob");
 
   b.add_u64_counter(l_bluestore_txc, "bluestore_txc", "Transactions committed");
   b.add_u64_counter(l_bluestore_onode_reshard, "bluestore_onode_reshard",
@@ -4226,10 +4787,51 @@ void BlueStore::_init_logger()
 		    "collection");
   b.add_u64_counter(l_bluestore_read_eio, "bluestore_read_eio",
                     "Read EIO errors propagated to high level callers");
+  b.add_u64_counter(l_bluestore_read_async_ops, "read_async_ops",
+		    "Asynchronous reads that had to wait for the device");
   b.add_u64(l_bluestore_fragmentation, "bluestore_fragmentation_micros",
             "How fragmented bluestore free space is (free extents / max possible number of free extents) * 1000");
+  b.add_u64_counter(l_bluestore_alloc_snapshot_loaded, "alloc_snapshot_loaded",
+		    "Mounts that loaded the allocator from its snapshot");
+  b.add_u64_counter(l_bluestore_alloc_snapshot_written,
+		    "alloc_snapshot_written",
+		    "Allocator snapshots written");
+  b.add_u64_counter(l_bluestore_fsck_onodes, "bluestore_fsck_onodes",
+		    "Onodes checked by fsck");
+  b.add_u64_counter(l_bluestore_fsck_read_bytes, "bluestore_fsck_read_bytes",
+		    "Data read and verified by deep fsck (bytes)",
+		    NULL, 0, unit_t(UNIT_BYTES));
+  b.add_time_avg(l_bluestore_fsck_lat, "fsck_lat",
+		 "Average fsck duration");
   logger = b.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
+
+  for (auto& i : Compressor::compression_algorithms) {
+    if (i.second == Compressor::COMP_ALG_NONE) {
+      continue;
+    }
+    PerfCountersBuilder cb(cct, string("bluestore_compress_") + i.first,
+			   l_bluestore_compressor_first,
+			   l_bluestore_compressor_last);
+    cb.add_time_avg(l_bluestore_compressor_cpu_lat, "cpu_lat",
+		    "Average CPU time spent compressing a blob");
+    cb.add_u64_counter(l_bluestore_compressor_original_bytes, "original_bytes",
+		       "Data handed to the compressor (bytes)",
+		       NULL, 0, unit_t(UNIT_BYTES));
+    cb.add_u64_counter(l_bluestore_compressor_compressed_bytes,
+		       "compressed_bytes",
+		       "Data coming out of the compressor (bytes)",
+		       NULL, 0, unit_t(UNIT_BYTES));
+    cb.add_u64_avg(l_bluestore_compressor_ratio, "ratio_permille",
+		   "Average compressed/original size ratio of a blob (x1000)");
+    cb.add_u64_counter(l_bluestore_compressor_rejected, "rejected",
+		       "Blobs compressed but stored uncompressed");
+    cb.add_u64_counter(l_bluestore_compressor_early_abort, "early_abort",
+		       "Blobs skipped as incompressible after compressing "
+		       "a sample");
+    compress_logger[i.second] = cb.create_perf_counters();
+    cct->get_perfcounters_collection()->add(compress_logger[i.second]);
+  }
 }
 
 int BlueStore::_reload_logger()
@@ -4251,6 +4853,13 @@ void BlueStore::_shutdown_logger()
 {
   cct->get_perfcounters_collection()->remove(logger);
   delete logger;
+  for (auto& l : compress_logger) {
+    if (l) {
+      cct->get_perfcounters_collection()->remove(l);
+      delete l;
+      l = nullptr;
+    }
+  }
 }
 
 int BlueStore::get_block_device_fsid(CephContext* cct, const string& path,
@@ -4415,6 +5024,9 @@ void BlueStore::_set_alloc_sizes(void)
     }
   }
 
+  inline_data_max_size =
+    cct->_conf->get_val<uint64_t>("bluestore_inline_data_max_size");
+
   if (cct->_conf->bluestore_deferred_batch_ops) {
     deferred_batch_ops = cct->_conf->bluestore_deferred_batch_ops;
   } else {
@@ -4426,12 +5038,23 @@ void BlueStore::_set_alloc_sizes(void)
     }
   }
 
+  assert(bdev);
+  if (bdev->is_rotational()) {
+    deferred_combine =
+      cct->_conf->get_val<bool>("bluestore_deferred_combine_hdd");
+  } else {
+    deferred_combine =
+      cct->_conf->get_val<bool>("bluestore_deferred_combine_ssd");
+  }
+
   dout(10) << __func__ << " min_alloc_size 0x" << std::hex << min_alloc_size
 	   << std::dec << " order " << (int)min_alloc_size_order
 	   << " max_alloc_size 0x" << std::hex << max_alloc_size
 	   << " prefer_deferred_size 0x" << prefer_deferred_size
+	   << " inline_data_max_size 0x" << inline_data_max_size
 	   << std::dec
 	   << " deferred_batch_ops " << deferred_batch_ops
+	   << " deferred_combine " << deferred_combine
 	   << dendl;
 }
 
@@ -4594,7 +5217,7 @@ void BlueStore::_close_fm()
   fm = NULL;
 }
 
-int BlueStore::_open_alloc()
+int BlueStore::_open_alloc(bool use_snapshot)
 {
   assert(alloc == NULL);
   assert(bdev->get_size());
@@ -4611,18 +5234,28 @@ int BlueStore::_open_alloc()
   uint64_t num = 0, bytes = 0;
 
   dout(1) << __func__ << " opening allocation metadata" << dendl;
-  // initialize from freelist
-  fm->enumerate_reset();
-  uint64_t offset, length;
-  while (fm->enumerate_next(&offset, &length)) {
-    alloc->init_add_free(offset, length);
-    ++num;
-    bytes += length;
-  }
-  fm->enumerate_reset();
+  int r = use_snapshot ? _load_alloc_snapshot(&num, &bytes) : -ENOENT;
+  if (r < 0) {
+    // initialize from freelist
+    fm->enumerate_reset();
+    uint64_t offset, length;
+    while (fm->enumerate_next(&offset, &length)) {
+      alloc->init_add_free(offset, length);
+      ++num;
+      bytes += length;
+    }
+    fm->enumerate_reset();
+  }
   dout(1) << __func__ << " loaded " << byte_u_t(bytes)
 	  << " in " << num << " extents"
+	  << (r < 0 ? "" : " from snapshot")
 	  << dendl;
+  if (r == 0) {
+    logger->inc(l_bluestore_alloc_snapshot_loaded);
+  }
+  alloc_snapshot_changes = alloc_fm_changes;
+  alloc_snapshot_next = mono_clock::now() + ceph::make_timespan(
+    cct->_conf->get_val<double>("bluestore_alloc_snapshot_interval"));
 
   // also mark bluefs space as allocated
   for (auto e = bluefs_extents.begin(); e != bluefs_extents.end(); ++e) {
@@ -4645,53 +5278,313 @@ void BlueStore::_close_alloc()
   alloc = NULL;
 }
 
-int BlueStore::_open_fsid(bool create)
-{
-  assert(fsid_fd < 0);
-  int flags = O_RDWR;
-  if (create)
-    flags |= O_CREAT;
-  fsid_fd = ::openat(path_fd, "fsid", flags, 0644);
-  if (fsid_fd < 0) {
-    int err = -errno;
-    derr << __func__ << " " << cpp_strerror(err) << dendl;
-    return err;
-  }
-  return 0;
-}
+/*
+ * Allocator snapshot
+ *
+ * Rebuilding the allocator means walking the whole freelist, which on a
+ * large (or fragmented) device dominates mount time.  Instead we
+ * checkpoint the free extents into the kv store: a header under
+ * PREFIX_SUPER "alloc_snapshot" and the extents themselves in fixed size
+ * chunks under PREFIX_ALLOC_SNAPSHOT.  The header is the validity stamp:
+ * every txc that changes the freelist while it may exist removes it in
+ * the same kv transaction, so a snapshot found at mount always matches
+ * the freelist.
+ *
+ * The snapshot records what the freelist considers free, i.e. the
+ * allocator free space plus bluefs_extents; mount keeps marking the
+ * latter as allocated as before.
+ *
+ * Older releases know nothing of the stamp and would leave a stale one
+ * behind, so min_compat_ondisk_format is raised to
+ * alloc_snapshot_compat_ondisk_format before the first snapshot is
+ * written; from then on they refuse to mount the store.
+ */
 
-int BlueStore::_read_fsid(uuid_d *uuid)
+static const uint64_t ALLOC_SNAPSHOT_CHUNK_EXTENTS = 65536;
+
+bool BlueStore::_alloc_snapshot_enabled()
 {
-  char fsid_str[40];
-  memset(fsid_str, 0, sizeof(fsid_str));
-  int ret = safe_read(fsid_fd, fsid_str, sizeof(fsid_str));
-  if (ret < 0) {
-    derr << __func__ << " failed: " << cpp_strerror(ret) << dendl;
-    return ret;
-  }
-  if (ret > 36)
-    fsid_str[36] = 0;
-  else
-    fsid_str[ret] = 0;
-  if (!uuid->parse(fsid_str)) {
-    derr << __func__ << " unparsable uuid " << fsid_str << dendl;
-    return -EINVAL;
-  }
-  return 0;
+  return cct->_conf->get_val<bool>("bluestore_alloc_snapshot") &&
+    !cct->_conf->bluestore_debug_no_reuse_blocks;
 }
 
-int BlueStore::_write_fsid()
+int BlueStore::_load_alloc_snapshot(uint64_t *num, uint64_t *bytes)
 {
-  int r = ::ftruncate(fsid_fd, 0);
+  alloc_snapshot_valid = false;
+
+  bufferlist bl;
+  int r = db->get(PREFIX_SUPER, "alloc_snapshot", &bl);
   if (r < 0) {
-    r = -errno;
-    derr << __func__ << " fsid truncate failed: " << cpp_strerror(r) << dendl;
-    return r;
+    dout(10) << __func__ << " no snapshot" << dendl;
+    return -ENOENT;
   }
-  string str = stringify(fsid) + "\n";
-  r = safe_write(fsid_fd, str.c_str(), str.length());
-  if (r < 0) {
-    derr << __func__ << " fsid write failed: " << cpp_strerror(r) << dendl;
+  // whether we use it or not, writes must drop it from now on
+  alloc_snapshot_valid = true;
+  if (!_alloc_snapshot_enabled()) {
+    return -ENOENT;
+  }
+  if (compat_ondisk_format < alloc_snapshot_compat_ondisk_format) {
+    // a release that ignores the stamp may have mounted us since
+    dout(1) << __func__ << " min_compat_ondisk_format "
+	    << compat_ondisk_format << ", ignoring snapshot" << dendl;
+    return -ENOENT;
+  }
+
+  bluestore_alloc_snapshot_t h;
+  try {
+    auto p = bl.cbegin();
+    decode(h, p);
+  } catch (buffer::error& e) {
+    derr << __func__ << " unable to decode snapshot header" << dendl;
+    return -EIO;
+  }
+  if (h.size != bdev->get_size() || h.min_alloc_size != min_alloc_size) {
+    dout(1) << __func__ << " snapshot for size 0x" << std::hex << h.size
+	    << " min_alloc_size 0x" << h.min_alloc_size << std::dec
+	    << " does not match, ignoring" << dendl;
+    return -ESTALE;
+  }
+
+  // read and verify everything before touching the allocator
+  std::vector<std::pair<uint64_t,uint64_t>> extents;
+  extents.reserve(h.num_extents);
+  uint32_t crc = -1;
+  uint32_t chunks = 0;
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_ALLOC_SNAPSHOT);
+  try {
+    for (it->lower_bound(string()); it->valid(); it->next(), ++chunks) {
+      bufferlist v = it->value();
+      crc = v.crc32c(crc);
+      std::vector<std::pair<uint64_t,uint64_t>> chunk;
+      auto p = v.cbegin();
+      decode(chunk, p);
+      extents.insert(extents.end(), chunk.begin(), chunk.end());
+    }
+  } catch (buffer::error& e) {
+    derr << __func__ << " unable to decode snapshot chunk " << chunks << dendl;
+    return -EIO;
+  }
+  if (chunks != h.num_chunks || extents.size() != h.num_extents ||
+      crc != h.crc) {
+    derr << __func__ << " snapshot has " << chunks << " chunks, "
+	 << extents.size() << " extents, crc " << crc
+	 << ", expected " << h.num_chunks << ", " << h.num_extents
+	 << ", " << h.crc << dendl;
+    return -EIO;
+  }
+
+  for (auto& e : extents) {
+    alloc->init_add_free(e.first, e.second);
+  }
+  *num = h.num_extents;
+  *bytes = h.bytes;
+  return 0;
+}
+
+void BlueStore::_prepare_alloc_snapshot(
+  KeyValueDB::Transaction t,
+  const interval_set<uint64_t>& bluefs_free)  ///< bluefs_extents (+reclaiming)
+{
+  std::vector<std::pair<uint64_t,uint64_t>> extents;
+  bluestore_alloc_snapshot_t h;
+  alloc->dump([&](uint64_t offset, uint64_t length) {
+      extents.emplace_back(offset, length);
+      h.bytes += length;
+    });
+  for (auto p = bluefs_free.begin(); p != bluefs_free.end(); ++p) {
+    extents.emplace_back(p.get_start(), p.get_len());
+    h.bytes += p.get_len();
+  }
+  h.size = bdev->get_size();
+  h.min_alloc_size = min_alloc_size;
+  h.num_extents = extents.size();
+
+  t->rmkeys_by_prefix(PREFIX_ALLOC_SNAPSHOT);
+  for (uint64_t i = 0; i < extents.size();
+       i += ALLOC_SNAPSHOT_CHUNK_EXTENTS) {
+    auto end = std::min<uint64_t>(extents.size(),
+				  i + ALLOC_SNAPSHOT_CHUNK_EXTENTS);
+    std::vector<std::pair<uint64_t,uint64_t>> chunk(
+      extents.begin() + i, extents.begin() + end);
+    bufferlist bl;
+    encode(chunk, bl);
+    h.crc = bl.crc32c(h.crc);
+    string key;
+    _key_encode_u64(h.num_chunks++, &key);
+    t->set(PREFIX_ALLOC_SNAPSHOT, key, bl);
+  }
+
+  bufferlist bl;
+  encode(h, bl);
+  t->set(PREFIX_SUPER, "alloc_snapshot", bl);
+  dout(10) << __func__ << " " << byte_u_t(h.bytes) << " in "
+	   << h.num_extents << " extents, " << h.num_chunks << " chunks"
+	   << dendl;
+}
+
+int BlueStore::_write_alloc_snapshot()
+{
+  // only valid if nothing is in flight, e.g. at umount
+  if (alloc_unsettled) {
+    dout(1) << __func__ << " " << alloc_unsettled
+	    << " txcs still hold allocations, skipping" << dendl;
+    return -EBUSY;
+  }
+  int r = _require_compat_ondisk_format(alloc_snapshot_compat_ondisk_format);
+  if (r < 0) {
+    return r;
+  }
+  alloc_snapshot_valid = true;
+  KeyValueDB::Transaction t = db->get_transaction();
+  interval_set<uint64_t> bluefs_free = bluefs_extents;
+  bluefs_free.insert(bluefs_extents_reclaiming);
+  _prepare_alloc_snapshot(t, bluefs_free);
+  r = db->submit_transaction_sync(t);
+  if (r < 0) {
+    derr << __func__ << " failed: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  alloc_snapshot_changes = alloc_fm_changes;
+  logger->inc(l_bluestore_alloc_snapshot_written);
+  return 0;
+}
+
+bool BlueStore::_alloc_snapshot_wanted(ceph::timespan *wait)
+{
+  double interval =
+    cct->_conf->get_val<double>("bluestore_alloc_snapshot_interval");
+  if (interval <= 0 ||
+      alloc_snapshot_changes == alloc_fm_changes ||
+      !_alloc_snapshot_enabled() ||
+      // queued discards are released to the allocator behind our back
+      (cct->_conf->bdev_enable_discard && cct->_conf->bdev_async_discard)) {
+    return false;
+  }
+  auto now = mono_clock::now();
+  *wait = alloc_snapshot_next > now ?
+    ceph::timespan(alloc_snapshot_next - now) : ceph::timespan::zero();
+  return true;
+}
+
+void BlueStore::_build_alloc_snapshot(
+  const interval_set<uint64_t>& bluefs_free,  ///< captured by kv_sync_thread
+  uint64_t changes)                           ///< alloc_fm_changes back then
+{
+  // Runs on alloc_snapshot_finisher: dumping a large allocator and encoding
+  // the extents must not stall kv_sync_thread, which only submits the
+  // result (see _submit_alloc_snapshot()).  The bluefs extent sets belong
+  // to kv_sync_thread, so it hands us a copy along with the change count
+  // it was taken at; a bluefs gift or reclaim since bumps that count
+  // before it touches the allocator, and so does any freelist change.
+  double interval =
+    cct->_conf->get_val<double>("bluestore_alloc_snapshot_interval");
+  auto now = mono_clock::now();
+
+  // Raise the flag first so any txc finalized from here on removes the
+  // stamp in its own kv transaction.  Allocations in flight are not in
+  // the freelist yet (and releases not in the allocator), so we only go
+  // ahead if no txc holds any; _txc_alloc_unsettled() counts a txc before
+  // it touches the allocator, which makes the checks below race free.
+  alloc_snapshot_valid = true;
+  KeyValueDB::Transaction t;
+  if (alloc_unsettled) {
+    dout(20) << __func__ << " " << alloc_unsettled << " txcs unsettled, retry"
+	     << dendl;
+  } else if (alloc_fm_changes != changes) {
+    dout(20) << __func__ << " changed since queued, retry" << dendl;
+  } else if (_require_compat_ondisk_format(
+	       alloc_snapshot_compat_ondisk_format) < 0) {
+    dout(1) << __func__ << " unable to raise compat, retry" << dendl;
+  } else {
+    t = db->get_transaction();
+    _prepare_alloc_snapshot(t, bluefs_free);
+    if (alloc_unsettled || alloc_fm_changes != changes) {
+      dout(20) << __func__ << " raced with a txc, retry" << dendl;
+      t.reset();
+    }
+  }
+
+  std::lock_guard<std::mutex> l(kv_lock);
+  alloc_snapshot_building = false;
+  alloc_snapshot_next = now + ceph::make_timespan(
+    t ? interval : std::min(interval, 1.0));
+  alloc_snapshot_t = t;
+  alloc_snapshot_t_changes = changes;
+  kv_cond.notify_all();
+}
+
+void BlueStore::_submit_alloc_snapshot(KeyValueDB::Transaction t,
+				       uint64_t changes)
+{
+  if (alloc_fm_changes != changes) {
+    // the freelist moved on while the snapshot waited for us
+    dout(20) << __func__ << " raced with a txc, dropping snapshot" << dendl;
+    return;
+  }
+  int r = db->submit_transaction_sync(t);
+  assert(r == 0);
+  if (alloc_fm_changes != changes) {
+    // a txc finalized meanwhile may have committed its removal of the
+    // stamp before we wrote it
+    dout(20) << __func__ << " raced with a txc, dropping snapshot" << dendl;
+    KeyValueDB::Transaction t = db->get_transaction();
+    t->rmkey(PREFIX_SUPER, "alloc_snapshot");
+    r = db->submit_transaction_sync(t);
+    assert(r == 0);
+    return;
+  }
+  alloc_snapshot_changes = changes;
+  logger->inc(l_bluestore_alloc_snapshot_written);
+  dout(10) << __func__ << " done" << dendl;
+}
+
+int BlueStore::_open_fsid(bool create)
+{
+  assert(fsid_fd < 0);
+  int flags = O_RDWR;
+  if (create)
+    flags |= O_CREAT;
+  fsid_fd = ::openat(path_fd, "fsid", flags, 0644);
+  if (fsid_fd < 0) {
+    int err = -errno;
+    derr << __func__ << " " << cpp_strerror(err) << dendl;
+    return err;
+  }
+  return 0;
+}
+
+int BlueStore::_read_fsid(uuid_d *uuid)
+{
+  char fsid_str[40];
+  memset(fsid_str, 0, sizeof(fsid_str));
+  int ret = safe_read(fsid_fd, fsid_str, sizeof(fsid_str));
+  if (ret < 0) {
+    derr << __func__ << " failed: " << cpp_strerror(ret) << dendl;
+    return ret;
+  }
+  if (ret > 36)
+    fsid_str[36] = 0;
+  else
+    fsid_str[ret] = 0;
+  if (!uuid->parse(fsid_str)) {
+    derr << __func__ << " unparsable uuid " << fsid_str << dendl;
+    return -EINVAL;
+  }
+  return 0;
+}
+
+int BlueStore::_write_fsid()
+{
+  int r = ::ftruncate(fsid_fd, 0);
+  if (r < 0) {
+    r = -errno;
+    derr << __func__ << " fsid truncate failed: " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  string str = stringify(fsid) + "\n";
+  r = safe_write(fsid_fd, str.c_str(), str.length());
+  if (r < 0) {
+    derr << __func__ << " fsid write failed: " << cpp_strerror(r) << dendl;
     return r;
   }
   r = ::fsync(fsid_fd);
@@ -5249,6 +6142,9 @@ int BlueStore::_balance_bluefs_freespace(PExtentVector *extents)
     dout(10) << __func__ << " gifting " << gift
 	     << " (" << byte_u_t(gift) << ")" << dendl;
 
+    // a gift moves space from the allocator to bluefs_extents; make an
+    // alloc snapshot being built concurrently start over
+    ++alloc_fm_changes;
     int64_t alloc_len = alloc->allocate(gift, cct->_conf->bluefs_alloc_size,
 					0, 0, extents);
 
@@ -5279,6 +6175,7 @@ int BlueStore::_balance_bluefs_freespace(PExtentVector *extents)
     reclaim = std::min<uint64_t>(reclaim, 1ull << 31);
     dout(10) << __func__ << " reclaiming " << reclaim
 	     << " (" << byte_u_t(reclaim) << ")" << dendl;
+    ++alloc_fm_changes;  // see the gift above
 
     while (reclaim > 0) {
       // NOTE: this will block and do IO.
@@ -5588,6 +6485,7 @@ int BlueStore::mkfs()
     }
 
     ondisk_format = latest_ondisk_format;
+    compat_ondisk_format = min_compat_ondisk_format;
     _prepare_ondisk_format_super(t);
     db->submit_transaction_sync(t);
   }
@@ -5721,7 +6619,7 @@ int BlueStore::_mount(bool kv_only, bool open_db)
   if (r < 0)
     goto out_db;
 
-  r = _open_alloc();
+  r = _open_alloc(true);
   if (r < 0)
     goto out_fm;
 
@@ -5746,6 +6644,8 @@ int BlueStore::_mount(bool kv_only, bool open_db)
     goto out_stop;
 
   mempool_thread.init();
+  compress_tp.init(
+    cct->_conf->get_val<uint64_t>("bluestore_compression_threads"));
 
   mounted = true;
   return 0;
@@ -5775,13 +6675,20 @@ int BlueStore::umount()
   dout(1) << __func__ << dendl;
 
   _osr_drain_all();
+  _read_async_drain();
 
   mounted = false;
   if (!_kv_only) {
     mempool_thread.shutdown();
+    compress_tp.shutdown();
     dout(20) << __func__ << " stopping kv thread" << dendl;
     _kv_stop();
     _flush_cache();
+    if (_alloc_snapshot_enabled()) {
+      dout(20) << __func__ << " writing allocator snapshot" << dendl;
+      bdev->discard_drain();
+      _write_alloc_snapshot();
+    }
     dout(20) << __func__ << " closing" << dendl;
 
     _close_alloc();
@@ -5858,7 +6765,7 @@ int BlueStore::_fsck_check_extents(
 	  bs.set(pos);
       });
       if (repairer) {
-	repairer->get_space_usage_tracker().set_used( e.offset, e.length, cid, oid);
+	repairer->note_space_used(e.offset, e.length, cid, oid);
       }
 
     if (e.end() > bdev->get_size()) {
@@ -5870,6 +6777,501 @@ int BlueStore::_fsck_check_extents(
   return errors;
 }
 
+typedef btree::btree_set<
+  uint64_t,std::less<uint64_t>,
+  mempool::bluestore_fsck::pool_allocator<uint64_t>> uint64_t_btree_t;
+
+struct BlueStore::fsck_sb_info_t {
+  coll_t cid;
+  list<ghobject_t> oids;
+  SharedBlobRef sb;
+  bluestore_extent_ref_map_t ref_map;
+  bool compressed = false;
+  bool passed = false;
+  bool updated = false;
+};
+
+// a blob region read by deep fsck, verified once the batch completes
+struct BlueStore::fsck_read_t {
+  CollectionRef c;
+  OnodeRef o;
+  BlobRef b;
+  uint64_t b_off;           ///< blob offset the data starts at
+  uint64_t logical_offset;  ///< object offset the data starts at
+  bufferlist bl;
+};
+
+struct BlueStore::fsck_read_batch_t {
+  std::unique_ptr<IOContext> ioc;
+  mempool::bluestore_fsck::list<fsck_read_t> reads;
+};
+
+// everything a fsck worker collects while walking its part of the onode
+// keyspace; merged into the global state once all workers are done
+struct BlueStore::fsck_shard_t {
+  int errors = 0;
+  uint64_t num_objects = 0;
+  uint64_t num_extents = 0;
+  uint64_t num_blobs = 0;
+  uint64_t num_spanning_blobs = 0;
+  uint64_t num_sharded_objects = 0;
+  uint64_t num_object_shards = 0;
+
+  uint64_t_btree_t used_nids;
+  uint64_t_btree_t used_omap_head;
+  uint64_t_btree_t used_pgmeta_omap_head;
+  mempool_dynamic_bitset used_blocks;
+  store_statfs_t expected_statfs;
+  mempool::bluestore_fsck::map<uint64_t,fsck_sb_info_t> sb_info;
+
+  // deep reads: one batch is being filled while the previous one is in
+  // flight, each holding at most read_queue_depth regions
+  unsigned read_queue_depth = 0;
+  fsck_read_batch_t filling;
+  fsck_read_batch_t in_flight;
+};
+
+void BlueStore::_fsck_check_objects(
+  fsck_shard_t& s,
+  const string& start,
+  const string& end,
+  bool deep,
+  BlueStoreRepairer* repairer)
+{
+  dout(10) << __func__ << " " << pretty_binary_string(start)
+	   << " to " << pretty_binary_string(end) << dendl;
+  KeyValueDB::Iterator it = db->get_iterator(PREFIX_OBJ);
+  if (!it) {
+    return;
+  }
+  CollectionRef c;
+  spg_t pgid;
+  mempool::bluestore_fsck::list<string> expecting_shards;
+  for (it->lower_bound(start);
+       it->valid() && (end.empty() || it->key() < end);
+       it->next()) {
+    if (g_conf->bluestore_debug_fsck_abort) {
+      return;
+    }
+    dout(30) << __func__ << " key "
+	     << pretty_binary_string(it->key()) << dendl;
+    if (is_extent_shard_key(it->key())) {
+      while (!expecting_shards.empty() &&
+	     expecting_shards.front() < it->key()) {
+	derr << "fsck error: missing shard key "
+	     << pretty_binary_string(expecting_shards.front())
+	     << dendl;
+	++s.errors;
+	expecting_shards.pop_front();
+      }
+      if (!expecting_shards.empty() &&
+	  expecting_shards.front() == it->key()) {
+	// all good
+	expecting_shards.pop_front();
+	continue;
+      }
+
+      uint32_t offset;
+      string okey;
+      get_key_extent_shard(it->key(), &okey, &offset);
+      derr << "fsck error: stray shard 0x" << std::hex << offset
+	   << std::dec << dendl;
+      if (expecting_shards.empty()) {
+	derr << "fsck error: " << pretty_binary_string(it->key())
+	     << " is unexpected" << dendl;
+	++s.errors;
+	continue;
+      }
+      while (expecting_shards.front() > it->key()) {
+	derr << "fsck error:   saw " << pretty_binary_string(it->key())
+	     << dendl;
+	derr << "fsck error:   exp "
+	     << pretty_binary_string(expecting_shards.front()) << dendl;
+	++s.errors;
+	expecting_shards.pop_front();
+	if (expecting_shards.empty()) {
+	  break;
+	}
+      }
+      continue;
+    }
+
+    ghobject_t oid;
+    int r = get_key_object(it->key(), &oid);
+    if (r < 0) {
+      derr << "fsck error: bad object key "
+	   << pretty_binary_string(it->key()) << dendl;
+      ++s.errors;
+      continue;
+    }
+    if (!c ||
+	oid.shard_id != pgid.shard ||
+	oid.hobj.pool != (int64_t)pgid.pool() ||
+	!c->contains(oid)) {
+      c = nullptr;
+      for (auto& p : coll_map) {
+	if (p.second->contains(oid)) {
+	  c = p.second;
+	  break;
+	}
+      }
+      if (!c) {
+	derr << "fsck error: stray object " << oid
+	     << " not owned by any collection" << dendl;
+	++s.errors;
+	continue;
+      }
+      c->cid.is_pg(&pgid);
+      dout(20) << __func__ << "  collection " << c->cid << " " << c->cnode
+	       << dendl;
+    }
+
+    if (!expecting_shards.empty()) {
+      for (auto &k : expecting_shards) {
+	derr << "fsck error: missing shard key "
+	     << pretty_binary_string(k) << dendl;
+      }
+      ++s.errors;
+      expecting_shards.clear();
+    }
+
+    dout(10) << __func__ << "  " << oid << dendl;
+    logger->inc(l_bluestore_fsck_onodes);
+    RWLock::RLocker l(c->lock);
+    OnodeRef o = c->get_onode(oid, false);
+    if (o->onode.nid) {
+      if (o->onode.nid > nid_max) {
+	derr << "fsck error: " << oid << " nid " << o->onode.nid
+	     << " > nid_max " << nid_max << dendl;
+	++s.errors;
+      }
+      if (s.used_nids.count(o->onode.nid)) {
+	derr << "fsck error: " << oid << " nid " << o->onode.nid
+	     << " already in use" << dendl;
+	++s.errors;
+	continue; // go for next object
+      }
+      s.used_nids.insert(o->onode.nid);
+    }
+    ++s.num_objects;
+    s.num_spanning_blobs += o->extent_map.spanning_blob_map.size();
+    o->extent_map.fault_range(db, 0, OBJECT_MAX_SIZE);
+    _dump_onode(o);
+    // shards
+    if (!o->extent_map.shards.empty()) {
+      ++s.num_sharded_objects;
+      s.num_object_shards += o->extent_map.shards.size();
+    }
+    for (auto& sh : o->extent_map.shards) {
+      dout(20) << __func__ << "    shard " << *sh.shard_info << dendl;
+      expecting_shards.push_back(string());
+      get_extent_shard_key(o->key, sh.shard_info->offset,
+			   &expecting_shards.back());
+      if (sh.shard_info->offset >= o->onode.size) {
+	derr << "fsck error: " << oid << " shard 0x" << std::hex
+	     << sh.shard_info->offset << " past EOF at 0x" << o->onode.size
+	     << std::dec << dendl;
+	++s.errors;
+      }
+    }
+    // inline data
+    if (o->onode.has_inline_data()) {
+      if (!o->extent_map.extent_map.empty()) {
+	derr << "fsck error: " << oid << " has both inline data and lextents"
+	     << dendl;
+	++s.errors;
+      }
+      if (o->onode.inline_data.length() > o->onode.size) {
+	derr << "fsck error: " << oid << " inline data 0x" << std::hex
+	     << o->onode.inline_data.length() << " past EOF at 0x"
+	     << o->onode.size << std::dec << dendl;
+	++s.errors;
+      }
+      if (compat_ondisk_format < inline_data_compat_ondisk_format) {
+	derr << "fsck error: " << oid << " has inline data but"
+	     << " min_compat_ondisk_format is " << compat_ondisk_format
+	     << dendl;
+	++s.errors;
+      }
+      s.expected_statfs.stored += o->onode.inline_data.length();
+    }
+    // lextents
+    map<BlobRef,bluestore_blob_t::unused_t> referenced;
+    uint64_t pos = 0;
+    mempool::bluestore_fsck::map<BlobRef,
+				 bluestore_blob_use_tracker_t> ref_map;
+    for (auto& l : o->extent_map.extent_map) {
+      dout(20) << __func__ << "    " << l << dendl;
+      if (l.logical_offset < pos) {
+	derr << "fsck error: " << oid << " lextent at 0x"
+	     << std::hex << l.logical_offset
+	     << " overlaps with the previous, which ends at 0x" << pos
+	     << std::dec << dendl;
+	++s.errors;
+      }
+      if (o->extent_map.spans_shard(l.logical_offset, l.length)) {
+	derr << "fsck error: " << oid << " lextent at 0x"
+	     << std::hex << l.logical_offset << "~" << l.length
+	     << " spans a shard boundary"
+	     << std::dec << dendl;
+	++s.errors;
+      }
+      pos = l.logical_offset + l.length;
+      s.expected_statfs.stored += l.length;
+      assert(l.blob);
+      const bluestore_blob_t& blob = l.blob->get_blob();
+
+      auto& ref = ref_map[l.blob];
+      if (ref.is_empty()) {
+	uint32_t min_release_size = blob.get_release_size(min_alloc_size);
+	uint32_t l = blob.get_logical_length();
+	ref.init(l, min_release_size);
+      }
+      ref.get(
+	l.blob_offset,
+	l.length);
+      ++s.num_extents;
+      if (blob.has_unused()) {
+	auto p = referenced.find(l.blob);
+	bluestore_blob_t::unused_t *pu;
+	if (p == referenced.end()) {
+	  pu = &referenced[l.blob];
+	} else {
+	  pu = &p->second;
+	}
+	uint64_t blob_len = blob.get_logical_length();
+	assert((blob_len % (sizeof(*pu)*8)) == 0);
+	assert(l.blob_offset + l.length <= blob_len);
+	uint64_t chunk_size = blob_len / (sizeof(*pu)*8);
+	uint64_t start = l.blob_offset / chunk_size;
+	uint64_t end =
+	  round_up_to(l.blob_offset + l.length, chunk_size) / chunk_size;
+	for (auto i = start; i < end; ++i) {
+	  (*pu) |= (1u << i);
+	}
+      }
+    }
+    for (auto &i : referenced) {
+      dout(20) << __func__ << "  referenced 0x" << std::hex << i.second
+	       << std::dec << " for " << *i.first << dendl;
+      const bluestore_blob_t& blob = i.first->get_blob();
+      if (i.second & blob.unused) {
+	derr << "fsck error: " << oid << " blob claims unused 0x"
+	     << std::hex << blob.unused
+	     << " but extents reference 0x" << i.second << std::dec
+	     << " on blob " << *i.first << dendl;
+	++s.errors;
+      }
+      if (blob.has_csum()) {
+	uint64_t blob_len = blob.get_logical_length();
+	uint64_t unused_chunk_size = blob_len / (sizeof(blob.unused)*8);
+	unsigned csum_count = blob.get_csum_count();
+	unsigned csum_chunk_size = blob.get_csum_chunk_size();
+	for (unsigned p = 0; p < csum_count; ++p) {
+	  unsigned pos = p * csum_chunk_size;
+	  unsigned firstbit = pos / unused_chunk_size;    // [firstbit,lastbit]
+	  unsigned lastbit = (pos + csum_chunk_size - 1) / unused_chunk_size;
+	  unsigned mask = 1u << firstbit;
+	  for (unsigned b = firstbit + 1; b <= lastbit; ++b) {
+	    mask |= 1u << b;
+	  }
+	  if ((blob.unused & mask) == mask) {
+	    // this csum chunk region is marked unused
+	    if (blob.get_csum_item(p) != 0) {
+	      derr << "fsck error: " << oid
+		   << " blob claims csum chunk 0x" << std::hex << pos
+		   << "~" << csum_chunk_size
+		   << " is unused (mask 0x" << mask << " of unused 0x"
+		   << blob.unused << ") but csum is non-zero 0x"
+		   << blob.get_csum_item(p) << std::dec << " on blob "
+		   << *i.first << dendl;
+	      ++s.errors;
+	    }
+	  }
+	}
+      }
+    }
+    for (auto &i : ref_map) {
+      ++s.num_blobs;
+      const bluestore_blob_t& blob = i.first->get_blob();
+      bool equal = i.first->get_blob_use_tracker().equal(i.second);
+      if (!equal) {
+	derr << "fsck error: " << oid << " blob " << *i.first
+	     << " doesn't match expected ref_map " << i.second << dendl;
+	++s.errors;
+      }
+      if (blob.is_compressed()) {
+	s.expected_statfs.compressed += blob.get_compressed_payload_length();
+	s.expected_statfs.compressed_original +=
+	  i.first->get_referenced_bytes();
+      }
+      if (blob.is_shared()) {
+	if (i.first->shared_blob->get_sbid() > blobid_max) {
+	  derr << "fsck error: " << oid << " blob " << blob
+	       << " sbid " << i.first->shared_blob->get_sbid() << " > blobid_max "
+	       << blobid_max << dendl;
+	  ++s.errors;
+	} else if (i.first->shared_blob->get_sbid() == 0) {
+	  derr << "fsck error: " << oid << " blob " << blob
+	       << " marked as shared but has uninitialized sbid"
+	       << dendl;
+	  ++s.errors;
+	}
+	fsck_sb_info_t& sbi = s.sb_info[i.first->shared_blob->get_sbid()];
+	assert(sbi.cid == coll_t() || sbi.cid == c->cid);
+	sbi.cid = c->cid;
+	sbi.sb = i.first->shared_blob;
+	sbi.oids.push_back(oid);
+	sbi.compressed = blob.is_compressed();
+	for (auto e : blob.get_extents()) {
+	  if (e.is_valid()) {
+	    sbi.ref_map.get(e.offset, e.length);
+	  }
+	}
+      } else {
+	s.errors += _fsck_check_extents(c->cid, oid, blob.get_extents(),
+					blob.is_compressed(),
+					s.used_blocks,
+					fm->get_alloc_size(),
+					repairer,
+					s.expected_statfs);
+      }
+    }
+    if (deep) {
+      _fsck_queue_deep_read(s, c, o);
+    }
+    // omap
+    if (o->onode.has_omap()) {
+      auto& m =
+	o->onode.is_pgmeta_omap() ? s.used_pgmeta_omap_head : s.used_omap_head;
+      if (m.count(o->onode.nid)) {
+	derr << "fsck error: " << oid << " omap_head " << o->onode.nid
+	     << " already in use" << dendl;
+	++s.errors;
+      } else {
+	m.insert(o->onode.nid);
+      }
+    }
+  }
+}
+
+void BlueStore::_fsck_queue_deep_read(
+  fsck_shard_t& s,
+  CollectionRef& c,
+  OnodeRef& o)
+{
+  // read what the lextents reference, rounded out to the csum chunks just
+  // like a regular read would; compressed blobs are read as a whole
+  map<BlobRef,interval_set<uint64_t>> regions;
+  map<BlobRef,uint64_t> blob_start;  // object offset of blob offset 0
+  for (auto& l : o->extent_map.extent_map) {
+    const bluestore_blob_t& blob = l.blob->get_blob();
+    blob_start.emplace(l.blob, l.logical_offset - l.blob_offset);
+    auto& r = regions[l.blob];
+    if (blob.is_compressed()) {
+      if (r.empty()) {
+	r.insert(0, blob.get_ondisk_length());
+      }
+      continue;
+    }
+    uint64_t chunk_size = blob.get_chunk_size(block_size);
+    uint64_t r_off = p2align<uint64_t>(l.blob_offset, chunk_size);
+    uint64_t r_end = std::min<uint64_t>(
+      p2roundup<uint64_t>(l.blob_offset + l.length, chunk_size),
+      blob.get_logical_length());
+    r.union_insert(r_off, r_end - r_off);
+  }
+
+  for (auto& p : regions) {
+    for (auto q = p.second.begin(); q != p.second.end(); ++q) {
+      if (s.filling.reads.size() >= s.read_queue_depth) {
+	// a single object may span more regions than the queue depth
+	_fsck_submit_deep_reads(s, c.get());
+      }
+      s.filling.reads.push_back(fsck_read_t());
+      fsck_read_t& rd = s.filling.reads.back();
+      rd.c = c;
+      rd.o = o;
+      rd.b = p.first;
+      rd.b_off = q.get_start();
+      rd.logical_offset = blob_start[p.first] + q.get_start();
+      int r = p.first->get_blob().map(
+	q.get_start(), q.get_len(),
+	[&](uint64_t offset, uint64_t length) {
+	  return bdev->aio_read(offset, length, &rd.bl, s.filling.ioc.get());
+	});
+      if (r < 0) {
+	// the submitted part of the batch is still reaped; the verification
+	// of this region is what reports the error
+	derr << __func__ << " bdev-read failed: " << cpp_strerror(r) << dendl;
+	assert(r == -EIO);
+	rd.bl.clear();
+      }
+    }
+  }
+}
+
+void BlueStore::_fsck_submit_deep_reads(fsck_shard_t& s, Collection *held)
+{
+  // keep a single batch in flight: what was queued last time has to be
+  // verified before the next batch goes out
+  _fsck_reap_deep_reads(s, held);
+  if (s.filling.ioc->has_pending_aios()) {
+    bdev->aio_submit(s.filling.ioc.get());
+  }
+  std::swap(s.filling, s.in_flight);
+  s.filling.ioc.reset(new IOContext(cct, NULL, true)); // allow EIO
+}
+
+void BlueStore::_fsck_reap_deep_reads(fsck_shard_t& s, Collection *held)
+{
+  if (s.in_flight.reads.empty()) {
+    return;
+  }
+  s.in_flight.ioc->aio_wait();
+  bool eio = s.in_flight.ioc->get_return_value() < 0;
+  uint64_t bytes = 0;
+  Onode *done = nullptr;  // object whose outcome is already known
+  for (auto& rd : s.in_flight.reads) {
+    if (rd.o.get() == done) {
+      continue;
+    }
+    const bluestore_blob_t& blob = rd.b->get_blob();
+    int r = 0;
+    if (eio) {
+      // we can't tell which region hit the error; redo the object's read
+      // the regular way
+      bufferlist bl;
+      if (rd.c.get() == held) {
+	r = _do_read(rd.c.get(), rd.o, 0, rd.o->onode.size, bl, 0);
+      } else {
+	RWLock::RLocker l(rd.c->lock);
+	r = _do_read(rd.c.get(), rd.o, 0, rd.o->onode.size, bl, 0);
+      }
+      bytes += bl.length();
+      done = rd.o.get();
+    } else if (rd.bl.length() == 0) {
+      r = -EIO;
+    } else {
+      bytes += rd.bl.length();
+      r = _verify_csum(rd.o, &blob, rd.b_off, rd.bl, rd.logical_offset);
+      if (r == 0 && blob.is_compressed()) {
+	bufferlist raw_bl;
+	r = _decompress(rd.bl, &raw_bl);
+      }
+    }
+    if (r < 0) {
+      ++s.errors;
+      derr << "fsck error: " << rd.o->oid << " error during read: "
+	   << cpp_strerror(r) << dendl;
+      done = rd.o.get();
+    }
+  }
+  logger->inc(l_bluestore_fsck_read_bytes, bytes);
+  s.in_flight.reads.clear();
+  s.in_flight.ioc.reset();
+}
+
 /**
 An overview for currently implemented repair logics 
 performed in fsck in two stages: detection(+preparation) and commit.
@@ -5915,9 +7317,6 @@ int BlueStore::_fsck(bool deep, bool repair)
   int errors = 0;
   unsigned repaired = 0;
 
-  typedef btree::btree_set<
-    uint64_t,std::less<uint64_t>,
-    mempool::bluestore_fsck::pool_allocator<uint64_t>> uint64_t_btree_t;
   uint64_t_btree_t used_nids;
   uint64_t_btree_t used_omap_head;
   uint64_t_btree_t used_pgmeta_omap_head;
@@ -5926,16 +7325,7 @@ int BlueStore::_fsck(bool deep, bool repair)
   mempool_dynamic_bitset used_blocks;
   KeyValueDB::Iterator it;
   store_statfs_t expected_statfs, actual_statfs;
-  struct sb_info_t {
-    coll_t cid;
-    list<ghobject_t> oids;
-    SharedBlobRef sb;
-    bluestore_extent_ref_map_t ref_map;
-    bool compressed = false;
-    bool passed = false;
-    bool updated = false;
-  };
-  mempool::bluestore_fsck::map<uint64_t,sb_info_t> sb_info;
+  mempool::bluestore_fsck::map<uint64_t,fsck_sb_info_t> sb_info;
 
   uint64_t num_objects = 0;
   uint64_t num_extents = 0;
@@ -6035,299 +7425,162 @@ int BlueStore::_fsck(bool deep, bool repair)
   expected_statfs.available = actual_statfs.available;
 
   // walk PREFIX_OBJ
-  dout(1) << __func__ << " walking object keyspace" << dendl;
-  it = db->get_iterator(PREFIX_OBJ);
-  if (it) {
-    CollectionRef c;
-    spg_t pgid;
-    mempool::bluestore_fsck::list<string> expecting_shards;
-    for (it->lower_bound(string()); it->valid(); it->next()) {
-      if (g_conf->bluestore_debug_fsck_abort) {
-	goto out_scan;
-      }
-      dout(30) << __func__ << " key "
-               << pretty_binary_string(it->key()) << dendl;
-      if (is_extent_shard_key(it->key())) {
-	while (!expecting_shards.empty() &&
-	       expecting_shards.front() < it->key()) {
-	  derr << "fsck error: missing shard key "
-	       << pretty_binary_string(expecting_shards.front())
-	       << dendl;
-	  ++errors;
-	  expecting_shards.pop_front();
-	}
-	if (!expecting_shards.empty() &&
-	    expecting_shards.front() == it->key()) {
-	  // all good
-	  expecting_shards.pop_front();
-	  continue;
-	}
-
-        uint32_t offset;
-        string okey;
-        get_key_extent_shard(it->key(), &okey, &offset);
-        derr << "fsck error: stray shard 0x" << std::hex << offset
-	     << std::dec << dendl;
-        if (expecting_shards.empty()) {
-          derr << "fsck error: " << pretty_binary_string(it->key())
-               << " is unexpected" << dendl;
-          ++errors;
-          continue;
-        }
-	while (expecting_shards.front() > it->key()) {
-	  derr << "fsck error:   saw " << pretty_binary_string(it->key())
-	       << dendl;
-	  derr << "fsck error:   exp "
-	       << pretty_binary_string(expecting_shards.front()) << dendl;
-	  ++errors;
-	  expecting_shards.pop_front();
-	  if (expecting_shards.empty()) {
-	    break;
-	  }
-	}
-	continue;
-      }
-
-      ghobject_t oid;
-      int r = get_key_object(it->key(), &oid);
-      if (r < 0) {
-        derr << "fsck error: bad object key "
-             << pretty_binary_string(it->key()) << dendl;
-	++errors;
-	continue;
-      }
-      if (!c ||
-	  oid.shard_id != pgid.shard ||
-	  oid.hobj.pool != (int64_t)pgid.pool() ||
-	  !c->contains(oid)) {
-	c = nullptr;
-	for (auto& p : coll_map) {
-	  if (p.second->contains(oid)) {
-	    c = p.second;
-	    break;
+  {
+    // split the keyspace at the collection boundaries (temp objects have a
+    // range of their own) and let the workers pick the ranges off the list
+    vector<string> bounds;
+    bounds.push_back(string());
+    for (auto& p : coll_map) {
+      string temp_start, temp_end, start, end;
+      get_coll_key_range(p.first, p.second->cnode.bits,
+			 &temp_start, &temp_end, &start, &end);
+      bounds.push_back(temp_start);
+      bounds.push_back(start);
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    unsigned num_threads = std::max<uint64_t>(1, std::min<uint64_t>(
+      cct->_conf->get_val<uint64_t>("bluestore_fsck_threads"),
+      bounds.size()));
+    uint64_t queue_depth = std::max<uint64_t>(1,
+      cct->_conf->get_val<uint64_t>("bluestore_fsck_read_queue_depth"));
+    dout(1) << __func__ << " walking object keyspace, " << bounds.size()
+	    << " ranges, " << num_threads << " threads" << dendl;
+
+    vector<fsck_shard_t> shards(num_threads);
+    std::atomic<size_t> next_range = {0};
+    std::mutex progress_lock;
+    std::condition_variable progress_cond;
+    unsigned running = num_threads;
+    vector<std::thread> workers;
+    for (auto& sh : shards) {
+      sh.used_blocks.resize(fm->get_alloc_units());
+      sh.read_queue_depth = queue_depth;
+      sh.filling.ioc.reset(new IOContext(cct, NULL, true)); // allow EIO
+      workers.push_back(make_named_thread(
+	"bstore_fsck",
+	[&](fsck_shard_t *sh) {
+	  size_t i;
+	  while ((i = next_range++) < bounds.size()) {
+	    _fsck_check_objects(
+	      *sh, bounds[i], i + 1 < bounds.size() ? bounds[i + 1] : string(),
+	      deep, repair ? &repairer : nullptr);
 	  }
-	}
-	if (!c) {
-          derr << "fsck error: stray object " << oid
-               << " not owned by any collection" << dendl;
-	  ++errors;
+	  _fsck_submit_deep_reads(*sh);
+	  _fsck_reap_deep_reads(*sh);
+	  std::lock_guard<std::mutex> l(progress_lock);
+	  --running;
+	  progress_cond.notify_all();
+	},
+	&sh));
+    }
+    {
+      uint64_t onodes0 = logger->get(l_bluestore_fsck_onodes);
+      uint64_t bytes0 = logger->get(l_bluestore_fsck_read_bytes);
+      auto walk_start = mono_clock::now();
+      std::unique_lock<std::mutex> l(progress_lock);
+      while (running > 0) {
+	if (progress_cond.wait_for(l, std::chrono::seconds(10)) !=
+	    std::cv_status::timeout) {
 	  continue;
 	}
-	c->cid.is_pg(&pgid);
-	dout(20) << __func__ << "  collection " << c->cid << " " << c->cnode
-		 << dendl;
-      }
-
-      if (!expecting_shards.empty()) {
-	for (auto &k : expecting_shards) {
-	  derr << "fsck error: missing shard key "
-	       << pretty_binary_string(k) << dendl;
-	}
-	++errors;
-	expecting_shards.clear();
+	double secs = std::chrono::duration<double>(
+	  mono_clock::now() - walk_start).count();
+	uint64_t onodes = logger->get(l_bluestore_fsck_onodes) - onodes0;
+	uint64_t bytes = logger->get(l_bluestore_fsck_read_bytes) - bytes0;
+	dout(1) << __func__ << " checked " << onodes << " onodes ("
+		<< (uint64_t)(onodes / secs) << "/s), read "
+		<< byte_u_t(bytes) << " (" << byte_u_t(bytes / secs) << "/s)"
+		<< dendl;
       }
+    }
+    for (auto& t : workers) {
+      t.join();
+    }
+    if (g_conf->bluestore_debug_fsck_abort) {
+      goto out_scan;
+    }
 
-      dout(10) << __func__ << "  " << oid << dendl;
-      RWLock::RLocker l(c->lock);
-      OnodeRef o = c->get_onode(oid, false);
-      if (o->onode.nid) {
-	if (o->onode.nid > nid_max) {
-	  derr << "fsck error: " << oid << " nid " << o->onode.nid
-	       << " > nid_max " << nid_max << dendl;
-	  ++errors;
-	}
-	if (used_nids.count(o->onode.nid)) {
-	  derr << "fsck error: " << oid << " nid " << o->onode.nid
-	       << " already in use" << dendl;
-	  ++errors;
-	  continue; // go for next object
-	}
-	used_nids.insert(o->onode.nid);
-      }
-      ++num_objects;
-      num_spanning_blobs += o->extent_map.spanning_blob_map.size();
-      o->extent_map.fault_range(db, 0, OBJECT_MAX_SIZE);
-      _dump_onode(o);
-      // shards
-      if (!o->extent_map.shards.empty()) {
-	++num_sharded_objects;
-	num_object_shards += o->extent_map.shards.size();
-      }
-      for (auto& s : o->extent_map.shards) {
-	dout(20) << __func__ << "    shard " << *s.shard_info << dendl;
-	expecting_shards.push_back(string());
-	get_extent_shard_key(o->key, s.shard_info->offset,
-			     &expecting_shards.back());
-	if (s.shard_info->offset >= o->onode.size) {
-	  derr << "fsck error: " << oid << " shard 0x" << std::hex
-	       << s.shard_info->offset << " past EOF at 0x" << o->onode.size
-	       << std::dec << dendl;
+    for (auto& sh : shards) {
+      errors += sh.errors;
+      num_objects += sh.num_objects;
+      num_extents += sh.num_extents;
+      num_blobs += sh.num_blobs;
+      num_spanning_blobs += sh.num_spanning_blobs;
+      num_sharded_objects += sh.num_sharded_objects;
+      num_object_shards += sh.num_object_shards;
+
+      expected_statfs.allocated += sh.expected_statfs.allocated;
+      expected_statfs.stored += sh.expected_statfs.stored;
+      expected_statfs.compressed += sh.expected_statfs.compressed;
+      expected_statfs.compressed_allocated +=
+	sh.expected_statfs.compressed_allocated;
+      expected_statfs.compressed_original +=
+	sh.expected_statfs.compressed_original;
+
+      // the workers only see their own objects: duplicates across them
+      // show up here
+      for (auto nid : sh.used_nids) {
+	if (!used_nids.insert(nid).second) {
+	  derr << "fsck error: nid " << nid << " already in use" << dendl;
 	  ++errors;
 	}
       }
-      // lextents
-      map<BlobRef,bluestore_blob_t::unused_t> referenced;
-      uint64_t pos = 0;
-      mempool::bluestore_fsck::map<BlobRef,
-				   bluestore_blob_use_tracker_t> ref_map;
-      for (auto& l : o->extent_map.extent_map) {
-	dout(20) << __func__ << "    " << l << dendl;
-	if (l.logical_offset < pos) {
-	  derr << "fsck error: " << oid << " lextent at 0x"
-	       << std::hex << l.logical_offset
-	       << " overlaps with the previous, which ends at 0x" << pos
-	       << std::dec << dendl;
-	  ++errors;
-	}
-	if (o->extent_map.spans_shard(l.logical_offset, l.length)) {
-	  derr << "fsck error: " << oid << " lextent at 0x"
-	       << std::hex << l.logical_offset << "~" << l.length
-	       << " spans a shard boundary"
-	       << std::dec << dendl;
+      for (auto nid : sh.used_omap_head) {
+	if (!used_omap_head.insert(nid).second) {
+	  derr << "fsck error: omap_head " << nid << " already in use" << dendl;
 	  ++errors;
 	}
-	pos = l.logical_offset + l.length;
-	expected_statfs.stored += l.length;
-	assert(l.blob);
-	const bluestore_blob_t& blob = l.blob->get_blob();
-
-        auto& ref = ref_map[l.blob];
-        if (ref.is_empty()) {
-          uint32_t min_release_size = blob.get_release_size(min_alloc_size);
-          uint32_t l = blob.get_logical_length();
-          ref.init(l, min_release_size);
-        }
-	ref.get(
-	  l.blob_offset, 
-	  l.length);
-	++num_extents;
-	if (blob.has_unused()) {
-	  auto p = referenced.find(l.blob);
-	  bluestore_blob_t::unused_t *pu;
-	  if (p == referenced.end()) {
-	    pu = &referenced[l.blob];
-	  } else {
-	    pu = &p->second;
-	  }
-	  uint64_t blob_len = blob.get_logical_length();
-	  assert((blob_len % (sizeof(*pu)*8)) == 0);
-	  assert(l.blob_offset + l.length <= blob_len);
-	  uint64_t chunk_size = blob_len / (sizeof(*pu)*8);
-	  uint64_t start = l.blob_offset / chunk_size;
-	  uint64_t end =
-	    round_up_to(l.blob_offset + l.length, chunk_size) / chunk_size;
-	  for (auto i = start; i < end; ++i) {
-	    (*pu) |= (1u << i);
-	  }
-	}
       }
-      for (auto &i : referenced) {
-	dout(20) << __func__ << "  referenced 0x" << std::hex << i.second
-		 << std::dec << " for " << *i.first << dendl;
-	const bluestore_blob_t& blob = i.first->get_blob();
-	if (i.second & blob.unused) {
-	  derr << "fsck error: " << oid << " blob claims unused 0x"
-	       << std::hex << blob.unused
-	       << " but extents reference 0x" << i.second << std::dec
-	       << " on blob " << *i.first << dendl;
+      for (auto nid : sh.used_pgmeta_omap_head) {
+	if (!used_pgmeta_omap_head.insert(nid).second) {
+	  derr << "fsck error: omap_head " << nid << " already in use" << dendl;
 	  ++errors;
 	}
-	if (blob.has_csum()) {
-	  uint64_t blob_len = blob.get_logical_length();
-	  uint64_t unused_chunk_size = blob_len / (sizeof(blob.unused)*8);
-	  unsigned csum_count = blob.get_csum_count();
-	  unsigned csum_chunk_size = blob.get_csum_chunk_size();
-	  for (unsigned p = 0; p < csum_count; ++p) {
-	    unsigned pos = p * csum_chunk_size;
-	    unsigned firstbit = pos / unused_chunk_size;    // [firstbit,lastbit]
-	    unsigned lastbit = (pos + csum_chunk_size - 1) / unused_chunk_size;
-	    unsigned mask = 1u << firstbit;
-	    for (unsigned b = firstbit + 1; b <= lastbit; ++b) {
-	      mask |= 1u << b;
-	    }
-	    if ((blob.unused & mask) == mask) {
-	      // this csum chunk region is marked unused
-	      if (blob.get_csum_item(p) != 0) {
-		derr << "fsck error: " << oid
-		     << " blob claims csum chunk 0x" << std::hex << pos
-		     << "~" << csum_chunk_size
-		     << " is unused (mask 0x" << mask << " of unused 0x"
-		     << blob.unused << ") but csum is non-zero 0x"
-		     << blob.get_csum_item(p) << std::dec << " on blob "
-		     << *i.first << dendl;
-		++errors;
-	      }
-	    }
-	  }
-	}
       }
-      for (auto &i : ref_map) {
-	++num_blobs;
-	const bluestore_blob_t& blob = i.first->get_blob();
-	bool equal = i.first->get_blob_use_tracker().equal(i.second);
-	if (!equal) {
-	  derr << "fsck error: " << oid << " blob " << *i.first
-	       << " doesn't match expected ref_map " << i.second << dendl;
-	  ++errors;
+
+      mempool_dynamic_bitset overlap = used_blocks & sh.used_blocks;
+      size_t start = overlap.find_first();
+      while (start != mempool_dynamic_bitset::npos) {
+	size_t cur = start;
+	size_t next;
+	while ((next = overlap.find_next(cur)) == cur + 1) {
+	  cur = next;
 	}
-	if (blob.is_compressed()) {
-	  expected_statfs.compressed += blob.get_compressed_payload_length();
-	  expected_statfs.compressed_original += 
-	    i.first->get_referenced_bytes();
+	derr << "fsck error: extent 0x" << std::hex
+	     << ((uint64_t)start * fm->get_alloc_size()) << "~"
+	     << ((cur + 1 - start) * fm->get_alloc_size()) << std::dec
+	     << " is referenced more than once (misreferenced)" << dendl;
+	++errors;
+	if (repair) {
+	  repairer.note_misreference(start * min_alloc_size,
+				     (cur + 1 - start) * min_alloc_size,
+				     true);
 	}
-	if (blob.is_shared()) {
-	  if (i.first->shared_blob->get_sbid() > blobid_max) {
-	    derr << "fsck error: " << oid << " blob " << blob
-		 << " sbid " << i.first->shared_blob->get_sbid() << " > blobid_max "
-		 << blobid_max << dendl;
-	    ++errors;
-	  } else if (i.first->shared_blob->get_sbid() == 0) {
-            derr << "fsck error: " << oid << " blob " << blob
-                 << " marked as shared but has uninitialized sbid"
-                 << dendl;
-            ++errors;
-          }
-	  sb_info_t& sbi = sb_info[i.first->shared_blob->get_sbid()];
-	  assert(sbi.cid == coll_t() || sbi.cid == c->cid);
-	  sbi.cid = c->cid;
-	  sbi.sb = i.first->shared_blob;
-	  sbi.oids.push_back(oid);
-	  sbi.compressed = blob.is_compressed();
-	  for (auto e : blob.get_extents()) {
-	    if (e.is_valid()) {
-	      sbi.ref_map.get(e.offset, e.length);
+	start = next;
+      }
+      used_blocks |= sh.used_blocks;
+      mempool_dynamic_bitset().swap(sh.used_blocks);
+
+      for (auto& p : sh.sb_info) {
+	fsck_sb_info_t& sbi = sb_info[p.first];
+	assert(sbi.cid == coll_t() || sbi.cid == p.second.cid);
+	sbi.cid = p.second.cid;
+	sbi.sb = p.second.sb;
+	sbi.oids.splice(sbi.oids.end(), p.second.oids);
+	sbi.compressed |= p.second.compressed;
+	if (sbi.ref_map.empty()) {
+	  sbi.ref_map = std::move(p.second.ref_map);
+	} else {
+	  for (auto& r : p.second.ref_map.ref_map) {
+	    for (unsigned i = 0; i < r.second.refs; ++i) {
+	      sbi.ref_map.get(r.first, r.second.length);
 	    }
 	  }
-	} else {
-	  errors += _fsck_check_extents(c->cid, oid, blob.get_extents(),
-					blob.is_compressed(),
-					used_blocks,
-					fm->get_alloc_size(),
-					repair ? &repairer : nullptr,
-					expected_statfs);
-        }
-      }
-      if (deep) {
-	bufferlist bl;
-	int r = _do_read(c.get(), o, 0, o->onode.size, bl, 0);
-	if (r < 0) {
-	  ++errors;
-	  derr << "fsck error: " << oid << " error during read: "
-	       << cpp_strerror(r) << dendl;
-	}
-      }
-      // omap
-      if (o->onode.has_omap()) {
-	auto& m =
-	  o->onode.is_pgmeta_omap() ? used_pgmeta_omap_head : used_omap_head;
-	if (m.count(o->onode.nid)) {
-	  derr << "fsck error: " << oid << " omap_head " << o->onode.nid
-	       << " already in use" << dendl;
-	  ++errors;
-	} else {
-	  m.insert(o->onode.nid);
 	}
       }
+      sh.sb_info.clear();
     }
   }
 
@@ -6356,7 +7609,7 @@ int BlueStore::_fsck(bool deep, bool repair)
 	++errors;
       } else {
 	++num_shared_blobs;
-	sb_info_t& sbi = p->second;
+	fsck_sb_info_t& sbi = p->second;
 	bluestore_shared_blob_t shared_blob(sbid);
 	bufferlist bl = it->value();
 	auto blp = bl.cbegin();
@@ -6538,12 +7791,12 @@ int BlueStore::_fsck(bool deep, bool repair)
 
 	    auto sb_it = sb_info.find(b->shared_blob->get_sbid());
 	    assert(sb_it != sb_info.end());
-	    sb_info_t& sbi = sb_it->second;
+	    fsck_sb_info_t& sbi = sb_it->second;
 
 	    for (auto& r : sbi.ref_map.ref_map) {
 	      expected_statfs.allocated -= r.second.length;
 	      if (sbi.compressed) {
-		// NB: it's crucial to use compressed flag from sb_info_t
+		// NB: it's crucial to use compressed flag from fsck_sb_info_t
 		// as we originally used that value while accumulating 
 		// expected_statfs
 		expected_statfs.compressed_allocated -= r.second.length;
@@ -6586,7 +7839,7 @@ int BlueStore::_fsck(bool deep, bool repair)
   } //if (repair && repairer.preprocess_misreference()) {
 
   for (auto &p : sb_info) {
-    sb_info_t& sbi = p.second;
+    fsck_sb_info_t& sbi = p.second;
     if (!sbi.passed) {
       derr << "fsck error: missing " << *sbi.sb << dendl;
       ++errors;
@@ -6767,6 +8020,12 @@ int BlueStore::_fsck(bool deep, bool repair)
   if (repair) {
     dout(5) << __func__ << " applying repair results" << dendl;
     repaired = repairer.apply(db);
+    if (repaired) {
+      // the freelist may have changed underneath the allocator snapshot
+      KeyValueDB::Transaction t = db->get_transaction();
+      t->rmkey(PREFIX_SUPER, "alloc_snapshot");
+      db->submit_transaction_sync(t);
+    }
     dout(5) << __func__ << " repair applied" << dendl;
   }
  out_scan:
@@ -6800,6 +8059,7 @@ int BlueStore::_fsck(bool deep, bool repair)
 	  << dendl;
 
   utime_t duration = ceph_clock_now() - start;
+  logger->tinc(l_bluestore_fsck_lat, duration);
   dout(1) << __func__ << " <<<FINISH>>> with " << errors << " errors, " << repaired
 	  << " repaired, " << (errors - (int)repaired) << " remaining in "
 	  << duration << " seconds" << dendl;
@@ -7066,15 +8326,21 @@ void BlueStore::_update_cache_logger()
   uint64_t num_blobs = 0;
   uint64_t num_buffers = 0;
   uint64_t num_buffer_bytes = 0;
+  uint64_t onode_ghost_hits = 0;
+  uint64_t buffer_ghost_hit_bytes = 0;
   for (auto c : cache_shards) {
     c->add_stats(&num_onodes, &num_extents, &num_blobs,
 		 &num_buffers, &num_buffer_bytes);
+    onode_ghost_hits += c->onode_ghost_hits;
+    buffer_ghost_hit_bytes += c->buffer_ghost_hit_bytes;
   }
   logger->set(l_bluestore_onodes, num_onodes);
   logger->set(l_bluestore_extents, num_extents);
   logger->set(l_bluestore_blobs, num_blobs);
   logger->set(l_bluestore_buffers, num_buffers);
   logger->set(l_bluestore_buffer_bytes, num_buffer_bytes);
+  logger->set(l_bluestore_onode_ghost_hits, onode_ghost_hits);
+  logger->set(l_bluestore_buffer_ghost_hit_bytes, buffer_ghost_hit_bytes);
 }
 
 // ---------------
@@ -7158,6 +8424,76 @@ int BlueStore::set_collection_opts(
   return 0;
 }
 
+// --------------------------------------------------------
+// intermediate data structures used while reading
+struct region_t {
+  uint64_t logical_offset;
+  uint64_t blob_xoffset;   //region offset within the blob
+  uint64_t length;
+  bufferlist bl;
+
+  // used later in read process
+  uint64_t front = 0;
+  uint64_t r_off = 0;
+
+  region_t(uint64_t offset, uint64_t b_offs, uint64_t len)
+    : logical_offset(offset),
+    blob_xoffset(b_offs),
+    length(len){}
+  region_t(const region_t& from)
+    : logical_offset(from.logical_offset),
+    blob_xoffset(from.blob_xoffset),
+    length(from.length){}
+
+  friend ostream& operator<<(ostream& out, const region_t& r) {
+    return out << "0x" << std::hex << r.logical_offset << ":"
+      << r.blob_xoffset << "~" << r.length << std::dec;
+  }
+};
+
+typedef list<region_t> regions2read_t;
+typedef map<BlueStore::BlobRef, regions2read_t> blobs2read_t;
+
+/// the state of one read between its phases; for an async read this is
+/// also the aio completion, which hands it over to a finisher thread
+struct BlueStore::ReadOp : public BlueStore::AioContext {
+  CollectionRef c;
+  OnodeRef o;
+  uint64_t offset;
+  size_t length;
+  uint32_t op_flags;
+  bool buffered = false;
+
+  ready_regions_t ready_regions;  ///< cached (and, later, read) data
+  blobs2read_t blobs2read;        ///< what we need from the device
+  unsigned num_regions = 0;
+  vector<bufferlist> compressed_blob_bls;
+  IOContext ioc;
+  mono_time start;                ///< when the device reads were issued
+
+  // async reads only
+  ghobject_t oid;
+  bufferlist *bl = nullptr;
+  Context *on_complete = nullptr;
+  mono_time read_start;
+
+  ReadOp(CephContext *cct, Collection *c, OnodeRef& o,
+	 uint64_t offset, size_t length, uint32_t op_flags, bool async)
+    : c(c), o(o), offset(offset), length(length), op_flags(op_flags),
+      ioc(cct, async ? this : nullptr, true) // allow EIO
+  {}
+
+  void aio_finish(BlueStore *store) override {
+    // csum verification and decompression are too slow for the aio
+    // thread, and need the collection lock; keep them off the finishers
+    // that complete txc commits
+    store->read_finisher.queue(new FunctionContext(
+      [store, this](int r) {
+	store->_read_async_finish(this);
+      }));
+  }
+};
+
 int BlueStore::read(
   CollectionHandle &c_,
   const ghobject_t& oid,
@@ -7197,16 +8533,7 @@ int BlueStore::read(
   }
 
  out:
-  if (r >= 0 && _debug_data_eio(oid)) {
-    r = -EIO;
-    derr << __func__ << " " << c->cid << " " << oid << " INJECT EIO" << dendl;
-  } else if (oid.hobj.pool > 0 &&  /* FIXME, see #23029 */
-	     cct->_conf->bluestore_debug_random_read_err &&
-	     (rand() % (int)(cct->_conf->bluestore_debug_random_read_err *
-			     100.0)) == 0) {
-    dout(0) << __func__ << ": inject random EIO" << dendl;
-    r = -EIO;
-  }
+  r = _debug_read_err(c, oid, r);
   dout(10) << __func__ << " " << cid << " " << oid
 	   << " 0x" << std::hex << offset << "~" << length << std::dec
 	   << " = " << r << dendl;
@@ -7214,35 +8541,136 @@ int BlueStore::read(
   return r;
 }
 
-// --------------------------------------------------------
-// intermediate data structures used while reading
-struct region_t {
-  uint64_t logical_offset;
-  uint64_t blob_xoffset;   //region offset within the blob
-  uint64_t length;
-  bufferlist bl;
+int BlueStore::read_async(
+  CollectionHandle &c_,
+  const ghobject_t& oid,
+  uint64_t offset,
+  size_t length,
+  bufferlist& bl,
+  uint32_t op_flags,
+  Context *on_complete)
+{
+  auto start = mono_clock::now();
+  Collection *c = static_cast<Collection *>(c_.get());
+  const coll_t &cid = c->get_cid();
+  dout(15) << __func__ << " " << cid << " " << oid
+	   << " 0x" << std::hex << offset << "~" << length << std::dec
+	   << dendl;
+  if (!c->exists) {
+    delete on_complete;
+    return -ENOENT;
+  }
 
-  // used later in read process
-  uint64_t front = 0;
-  uint64_t r_off = 0;
+  bl.clear();
+  int r;
+  {
+    RWLock::RLocker l(c->lock);
+    auto start1 = mono_clock::now();
+    OnodeRef o = c->get_onode(oid, false);
+    logger->tinc(l_bluestore_read_onode_meta_lat, mono_clock::now() - start1);
+    if (!o || !o->exists) {
+      r = -ENOENT;
+      goto out;
+    }
 
-  region_t(uint64_t offset, uint64_t b_offs, uint64_t len)
-    : logical_offset(offset),
-    blob_xoffset(b_offs),
-    length(len){}
-  region_t(const region_t& from)
-    : logical_offset(from.logical_offset),
-    blob_xoffset(from.blob_xoffset),
-    length(from.length){}
+    if (offset == length && offset == 0)
+      length = o->onode.size;
 
-  friend ostream& operator<<(ostream& out, const region_t& r) {
-    return out << "0x" << std::hex << r.logical_offset << ":"
-      << r.blob_xoffset << "~" << r.length << std::dec;
+    if (_read_trivial(o, offset, &length, bl)) {
+      r = bl.length();
+      goto out;
+    }
+
+    ReadOp *rop = new ReadOp(cct, c, o, offset, length, op_flags, true);
+    _read_prepare(rop);
+    rop->start = mono_clock::now();
+    r = _read_issue(rop, true);
+    if (r >= 0 && rop->ioc.has_pending_aios()) {
+      // the rest happens in _read_async_finish
+      rop->oid = oid;
+      rop->bl = &bl;
+      rop->on_complete = on_complete;
+      rop->read_start = start;
+      logger->inc(l_bluestore_read_async_ops);
+      ++read_async_in_flight;
+      dout(20) << __func__ << " " << cid << " " << oid
+	       << " 0x" << std::hex << offset << "~" << length << std::dec
+	       << " waiting for aio" << dendl;
+      bdev->aio_submit(&rop->ioc);
+      return -EINPROGRESS;
+    }
+    if (r >= 0) {
+      logger->tinc(l_bluestore_read_wait_aio_lat,
+		   mono_clock::now() - rop->start);
+      r = _read_finish(rop, bl);
+    }
+    delete rop;
+    if (r == -EIO) {
+      logger->inc(l_bluestore_read_eio);
+    }
   }
-};
 
-typedef list<region_t> regions2read_t;
-typedef map<BlueStore::BlobRef, regions2read_t> blobs2read_t;
+ out:
+  delete on_complete;
+  r = _debug_read_err(c, oid, r);
+  dout(10) << __func__ << " " << cid << " " << oid
+	   << " 0x" << std::hex << offset << "~" << length << std::dec
+	   << " = " << r << dendl;
+  logger->tinc(l_bluestore_read_lat, mono_clock::now() - start);
+  return r;
+}
+
+void BlueStore::_read_async_finish(ReadOp *rop)
+{
+  Collection *c = rop->c.get();
+  int r = rop->ioc.get_return_value();
+  logger->tinc(l_bluestore_read_wait_aio_lat, mono_clock::now() - rop->start);
+  if (r < 0) {
+    assert(r == -EIO); // no other errors allowed
+  } else {
+    RWLock::RLocker l(c->lock);
+    r = _read_finish(rop, *rop->bl);
+  }
+  if (r == -EIO) {
+    logger->inc(l_bluestore_read_eio);
+  }
+  r = _debug_read_err(c, rop->oid, r);
+  dout(10) << __func__ << " " << c->cid << " " << rop->oid
+	   << " 0x" << std::hex << rop->offset << "~" << rop->length
+	   << std::dec << " = " << r << dendl;
+  logger->tinc(l_bluestore_read_lat, mono_clock::now() - rop->read_start);
+  rop->on_complete->complete(r);
+  delete rop;
+  if (--read_async_in_flight == 0) {
+    std::lock_guard<std::mutex> l(read_async_lock);
+    read_async_cond.notify_all();
+  }
+}
+
+void BlueStore::_read_async_drain()
+{
+  dout(10) << __func__ << " " << read_async_in_flight << " in flight"
+	   << dendl;
+  std::unique_lock<std::mutex> l(read_async_lock);
+  while (read_async_in_flight > 0) {
+    read_async_cond.wait(l);
+  }
+}
+
+int BlueStore::_debug_read_err(Collection *c, const ghobject_t& oid, int r)
+{
+  if (r >= 0 && _debug_data_eio(oid)) {
+    r = -EIO;
+    derr << __func__ << " " << c->cid << " " << oid << " INJECT EIO" << dendl;
+  } else if (oid.hobj.pool > 0 &&  /* FIXME, see #23029 */
+	     cct->_conf->bluestore_debug_random_read_err &&
+	     (rand() % (int)(cct->_conf->bluestore_debug_random_read_err *
+			     100.0)) == 0) {
+    dout(0) << __func__ << ": inject random EIO" << dendl;
+    r = -EIO;
+  }
+  return r;
+}
 
 int BlueStore::_do_read(
   Collection *c,
@@ -7260,25 +8688,81 @@ int BlueStore::_do_read(
            << o->onode.size << ")" << dendl;
   bl.clear();
 
+  if (_read_trivial(o, offset, &length, bl)) {
+    return bl.length();
+  }
+
+  ReadOp rop(cct, c, o, offset, length, op_flags, false);
+  _read_prepare(&rop);
+
+  // read raw blob data.
+  rop.start = mono_clock::now(); // for the sake of simplicity
+                                 // measure the whole block below.
+                                 // The error isn't that much...
+  r = _read_issue(&rop, false);
+  if (r < 0) {
+    return r;
+  }
+  if (rop.ioc.has_pending_aios()) {
+    bdev->aio_submit(&rop.ioc);
+    dout(20) << __func__ << " waiting for aio" << dendl;
+    rop.ioc.aio_wait();
+    r = rop.ioc.get_return_value();
+    if (r < 0) {
+      assert(r == -EIO); // no other errors allowed
+      return -EIO;
+    }
+  }
+  logger->tinc(l_bluestore_read_wait_aio_lat, mono_clock::now() - rop.start);
+
+  return _read_finish(&rop, bl);
+}
+
+bool BlueStore::_read_trivial(
+  OnodeRef& o,
+  uint64_t offset,
+  size_t *length,
+  bufferlist& bl)
+{
   if (offset >= o->onode.size) {
-    return r;
+    return true;
+  }
+
+  if (offset + *length > o->onode.size) {
+    *length = o->onode.size - offset;
   }
 
+  if (o->onode.has_inline_data()) {
+    // the data lives in the onode itself, anything past it reads as zeros
+    uint64_t ilen = o->onode.inline_data.length();
+    if (offset < ilen) {
+      uint64_t l = std::min<uint64_t>(*length, ilen - offset);
+      bl.substr_of(o->onode.inline_data, offset, l);
+    }
+    bl.append_zero(*length - bl.length());
+    dout(20) << __func__ << " inline 0x" << std::hex << offset << "~"
+	     << *length << std::dec << dendl;
+    return true;
+  }
+  return false;
+}
+
+void BlueStore::_read_prepare(ReadOp *rop)
+{
+  OnodeRef& o = rop->o;
+  uint64_t offset = rop->offset;
+  size_t length = rop->length;
+
   // generally, don't buffer anything, unless the client explicitly requests
   // it.
-  bool buffered = false;
-  if (op_flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED) {
+  if (rop->op_flags & CEPH_OSD_OP_FLAG_FADVISE_WILLNEED) {
     dout(20) << __func__ << " will do buffered read" << dendl;
-    buffered = true;
+    rop->buffered = true;
   } else if (cct->_conf->bluestore_default_buffered_read &&
-	     (op_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
-			  CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) == 0) {
+	     (rop->op_flags & (CEPH_OSD_OP_FLAG_FADVISE_DONTNEED |
+			       CEPH_OSD_OP_FLAG_FADVISE_NOCACHE)) == 0) {
     dout(20) << __func__ << " defaulting to buffered read" << dendl;
-    buffered = true;
-  }
-
-  if (offset + length > o->onode.size) {
-    length = o->onode.size - offset;
+    rop->buffered = true;
   }
 
   auto start = mono_clock::now();
@@ -7286,13 +8770,9 @@ int BlueStore::_do_read(
   logger->tinc(l_bluestore_read_onode_meta_lat, mono_clock::now() - start);
   _dump_onode(o);
 
-  ready_regions_t ready_regions;
-
   // build blob-wise list to of stuff read (that isn't cached)
-  blobs2read_t blobs2read;
   unsigned left = length;
   uint64_t pos = offset;
-  unsigned num_regions = 0;
   auto lp = o->extent_map.seek_lextent(offset);
   while (left > 0 && lp != o->extent_map.extent_map.end()) {
     if (pos < lp->logical_offset) {
@@ -7325,7 +8805,7 @@ int BlueStore::_do_read(
       if (pc != cache_res.end() &&
 	  pc->first == b_off) {
 	l = pc->second.length();
-	ready_regions[pos].claim(pc->second);
+	rop->ready_regions[pos].claim(pc->second);
 	dout(30) << __func__ << "    use cache 0x" << std::hex << pos << ": 0x"
 		 << b_off << "~" << l << std::dec << dendl;
 	++pc;
@@ -7337,8 +8817,8 @@ int BlueStore::_do_read(
 	}
 	dout(30) << __func__ << "    will read 0x" << std::hex << pos << ": 0x"
 		 << b_off << "~" << l << std::dec << dendl;
-	blobs2read[bptr].emplace_back(region_t(pos, b_off, l));
-	++num_regions;
+	rop->blobs2read[bptr].emplace_back(region_t(pos, b_off, l));
+	++rop->num_regions;
       }
       pos += l;
       b_off += l;
@@ -7347,13 +8827,16 @@ int BlueStore::_do_read(
     }
     ++lp;
   }
+}
 
-  // read raw blob data.  use aio if we have >1 blobs to read.
-  start = mono_clock::now(); // for the sake of simplicity
-                             // measure the whole block below.
-                             // The error isn't that much...
-  vector<bufferlist> compressed_blob_bls;
-  IOContext ioc(cct, NULL, true); // allow EIO
+int BlueStore::_read_issue(ReadOp *rop, bool all_aio)
+{
+  // unless asked for aio only, use aio if we have >1 blobs to read.
+  int r = 0;
+  IOContext *ioc = &rop->ioc;
+  auto& blobs2read = rop->blobs2read;
+  auto& compressed_blob_bls = rop->compressed_blob_bls;
+  unsigned num_regions = rop->num_regions;
   for (auto& p : blobs2read) {
     const BlobRef& bptr = p.first;
     dout(20) << __func__ << "  blob " << *bptr << std::hex
@@ -7371,10 +8854,10 @@ int BlueStore::_do_read(
 	[&](uint64_t offset, uint64_t length) {
 	  int r;
 	  // use aio if there are more regions to read than those in this blob
-	  if (num_regions > p.second.size()) {
-	    r = bdev->aio_read(offset, length, &bl, &ioc);
+	  if (all_aio || num_regions > p.second.size()) {
+	    r = bdev->aio_read(offset, length, &bl, ioc);
 	  } else {
-	    r = bdev->read(offset, length, &bl, &ioc, false);
+	    r = bdev->read(offset, length, &bl, ioc, false);
 	  }
 	  if (r < 0)
             return r;
@@ -7416,10 +8899,10 @@ int BlueStore::_do_read(
 	  [&](uint64_t offset, uint64_t length) {
 	    int r;
 	    // use aio if there is more than one region to read
-	    if (num_regions > 1) {
-	      r = bdev->aio_read(offset, length, &reg.bl, &ioc);
+	    if (all_aio || num_regions > 1) {
+	      r = bdev->aio_read(offset, length, &reg.bl, ioc);
 	    } else {
-	      r = bdev->read(offset, length, &reg.bl, &ioc, false);
+	      r = bdev->read(offset, length, &reg.bl, ioc, false);
 	    }
 	    if (r < 0)
               return r;
@@ -7438,27 +8921,26 @@ int BlueStore::_do_read(
       }
     }
   }
-  if (ioc.has_pending_aios()) {
-    bdev->aio_submit(&ioc);
-    dout(20) << __func__ << " waiting for aio" << dendl;
-    ioc.aio_wait();
-    r = ioc.get_return_value();
-    if (r < 0) {
-      assert(r == -EIO); // no other errors allowed
-      return -EIO;
-    }
-  }
-  logger->tinc(l_bluestore_read_wait_aio_lat, mono_clock::now() - start);
+  return 0;
+}
+
+int BlueStore::_read_finish(ReadOp *rop, bufferlist& bl)
+{
+  int r = 0;
+  OnodeRef& o = rop->o;
+  uint64_t offset = rop->offset;
+  size_t length = rop->length;
+  auto& ready_regions = rop->ready_regions;
 
   // enumerate and decompress desired blobs
-  auto p = compressed_blob_bls.begin();
-  blobs2read_t::iterator b2r_it = blobs2read.begin();
-  while (b2r_it != blobs2read.end()) {
+  auto p = rop->compressed_blob_bls.begin();
+  blobs2read_t::iterator b2r_it = rop->blobs2read.begin();
+  while (b2r_it != rop->blobs2read.end()) {
     const BlobRef& bptr = b2r_it->first;
     dout(20) << __func__ << "  blob " << *bptr << std::hex
 	     << " need 0x" << b2r_it->second << std::dec << dendl;
     if (bptr->get_blob().is_compressed()) {
-      assert(p != compressed_blob_bls.end());
+      assert(p != rop->compressed_blob_bls.end());
       bufferlist& compressed_bl = *p++;
       if (_verify_csum(o, &bptr->get_blob(), 0, compressed_bl,
 		       b2r_it->second.front().logical_offset) < 0) {
@@ -7468,7 +8950,7 @@ int BlueStore::_do_read(
       r = _decompress(compressed_bl, &raw_bl);
       if (r < 0)
 	return r;
-      if (buffered) {
+      if (rop->buffered) {
 	bptr->shared_blob->bc.did_read(bptr->shared_blob->get_cache(), 0,
 				       raw_bl);
       }
@@ -7482,7 +8964,7 @@ int BlueStore::_do_read(
 			 reg.logical_offset) < 0) {
 	  return -EIO;
 	}
-	if (buffered) {
+	if (rop->buffered) {
 	  bptr->shared_blob->bc.did_read(bptr->shared_blob->get_cache(),
 					 reg.r_off, reg.bl);
 	}
@@ -7498,7 +8980,7 @@ int BlueStore::_do_read(
   // generate a resulting buffer
   auto pr = ready_regions.begin();
   auto pr_end = ready_regions.end();
-  pos = 0;
+  uint64_t pos = 0;
   while (pos < length) {
     if (pr != pr_end && pr->first == pos + offset) {
       dout(30) << __func__ << " assemble 0x" << std::hex << pos
@@ -7627,6 +9109,17 @@ int BlueStore::_fiemap(
       length = o->onode.size - offset;
     }
 
+    if (o->onode.has_inline_data()) {
+      uint64_t ilen = o->onode.inline_data.length();
+      if (offset < ilen) {
+	uint64_t x_len = std::min<uint64_t>(length, ilen - offset);
+	destset.insert(offset, x_len);
+	offset += x_len;
+	length -= x_len;
+      }
+      goto out;
+    }
+
     o->extent_map.fault_range(db, offset, length);
     eend = o->extent_map.extent_map.end();
     ep = o->extent_map.seek_lextent(offset);
@@ -8108,15 +9601,20 @@ int BlueStore::omap_get_values(
     o->flush();
     _key_encode_u64(o->onode.nid, &final_key);
     final_key.push_back('.');
+    // look the keys up as one batch; the encoded keys sort just like the
+    // user keys do
+    set<string> final_keys;
     for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
       final_key.resize(9); // keep prefix
       final_key += *p;
-      bufferlist val;
-      if (db->get(prefix, final_key, &val) >= 0) {
-	dout(30) << __func__ << "  got " << pretty_binary_string(final_key)
-		 << " -> " << *p << dendl;
-	out->insert(make_pair(*p, val));
-      }
+      final_keys.emplace_hint(final_keys.end(), final_key);
+    }
+    map<string,bufferlist> vals;
+    db->get(prefix, final_keys, &vals);
+    for (auto& p : vals) {
+      dout(30) << __func__ << "  got " << pretty_binary_string(p.first)
+	       << " -> " << p.first.substr(9) << dendl;
+      out->insert(make_pair(p.first.substr(9), std::move(p.second)));
     }
   }
  out:
@@ -8152,18 +9650,18 @@ int BlueStore::omap_check_keys(
     o->flush();
     _key_encode_u64(o->onode.nid, &final_key);
     final_key.push_back('.');
+    set<string> final_keys;
     for (set<string>::const_iterator p = keys.begin(); p != keys.end(); ++p) {
       final_key.resize(9); // keep prefix
       final_key += *p;
-      bufferlist val;
-      if (db->get(prefix, final_key, &val) >= 0) {
-	dout(30) << __func__ << "  have " << pretty_binary_string(final_key)
-		 << " -> " << *p << dendl;
-	out->insert(*p);
-      } else {
-	dout(30) << __func__ << "  miss " << pretty_binary_string(final_key)
-		 << " -> " << *p << dendl;
-      }
+      final_keys.emplace_hint(final_keys.end(), final_key);
+    }
+    map<string,bufferlist> vals;
+    db->get(prefix, final_keys, &vals);
+    for (auto& p : vals) {
+      dout(30) << __func__ << "  have " << pretty_binary_string(p.first)
+	       << " -> " << p.first.substr(9) << dendl;
+      out->insert(p.first.substr(9));
     }
   }
  out:
@@ -8201,9 +9699,10 @@ ObjectMap::ObjectMapIterator BlueStore::get_omap_iterator(
 void BlueStore::_prepare_ondisk_format_super(KeyValueDB::Transaction& t)
 {
   dout(10) << __func__ << " ondisk_format " << ondisk_format
-	   << " min_compat_ondisk_format " << min_compat_ondisk_format
+	   << " min_compat_ondisk_format " << compat_ondisk_format
 	   << dendl;
   assert(ondisk_format == latest_ondisk_format);
+  assert(compat_ondisk_format >= min_compat_ondisk_format);
   {
     bufferlist bl;
     encode(ondisk_format, bl);
@@ -8211,11 +9710,38 @@ void BlueStore::_prepare_ondisk_format_super(KeyValueDB::Transaction& t)
   }
   {
     bufferlist bl;
-    encode(min_compat_ondisk_format, bl);
+    encode((int32_t)compat_ondisk_format, bl);
     t->set(PREFIX_SUPER, "min_compat_ondisk_format", bl);
   }
 }
 
+int BlueStore::_require_compat_ondisk_format(int32_t compat)
+{
+  if (compat_ondisk_format >= compat) {
+    return 0;
+  }
+  // Commit this on its own: a txc carrying the key might land in a later
+  // kv batch than another txc's write that depends on it.
+  std::lock_guard<std::mutex> l(compat_lock);
+  if (compat_ondisk_format >= compat) {
+    return 0;
+  }
+  dout(1) << __func__ << " min_compat_ondisk_format "
+	  << compat_ondisk_format << " -> " << compat << dendl;
+  KeyValueDB::Transaction t = db->get_transaction();
+  bufferlist bl;
+  encode(compat, bl);
+  t->set(PREFIX_SUPER, "min_compat_ondisk_format", bl);
+  int r = db->submit_transaction_sync(t);
+  if (r < 0) {
+    derr << __func__ << " failed to update min_compat_ondisk_format: "
+	 << cpp_strerror(r) << dendl;
+    return r;
+  }
+  compat_ondisk_format = compat;
+  return 0;
+}
+
 int BlueStore::_open_super_meta()
 {
   // nid
@@ -8284,7 +9810,7 @@ int BlueStore::_open_super_meta()
   }
 
   // ondisk format
-  int32_t compat_ondisk_format = 0;
+  int32_t compat = 0;
   {
     bufferlist bl;
     int r = db->get(PREFIX_SUPER, "ondisk_format", &bl);
@@ -8293,7 +9819,7 @@ int BlueStore::_open_super_meta()
       dout(20) << __func__ << " missing ondisk_format; assuming kraken"
 	       << dendl;
       ondisk_format = 1;
-      compat_ondisk_format = 1;
+      compat = 1;
     } else {
       auto p = bl.cbegin();
       try {
@@ -8308,7 +9834,7 @@ int BlueStore::_open_super_meta()
 	assert(!r);
 	auto p = bl.cbegin();
 	try {
-	  decode(compat_ondisk_format, p);
+	  decode(compat, p);
 	} catch (buffer::error& e) {
 	  derr << __func__ << " unable to read compat_ondisk_format" << dendl;
 	  return -EIO;
@@ -8316,16 +9842,17 @@ int BlueStore::_open_super_meta()
       }
     }
     dout(10) << __func__ << " ondisk_format " << ondisk_format
-	     << " compat_ondisk_format " << compat_ondisk_format
+	     << " compat_ondisk_format " << compat
 	     << dendl;
   }
 
-  if (latest_ondisk_format < compat_ondisk_format) {
+  if (latest_ondisk_format < compat) {
     derr << __func__ << " compat_ondisk_format is "
-	 << compat_ondisk_format << " but we only understand version "
+	 << compat << " but we only understand version "
 	 << latest_ondisk_format << dendl;
     return -EPERM;
   }
+  compat_ondisk_format = compat;
   if (ondisk_format < latest_ondisk_format) {
     int r = _upgrade_super();
     if (r < 0) {
@@ -8357,6 +9884,7 @@ int BlueStore::_open_super_meta()
   _set_csum();
   _set_compression();
   _set_blob_size();
+  _set_txc_slow_history();
 
   _set_finisher_num();
 
@@ -8370,6 +9898,7 @@ int BlueStore::_upgrade_super()
   assert(ondisk_format > 0);
   assert(ondisk_format < latest_ondisk_format);
 
+  KeyValueDB::Transaction t = db->get_transaction();
   if (ondisk_format == 1) {
     // changes:
     // - super: added ondisk_format
@@ -8377,7 +9906,6 @@ int BlueStore::_upgrade_super()
     // - super: added min_compat_ondisk_format
     // - super: added min_alloc_size
     // - super: removed min_min_alloc_size
-    KeyValueDB::Transaction t = db->get_transaction();
     {
       bufferlist bl;
       db->get(PREFIX_SUPER, "min_min_alloc_size", &bl);
@@ -8394,10 +9922,20 @@ int BlueStore::_upgrade_super()
       t->rmkey(PREFIX_SUPER, "min_min_alloc_size");
     }
     ondisk_format = 2;
-    _prepare_ondisk_format_super(t);
-    int r = db->submit_transaction_sync(t);
-    assert(r == 0);
   }
+  if (ondisk_format == 2) {
+    // changes:
+    // - onode: may carry inline data; min_compat_ondisk_format is raised
+    //   to inline_data_compat_ondisk_format before the first one is written
+    // - super: may carry an alloc snapshot; min_compat_ondisk_format is
+    //   raised to alloc_snapshot_compat_ondisk_format before the first one
+    ondisk_format = 3;
+  }
+  compat_ondisk_format = std::max<int32_t>(compat_ondisk_format,
+					   min_compat_ondisk_format);
+  _prepare_ondisk_format_super(t);
+  int r = db->submit_transaction_sync(t);
+  assert(r == 0);
 
   // done
   dout(1) << __func__ << " done" << dendl;
@@ -8716,6 +10254,13 @@ void BlueStore::_txc_finalize_kv(TransContext *txc, KeyValueDB::Transaction t)
 	     << "~" << p.get_len() << std::dec << dendl;
     fm->release(p.get_start(), p.get_len(), t);
   }
+  if (!pallocated->empty() || !preleased->empty()) {
+    ++alloc_fm_changes;
+    if (alloc_snapshot_valid) {
+      t->rmkey(PREFIX_SUPER, "alloc_snapshot");
+      txc->alloc_snapshot_rm = true;
+    }
+  }
 
   _txc_update_store_statfs(txc);
 }
@@ -8806,6 +10351,7 @@ void BlueStore::_txc_finish(TransContext *txc)
     _txc_release_alloc(txc);
     releasing_txc.pop_front();
     txc->log_state_latency(logger, l_bluestore_state_done_lat);
+    _txc_track_slow(txc);
     delete txc;
   }
 
@@ -8828,6 +10374,109 @@ void BlueStore::_txc_finish(TransContext *txc)
     (uint64_t)(alloc->get_fragmentation(min_alloc_size) * 1000));
 }
 
+BlueStore::TxcTrace::TxcTrace(const TransContext *txc, utime_t now)
+  : seq(txc->seq),
+    cid(txc->osr->cid),
+    osr(txc->osr.get()),
+    bytes(txc->bytes),
+    cost(txc->cost),
+    had_ios(txc->had_ios),
+    deferred(txc->deferred_txn),
+    start(txc->start),
+    end(now)
+{
+  std::copy(txc->state_lat, txc->state_lat + TransContext::NUM_STATE_LAT,
+	    state_lat);
+}
+
+void BlueStore::TxcTrace::dump(Formatter *f) const
+{
+  f->dump_stream("osr") << osr;
+  f->dump_stream("cid") << cid;
+  f->dump_unsigned("seq", seq);
+  f->dump_stream("start") << start;
+  f->dump_stream("latency") << end - start;
+  f->dump_unsigned("bytes", bytes);
+  f->dump_unsigned("cost", cost);
+  f->dump_bool("had_ios", had_ios);
+  f->dump_bool("deferred", deferred);
+  f->open_object_section("states");
+  for (int i = 0; i < TransContext::NUM_STATE_LAT; ++i) {
+    f->dump_stream(TransContext::get_state_latency_name(
+		     l_bluestore_state_prepare_lat + i)) << state_lat[i];
+  }
+  f->close_section();
+}
+
+void BlueStore::_txc_track_slow(TransContext *txc)
+{
+  if (!txc_slow_history_size) {
+    return;
+  }
+  utime_t now = txc->last_stamp;
+  utime_t lat = now - txc->start;
+  if (lat.to_nsec() <= txc_slow_min &&
+      now.to_nsec() < txc_slow_expire) {
+    return;  // fast path: not among the slowest, and nothing to age out
+  }
+
+  std::lock_guard<std::mutex> l(txc_slow_lock);
+  utime_t cutoff = now;
+  cutoff -= (double)txc_slow_history_duration;
+  for (auto p = txc_slow.begin(); p != txc_slow.end(); ) {
+    if (p->second.end < cutoff) {
+      p = txc_slow.erase(p);
+    } else {
+      ++p;
+    }
+  }
+  if (txc_slow.size() < txc_slow_history_size ||
+      lat > txc_slow.begin()->first) {
+    dout(20) << __func__ << " " << txc << " seq " << txc->seq
+	     << " latency " << lat << dendl;
+    txc_slow.emplace(lat, TxcTrace(txc, now));
+    if (txc_slow.size() > txc_slow_history_size) {
+      txc_slow.erase(txc_slow.begin());
+    }
+  }
+
+  if (txc_slow.size() < txc_slow_history_size) {
+    txc_slow_min = 0;
+  } else {
+    txc_slow_min = txc_slow.begin()->first.to_nsec();
+  }
+  uint64_t expire = std::numeric_limits<uint64_t>::max();
+  for (auto& p : txc_slow) {
+    expire = std::min<uint64_t>(expire, p.second.end.to_nsec() +
+		      txc_slow_history_duration * 1000000000ull);
+  }
+  txc_slow_expire = expire;
+}
+
+void BlueStore::dump_slow_transactions(Formatter *f, int num)
+{
+  utime_t cutoff = ceph_clock_now();
+  cutoff -= (double)txc_slow_history_duration;
+  std::lock_guard<std::mutex> l(txc_slow_lock);
+  f->open_object_section("slow_transactions");
+  f->dump_unsigned("history_size", txc_slow_history_size);
+  f->dump_unsigned("history_duration", txc_slow_history_duration);
+  f->open_array_section("transactions");
+  for (auto p = txc_slow.rbegin();
+       p != txc_slow.rend() && num != 0;
+       ++p) {
+    if (p->second.end < cutoff) {
+      continue;
+    }
+    f->open_object_section("txc");
+    p->second.dump(f);
+    f->close_section();
+    --num;
+  }
+  f->close_section();
+  f->close_section();
+}
+
 void BlueStore::_txc_release_alloc(TransContext *txc)
 {
   // it's expected we're called with lazy_release_lock already taken!
@@ -8853,6 +10502,20 @@ void BlueStore::_txc_release_alloc(TransContext *txc)
 out:
   txc->allocated.clear();
   txc->released.clear();
+  if (txc->alloc_unsettled) {
+    txc->alloc_unsettled = false;
+    --alloc_unsettled;
+  }
+}
+
+void BlueStore::_txc_alloc_unsettled(TransContext *txc)
+{
+  // must be counted before the allocator sees any change on behalf of
+  // this txc; see _build_alloc_snapshot()
+  if (!txc->alloc_unsettled) {
+    txc->alloc_unsettled = true;
+    ++alloc_unsettled;
+  }
 }
 
 void BlueStore::_osr_register_zombie(OpSequencer *osr)
@@ -8962,6 +10625,8 @@ void BlueStore::_kv_start()
   }
 
   deferred_finisher.start();
+  alloc_snapshot_finisher.start();
+  read_finisher.start();
   for (auto f : finishers) {
     f->start();
   }
@@ -9002,6 +10667,16 @@ void BlueStore::_kv_stop()
   dout(10) << __func__ << " stopping finishers" << dendl;
   deferred_finisher.wait_for_empty();
   deferred_finisher.stop();
+  alloc_snapshot_finisher.wait_for_empty();
+  alloc_snapshot_finisher.stop();
+  read_finisher.wait_for_empty();
+  read_finisher.stop();
+  {
+    // a snapshot built after kv_sync_thread stopped is simply dropped
+    std::lock_guard<std::mutex> l(kv_lock);
+    alloc_snapshot_building = false;
+    alloc_snapshot_t.reset();
+  }
   for (auto f : finishers) {
     f->wait_for_empty();
     f->stop();
@@ -9024,8 +10699,38 @@ void BlueStore::_kv_sync_thread()
 	 !deferred_aggressive)) {
       if (kv_stop)
 	break;
-      dout(20) << __func__ << " sleep" << dendl;
-      kv_cond.wait(l);
+      if (alloc_snapshot_t) {
+	KeyValueDB::Transaction t;
+	t.swap(alloc_snapshot_t);
+	uint64_t changes = alloc_snapshot_t_changes;
+	l.unlock();
+	_submit_alloc_snapshot(t, changes);
+	l.lock();
+	continue;
+      }
+      ceph::timespan wait;
+      if (!alloc_snapshot_building && _alloc_snapshot_wanted(&wait)) {
+	if (wait == ceph::timespan::zero()) {
+	  alloc_snapshot_building = true;
+	  // taken while no balance can run; see _build_alloc_snapshot()
+	  interval_set<uint64_t> bluefs_free = bluefs_extents;
+	  bluefs_free.insert(bluefs_extents_reclaiming);
+	  uint64_t changes = alloc_fm_changes;
+	  alloc_snapshot_finisher.queue(new FunctionContext(
+	    [this, bluefs_free, changes](int) {
+	      _build_alloc_snapshot(bluefs_free, changes);
+	    }));
+	  dout(20) << __func__ << " sleep (alloc snapshot building)" << dendl;
+	  kv_cond.wait(l);
+	} else {
+	  dout(20) << __func__ << " sleep (alloc snapshot in " << wait << ")"
+		   << dendl;
+	  kv_cond.wait_for(l, wait);
+	}
+      } else {
+	dout(20) << __func__ << " sleep" << dendl;
+	kv_cond.wait(l);
+      }
       dout(20) << __func__ << " wake" << dendl;
     } else {
       deque<TransContext*> kv_submitting;
@@ -9116,7 +10821,9 @@ void BlueStore::_kv_sync_thread()
 	dout(10) << __func__ << " new_blobid_max " << new_blobid_max << dendl;
       }
 
+      bool alloc_snapshot_rm = false;
       for (auto txc : kv_committing) {
+	alloc_snapshot_rm |= txc->alloc_snapshot_rm;
 	if (txc->state == TransContext::STATE_KV_QUEUED) {
 	  txc->log_state_latency(logger, l_bluestore_state_kv_queued_lat);
 	  int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction(txc->t);
@@ -9181,6 +10888,10 @@ void BlueStore::_kv_sync_thread()
       // submit synct synchronously (block and wait for it to commit)
       int r = cct->_conf->bluestore_debug_omit_kv_commit ? 0 : db->submit_transaction_sync(synct);
       assert(r == 0);
+      if (alloc_snapshot_rm) {
+	// the stamp is gone for good; later txcs need not remove it again
+	alloc_snapshot_valid = false;
+      }
 
       {
 	std::unique_lock<std::mutex> m(kv_finalize_lock);
@@ -9236,6 +10947,7 @@ void BlueStore::_kv_sync_thread()
 	if (!bluefs_extents_reclaiming.empty()) {
 	  dout(0) << __func__ << " releasing old bluefs 0x" << std::hex
 		   << bluefs_extents_reclaiming << std::dec << dendl;
+	  ++alloc_fm_changes;
 	  alloc->release(bluefs_extents_reclaiming);
 	  bluefs_extents_reclaiming.clear();
 	}
@@ -9363,6 +11075,11 @@ void BlueStore::deferred_try_submit()
   for (auto& osr : deferred_queue) {
     osrs.push_back(&osr);
   }
+  if (deferred_combine && osrs.size() > 1) {
+    _deferred_submit_group_unlock(osrs);
+    deferred_lock.lock();
+    return;
+  }
   for (auto& osr : osrs) {
     if (osr->deferred_pending) {
       if (!osr->deferred_running) {
@@ -9398,11 +11115,100 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
   for (auto& txc : b->txcs) {
     txc.log_state_latency(logger, l_bluestore_state_deferred_queued_lat);
   }
+  _deferred_write_merged({b}, &b->ioc);
+  bdev->aio_submit(&b->ioc);
+}
+
+void BlueStore::_deferred_submit_group_unlock(
+  const vector<OpSequencerRef>& osrs)
+{
+  // a combined write holds one io per device offset, so only batches that
+  // do not overlap are combined.  The others are submitted on their own
+  // right after it, concurrently with it and with each other, as they
+  // always were: ordering across sequencers is not guaranteed either way.
+  vector<OpSequencer*> group, rest;
+  interval_set<uint64_t> covered;
+  for (auto& osr : osrs) {
+    if (!osr->deferred_pending || osr->deferred_running) {
+      continue;
+    }
+    auto b = osr->deferred_pending;
+    bool overlaps = false;
+    for (auto& i : b->iomap) {
+      if (covered.intersects(i.first, i.second.bl.length())) {
+	overlaps = true;
+	break;
+      }
+    }
+    if (overlaps) {
+      rest.push_back(osr.get());
+      continue;
+    }
+    for (auto& i : b->iomap) {
+      covered.insert(i.first, i.second.bl.length());
+    }
+    group.push_back(osr.get());
+  }
+  if (group.size() < 2) {
+    rest.insert(rest.end(), group.begin(), group.end());
+    group.clear();
+  }
+
+  DeferredGroup *g = nullptr;
+  if (!group.empty()) {
+    g = new DeferredGroup(cct);
+    for (auto osr : group) {
+      auto b = osr->deferred_pending;
+      deferred_queue_size -= b->seq_bytes.size();
+      assert(deferred_queue_size >= 0);
+      osr->deferred_running = b;
+      osr->deferred_pending = nullptr;
+      g->batches.push_back(b);
+    }
+  }
+  dout(10) << __func__ << " " << group.size() << " osrs combined, "
+	   << rest.size() << " on their own" << dendl;
+  deferred_lock.unlock();
+
+  if (g) {
+    for (auto b : g->batches) {
+      for (auto& txc : b->txcs) {
+	txc.log_state_latency(logger, l_bluestore_state_deferred_queued_lat);
+      }
+    }
+    logger->inc(l_bluestore_deferred_combined_batches, g->batches.size());
+    _deferred_write_merged(g->batches, &g->ioc);
+    bdev->aio_submit(&g->ioc);
+  }
+
+  for (auto osr : rest) {
+    deferred_lock.lock();
+    if (osr->deferred_pending && !osr->deferred_running) {
+      _deferred_submit_unlock(osr);
+    } else {
+      deferred_lock.unlock();
+    }
+  }
+}
+
+void BlueStore::_deferred_write_merged(
+  const vector<DeferredBatch*>& batches,
+  IOContext *ioc)
+{
+  // all ios in device offset order; contiguous ones go out as one write
+  map<uint64_t, DeferredBatch::deferred_io*> ios;
+  for (auto b : batches) {
+    for (auto& i : b->iomap) {
+      bool inserted = ios.emplace(i.first, &i.second).second;
+      assert(inserted);
+    }
+  }
+
   uint64_t start = 0, pos = 0;
   bufferlist bl;
-  auto i = b->iomap.begin();
+  auto i = ios.begin();
   while (true) {
-    if (i == b->iomap.end() || i->first != pos) {
+    if (i == ios.end() || i->first != pos) {
       if (bl.length()) {
 	dout(20) << __func__ << " write 0x" << std::hex
 		 << start << "~" << bl.length()
@@ -9410,29 +11216,27 @@ void BlueStore::_deferred_submit_unlock(OpSequencer *osr)
 	if (!g_conf->bluestore_debug_omit_block_device_write) {
 	  logger->inc(l_bluestore_deferred_write_ops);
 	  logger->inc(l_bluestore_deferred_write_bytes, bl.length());
-	  int r = bdev->aio_write(start, bl, &b->ioc, false);
+	  int r = bdev->aio_write(start, bl, ioc, false);
 	  assert(r == 0);
 	}
       }
-      if (i == b->iomap.end()) {
+      if (i == ios.end()) {
 	break;
       }
       start = 0;
       pos = i->first;
       bl.clear();
     }
-    dout(20) << __func__ << "   seq " << i->second.seq << " 0x"
-	     << std::hex << pos << "~" << i->second.bl.length() << std::dec
+    dout(20) << __func__ << "   seq " << i->second->seq << " 0x"
+	     << std::hex << pos << "~" << i->second->bl.length() << std::dec
 	     << dendl;
     if (!bl.length()) {
       start = pos;
     }
-    pos += i->second.bl.length();
-    bl.claim_append(i->second.bl);
+    pos += i->second->bl.length();
+    bl.claim_append(i->second->bl);
     ++i;
   }
-
-  bdev->aio_submit(&b->ioc);
 }
 
 struct C_DeferredTrySubmit : public Context {
@@ -9646,7 +11450,7 @@ void BlueStore::_txc_add_transaction(TransContext *txc, Transaction *t)
 
   vector<CollectionRef> cvec(i.colls.size());
   unsigned j = 0;
-  for (vector<coll_t>::iterator p = i.colls.begin(); p != i.colls.end();
+  for (vector<coll_t>::const_iterator p = i.colls.begin(); p != i.colls.end();
        ++p, ++j) {
     cvec[j] = _get_collection(*p);
   }
@@ -10016,6 +11820,8 @@ void BlueStore::_dump_onode(const OnodeRef& o)
 		  << " in " << o->onode.extent_map_shards.size() << " shards"
 		  << ", " << o->extent_map.spanning_blob_map.size()
 		  << " spanning blobs"
+		  << ", 0x" << std::hex << o->onode.inline_data.length()
+		  << std::dec << " inline bytes"
 		  << dendl;
   for (auto p = o->onode.attrs.begin();
        p != o->onode.attrs.end();
@@ -10534,6 +12340,105 @@ void BlueStore::_do_write_big(
   }
 }
 
+static ceph::timespan thread_cpu_time()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+void BlueStore::_compress_blob(
+  const CompressorRef& c,
+  double crr,
+  WriteContext::write_item& wi)
+{
+  auto start = mono_clock::now();
+  auto cpu_start = thread_cpu_time();
+  PerfCounters *l = compress_logger[c->get_type()];
+
+  assert(wi.b_off == 0);
+  assert(wi.blob_length == wi.bl.length());
+
+  uint64_t want_len_raw = wi.blob_length * crr;
+  uint64_t want_len = p2roundup(want_len_raw, min_alloc_size);
+
+  // compress a few slices spread over the blob first: if even those do
+  // not get to the required ratio, incompressible data is not worth
+  // running through the compressor in full
+  uint64_t sample_size = comp_sample_size;
+  if (sample_size && wi.blob_length >= sample_size * 4) {
+    const unsigned slices = 4;
+    uint64_t slice = sample_size / slices;
+    bufferlist sample, t;
+    for (unsigned i = 0; i < slices; ++i) {
+      bufferlist s;
+      s.substr_of(wi.bl, i * (wi.blob_length / slices), slice);
+      sample.claim_append(s);
+    }
+    int r = c->compress(sample, t);
+    if (r == 0 && t.length() > sample.length() * crr) {
+      dout(20) << __func__ << std::hex << "  0x" << wi.blob_length
+	       << " sample 0x" << sample.length() << " compressed to 0x"
+	       << t.length() << " with " << c->get_type()
+	       << ", leaving uncompressed" << std::dec << dendl;
+      logger->inc(l_bluestore_compress_early_abort_count);
+      if (l) {
+	l->inc(l_bluestore_compressor_early_abort);
+	l->tinc(l_bluestore_compressor_cpu_lat, thread_cpu_time() - cpu_start);
+      }
+      logger->tinc(l_bluestore_compress_lat, mono_clock::now() - start);
+      return;
+    }
+  }
+
+  // FIXME: memory alignment here is bad
+  bufferlist t;
+  int r = c->compress(wi.bl, t);
+  assert(r == 0);
+
+  bluestore_compression_header_t chdr;
+  chdr.type = c->get_type();
+  chdr.length = t.length();
+  encode(chdr, wi.compressed_bl);
+  wi.compressed_bl.claim_append(t);
+
+  wi.compressed_len = wi.compressed_bl.length();
+  uint64_t newlen = p2roundup(wi.compressed_len, min_alloc_size);
+  if (newlen <= want_len && newlen < wi.blob_length) {
+    // Cool. We compressed at least as much as we were hoping to.
+    // pad out to min_alloc_size
+    wi.compressed_bl.append_zero(newlen - wi.compressed_len);
+    logger->inc(l_bluestore_write_pad_bytes, newlen - wi.compressed_len);
+    dout(20) << __func__ << std::hex << "  compressed 0x" << wi.blob_length
+	     << " -> 0x" << wi.compressed_len << " => 0x" << newlen
+	     << " with " << c->get_type()
+	     << std::dec << dendl;
+    logger->inc(l_bluestore_compress_success_count);
+    wi.compressed = true;
+  } else {
+    dout(20) << __func__ << std::hex << "  0x" << wi.blob_length
+	     << " compressed to 0x" << wi.compressed_len << " -> 0x" << newlen
+	     << " with " << c->get_type()
+	     << ", which is more than required 0x" << want_len_raw
+	     << " -> 0x" << want_len
+	     << ", leaving uncompressed"
+	     << std::dec << dendl;
+    logger->inc(l_bluestore_compress_rejected_count);
+    if (l) {
+      l->inc(l_bluestore_compressor_rejected);
+    }
+    wi.compressed_bl.clear();
+  }
+  if (l) {
+    l->tinc(l_bluestore_compressor_cpu_lat, thread_cpu_time() - cpu_start);
+    l->inc(l_bluestore_compressor_original_bytes, wi.blob_length);
+    l->inc(l_bluestore_compressor_compressed_bytes, wi.compressed_len);
+    l->inc(l_bluestore_compressor_ratio,
+	   wi.compressed_len * 1000 / wi.blob_length);
+  }
+  logger->tinc(l_bluestore_compress_lat, mono_clock::now() - start);
+}
+
 int BlueStore::_do_alloc_write(
   TransContext *txc,
   CollectionRef coll,
@@ -10596,57 +12501,33 @@ int BlueStore::_do_alloc_write(
   // compress (as needed) and calc needed space
   uint64_t need = 0;
   auto max_bsize = std::max(wctx->target_blob_size, min_alloc_size);
+  if (c) {
+    vector<WriteContext::write_item*> to_compress;
+    for (auto& wi : wctx->writes) {
+      if (wi.blob_length > min_alloc_size) {
+	to_compress.push_back(&wi);
+      }
+    }
+    // the blobs are independent, so a large write compresses them in
+    // parallel and only waits for the slowest one
+    auto start = mono_clock::now();
+    compress_tp.run(
+      to_compress.size(),
+      [&](size_t i) {
+	_compress_blob(c, crr, *to_compress[i]);
+      });
+    if (to_compress.size() > 1) {
+      logger->tinc(l_bluestore_compress_parallel_lat,
+		   mono_clock::now() - start);
+    }
+  }
   for (auto& wi : wctx->writes) {
-    if (c && wi.blob_length > min_alloc_size) {
-      auto start = mono_clock::now();
-
-      // compress
-      assert(wi.b_off == 0);
-      assert(wi.blob_length == wi.bl.length());
-
-      // FIXME: memory alignment here is bad
-      bufferlist t;
-      int r = c->compress(wi.bl, t);
-      assert(r == 0);
-
-      bluestore_compression_header_t chdr;
-      chdr.type = c->get_type();
-      chdr.length = t.length();
-      encode(chdr, wi.compressed_bl);
-      wi.compressed_bl.claim_append(t);
-
-      wi.compressed_len = wi.compressed_bl.length();
-      uint64_t newlen = p2roundup(wi.compressed_len, min_alloc_size);
-      uint64_t want_len_raw = wi.blob_length * crr;
-      uint64_t want_len = p2roundup(want_len_raw, min_alloc_size);
-      if (newlen <= want_len && newlen < wi.blob_length) {
-	// Cool. We compressed at least as much as we were hoping to.
-	// pad out to min_alloc_size
-	wi.compressed_bl.append_zero(newlen - wi.compressed_len);
-	logger->inc(l_bluestore_write_pad_bytes, newlen - wi.compressed_len);
-	dout(20) << __func__ << std::hex << "  compressed 0x" << wi.blob_length
-		 << " -> 0x" << wi.compressed_len << " => 0x" << newlen
-		 << " with " << c->get_type()
-		 << std::dec << dendl;
-	txc->statfs_delta.compressed() += wi.compressed_len;
-	txc->statfs_delta.compressed_original() += wi.blob_length;
-	txc->statfs_delta.compressed_allocated() += newlen;
-	logger->inc(l_bluestore_compress_success_count);
-	wi.compressed = true;
-	need += newlen;
-      } else {
-	dout(20) << __func__ << std::hex << "  0x" << wi.blob_length
-		 << " compressed to 0x" << wi.compressed_len << " -> 0x" << newlen
-		 << " with " << c->get_type()
-		 << ", which is more than required 0x" << want_len_raw
-		 << " -> 0x" << want_len
-		 << ", leaving uncompressed"
-		 << std::dec << dendl;
-	logger->inc(l_bluestore_compress_rejected_count);
-	need += wi.blob_length;
-      }
-      logger->tinc(l_bluestore_compress_lat,
-                  mono_clock::now() - start);
+    if (wi.compressed) {
+      uint64_t newlen = wi.compressed_bl.length();
+      txc->statfs_delta.compressed() += wi.compressed_len;
+      txc->statfs_delta.compressed_original() += wi.blob_length;
+      txc->statfs_delta.compressed_allocated() += newlen;
+      need += newlen;
     } else {
       need += wi.blob_length;
     }
@@ -10654,6 +12535,7 @@ int BlueStore::_do_alloc_write(
   PExtentVector prealloc;
   prealloc.reserve(2 * wctx->writes.size());;
   int prealloc_left = 0;
+  _txc_alloc_unsettled(txc);
   prealloc_left = alloc->allocate(
     need, min_alloc_size, need,
     0, &prealloc);
@@ -10847,6 +12729,9 @@ void BlueStore::_wctx_finish(
     // that are no longer referenced but not deallocated (until they
     // age out of the cache naturally).
     b->discard_unallocated(c.get());
+    if (!r.empty()) {
+      _txc_alloc_unsettled(txc);
+    }
     for (auto e : r) {
       dout(20) << __func__ << "  release " << e << dendl;
       txc->released.insert(e.offset, e.length);
@@ -11087,6 +12972,16 @@ int BlueStore::_do_write(
     return 0;
   }
 
+  if (_do_write_inline(txc, o, offset, length, bl)) {
+    return 0;
+  }
+  if (o->onode.has_inline_data()) {
+    r = _do_uninline(txc, c, o, fadvise_flags);
+    if (r < 0) {
+      return r;
+    }
+  }
+
   uint64_t end = offset + length;
 
   GarbageCollector gc(c->store->cct);
@@ -11143,6 +13038,89 @@ int BlueStore::_do_write(
   return r;
 }
 
+bool BlueStore::_do_write_inline(
+  TransContext *txc,
+  OnodeRef o,
+  uint64_t offset,
+  uint64_t length,
+  const bufferlist& bl)
+{
+  uint64_t ilen = o->onode.inline_data.length();
+  uint64_t new_ilen = std::max(ilen, offset + length);
+  if (new_ilen > inline_data_max_size) {
+    return false;
+  }
+  // only an object without any extents can take inline data; with no
+  // shards the whole extent map is already loaded, so an empty map is
+  // the full picture
+  if (!o->onode.has_inline_data() &&
+      (!o->onode.extent_map_shards.empty() ||
+       !o->extent_map.extent_map.empty())) {
+    return false;
+  }
+  // older releases decode the onode fine but silently drop inline data,
+  // so they must refuse to mount before any onode carries it
+  if (_require_compat_ondisk_format(inline_data_compat_ondisk_format) < 0) {
+    return false;
+  }
+  dout(20) << __func__ << " 0x" << std::hex << offset << "~" << length
+	   << " inline 0x" << ilen << " -> 0x" << new_ilen << std::dec << dendl;
+
+  // copy into a buffer of our own so that the onode does not pin the
+  // (possibly much larger) buffer the write came in
+  bufferptr p(new_ilen);
+  if (ilen) {
+    o->onode.inline_data.copy(0, ilen, p.c_str());
+  }
+  if (offset > ilen) {
+    p.zero(ilen, offset - ilen);
+  }
+  bl.copy(0, length, p.c_str() + offset);
+  o->onode.inline_data.clear();
+  o->onode.inline_data.append(std::move(p));
+  o->onode.inline_data.reassign_to_mempool(
+    mempool::mempool_bluestore_cache_other);
+  txc->statfs_delta.stored() += new_ilen - ilen;
+
+  if (offset + length > o->onode.size) {
+    dout(20) << __func__ << " extending size to 0x" << std::hex
+	     << offset + length << std::dec << dendl;
+    o->onode.size = offset + length;
+  }
+  logger->inc(l_bluestore_write_inline);
+  return true;
+}
+
+int BlueStore::_do_uninline(
+  TransContext *txc,
+  CollectionRef& c,
+  OnodeRef o,
+  uint32_t fadvise_flags)
+{
+  bufferlist bl;
+  bl.claim(o->onode.inline_data);
+  uint64_t length = bl.length();
+  dout(20) << __func__ << " " << o->oid << " 0x" << std::hex << length
+	   << std::dec << " bytes" << dendl;
+
+  // the regular write path below accounts these bytes again
+  txc->statfs_delta.stored() -= length;
+
+  WriteContext wctx;
+  _choose_write_options(c, o, fadvise_flags, &wctx);
+  _do_write_data(txc, c, o, 0, length, bl, &wctx);
+  int r = _do_alloc_write(txc, c, o, &wctx);
+  if (r < 0) {
+    derr << __func__ << " _do_alloc_write failed with " << cpp_strerror(r)
+	 << dendl;
+    return r;
+  }
+  _wctx_finish(txc, c, o, &wctx);
+  o->extent_map.dirty_range(0, length);
+  logger->inc(l_bluestore_write_uninline);
+  return 0;
+}
+
 int BlueStore::_write(TransContext *txc,
 		      CollectionRef& c,
 		      OnodeRef& o,
@@ -11200,11 +13178,26 @@ int BlueStore::_do_zero(TransContext *txc,
 
   _dump_onode(o);
 
-  WriteContext wctx;
-  o->extent_map.fault_range(db, offset, length);
-  o->extent_map.punch_hole(c, offset, length, &wctx.old_extents);
-  o->extent_map.dirty_range(offset, length);
-  _wctx_finish(txc, c, o, &wctx);
+  if (o->onode.has_inline_data()) {
+    // only the part covered by the inline data needs zeroing, past it
+    // the object reads as zeros anyway
+    uint64_t ilen = o->onode.inline_data.length();
+    if (offset < ilen) {
+      bufferptr p(ilen);
+      o->onode.inline_data.copy(0, ilen, p.c_str());
+      p.zero(offset, std::min<uint64_t>(length, ilen - offset));
+      o->onode.inline_data.clear();
+      o->onode.inline_data.append(std::move(p));
+      o->onode.inline_data.reassign_to_mempool(
+	mempool::mempool_bluestore_cache_other);
+    }
+  } else {
+    WriteContext wctx;
+    o->extent_map.fault_range(db, offset, length);
+    o->extent_map.punch_hole(c, offset, length, &wctx.old_extents);
+    o->extent_map.dirty_range(offset, length);
+    _wctx_finish(txc, c, o, &wctx);
+  }
 
   if (length > 0 && offset + length > o->onode.size) {
     o->onode.size = offset + length;
@@ -11231,6 +13224,18 @@ void BlueStore::_do_truncate(
   if (offset == o->onode.size)
     return;
 
+  if (offset < o->onode.inline_data.length()) {
+    uint64_t ilen = o->onode.inline_data.length();
+    txc->statfs_delta.stored() -= ilen - offset;
+    if (offset) {
+      bufferlist t;
+      t.substr_of(o->onode.inline_data, 0, offset);
+      o->onode.inline_data.swap(t);
+    } else {
+      o->onode.inline_data.clear();
+    }
+  }
+
   if (offset < o->onode.size) {
     WriteContext wctx;
     uint64_t length = o->onode.size - offset;
@@ -11688,7 +13693,8 @@ int BlueStore::_clone(TransContext *txc,
   // clone data
   oldo->flush();
   _do_truncate(txc, c, newo, 0);
-  if (cct->_conf->bluestore_clone_cow) {
+  if (cct->_conf->bluestore_clone_cow &&
+      !oldo->onode.has_inline_data()) {
     _do_clone_range(txc, c, oldo, newo, 0, oldo->onode.size, 0);
   } else {
     bufferlist bl;
@@ -11801,7 +13807,10 @@ int BlueStore::_clone_range(TransContext *txc,
   _assign_nid(txc, newo);
 
   if (length > 0) {
-    if (cct->_conf->bluestore_clone_cow) {
+    // inline data has no blobs to share, copy it instead
+    if (cct->_conf->bluestore_clone_cow &&
+	!oldo->onode.has_inline_data() &&
+	!newo->onode.has_inline_data()) {
       _do_zero(txc, c, newo, dstoff, length);
       _do_clone_range(txc, c, oldo, newo, srcoff, length, dstoff);
     } else {
@@ -22,6 +22,9 @@
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
 
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/unordered_set.hpp>
@@ -74,6 +77,18 @@ enum {
   l_bluestore_state_deferred_cleanup_lat,
   l_bluestore_state_finishing_lat,
   l_bluestore_state_done_lat,
+  // same order as the state latencies above
+  l_bluestore_state_prepare_lat_hist,
+  l_bluestore_state_aio_wait_lat_hist,
+  l_bluestore_state_io_done_lat_hist,
+  l_bluestore_state_kv_queued_lat_hist,
+  l_bluestore_state_kv_committing_lat_hist,
+  l_bluestore_state_kv_done_lat_hist,
+  l_bluestore_state_deferred_queued_lat_hist,
+  l_bluestore_state_deferred_aio_wait_lat_hist,
+  l_bluestore_state_deferred_cleanup_lat_hist,
+  l_bluestore_state_finishing_lat_hist,
+  l_bluestore_state_done_lat_hist,
   l_bluestore_throttle_lat,
   l_bluestore_submit_lat,
   l_bluestore_commit_lat,
@@ -85,9 +100,12 @@ enum {
   l_bluestore_csum_lat,
   l_bluestore_compress_success_count,
   l_bluestore_compress_rejected_count,
+  l_bluestore_compress_early_abort_count,
+  l_bluestore_compress_parallel_lat,
   l_bluestore_write_pad_bytes,
   l_bluestore_deferred_write_ops,
   l_bluestore_deferred_write_bytes,
+  l_bluestore_deferred_combined_batches,
   l_bluestore_write_penalty_read_ops,
   l_bluestore_allocated,
   l_bluestore_stored,
@@ -97,6 +115,7 @@ enum {
   l_bluestore_onodes,
   l_bluestore_onode_hits,
   l_bluestore_onode_misses,
+  l_bluestore_onode_ghost_hits,
   l_bluestore_onode_shard_hits,
   l_bluestore_onode_shard_misses,
   l_bluestore_extents,
@@ -105,6 +124,7 @@ enum {
   l_bluestore_buffer_bytes,
   l_bluestore_buffer_hit_bytes,
   l_bluestore_buffer_miss_bytes,
+  l_bluestore_buffer_ghost_hit_bytes,
   l_bluestore_write_big,
   l_bluestore_write_big_bytes,
   l_bluestore_write_big_blobs,
@@ -114,16 +134,36 @@ enum {
   l_bluestore_write_small_deferred,
   l_bluestore_write_small_pre_read,
   l_bluestore_write_small_new,
+  l_bluestore_write_inline,
+  l_bluestore_write_uninline,
   l_bluestore_txc,
   l_bluestore_onode_reshard,
   l_bluestore_blob_split,
   l_bluestore_extent_compress,
   l_bluestore_gc_merged,
   l_bluestore_read_eio,
+  l_bluestore_read_async_ops,
   l_bluestore_fragmentation,
+  l_bluestore_alloc_snapshot_loaded,
+  l_bluestore_alloc_snapshot_written,
+  l_bluestore_fsck_onodes,
+  l_bluestore_fsck_read_bytes,
+  l_bluestore_fsck_lat,
   l_bluestore_last
 };
 
+/// per compression algorithm counters ("bluestore_compress_<alg>")
+enum {
+  l_bluestore_compressor_first = 732700,
+  l_bluestore_compressor_cpu_lat,
+  l_bluestore_compressor_original_bytes,
+  l_bluestore_compressor_compressed_bytes,
+  l_bluestore_compressor_ratio,
+  l_bluestore_compressor_rejected,
+  l_bluestore_compressor_early_abort,
+  l_bluestore_compressor_last
+};
+
 class BlueStore : public ObjectStore,
 		  public md_config_obs_t {
   // -----------------------------------------------------
@@ -140,6 +180,7 @@ public:
   void _set_csum();
   void _set_compression();
   void _set_throttle_params();
+  void _set_txc_slow_history();
   int _set_cache_sizes();
 
   class TransContext;
@@ -1021,6 +1062,8 @@ public:
     mempool::bluestore_cache_other::string key;
 
     boost::intrusive::list_member_hook<> lru_item;
+    uint8_t cache_private = 0; ///< opaque (to us) value used by Cache impl
+    bool cache_ref = false;    ///< referenced; used by Cache impl
 
     bluestore_onode_t onode;  ///< metadata stored as value in kv store
     bool exists;              ///< true if object logically exists
@@ -1064,6 +1107,11 @@ public:
     std::atomic<uint64_t> num_extents = {0};
     std::atomic<uint64_t> num_blobs = {0};
 
+    /// misses that the cache would have served had it been larger (only
+    /// counted by caches keeping ghost entries)
+    std::atomic<uint64_t> onode_ghost_hits = {0};
+    std::atomic<uint64_t> buffer_ghost_hit_bytes = {0};
+
     static Cache *create(CephContext* cct, string type, PerfCounters *logger);
 
     Cache(CephContext* cct) : cct(cct), logger(nullptr) {}
@@ -1301,6 +1349,170 @@ public:
       *bytes += buffer_bytes;
     }
 
+#ifdef DEBUG_CACHE
+    void _audit(const char *s) override;
+#endif
+  };
+
+  /// CLOCK with adaptive replacement (CAR) for onodes and buffers
+  ///
+  /// Entries seen once sit in the "recent" clock, entries seen again in
+  /// the "frequent" clock.  A hit only sets a reference bit; nothing is
+  /// moved until the clock hand passes by during trim, which clears the
+  /// bit and moves referenced recent entries to the frequent clock.  A
+  /// one-time scan thus only cycles through the recent clock and leaves
+  /// the frequent one alone.  Evicted entries are remembered as ghosts
+  /// (hashes for onodes, empty buffers for data): a miss on a recent
+  /// ghost grows the target size of the recent clock, a miss on a frequent
+  /// ghost shrinks it, and both are counted as demand for the autotuner.
+  struct ClockCache : public Cache {
+  private:
+    typedef boost::intrusive::list<
+      Onode,
+      boost::intrusive::member_hook<
+        Onode,
+	boost::intrusive::list_member_hook<>,
+	&Onode::lru_item> > onode_list_t;
+    typedef boost::intrusive::list<
+      Buffer,
+      boost::intrusive::member_hook<
+	Buffer,
+	boost::intrusive::list_member_hook<>,
+	&Buffer::lru_item> > buffer_list_t;
+
+    /// evicted onodes, by oid hash, oldest first
+    struct ghost_list_t {
+      mempool::bluestore_cache_other::list<size_t> order;
+      mempool::bluestore_cache_other::unordered_map<
+	size_t,
+	mempool::bluestore_cache_other::list<size_t>::iterator> index;
+
+      size_t size() const {
+	return order.size();
+      }
+      void push(size_t h) {
+	auto p = index.find(h);
+	if (p != index.end()) {
+	  order.erase(p->second);
+	}
+	order.push_back(h);
+	index[h] = --order.end();
+      }
+      bool erase(size_t h) {
+	auto p = index.find(h);
+	if (p == index.end()) {
+	  return false;
+	}
+	order.erase(p->second);
+	index.erase(p);
+	return true;
+      }
+      void pop() {
+	index.erase(order.front());
+	order.pop_front();
+      }
+      void clear() {
+	index.clear();
+	order.clear();
+      }
+    };
+
+    // the hands sit at the front of each clock; new entries go to the back
+    onode_list_t onode_recent;           ///< "T1" seen once
+    onode_list_t onode_frequent;         ///< "T2" seen more than once
+    ghost_list_t onode_recent_ghost;     ///< "B1" evicted from T1
+    ghost_list_t onode_frequent_ghost;   ///< "B2" evicted from T2
+    uint64_t onode_recent_target = 0;    ///< "p", target size of T1
+    uint64_t onode_max = 0;              ///< as of last trim
+
+    enum {
+      ONODE_NEW = 0,
+      ONODE_RECENT,
+      ONODE_FREQUENT,
+    };
+
+    buffer_list_t buffer_recent;         ///< "T1" seen once
+    buffer_list_t buffer_frequent;       ///< "T2" seen more than once
+    buffer_list_t buffer_recent_ghost;   ///< "B1" empty, evicted from T1
+    buffer_list_t buffer_frequent_ghost; ///< "B2" empty, evicted from T2
+    uint64_t buffer_bytes = 0;           ///< bytes in T1 and T2
+    uint64_t buffer_recent_target = 0;   ///< "p", target bytes of T1
+    uint64_t buffer_max = 0;             ///< as of last trim
+
+    enum {
+      BUFFER_NEW = 0,
+      BUFFER_RECENT,
+      BUFFER_FREQUENT,
+      BUFFER_RECENT_GHOST,
+      BUFFER_FREQUENT_GHOST,
+      BUFFER_TYPE_MAX,
+
+      // cache_private is the list, plus the reference bit
+      BUFFER_TYPE_MASK = 0xff,
+      BUFFER_REF = 0x100,
+    };
+
+    uint64_t buffer_list_bytes[BUFFER_TYPE_MAX] = {0}; ///< bytes per type
+
+    buffer_list_t& _buffer_list(int type) {
+      switch (type) {
+      case BUFFER_RECENT: return buffer_recent;
+      case BUFFER_FREQUENT: return buffer_frequent;
+      case BUFFER_RECENT_GHOST: return buffer_recent_ghost;
+      case BUFFER_FREQUENT_GHOST: return buffer_frequent_ghost;
+      default:
+	assert(0 == "bad cache_private");
+      }
+    }
+    void _buffer_account(Buffer *b, int64_t delta) {
+      int type = b->cache_private & BUFFER_TYPE_MASK;
+      assert((int64_t)buffer_list_bytes[type] + delta >= 0);
+      buffer_list_bytes[type] += delta;
+      if (!b->is_empty()) {
+	assert((int64_t)buffer_bytes + delta >= 0);
+	buffer_bytes += delta;
+      }
+    }
+
+    void _trim_onodes(uint64_t onode_max);
+    void _trim_buffers(uint64_t buffer_max);
+
+  public:
+    ClockCache(CephContext* cct) : Cache(cct) {}
+    uint64_t _get_num_onodes() override {
+      return onode_recent.size() + onode_frequent.size();
+    }
+    void _add_onode(OnodeRef& o, int level) override;
+    void _rm_onode(OnodeRef& o) override;
+    void _touch_onode(OnodeRef& o) override {
+      o->cache_ref = true;
+    }
+
+    uint64_t _get_buffer_bytes() override {
+      return buffer_bytes;
+    }
+    void _add_buffer(Buffer *b, int level, Buffer *near) override;
+    void _rm_buffer(Buffer *b) override;
+    void _move_buffer(Cache *src, Buffer *b) override;
+    void _adjust_buffer_size(Buffer *b, int64_t delta) override;
+    void _touch_buffer(Buffer *b) override {
+      b->cache_private |= BUFFER_REF;
+    }
+
+    void _trim(uint64_t onode_max, uint64_t buffer_max) override;
+
+    void add_stats(uint64_t *onodes, uint64_t *extents,
+		   uint64_t *blobs,
+		   uint64_t *buffers,
+		   uint64_t *bytes) override {
+      std::lock_guard<std::recursive_mutex> l(lock);
+      *onodes += onode_recent.size() + onode_frequent.size();
+      *extents += num_extents;
+      *blobs += num_blobs;
+      *buffers += buffer_recent.size() + buffer_frequent.size();
+      *bytes += buffer_bytes;
+    }
+
 #ifdef DEBUG_CACHE
     void _audit(const char *s) override;
 #endif
@@ -1525,8 +1737,7 @@ public:
       return "???";
     }
 
-#if defined(WITH_LTTNG) && defined(WITH_EVENTTRACE)
-    const char *get_state_latency_name(int state) {
+    static const char *get_state_latency_name(int state) {
       switch (state) {
       case l_bluestore_state_prepare_lat: return "prepare";
       case l_bluestore_state_aio_wait_lat: return "aio_wait";
@@ -1535,18 +1746,29 @@ public:
       case l_bluestore_state_kv_committing_lat: return "kv_committing";
       case l_bluestore_state_kv_done_lat: return "kv_done";
       case l_bluestore_state_deferred_queued_lat: return "deferred_queued";
+      case l_bluestore_state_deferred_aio_wait_lat: return "deferred_aio_wait";
       case l_bluestore_state_deferred_cleanup_lat: return "deferred_cleanup";
       case l_bluestore_state_finishing_lat: return "finishing";
       case l_bluestore_state_done_lat: return "done";
       }
       return "???";
     }
-#endif
+
+    static const int NUM_STATE_LAT =
+      l_bluestore_state_done_lat - l_bluestore_state_prepare_lat + 1;
+    utime_t state_lat[NUM_STATE_LAT]; ///< time spent in each state
 
     void log_state_latency(PerfCounters *logger, int state) {
       utime_t lat, now = ceph_clock_now();
       lat = now - last_stamp;
       logger->tinc(state, lat);
+      if (state >= l_bluestore_state_prepare_lat &&
+	  state <= l_bluestore_state_done_lat) {
+	int i = state - l_bluestore_state_prepare_lat;
+	state_lat[i] += lat;
+	logger->hinc(l_bluestore_state_prepare_lat_hist + i, lat.to_nsec(),
+		     bytes);
+      }
 #if defined(WITH_LTTNG) && defined(WITH_EVENTTRACE)
       if (state >= l_bluestore_state_prepare_lat && state <= l_bluestore_state_done_lat) {
         double usecs = (now.to_nsec()-last_stamp.to_nsec())/1000;
@@ -1576,6 +1798,8 @@ public:
 
     interval_set<uint64_t> allocated, released;
     volatile_statfs statfs_delta;
+    bool alloc_unsettled = false;   ///< counted in BlueStore::alloc_unsettled
+    bool alloc_snapshot_rm = false; ///< our kv txn drops the alloc snapshot
 
     IOContext ioc;
     bool had_ios = false;  ///< true if we submitted IOs before our kv txn
@@ -1662,6 +1886,26 @@ public:
     }
   };
 
+  /// deferred batches of several sequencers, written out together
+  struct DeferredGroup final : public AioContext {
+    vector<DeferredBatch*> batches;
+    IOContext ioc;                   ///< aios of all batches
+
+    explicit DeferredGroup(CephContext *cct) : ioc(cct, this) {}
+
+    void aio_finish(BlueStore *store) override {
+      // the batches may go away as soon as they are finished
+      vector<OpSequencer*> osrs;
+      for (auto b : batches) {
+	osrs.push_back(b->osr);
+      }
+      for (auto osr : osrs) {
+	store->_deferred_aio_finish(osr);
+      }
+      delete this;
+    }
+  };
+
   class OpSequencer : public RefCountedObject {
   public:
     std::mutex qlock;
@@ -1846,12 +2090,29 @@ private:
   interval_set<uint64_t> bluefs_extents;  ///< block extents owned by bluefs
   interval_set<uint64_t> bluefs_extents_reclaiming; ///< currently reclaiming
 
+  /// allocator snapshot state, see _write_alloc_snapshot()
+  std::atomic<bool> alloc_snapshot_valid = {false}; ///< stamp may be on disk
+  std::atomic<uint64_t> alloc_unsettled = {0}; ///< txcs not yet released
+  /// freelist-changing txcs, and bluefs gifts and reclaims
+  std::atomic<uint64_t> alloc_fm_changes = {0};
+  uint64_t alloc_snapshot_changes = 0; ///< alloc_fm_changes at last snapshot
+  mono_time alloc_snapshot_next;       ///< next periodic attempt (kv_lock)
+  bool alloc_snapshot_building = false; ///< queued on finisher (kv_lock)
+  KeyValueDB::Transaction alloc_snapshot_t; ///< built, to submit (kv_lock)
+  uint64_t alloc_snapshot_t_changes = 0; ///< alloc_fm_changes it reflects
+
   std::mutex deferred_lock;
   std::atomic<uint64_t> deferred_seq = {0};
   deferred_osr_queue_t deferred_queue; ///< osr's with deferred io pending
   int deferred_queue_size = 0;         ///< num txc's queued across all osrs
   atomic_int deferred_aggressive = {0}; ///< aggressive wakeup of kv thread
   Finisher deferred_finisher;
+  Finisher alloc_snapshot_finisher;   ///< builds periodic alloc snapshots
+  Finisher read_finisher;  ///< verifies and decompresses async reads
+
+  std::atomic<uint64_t> read_async_in_flight = {0}; ///< read_async() aios
+  std::mutex read_async_lock;
+  std::condition_variable read_async_cond;  ///< in flight dropped to 0
 
   int m_finisher_num = 1;
   vector<Finisher*> finishers;
@@ -1876,6 +2137,8 @@ private:
   deque<DeferredBatch*> deferred_stable_to_finalize; ///< pending finalization
 
   PerfCounters *logger = nullptr;
+  /// per algorithm, indexed by Compressor::CompressionAlgorithm
+  PerfCounters *compress_logger[Compressor::COMP_ALG_LAST] = {nullptr};
 
   list<CollectionRef> removed_collections;
 
@@ -1899,12 +2162,41 @@ private:
   ///< maximum allocation unit (power of 2)
   std::atomic<uint64_t> max_alloc_size = {0};
 
+  /// a finished txc, as kept for dump_slow_transactions()
+  struct TxcTrace {
+    uint64_t seq;
+    coll_t cid;               ///< of its OpSequencer
+    const OpSequencer *osr;
+    uint64_t bytes, cost;
+    bool had_ios, deferred;
+    utime_t start, end;
+    utime_t state_lat[TransContext::NUM_STATE_LAT];
+
+    explicit TxcTrace(const TransContext *txc, utime_t now);
+    void dump(Formatter *f) const;
+  };
+
+  std::mutex txc_slow_lock;
+  std::multimap<utime_t,TxcTrace> txc_slow;  ///< slowest recent txcs, by latency
+  std::atomic<uint64_t> txc_slow_min = {0};  ///< (ns) latency to make the list
+  std::atomic<uint64_t> txc_slow_expire = {0}; ///< (ns) first entry ages out
+
+  ///< how many of the slowest txcs to keep, and for how long (seconds)
+  std::atomic<uint64_t> txc_slow_history_size = {0};
+  std::atomic<uint64_t> txc_slow_history_duration = {0};
+
   ///< number threshold for forced deferred writes
   std::atomic<int> deferred_batch_ops = {0};
 
+  ///< write the deferred batches of all sequencers out together
+  std::atomic<bool> deferred_combine = {false};
+
   ///< size threshold for forced deferred writes
   std::atomic<uint64_t> prefer_deferred_size = {0};
 
+  ///< objects up to this size keep their data in the onode
+  std::atomic<uint64_t> inline_data_max_size = {0};
+
   ///< approx cost per io, in bytes
   std::atomic<uint64_t> throttle_cost_per_io = {0};
 
@@ -1913,6 +2205,7 @@ private:
   CompressorRef compressor;
   std::atomic<uint64_t> comp_min_blob_size = {0};
   std::atomic<uint64_t> comp_max_blob_size = {0};
+  std::atomic<uint64_t> comp_sample_size = {0};  ///< early abort sample
 
   std::atomic<uint64_t> max_blob_size = {0};  ///< maximum blob size
 
@@ -1941,11 +2234,16 @@ private:
     Cond cond;
     Mutex lock;
     bool stop = false;
+    uint64_t last_onode_ghost_hits = 0;
+    uint64_t last_buffer_ghost_hit_bytes = 0;
 
     struct MempoolCache : public PriorityCache::PriCache {
       BlueStore *store;
       int64_t cache_bytes[PriorityCache::Priority::LAST+1];
       double cache_ratio = 0;
+      /// bytes that would have turned misses since the last balance into
+      /// hits, as seen by the ghost entries of the cache shards
+      uint64_t ghost_bytes = 0;
 
       MempoolCache(BlueStore *s) : store(s) {};
 
@@ -1959,7 +2257,7 @@ private:
         // All cache items are currently shoved into the LAST priority 
         case PriorityCache::Priority::LAST:
           {
-            uint64_t usage = _get_used_bytes();
+            uint64_t usage = _get_used_bytes() + ghost_bytes;
             int64_t request = PriorityCache::get_chunk(usage, chunk_bytes);
             return(request > assigned) ? request - assigned : 0;
           }
@@ -2060,12 +2358,47 @@ private:
   private:
     void _adjust_cache_settings();
     void _trim_shards(bool log_stats);
+    void _update_ghost_demand();
     void _balance_cache(const std::list<PriorityCache::PriCache *>& caches);
     void _balance_cache_pri(int64_t *mem_avail, 
                             const std::list<PriorityCache::PriCache *>& caches, 
                             PriorityCache::Priority pri);
   } mempool_thread;
 
+  /// threads compressing the blobs of a single write in parallel
+  struct CompressThreadPool {
+    /// work items of one caller, taken by whoever gets to them first
+    struct Batch {
+      std::function<void(size_t)> fn;
+      size_t num = 0;
+      std::atomic<size_t> next = {0};
+      size_t done = 0;  ///< protected by lock
+      std::mutex lock;
+      std::condition_variable cond;
+
+      void run();
+    };
+
+    BlueStore *store;
+    std::mutex lock;
+    std::condition_variable cond;
+    std::deque<std::shared_ptr<Batch>> queue;
+    std::vector<std::thread> threads;
+    bool stop = false;
+
+    explicit CompressThreadPool(BlueStore *s) : store(s) {}
+
+    void init(unsigned num_threads);
+    void shutdown();
+
+    /// call fn(0) .. fn(num - 1) on the pool, with the calling thread
+    /// pitching in, and return once all of them are done
+    void run(size_t num, std::function<void(size_t)>&& fn);
+
+  private:
+    void entry();
+  } compress_tp;
+
   // --------------------------------------------------------
   // private methods
 
@@ -2094,8 +2427,17 @@ private:
   void _close_db();
   int _open_fm(bool create);
   void _close_fm();
-  int _open_alloc();
+  int _open_alloc(bool use_snapshot = false);
   void _close_alloc();
+  bool _alloc_snapshot_enabled();
+  int _load_alloc_snapshot(uint64_t *num, uint64_t *bytes);
+  void _prepare_alloc_snapshot(KeyValueDB::Transaction t,
+			       const interval_set<uint64_t>& bluefs_free);
+  int _write_alloc_snapshot();
+  bool _alloc_snapshot_wanted(ceph::timespan *wait);
+  void _build_alloc_snapshot(const interval_set<uint64_t>& bluefs_free,
+			     uint64_t changes);
+  void _submit_alloc_snapshot(KeyValueDB::Transaction t, uint64_t changes);
   int _open_collections(int *errors=0);
   void _close_collections();
 
@@ -2151,6 +2493,8 @@ private:
   void _txc_committed_kv(TransContext *txc);
   void _txc_finish(TransContext *txc);
   void _txc_release_alloc(TransContext *txc);
+  void _txc_track_slow(TransContext *txc);
+  void _txc_alloc_unsettled(TransContext *txc);
 
   void _osr_register_zombie(OpSequencer *osr);
   void _osr_drain_preceding(TransContext *txc);
@@ -2167,6 +2511,9 @@ public:
   void deferred_try_submit();
 private:
   void _deferred_submit_unlock(OpSequencer *osr);
+  void _deferred_submit_group_unlock(const vector<OpSequencerRef>& osrs);
+  void _deferred_write_merged(const vector<DeferredBatch*>& batches,
+			      IOContext *ioc);
   void _deferred_aio_finish(OpSequencer *osr);
   int _deferred_replay();
 
@@ -2186,6 +2533,23 @@ private:
     BlueStoreRepairer* repairer,
     store_statfs_t& expected_statfs);
 
+  struct fsck_sb_info_t;
+  struct fsck_read_t;
+  struct fsck_read_batch_t;
+  struct fsck_shard_t;
+
+  /// check the onodes in [start, end) of PREFIX_OBJ (end empty: no limit)
+  void _fsck_check_objects(
+    fsck_shard_t& s,
+    const string& start,
+    const string& end,
+    bool deep,
+    BlueStoreRepairer* repairer);
+  void _fsck_queue_deep_read(fsck_shard_t& s, CollectionRef& c, OnodeRef& o);
+  /// held: collection the caller already holds the read lock of, if any
+  void _fsck_submit_deep_reads(fsck_shard_t& s, Collection *held = nullptr);
+  void _fsck_reap_deep_reads(fsck_shard_t& s, Collection *held = nullptr);
+
   void _buffer_cache_write(
     TransContext *txc,
     BlobRef b,
@@ -2219,15 +2583,27 @@ private:
 
   // -- ondisk version ---
 public:
-  const int32_t latest_ondisk_format = 2;        ///< our version
+  const int32_t latest_ondisk_format = 3;        ///< our version
   const int32_t min_readable_ondisk_format = 1;  ///< what we can read
   const int32_t min_compat_ondisk_format = 2;    ///< who can read us
+  /// who can read us once an onode carries inline data
+  const int32_t inline_data_compat_ondisk_format = 3;
+  /// who can read us once an alloc snapshot has been written
+  const int32_t alloc_snapshot_compat_ondisk_format = 3;
+
+  int32_t get_compat_ondisk_format() const {
+    return compat_ondisk_format;
+  }
 
 private:
   int32_t ondisk_format = 0;  ///< value detected on mount
+  std::atomic<int32_t> compat_ondisk_format = {0};  ///< value in effect
+  std::mutex compat_lock;  ///< serialize raising compat_ondisk_format
 
   int _upgrade_super();  ///< upgrade (called during open_super)
   void _prepare_ondisk_format_super(KeyValueDB::Transaction& t);
+  /// persist compat (if higher) before writing what needs it
+  int _require_compat_ondisk_format(int32_t compat);
 
   // --- public interface ---
 public:
@@ -2307,6 +2683,7 @@ public:
   }
 
   void get_db_statistics(Formatter *f) override;
+  void dump_slow_transactions(Formatter *f, int num) override;
   void generate_db_histogram(Formatter *f) override;
   void _flush_cache();
   void flush_cache() override;
@@ -2337,6 +2714,14 @@ public:
     size_t len,
     bufferlist& bl,
     uint32_t op_flags = 0) override;
+  int read_async(
+    CollectionHandle &c,
+    const ghobject_t& oid,
+    uint64_t offset,
+    size_t len,
+    bufferlist& bl,
+    uint32_t op_flags,
+    Context *on_complete) override;
   int _do_read(
     Collection *c,
     OnodeRef o,
@@ -2513,6 +2898,23 @@ private:
 
   // --------------------------------------------------------
   // read processing internal methods
+
+  // _do_read() and read_async() go through the same phases: look the
+  // range up in the cache, issue the device reads for the rest, and once
+  // they are done verify, decompress and assemble the result
+  struct ReadOp;
+  bool _read_trivial(
+    OnodeRef& o,
+    uint64_t offset,
+    size_t *length,
+    bufferlist& bl);
+  void _read_prepare(ReadOp *rop);
+  int _read_issue(ReadOp *rop, bool all_aio);
+  int _read_finish(ReadOp *rop, bufferlist& bl);
+  void _read_async_finish(ReadOp *rop);
+  void _read_async_drain();  ///< wait for all read_async() to complete
+  int _debug_read_err(Collection *c, const ghobject_t& oid, int r);
+
   int _verify_csum(
     OnodeRef& o,
     const bluestore_blob_t* blob,
@@ -2621,6 +3023,10 @@ private:
     uint64_t offset, uint64_t length,
     bufferlist::iterator& blp,
     WriteContext *wctx);
+  void _compress_blob(
+    const CompressorRef& c,
+    double crr,
+    WriteContext::write_item& wi);
   int _do_alloc_write(
     TransContext *txc,
     CollectionRef c,
@@ -2668,6 +3074,14 @@ private:
                       uint64_t length,
                       bufferlist& bl,
                       WriteContext *wctx);
+  bool _do_write_inline(TransContext *txc,
+			OnodeRef o,
+			uint64_t offset, uint64_t length,
+			const bufferlist& bl);
+  int _do_uninline(TransContext *txc,
+		   CollectionRef& c,
+		   OnodeRef o,
+		   uint32_t fadvise_flags);
 
   int _touch(TransContext *txc,
 	     CollectionRef& c,
@@ -2930,12 +3344,19 @@ public:
 
   unsigned apply(KeyValueDB* db);
 
+  // may be called by concurrent fsck workers
   void note_misreference(uint64_t offs, uint64_t len, bool inc_error) {
+    std::lock_guard<std::mutex> l(lock);
     misreferenced_extents.union_insert(offs, len);
     if (inc_error) {
       ++to_repair_cnt;
     }
   }
+  void note_space_used(uint64_t offset, uint64_t len,
+		       const coll_t& cid, const ghobject_t& oid) {
+    std::lock_guard<std::mutex> l(lock);
+    space_usage_tracker.set_used(offset, len, cid, oid);
+  }
 
   StoreSpaceTracker& get_space_usage_tracker() {
     return space_usage_tracker;
@@ -2948,6 +3369,8 @@ public:
   }
 
 private:
+  std::mutex lock;  ///< protects the detection stage state below
+
   unsigned to_repair_cnt = 0;
   KeyValueDB::Transaction fix_fm_leaked_txn;
   KeyValueDB::Transaction fix_fm_false_free_txn;
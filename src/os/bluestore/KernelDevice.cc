@@ -19,6 +19,7 @@
 #include <fcntl.h>
 
 #include "KernelDevice.h"
+#include "ioring.h"
 #include "include/types.h"
 #include "include/compat.h"
 #include "include/stringify.h"
@@ -38,7 +39,6 @@ KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv, ai
     fd_buffered(-1),
     aio(false), dio(false),
     debug_lock("KernelDevice::debug_lock"),
-    aio_queue(cct->_conf->bdev_aio_max_queue_depth),
     discard_callback(d_cb),
     discard_callback_priv(d_cbpriv),
     aio_stop(false),
@@ -48,6 +48,21 @@ KernelDevice::KernelDevice(CephContext* cct, aio_callback_t cb, void *cbpriv, ai
     discard_thread(this),
     injecting_crash(0)
 {
+  unsigned iodepth = cct->_conf->bdev_aio_max_queue_depth;
+  if (cct->_conf->get_val<bool>("bdev_ioring")) {
+    if (ioring_queue_t::supported()) {
+      io_queue = std::make_unique<ioring_queue_t>(
+	iodepth,
+	cct->_conf->get_val<bool>("bdev_ioring_sqthread_poll"),
+	cct->_conf->get_val<uint64_t>("bdev_ioring_registered_buffers"),
+	cct->_conf->get_val<uint64_t>("bdev_ioring_registered_buffer_size"));
+    } else {
+      derr << __func__ << " io_uring is not supported, using libaio" << dendl;
+    }
+  }
+  if (!io_queue) {
+    io_queue = std::make_unique<aio_queue_t>(iodepth);
+  }
 }
 
 int KernelDevice::_lock()
@@ -349,7 +364,18 @@ int KernelDevice::_aio_start()
 {
   if (aio) {
     dout(10) << __func__ << dendl;
-    int r = aio_queue.init();
+    std::vector<int> fds = {fd_direct, fd_buffered};
+    int r = io_queue->init(fds);
+    if (r < 0 && dynamic_cast<ioring_queue_t*>(io_queue.get())) {
+      // e.g. EPERM for an SQ polling thread without CAP_SYS_NICE, ENOMEM
+      // for the ring's locked memory, or EOPNOTSUPP for a kernel that may
+      // drop completions
+      derr << __func__ << " io_uring setup failed: " << cpp_strerror(r)
+	   << ", using libaio" << dendl;
+      io_queue = std::make_unique<aio_queue_t>(
+	cct->_conf->bdev_aio_max_queue_depth);
+      r = io_queue->init(fds);
+    }
     if (r < 0) {
       if (r == -EAGAIN) {
 	derr << __func__ << " io_setup(2) failed with EAGAIN; "
@@ -371,7 +397,7 @@ void KernelDevice::_aio_stop()
     aio_stop = true;
     aio_thread.join();
     aio_stop = false;
-    aio_queue.shutdown();
+    io_queue->shutdown();
   }
 }
 
@@ -426,7 +452,7 @@ void KernelDevice::_aio_thread()
     dout(40) << __func__ << " polling" << dendl;
     int max = cct->_conf->bdev_aio_reap_max;
     aio_t *aio[max];
-    int r = aio_queue.get_next_completed(cct->_conf->bdev_aio_poll_ms,
+    int r = io_queue->get_next_completed(cct->_conf->bdev_aio_poll_ms,
 					 aio, max);
     if (r < 0) {
       derr << __func__ << " got " << cpp_strerror(r) << dendl;
@@ -658,7 +684,7 @@ void KernelDevice::aio_submit(IOContext *ioc)
 
   void *priv = static_cast<void*>(ioc);
   int r, retries = 0;
-  r = aio_queue.submit_batch(ioc->running_aios.begin(), e, 
+  r = io_queue->submit_batch(ioc->running_aios.begin(), e,
 			     pending, priv, &retries);
   
   if (retries)
@@ -844,6 +870,10 @@ int KernelDevice::aio_read(
     ++ioc->num_pending;
     aio_t& aio = ioc->pending_aios.back();
     aio.pread(off, len);
+    int index;
+    if (io_queue->get_registered_buffer(len, &index)) {
+      aio.buf_index = index;
+    }
     dout(30) << aio << dendl;
     pbl->append(aio.bl);
     dout(5) << __func__ << " 0x" << std::hex << off << "~" << len
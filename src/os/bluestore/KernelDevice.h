@@ -16,6 +16,7 @@
 #define CEPH_OS_BLUESTORE_KERNELDEVICE_H
 
 #include <atomic>
+#include <memory>
 
 #include "include/types.h"
 #include "include/interval_set.h"
@@ -41,7 +42,7 @@ class KernelDevice : public BlockDevice {
   std::atomic<bool> io_since_flush = {false};
   std::mutex flush_mutex;
 
-  aio_queue_t aio_queue;
+  std::unique_ptr<io_queue_t> io_queue;
   aio_callback_t discard_callback;
   void *discard_callback_priv;
   bool aio_stop;
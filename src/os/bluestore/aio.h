@@ -7,6 +7,8 @@
 #include <boost/intrusive/list.hpp>
 #include <boost/container/small_vector.hpp>
 
+#include <vector>
+
 #include "include/buffer.h"
 #include "include/types.h"
 
@@ -17,6 +19,7 @@ struct aio_t {
   boost::container::small_vector<iovec,4> iov;
   uint64_t offset, length;
   long rval;
+  int buf_index = -1;  ///< registered io_uring buffer the read bounces through
   bufferlist bl;  ///< write payload (so that it remains stable for duration)
 
   boost::intrusive::list_member_hook<> queue_item;
@@ -51,21 +54,38 @@ typedef boost::intrusive::list<
     boost::intrusive::list_member_hook<>,
     &aio_t::queue_item> > aio_list_t;
 
-struct aio_queue_t {
+struct io_queue_t {
+  typedef list<aio_t>::iterator aio_iter;
+
+  virtual ~io_queue_t() {}
+
+  virtual int init(std::vector<int> &fds) = 0;
+  virtual void shutdown() = 0;
+  virtual int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
+			   void *priv, int *retries) = 0;
+  virtual int get_next_completed(int timeout_ms, aio_t **paio, int max) = 0;
+
+  /// reserve a buffer the queue can read len bytes into without mapping
+  /// it; the data is copied into the aio's own buffer on completion, which
+  /// frees the reservation again
+  virtual bool get_registered_buffer(uint64_t len, int *index) {
+    return false;
+  }
+};
+
+struct aio_queue_t final : public io_queue_t {
   int max_iodepth;
   io_context_t ctx;
 
-  typedef list<aio_t>::iterator aio_iter;
-
   explicit aio_queue_t(unsigned max_iodepth)
     : max_iodepth(max_iodepth),
       ctx(0) {
   }
-  ~aio_queue_t() {
+  ~aio_queue_t() final {
     assert(ctx == 0);
   }
 
-  int init() {
+  int init(std::vector<int> &fds) final {
     assert(ctx == 0);
     int r = io_setup(max_iodepth, &ctx);
     if (r < 0) {
@@ -76,7 +96,7 @@ struct aio_queue_t {
     }
     return r;
   }
-  void shutdown() {
+  void shutdown() final {
     if (ctx) {
       int r = io_destroy(ctx);
       assert(r == 0);
@@ -84,7 +104,7 @@ struct aio_queue_t {
     }
   }
 
-  int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size, 
-		   void *priv, int *retries);
-  int get_next_completed(int timeout_ms, aio_t **paio, int max);
+  int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
+		   void *priv, int *retries) final;
+  int get_next_completed(int timeout_ms, aio_t **paio, int max) final;
 };
@@ -1055,11 +1055,16 @@ void bluestore_onode_t::dump(Formatter *f) const
   f->dump_unsigned("expected_object_size", expected_object_size);
   f->dump_unsigned("expected_write_size", expected_write_size);
   f->dump_unsigned("alloc_hint_flags", alloc_hint_flags);
+  f->dump_unsigned("inline_data_len", inline_data.length());
 }
 
 void bluestore_onode_t::generate_test_instances(list<bluestore_onode_t*>& o)
 {
   o.push_back(new bluestore_onode_t());
+  o.push_back(new bluestore_onode_t());
+  o.back()->nid = 3;
+  o.back()->size = 4096;
+  o.back()->inline_data.append("tiny object");
   // FIXME
 }
 
@@ -1130,3 +1135,26 @@ void bluestore_compression_header_t::generate_test_instances(
   o.push_back(new bluestore_compression_header_t(1));
   o.back()->length = 1234;
 }
+
+void bluestore_alloc_snapshot_t::dump(Formatter *f) const
+{
+  f->dump_unsigned("size", size);
+  f->dump_unsigned("min_alloc_size", min_alloc_size);
+  f->dump_unsigned("num_chunks", num_chunks);
+  f->dump_unsigned("num_extents", num_extents);
+  f->dump_unsigned("bytes", bytes);
+  f->dump_unsigned("crc", crc);
+}
+
+void bluestore_alloc_snapshot_t::generate_test_instances(
+  list<bluestore_alloc_snapshot_t*>& o)
+{
+  o.push_back(new bluestore_alloc_snapshot_t);
+  o.push_back(new bluestore_alloc_snapshot_t);
+  o.back()->size = 1ull << 30;
+  o.back()->min_alloc_size = 4096;
+  o.back()->num_chunks = 2;
+  o.back()->num_extents = 70000;
+  o.back()->bytes = 1ull << 29;
+  o.back()->crc = 0x12345678;
+}
@@ -901,6 +901,11 @@ struct bluestore_onode_t {
 
   uint8_t flags = 0;
 
+  /// data of a tiny object kept in the onode itself; [0, length) of the
+  /// object, the rest up to size reads as zeros.  An object with inline
+  /// data has no lextents.
+  bufferlist inline_data;
+
   enum {
     FLAG_OMAP = 1,       ///< object may have omap data
     FLAG_PGMETA_OMAP = 2,  ///< omap data is in meta omap prefix
@@ -929,6 +934,9 @@ struct bluestore_onode_t {
   bool has_omap() const {
     return has_flag(FLAG_OMAP);
   }
+  bool has_inline_data() const {
+    return inline_data.length() > 0;
+  }
   bool is_pgmeta_omap() const {
     return has_flag(FLAG_PGMETA_OMAP);
   }
@@ -942,7 +950,8 @@ struct bluestore_onode_t {
   }
 
   DENC(bluestore_onode_t, v, p) {
-    DENC_START(1, 1, p);
+    // a v1 decoder would skip inline_data and see an empty object
+    DENC_START(2, v.has_inline_data() ? 2 : 1, p);
     denc_varint(v.nid, p);
     denc_varint(v.size, p);
     denc(v.attrs, p);
@@ -951,6 +960,9 @@ struct bluestore_onode_t {
     denc_varint(v.expected_object_size, p);
     denc_varint(v.expected_write_size, p);
     denc_varint(v.alloc_hint_flags, p);
+    if (struct_v >= 2) {
+      denc(v.inline_data, p);
+    }
     DENC_FINISH(p);
   }
   void dump(Formatter *f) const;
@@ -1023,5 +1035,29 @@ struct bluestore_compression_header_t {
 };
 WRITE_CLASS_DENC(bluestore_compression_header_t)
 
+/// header of a checkpoint of the allocator free extents
+struct bluestore_alloc_snapshot_t {
+  uint64_t size = 0;            ///< device size the snapshot covers
+  uint64_t min_alloc_size = 0;
+  uint32_t num_chunks = 0;      ///< extent chunks that follow the header
+  uint64_t num_extents = 0;
+  uint64_t bytes = 0;           ///< total free bytes
+  uint32_t crc = -1;            ///< crc32c over all chunks, in order
+
+  DENC(bluestore_alloc_snapshot_t, v, p) {
+    DENC_START(1, 1, p);
+    denc(v.size, p);
+    denc(v.min_alloc_size, p);
+    denc(v.num_chunks, p);
+    denc(v.num_extents, p);
+    denc(v.bytes, p);
+    denc(v.crc, p);
+    DENC_FINISH(p);
+  }
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<bluestore_alloc_snapshot_t*>& o);
+};
+WRITE_CLASS_DENC(bluestore_alloc_snapshot_t)
+
 
 #endif
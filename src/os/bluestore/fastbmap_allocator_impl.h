@@ -464,6 +464,38 @@ public:
     }
     return res * l0_granularity;
   }
+
+  /// call notify(offset, length) for every run of free entries, in order
+  template <typename F>
+  void foreach_free(F notify) const
+  {
+    uint64_t run_start = 0;
+    uint64_t run_len = 0;
+    for (uint64_t i = 0; i < l0.size(); ++i) {
+      auto v = l0[i];
+      if (v == all_slot_set) {
+        if (!run_len) {
+          run_start = i * bits_per_slot;
+        }
+        run_len += bits_per_slot;
+        continue;
+      }
+      for (size_t bit = 0; bit < bits_per_slot; ++bit) {
+        if (v & (slot_t(1) << bit)) {
+          if (!run_len) {
+            run_start = i * bits_per_slot + bit;
+          }
+          ++run_len;
+        } else if (run_len) {
+          notify(run_start * l0_granularity, run_len * l0_granularity);
+          run_len = 0;
+        }
+      }
+    }
+    if (run_len) {
+      notify(run_start * l0_granularity, run_len * l0_granularity);
+    }
+  }
 };
 
 class AllocatorLevel01Compact : public AllocatorLevel01
@@ -501,6 +533,12 @@ public:
   {
     return l1.get_min_alloc_size();
   }
+  template <typename F>
+  void foreach_free(F notify)
+  {
+    std::lock_guard<std::mutex> l(lock);
+    l1.foreach_free(notify);
+  }
 
 protected:
   std::mutex lock;
@@ -0,0 +1,386 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "ioring.h"
+
+#if defined(HAVE_LIBURING)
+
+#include <algorithm>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include <liburing.h>
+
+#include "include/compat.h"
+#include "include/intarith.h"
+
+struct ioring_data {
+  struct io_uring io_uring;
+  int epoll_fd = -1;
+};
+
+struct ioring_queue_t::buffer_pool_t {
+  char *base = nullptr;
+  uint64_t buffer_size;
+  std::vector<struct iovec> iov;
+
+  std::mutex lock;
+  std::vector<int> free_list;
+
+  char *get(int i) const {
+    return base + i * buffer_size;
+  }
+
+  buffer_pool_t(unsigned num, uint64_t size) : buffer_size(size) {
+    void *p = nullptr;
+    if (::posix_memalign(&p, CEPH_PAGE_SIZE, num * size) != 0) {
+      return;
+    }
+    base = static_cast<char*>(p);
+    for (unsigned i = 0; i < num; ++i) {
+      iov.push_back({base + i * size, size});
+      free_list.push_back(num - 1 - i);
+    }
+  }
+  ~buffer_pool_t() {
+    ::free(base);
+  }
+};
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth, bool sq_thread_poll,
+			       unsigned num_buffers, uint64_t buffer_size)
+  : d(new ioring_data),
+    iodepth(iodepth),
+    sq_thread_poll(sq_thread_poll),
+    num_buffers(num_buffers),
+    buffer_size(p2roundup<uint64_t>(buffer_size, CEPH_PAGE_SIZE))
+{
+}
+
+ioring_queue_t::~ioring_queue_t()
+{
+  assert(d->epoll_fd < 0);
+}
+
+bool ioring_queue_t::supported()
+{
+  struct io_uring ring;
+  int r = io_uring_queue_init(16, &ring, 0);
+  if (r < 0) {
+    return false;
+  }
+  io_uring_queue_exit(&ring);
+  return true;
+}
+
+int ioring_queue_t::init(std::vector<int> &fds)
+{
+  assert(d->epoll_fd < 0);
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  if (sq_thread_poll) {
+    // the kernel thread goes to sleep after a second without submissions
+    params.flags |= IORING_SETUP_SQPOLL;
+    params.sq_thread_idle = 1000;
+  }
+
+  int r = io_uring_queue_init_params(iodepth, &d->io_uring, &params);
+  if (r < 0) {
+    return r;
+  }
+  // nothing stops us from having more I/O in flight than the completion
+  // ring holds; older kernels then silently drop completions, newer ones
+  // keep them and make io_uring_submit() fail with EBUSY until we catch up
+  if (!(params.features & IORING_FEAT_NODROP)) {
+    r = -EOPNOTSUPP;
+    goto out_ring;
+  }
+
+  r = io_uring_register_files(&d->io_uring, fds.data(), fds.size());
+  if (r < 0) {
+    goto out_ring;
+  }
+  this->fds = fds;
+
+  // registering buffers needs locked memory; without it reads simply use
+  // regular buffers
+  if (num_buffers > 0 && init_buffers() < 0) {
+    buffers.reset();
+  }
+
+  d->epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+  if (d->epoll_fd < 0) {
+    r = -errno;
+    goto out_ring;
+  }
+  {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    r = ::epoll_ctl(d->epoll_fd, EPOLL_CTL_ADD, d->io_uring.ring_fd, &ev);
+    if (r < 0) {
+      r = -errno;
+      goto out_epoll;
+    }
+  }
+  return 0;
+
+ out_epoll:
+  VOID_TEMP_FAILURE_RETRY(::close(d->epoll_fd));
+  d->epoll_fd = -1;
+ out_ring:
+  io_uring_queue_exit(&d->io_uring);
+  this->fds.clear();
+  buffers.reset();
+  return r;
+}
+
+int ioring_queue_t::init_buffers()
+{
+  buffers = std::make_unique<buffer_pool_t>(num_buffers, buffer_size);
+  if (buffers->base == nullptr) {
+    return -ENOMEM;
+  }
+  return io_uring_register_buffers(&d->io_uring, buffers->iov.data(),
+				   buffers->iov.size());
+}
+
+void ioring_queue_t::shutdown()
+{
+  if (d->epoll_fd < 0) {
+    return;
+  }
+  VOID_TEMP_FAILURE_RETRY(::close(d->epoll_fd));
+  d->epoll_fd = -1;
+
+  io_uring_queue_exit(&d->io_uring);
+  fds.clear();
+  buffers.reset();
+}
+
+int ioring_queue_t::find_fd(int fd) const
+{
+  for (unsigned i = 0; i < fds.size(); ++i) {
+    if (fds[i] == fd) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int ioring_queue_t::submit_pending(unsigned *pending, int *attempts,
+				   int *delay, int *retries)
+{
+  // io_uring_submit() may hand fewer entries to the kernel than are queued
+  // (the rest stay on the ring for the next call), or fail with EBUSY or
+  // EAGAIN while the completion ring is overcommitted; back off the same
+  // way aio_queue_t does for io_submit()
+  while (*pending > 0) {
+    int r = io_uring_submit(&d->io_uring);
+    if (r < 0 && r != -EBUSY && r != -EAGAIN) {
+      return r;
+    }
+    if (r <= 0) {
+      if ((*attempts)-- <= 0) {
+	return r < 0 ? r : -EAGAIN;
+      }
+      usleep(*delay);
+      *delay *= 2;
+      (*retries)++;
+      continue;
+    }
+    *pending -= std::min<unsigned>(r, *pending);
+    *attempts = 16;
+    *delay = 125;
+  }
+  return 0;
+}
+
+int ioring_queue_t::submit_batch(aio_iter begin, aio_iter end,
+				 uint16_t aios_size, void *priv,
+				 int *retries)
+{
+  // 2^16 * 125us = ~8 seconds, so max sleep is ~16 seconds
+  int attempts = 16;
+  int delay = 125;
+
+  std::lock_guard<std::mutex> l(sq_mutex);
+
+  int queued = 0;
+  unsigned pending = 0;
+  for (aio_iter cur = begin; cur != end; ++cur) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&d->io_uring);
+    while (sqe == nullptr) {
+      // the submission ring is full: push what we have queued so far and
+      // wait for the kernel (or the SQ thread) to consume it
+      int r = submit_pending(&pending, &attempts, &delay, retries);
+      if (r < 0) {
+	return r;
+      }
+      sqe = io_uring_get_sqe(&d->io_uring);
+      if (sqe == nullptr) {
+	if (attempts-- <= 0) {
+	  return -EAGAIN;
+	}
+	usleep(delay);
+	delay *= 2;
+	(*retries)++;
+      }
+    }
+
+    aio_t &io = *cur;
+    io.priv = priv;
+
+    int fd = find_fd(io.fd);
+    if (io.iocb.aio_lio_opcode == IO_CMD_PWRITEV) {
+      io_uring_prep_writev(sqe, fd >= 0 ? fd : io.fd, &io.iov[0],
+			   io.iov.size(), io.offset);
+    } else if (io.iocb.aio_lio_opcode == IO_CMD_PREAD) {
+      if (io.buf_index >= 0) {
+	io_uring_prep_read_fixed(sqe, fd >= 0 ? fd : io.fd,
+				 buffers->get(io.buf_index),
+				 io.length, io.offset, io.buf_index);
+      } else {
+	io.iov.push_back({io.iocb.u.c.buf, io.length});
+	io_uring_prep_readv(sqe, fd >= 0 ? fd : io.fd, &io.iov[0],
+			    io.iov.size(), io.offset);
+      }
+    } else {
+      assert(0 == "unexpected aio opcode");
+    }
+    if (fd >= 0) {
+      sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    io_uring_sqe_set_data(sqe, &io);
+    ++queued;
+    ++pending;
+  }
+  assert(aios_size >= queued);
+
+  // one submission for the whole batch, unless the kernel takes it in parts
+  int r = submit_pending(&pending, &attempts, &delay, retries);
+  if (r < 0) {
+    return r;
+  }
+  return queued;
+}
+
+int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
+{
+  std::lock_guard<std::mutex> l(cq_mutex);
+
+  struct io_uring_cqe *cqes[max];
+  unsigned n = io_uring_peek_batch_cqe(&d->io_uring, cqes, max);
+  if (n == 0) {
+    // nothing on the completion ring yet; sleep until the kernel posts
+    // something (the ring fd polls readable) or the timeout expires
+    struct epoll_event ev;
+    int r;
+    do {
+      r = ::epoll_wait(d->epoll_fd, &ev, 1, timeout_ms);
+    } while (r < 0 && errno == EINTR);
+    if (r < 0) {
+      return -errno;
+    }
+    n = io_uring_peek_batch_cqe(&d->io_uring, cqes, max);
+  }
+
+  for (unsigned i = 0; i < n; ++i) {
+    aio_t *io = static_cast<aio_t*>(io_uring_cqe_get_data(cqes[i]));
+    io->rval = cqes[i]->res;
+    if (io->buf_index >= 0) {
+      if (io->rval > 0) {
+	memcpy(io->iocb.u.c.buf, buffers->get(io->buf_index), io->rval);
+      }
+      std::lock_guard<std::mutex> l(buffers->lock);
+      buffers->free_list.push_back(io->buf_index);
+      io->buf_index = -1;
+    }
+    paio[i] = io;
+  }
+  io_uring_cq_advance(&d->io_uring, n);
+  return n;
+}
+
+bool ioring_queue_t::get_registered_buffer(uint64_t len, int *index)
+{
+  if (!buffers || len > buffers->buffer_size) {
+    return false;
+  }
+  std::lock_guard<std::mutex> l(buffers->lock);
+  if (buffers->free_list.empty()) {
+    return false;
+  }
+  *index = buffers->free_list.back();
+  buffers->free_list.pop_back();
+  return true;
+}
+
+#else // #if defined(HAVE_LIBURING)
+
+struct ioring_data {};
+
+struct ioring_queue_t::buffer_pool_t {};
+
+ioring_queue_t::ioring_queue_t(unsigned iodepth, bool sq_thread_poll,
+			       unsigned num_buffers, uint64_t buffer_size)
+  : iodepth(iodepth),
+    sq_thread_poll(sq_thread_poll),
+    num_buffers(num_buffers),
+    buffer_size(buffer_size)
+{
+}
+
+ioring_queue_t::~ioring_queue_t()
+{
+}
+
+bool ioring_queue_t::supported()
+{
+  return false;
+}
+
+int ioring_queue_t::init(std::vector<int> &fds)
+{
+  return -EOPNOTSUPP;
+}
+
+void ioring_queue_t::shutdown()
+{
+}
+
+int ioring_queue_t::submit_batch(aio_iter begin, aio_iter end,
+				 uint16_t aios_size, void *priv,
+				 int *retries)
+{
+  assert(0 == "io_uring support is not built in");
+  return -EOPNOTSUPP;
+}
+
+int ioring_queue_t::get_next_completed(int timeout_ms, aio_t **paio, int max)
+{
+  assert(0 == "io_uring support is not built in");
+  return -EOPNOTSUPP;
+}
+
+bool ioring_queue_t::get_registered_buffer(uint64_t len, int *index)
+{
+  return false;
+}
+
+int ioring_queue_t::find_fd(int fd) const
+{
+  return -1;
+}
+
+int ioring_queue_t::init_buffers()
+{
+  return -EOPNOTSUPP;
+}
+
+#endif // #if defined(HAVE_LIBURING)
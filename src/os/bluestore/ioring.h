@@ -0,0 +1,64 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#pragma once
+
+#include "acconfig.h"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "aio.h"
+
+struct ioring_data;
+
+/**
+ * io_uring flavor of the block device io queue.
+ *
+ * A whole batch (usually one IOContext) is queued on the submission ring
+ * and handed to the kernel with a single io_uring_submit(); with
+ * sq_thread_poll a kernel thread picks the entries up and no syscall is
+ * made at all. Completions are reaped straight from the shared completion
+ * ring, waiting on the ring fd only when it is empty. The device files are
+ * registered with the ring, and reads can go through a pool of registered
+ * buffers so the kernel does not have to map the pages for every I/O; the
+ * data is copied out when the read completes, so a buffer is only tied up
+ * while its read is in flight.
+ */
+struct ioring_queue_t final : public io_queue_t {
+  ioring_queue_t(unsigned iodepth, bool sq_thread_poll,
+		 unsigned num_buffers, uint64_t buffer_size);
+  ~ioring_queue_t() final;
+
+  /// true if the running kernel (and the build) can do io_uring
+  static bool supported();
+
+  int init(std::vector<int> &fds) final;
+  void shutdown() final;
+
+  int submit_batch(aio_iter begin, aio_iter end, uint16_t aios_size,
+		   void *priv, int *retries) final;
+  int get_next_completed(int timeout_ms, aio_t **paio, int max) final;
+
+  bool get_registered_buffer(uint64_t len, int *index) final;
+
+private:
+  struct buffer_pool_t;
+
+  std::unique_ptr<ioring_data> d;
+  unsigned iodepth;
+  bool sq_thread_poll;
+  unsigned num_buffers;
+  uint64_t buffer_size;
+
+  std::mutex sq_mutex;
+  std::mutex cq_mutex;
+  std::vector<int> fds;        ///< registered files, by index
+  std::unique_ptr<buffer_pool_t> buffers;
+
+  int find_fd(int fd) const;
+  int init_buffers();
+  int submit_pending(unsigned *pending, int *attempts, int *delay,
+		     int *retries);
+};
@@ -6162,11 +6162,11 @@ void FileStore::OpSequencer::_register_apply(Op *o)
   }
   o->registered_apply = true;
   for (auto& t : o->tls) {
-    for (auto& i : t.get_object_index()) {
-      uint32_t key = i.first.hobj.get_hash();
-      applying.emplace(make_pair(key, &i.first));
-      dout(20) << __func__ << " " << o << " " << i.first << " ("
-	       << &i.first << ")" << dendl;
+    for (auto& i : t.get_objects()) {
+      uint32_t key = i.hobj.get_hash();
+      applying.emplace(make_pair(key, &i));
+      dout(20) << __func__ << " " << o << " " << i << " ("
+	       << &i << ")" << dendl;
     }
   }
 }
@@ -6175,15 +6175,15 @@ void FileStore::OpSequencer::_unregister_apply(Op *o)
 {
   assert(o->registered_apply);
   for (auto& t : o->tls) {
-    for (auto& i : t.get_object_index()) {
-      uint32_t key = i.first.hobj.get_hash();
+    for (auto& i : t.get_objects()) {
+      uint32_t key = i.hobj.get_hash();
       auto p = applying.find(key);
       bool removed = false;
       while (p != applying.end() &&
 	     p->first == key) {
-	if (p->second == &i.first) {
-	  dout(20) << __func__ << " " << o << " " << i.first << " ("
-		   << &i.first << ")" << dendl;
+	if (p->second == &i) {
+	  dout(20) << __func__ << " " << o << " " << i << " ("
+		   << &i << ")" << dendl;
 	  applying.erase(p);
 	  removed = true;
 	  break;
@@ -2190,7 +2190,7 @@ void KStore::_txc_add_transaction(TransContext *txc, Transaction *t)
 
   vector<CollectionRef> cvec(i.colls.size());
   unsigned j = 0;
-  for (vector<coll_t>::iterator p = i.colls.begin(); p != i.colls.end();
+  for (vector<coll_t>::const_iterator p = i.colls.begin(); p != i.colls.end();
        ++p, ++j) {
     cvec[j] = _get_collection(*p);
 
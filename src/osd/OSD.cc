@@ -2208,6 +2208,10 @@ will start to track new ops received afterwards.";
     f->close_section();
   } else if (admin_command == "dump_objectstore_kv_stats") {
     store->get_db_statistics(f);
+  } else if (admin_command == "dump_objectstore_slow_txcs") {
+    int64_t num = -1;
+    cmd_getval(cct, cmdmap, "num", num);
+    store->dump_slow_transactions(f, num);
   } else if (admin_command == "dump_scrubs") {
     service.dumps_scrub(f);
   } else if (admin_command == "calc_objectstore_db_histogram") {
@@ -2781,6 +2785,15 @@ void OSD::final_init()
 				     "print statistics of kvdb which used by bluestore");
   assert(r == 0);
 
+  r = admin_socket->register_command("dump_objectstore_slow_txcs",
+				     "dump_objectstore_slow_txcs "
+				     "name=num,type=CephInt,req=false",
+				     asok_hook,
+				     "print the slowest recent objectstore "
+				     "transactions, with the time spent in each "
+				     "state");
+  assert(r == 0);
+
   r = admin_socket->register_command("dump_scrubs",
 				     "dump_scrubs",
 				     asok_hook,
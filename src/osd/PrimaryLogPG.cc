@@ -277,9 +277,17 @@ void PrimaryLogPG::OpContext::finish_read(PrimaryLogPG *pg)
   assert(inflightreads > 0);
   --inflightreads;
   if (async_reads_complete()) {
-    assert(pg->in_progress_async_reads.size());
-    assert(pg->in_progress_async_reads.front().second == this);
-    pg->in_progress_async_reads.pop_front();
+    // replicated pools complete their reads in any order
+    auto p = std::find_if(
+      pg->in_progress_async_reads.begin(),
+      pg->in_progress_async_reads.end(),
+      [this](const pair<OpRequestRef, OpContext*>& i) {
+	return i.second == this;
+      });
+    assert(p != pg->in_progress_async_reads.end());
+    assert(p == pg->in_progress_async_reads.begin() ||
+	   !pg->pool.info.is_erasure());
+    pg->in_progress_async_reads.erase(p);
 
     // Restart the op context now that all reads have been
     // completed. Read failures will be handled by the op finisher
@@ -3885,7 +3893,6 @@ void PrimaryLogPG::execute_ctx(OpContext *ctx)
   if (result == -EINPROGRESS || pending_async_reads) {
     // come back later.
     if (pending_async_reads) {
-      assert(pool.info.is_erasure());
       in_progress_async_reads.push_back(make_pair(op, ctx));
       ctx->start_async_reads(this);
     }
@@ -5049,6 +5056,26 @@ struct ReadFinisher : public PrimaryLogPG::OpFinisher {
   }
 };
 
+// async read of a replicated pool: on EIO try to repair the object from a
+// replica and retry, like the synchronous path does
+struct RepReadFinisher : public PrimaryLogPG::OpFinisher {
+  PrimaryLogPG *pg;
+  PrimaryLogPG::OpContext *ctx;
+  OSDOp& osd_op;
+
+  RepReadFinisher(PrimaryLogPG *pg, PrimaryLogPG::OpContext *ctx,
+		  OSDOp& osd_op)
+    : pg(pg), ctx(ctx), osd_op(osd_op) {
+  }
+
+  int execute() override {
+    if (osd_op.rval == -EIO) {
+      return pg->rep_repair_primary_object(ctx->obs->oi.soid, ctx->op);
+    }
+    return osd_op.rval;
+  }
+};
+
 struct C_ChecksumRead : public Context {
   PrimaryLogPG *primary_log_pg;
   OSDOp &osd_op;
@@ -5377,6 +5404,20 @@ int PrimaryLogPG::finish_extent_cmp(OSDOp& osd_op, const bufferlist &read_bl)
   return 0;
 }
 
+bool PrimaryLogPG::can_read_async(OpContext *ctx, OSDOp& osd_op)
+{
+  // only plain reads of read-only ops; anything ordered against writes
+  // stays synchronous
+  if (osd_op.op.op != CEPH_OSD_OP_READ || !ctx->op ||
+      ctx->op->may_write() || ctx->op->may_cache() ||
+      !cct->_conf->get_val<bool>("osd_async_read")) {
+    return false;
+  }
+  const MOSDOp *m = static_cast<const MOSDOp*>(ctx->op->get_req());
+  return m->get_type() == CEPH_MSG_OSD_OP &&
+    !m->has_flag(CEPH_OSD_FLAG_RWORDERED);
+}
+
 int PrimaryLogPG::do_read(OpContext *ctx, OSDOp& osd_op) {
   dout(20) << __func__ << dendl;
   auto& op = osd_op.op;
@@ -5408,7 +5449,7 @@ int PrimaryLogPG::do_read(OpContext *ctx, OSDOp& osd_op) {
     // read size was trimmed to zero and it is expected to do nothing
     // a read operation of 0 bytes does *not* do nothing, this is why
     // the trimmed_read boolean is needed
-  } else if (pool.info.is_erasure()) {
+  } else if (pool.info.is_erasure() || can_read_async(ctx, osd_op)) {
     // The initialisation below is required to silence a false positive
     // -Wmaybe-uninitialized warning
     boost::optional<uint32_t> maybe_crc = boost::make_optional(false, uint32_t());
@@ -5427,8 +5468,13 @@ int PrimaryLogPG::do_read(OpContext *ctx, OSDOp& osd_op) {
 					 osd, soid, op.flags))));
     dout(10) << " async_read noted for " << soid << dendl;
 
-    ctx->op_finishers[ctx->current_osd_subop_num].reset(
-      new ReadFinisher(osd_op));
+    if (pool.info.is_erasure()) {
+      ctx->op_finishers[ctx->current_osd_subop_num].reset(
+	new ReadFinisher(osd_op));
+    } else {
+      ctx->op_finishers[ctx->current_osd_subop_num].reset(
+	new RepReadFinisher(this, ctx, osd_op));
+    }
   } else {
     int r = pgbackend->objects_read_sync(
       soid, op.extent.offset, op.extent.length, op.flags, &osd_op.outdata);
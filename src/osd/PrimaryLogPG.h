@@ -1362,6 +1362,7 @@ protected:
 
   friend class C_ExtentCmpRead;
 
+  bool can_read_async(OpContext *ctx, OSDOp& osd_op);
   int do_read(OpContext *ctx, OSDOp& osd_op);
   int do_sparse_read(OpContext *ctx, OSDOp& osd_op);
   int do_writesame(OpContext *ctx, OSDOp& osd_op);
@@ -254,6 +254,66 @@ int ReplicatedBackend::objects_read_sync(
   return store->read(ch, ghobject_t(hoid), off, len, *bl, op_flags);
 }
 
+// The reads of one objects_read_async() call.  The store reads into our
+// own buffers; the caller's buffers and contexts are only touched under
+// the pg lock, and not at all if the pg was reset in the meantime.
+struct AsyncReads {
+  struct read_t {
+    bufferlist *out = nullptr;
+    Context *on_read = nullptr;
+    bufferlist bl;
+    int r = 0;
+  };
+  vector<read_t> reads;
+  Context *on_complete = nullptr;
+  Context *on_all_read = nullptr;  ///< blessed C_DeliverAsyncReads
+  std::atomic<unsigned> pending = { 0 };
+
+  ~AsyncReads() {
+    for (auto& i : reads) {
+      delete i.on_read;
+    }
+    delete on_complete;
+  }
+  void put() {
+    if (--pending == 0) {
+      on_all_read->complete(0);
+    }
+  }
+};
+
+class C_AsyncReadDone : public Context {
+  AsyncReads *reads;
+  AsyncReads::read_t *read;
+public:
+  C_AsyncReadDone(AsyncReads *reads, AsyncReads::read_t *read)
+    : reads(reads), read(read) {}
+  void finish(int r) override {
+    read->r = r;
+    reads->put();
+  }
+};
+
+class C_DeliverAsyncReads : public Context {
+  std::unique_ptr<AsyncReads> reads;
+public:
+  explicit C_DeliverAsyncReads(AsyncReads *reads) : reads(reads) {}
+  void finish(int r) override {
+    for (auto& i : reads->reads) {
+      if (i.r >= 0) {
+	i.out->claim_append(i.bl);
+      }
+      if (i.on_read) {
+	i.on_read->complete(i.r);
+	i.on_read = nullptr;
+      }
+    }
+    Context *c = reads->on_complete;
+    reads->on_complete = nullptr;
+    c->complete(0);
+  }
+};
+
 void ReplicatedBackend::objects_read_async(
   const hobject_t &hoid,
   const list<pair<boost::tuple<uint64_t, uint64_t, uint32_t>,
@@ -261,7 +321,34 @@ void ReplicatedBackend::objects_read_async(
   Context *on_complete,
   bool fast_read)
 {
-  assert(0 == "async read is not used by replica pool");
+  AsyncReads *reads = new AsyncReads;
+  reads->reads.resize(to_read.size());
+  reads->on_complete = on_complete;
+  reads->on_all_read = get_parent()->bless_context(
+    new C_DeliverAsyncReads(reads));
+  // one extra reference until everything is issued
+  reads->pending = to_read.size() + 1;
+
+  auto rd = reads->reads.begin();
+  for (auto& i : to_read) {
+    rd->out = i.second.first;
+    rd->on_read = i.second.second;
+    int r = store->read_async(
+      ch, ghobject_t(hoid), i.first.get<0>(), i.first.get<1>(), rd->bl,
+      i.first.get<2>(), new C_AsyncReadDone(reads, &*rd));
+    if (r != -EINPROGRESS) {
+      rd->r = r;
+      --reads->pending;
+    }
+    dout(20) << __func__ << " " << hoid << " " << i.first.get<0>() << "~"
+	     << i.first.get<1>() << " r = " << r << dendl;
+    ++rd;
+  }
+  if (--reads->pending == 0) {
+    // everything was at hand; we still hold the pg lock
+    bool done = reads->on_all_read->sync_complete(0);
+    assert(done);
+  }
 }
 
 class C_OSD_OnOpCommit : public Context {
@@ -899,6 +986,7 @@ Message * ReplicatedBackend::generate_subop(
   const bufferlist &log_entries,
   boost::optional<pg_hit_set_history_t> &hset_hist,
   ObjectStore::Transaction &op_t,
+  const bufferlist &op_t_bl,
   pg_shard_t peer,
   const pg_info_t &pinfo)
 {
@@ -917,7 +1005,8 @@ Message * ReplicatedBackend::generate_subop(
     ObjectStore::Transaction t;
     encode(t, wr->get_data());
   } else {
-    encode(op_t, wr->get_data());
+    // shares op_t_bl's buffers with the other replicas' messages
+    wr->set_data(op_t_bl);
     wr->get_header().data_off = op_t.get_data_alignment();
   }
 
@@ -964,6 +1053,9 @@ void ReplicatedBackend::issue_op(
     // avoid doing the same work in generate_subop
     bufferlist logs;
     encode(log_entries, logs);
+    // encode the transaction once, not once per replica
+    bufferlist op_t_bl;
+    encode(op_t, op_t_bl);
 
     for (const auto& shard : get_parent()->get_acting_recovery_backfill_shards()) {
       if (shard == parent->whoami_shard()) continue;
@@ -982,6 +1074,7 @@ void ReplicatedBackend::issue_op(
 	  logs,
 	  hset_hist,
 	  op_t,
+	  op_t_bl,
 	  shard,
 	  pinfo);
       if (op->op && op->op->pg_trace)
@@ -0,0 +1,145 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <iostream>
+#include <string.h>
+
+#include "include/types.h"
+#include "include/buffer.h"
+#include "include/utime.h"
+#include "common/Clock.h"
+#include "common/Checksummer.h"
+#include "common/csum_multibuf.h"
+
+#include "gtest/gtest.h"
+
+static bufferptr make_data(unsigned len)
+{
+  bufferptr bp(len);
+  for (unsigned i = 0; i < len; ++i) {
+    bp.c_str()[i] = (i * 7919) >> 3;
+  }
+  return bp;
+}
+
+TEST(CsumMultibuf, MatchesGeneric) {
+  bufferptr bp = make_data(65536 * 3 + 64);
+  const unsigned char *data = (const unsigned char *)bp.c_str();
+  for (size_t len : {1, 7, 15, 16, 31, 32, 33, 100, 512, 4096, 4100, 65536}) {
+    for (size_t n = 1; n <= 17 && n * len + 3 <= bp.length(); ++n) {
+      for (size_t skew : {0, 3}) {
+	uint32_t a[17], b[17];
+	uint64_t c[17], d[17];
+	ceph_crc32c_multi(-1, data + skew, len, n, a);
+	ceph_crc32c_multi_generic(-1, data + skew, len, n, b);
+	ASSERT_EQ(0, memcmp(a, b, n * sizeof(a[0]))) << len << " x " << n;
+	ceph_xxhash32_multi(1234, data + skew, len, n, a);
+	ceph_xxhash32_multi_generic(1234, data + skew, len, n, b);
+	ASSERT_EQ(0, memcmp(a, b, n * sizeof(a[0]))) << len << " x " << n;
+	ceph_xxhash64_multi(-1, data + skew, len, n, c);
+	ceph_xxhash64_multi_generic(-1, data + skew, len, n, d);
+	ASSERT_EQ(0, memcmp(c, d, n * sizeof(c[0]))) << len << " x " << n;
+      }
+    }
+  }
+}
+
+template<class Alg>
+static void check_checksummer(const bufferlist& bl, size_t csum_block_size)
+{
+  size_t blocks = bl.length() / csum_block_size;
+  size_t vsize = sizeof(typename Alg::value_t);
+  bufferptr csum(blocks * vsize);
+  ASSERT_EQ(0, Checksummer::calculate<Alg>(csum_block_size, 0,
+					   blocks * csum_block_size, bl,
+					   &csum));
+  // one block at a time, never through the multi-buffer kernels
+  typename Alg::state_t state;
+  Alg::init(&state);
+  bufferlist::const_iterator p = bl.begin();
+  for (size_t i = 0; i < blocks; ++i) {
+    typename Alg::value_t v = Alg::calc(state, -1, csum_block_size, p);
+    ASSERT_EQ(0, memcmp(&v, csum.c_str() + i * vsize, vsize)) << i;
+  }
+  Alg::fini(&state);
+
+  ASSERT_EQ(-1, Checksummer::verify<Alg>(csum_block_size, 0,
+					 blocks * csum_block_size, bl, csum));
+  // corrupt the last block
+  csum.c_str()[(blocks - 1) * vsize] ^= 1;
+  ASSERT_EQ((int)((blocks - 1) * csum_block_size),
+	    Checksummer::verify<Alg>(csum_block_size, 0,
+				     blocks * csum_block_size, bl, csum));
+}
+
+TEST(CsumMultibuf, Checksummer) {
+  bufferptr bp = make_data(4096 * 40);
+  bufferlist contiguous;
+  contiguous.append(bp);
+  // blocks spanning buffers, and buffers shorter than a block
+  bufferlist fragmented;
+  unsigned off = 0;
+  for (unsigned l : {4096 * 5 + 100, 10, 4096 * 3 - 110, 4096 * 20 + 5}) {
+    fragmented.append(bufferptr(bp, off, l));
+    off += l;
+  }
+  fragmented.append(bufferptr(bp, off, bp.length() - off));
+  for (auto *bl : {&contiguous, &fragmented}) {
+    check_checksummer<Checksummer::crc32c>(*bl, 4096);
+    check_checksummer<Checksummer::crc32c_16>(*bl, 4096);
+    check_checksummer<Checksummer::crc32c_8>(*bl, 4096);
+    check_checksummer<Checksummer::xxhash32>(*bl, 4096);
+    check_checksummer<Checksummer::xxhash64>(*bl, 4096);
+    check_checksummer<Checksummer::crc32c>(*bl, 8192);
+  }
+}
+
+template<typename T, typename F>
+static void bench(const char *name, const bufferptr& bp, size_t len, F f)
+{
+  const unsigned char *data = (const unsigned char *)bp.c_str();
+  size_t n = bp.length() / len;
+  T out[Checksummer::multi_blocks];
+  int count = 64;
+  utime_t start = ceph_clock_now();
+  for (int i = 0; i < count; ++i) {
+    for (size_t b = 0; b < n; b += Checksummer::multi_blocks) {
+      f(data + b * len, len, std::min(n - b, Checksummer::multi_blocks), out);
+    }
+  }
+  utime_t end = ceph_clock_now();
+  float rate = (float)count * bp.length() / (float)(1024*1024) /
+    (float)(end - start);
+  std::cout << name << " " << len << " byte blocks = " << rate << " MB/sec"
+	    << std::endl;
+}
+
+TEST(CsumMultibuf, Performance) {
+  bufferptr bp = make_data(16 * 1024 * 1024);
+  for (size_t len : {4096, 65536}) {
+    bench<uint32_t>("crc32c one by one", bp, len,
+		    [](const unsigned char *d, size_t l, size_t n, uint32_t *o) {
+		      ceph_crc32c_multi_generic(-1, d, l, n, o);
+		    });
+    bench<uint32_t>("crc32c multi-buffer", bp, len,
+		    [](const unsigned char *d, size_t l, size_t n, uint32_t *o) {
+		      ceph_crc32c_multi(-1, d, l, n, o);
+		    });
+    bench<uint32_t>("xxhash32 one by one", bp, len,
+		    [](const unsigned char *d, size_t l, size_t n, uint32_t *o) {
+		      ceph_xxhash32_multi_generic(-1, d, l, n, o);
+		    });
+    bench<uint32_t>("xxhash32 multi-buffer", bp, len,
+		    [](const unsigned char *d, size_t l, size_t n, uint32_t *o) {
+		      ceph_xxhash32_multi(-1, d, l, n, o);
+		    });
+    bench<uint64_t>("xxhash64 one by one", bp, len,
+		    [](const unsigned char *d, size_t l, size_t n, uint64_t *o) {
+		      ceph_xxhash64_multi_generic(-1, d, l, n, o);
+		    });
+    bench<uint64_t>("xxhash64 multi-buffer", bp, len,
+		    [](const unsigned char *d, size_t l, size_t n, uint64_t *o) {
+		      ceph_xxhash64_multi(-1, d, l, n, o);
+		    });
+  }
+}
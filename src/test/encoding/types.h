@@ -152,6 +152,7 @@ TYPE(bluestore_onode_t)
 TYPE(bluestore_deferred_op_t)
 TYPE(bluestore_deferred_transaction_t)
 // TYPE(bluestore_compression_header_t) there is no encode here
+TYPE(bluestore_alloc_snapshot_t)
 
 #include "os/bluestore/bluefs_types.h"
 TYPE(bluefs_extent_t)
@@ -0,0 +1,397 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Offline replay of an rbd-replay trace through the prefetch image cache.
+ *
+ * The I/O actions of a trace produced by rbd-replay-prep are replayed
+ * back-to-back against the in-memory librados test stub, so the numbers
+ * only reflect the cache and the prediction/detection pipeline, never the
+ * network or the OSDs. For every phase (a fixed number of replayed ops)
+ * the read hit rate, prefetch accuracy, wasted prefetch bytes and the
+ * p50/p99 read latency are reported.
+ *
+ * Any "--<option> <value>" pair that is not recognized by the benchmark
+ * itself is applied to the client configuration, e.g.
+ *
+ *   ceph_bench_librbd_prefetch trace.bin --rbd_prefetch_cache_size 16M
+ */
+
+#include "include/rados/librados.hpp"
+#include "common/Cond.h"
+#include "common/ceph_argparse.h"
+#include "common/ceph_time.h"
+#include "common/TextTable.h"
+#include "common/errno.h"
+#include "global/global_context.h"
+#include "include/intarith.h"
+#include "include/stringify.h"
+#include "librbd/ImageCtx.h"
+#include "librbd/ImageState.h"
+#include "librbd/internal.h"
+#include "librbd/cache/PrefetchImageCache.h"
+#include "librbd/io/ImageRequestWQ.h"
+#include "librbd/io/ReadResult.h"
+#include "rbd_replay/ActionTypes.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+namespace action = rbd_replay::action;
+
+namespace {
+
+const std::string POOL_NAME("prefetch_bench");
+
+enum OpType {
+  OP_READ,
+  OP_WRITE,
+  OP_DISCARD
+};
+
+struct Op {
+  OpType type;
+  action::imagectx_id_t image;
+  uint64_t offset;
+  uint64_t length;
+};
+
+struct PhaseStats {
+  uint64_t reads = 0;
+  uint64_t writes = 0;
+  uint64_t discards = 0;
+  std::vector<uint64_t> read_latencies_us;
+};
+
+void usage(std::ostream &out) {
+  out << "usage: ceph_bench_librbd_prefetch [options] <trace>\n"
+      << "\n"
+      << "  --phase-ops <n>      replayed ops per reported phase"
+      << " (default 10000)\n"
+      << "  --think-time <us>    delay between replayed ops (default 0)\n"
+      << "  --order <bits>       image object size order (default 22)\n"
+      << "  --<option> <value>   set a client config option\n";
+}
+
+int load_trace(const std::string &path, std::vector<Op> *ops) {
+  bufferlist bl;
+  std::string err;
+  int r = bl.read_file(path.c_str(), &err);
+  if (r < 0) {
+    std::cerr << "failed to read " << path << ": " << err << std::endl;
+    return r;
+  }
+
+  auto it = bl.cbegin();
+  bool versioned = false;
+  if (it.get_remaining() >= action::BANNER.size()) {
+    std::string banner;
+    it.copy(action::BANNER.size(), banner);
+    versioned = (banner == action::BANNER);
+    if (!versioned) {
+      it.seek(0);
+    }
+  }
+
+  while (it.get_remaining() > 0) {
+    action::ActionEntry entry;
+    try {
+      if (versioned) {
+        entry.decode(it);
+      } else {
+        entry.decode_unversioned(it);
+      }
+    } catch (const buffer::error &e) {
+      std::cerr << "failed to decode trace action: " << e.what() << std::endl;
+      return -EINVAL;
+    }
+
+    const action::IoActionBase *io = nullptr;
+    OpType type;
+    if ((io = boost::get<action::ReadAction>(&entry.action)) != nullptr ||
+        (io = boost::get<action::AioReadAction>(&entry.action)) != nullptr) {
+      type = OP_READ;
+    } else if (
+        (io = boost::get<action::WriteAction>(&entry.action)) != nullptr ||
+        (io = boost::get<action::AioWriteAction>(&entry.action)) != nullptr) {
+      type = OP_WRITE;
+    } else if (
+        (io = boost::get<action::DiscardAction>(&entry.action)) != nullptr ||
+        (io = boost::get<action::AioDiscardAction>(&entry.action)) != nullptr) {
+      type = OP_DISCARD;
+    } else {
+      continue;
+    }
+
+    if (io->length > 0) {
+      ops->push_back({type, io->imagectx_id, io->offset, io->length});
+    }
+  }
+  return 0;
+}
+
+uint64_t percentile(std::vector<uint64_t> &values, double p) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t n = std::min(values.size() - 1,
+                      static_cast<size_t>(p * values.size()));
+  std::nth_element(values.begin(), values.begin() + n, values.end());
+  return values[n];
+}
+
+double ratio(uint64_t n, uint64_t d) {
+  return d == 0 ? 0.0 : static_cast<double>(n) / static_cast<double>(d);
+}
+
+librbd::cache::RealCache::Stats cache_stats(
+    const std::map<action::imagectx_id_t, librbd::ImageCtx*> &images) {
+  librbd::cache::RealCache::Stats total;
+  for (auto &it : images) {
+    auto image_cache = dynamic_cast<
+      librbd::cache::PrefetchImageCache<librbd::ImageCtx>*>(
+        it.second->image_cache);
+    if (image_cache == nullptr) {
+      continue;
+    }
+    auto stats = image_cache->get_cache_stats();
+    total.hits += stats.hits;
+    total.misses += stats.misses;
+    total.prefetched += stats.prefetched;
+    total.prefetched_bytes += stats.prefetched_bytes;
+    total.prefetch_used += stats.prefetch_used;
+    total.prefetch_unused += stats.prefetch_unused;
+    total.prefetch_unused_bytes += stats.prefetch_unused_bytes;
+  }
+  return total;
+}
+
+void add_row(TextTable &tbl, const std::string &name,
+             const librbd::cache::RealCache::Stats &start,
+             const librbd::cache::RealCache::Stats &end,
+             PhaseStats &phase) {
+  uint64_t hits = end.hits - start.hits;
+  uint64_t misses = end.misses - start.misses;
+  uint64_t prefetched = end.prefetched - start.prefetched;
+  uint64_t prefetch_used = end.prefetch_used - start.prefetch_used;
+
+  tbl << name
+      << phase.reads
+      << phase.writes
+      << ratio(hits, hits + misses)
+      << prefetched
+      << ratio(prefetch_used, prefetched)
+      << (end.prefetch_unused_bytes - start.prefetch_unused_bytes)
+      << percentile(phase.read_latencies_us, 0.50)
+      << percentile(phase.read_latencies_us, 0.99)
+      << TextTable::endrow;
+}
+
+} // anonymous namespace
+
+int main(int argc, const char **argv) {
+  std::vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+
+  uint64_t phase_ops = 10000;
+  uint64_t think_time_us = 0;
+  int order = 22;
+  std::map<std::string, std::string> config;
+  std::string trace_path;
+
+  std::string val;
+  for (auto i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(std::cout);
+      return 0;
+    } else if (ceph_argparse_witharg(args, i, &val, "--phase-ops",
+                                     (char*)NULL)) {
+      phase_ops = std::max<uint64_t>(1, strtoull(val.c_str(), NULL, 10));
+    } else if (ceph_argparse_witharg(args, i, &val, "--think-time",
+                                     (char*)NULL)) {
+      think_time_us = strtoull(val.c_str(), NULL, 10);
+    } else if (ceph_argparse_witharg(args, i, &val, "--order", (char*)NULL)) {
+      order = atoi(val.c_str());
+    } else if (strncmp(*i, "--", 2) == 0 && i + 1 != args.end()) {
+      config[*i + 2] = *(i + 1);
+      i = args.erase(i, i + 2);
+    } else if (trace_path.empty()) {
+      trace_path = *i;
+      i = args.erase(i);
+    } else {
+      usage(std::cerr);
+      return 1;
+    }
+  }
+  if (trace_path.empty()) {
+    usage(std::cerr);
+    return 1;
+  }
+
+  std::vector<Op> ops;
+  int r = load_trace(trace_path, &ops);
+  if (r < 0) {
+    return -r;
+  }
+
+  std::map<action::imagectx_id_t, uint64_t> image_sizes;
+  for (auto &op : ops) {
+    uint64_t &size = image_sizes[op.image];
+    size = std::max(size, op.offset + op.length);
+  }
+  std::cout << "replaying " << ops.size() << " I/O ops against "
+            << image_sizes.size() << " image(s)" << std::endl;
+
+  librados::Rados rados;
+  librados::IoCtx ioctx;
+  if ((r = rados.init(nullptr)) < 0 ||
+      (r = rados.connect()) < 0) {
+    std::cerr << "failed to connect: " << cpp_strerror(r) << std::endl;
+    return -r;
+  }
+  g_ceph_context = reinterpret_cast<CephContext*>(rados.cct());
+
+  // the trace is replayed from the first op, so cache from the first read
+  rados.conf_set("rbd_prefetch_cache_warmup_writes", "0");
+  for (auto &it : config) {
+    r = rados.conf_set(it.first.c_str(), it.second.c_str());
+    if (r < 0) {
+      std::cerr << "failed to set " << it.first << ": " << cpp_strerror(r)
+                << std::endl;
+      return -r;
+    }
+  }
+
+  if ((r = rados.pool_create(POOL_NAME.c_str())) < 0 ||
+      (r = rados.ioctx_create(POOL_NAME.c_str(), ioctx)) < 0) {
+    std::cerr << "failed to create pool: " << cpp_strerror(r) << std::endl;
+    return -r;
+  }
+
+  std::map<action::imagectx_id_t, librbd::ImageCtx*> images;
+  uint64_t object_size = 1ULL << order;
+  for (auto &it : image_sizes) {
+    std::string name = "image." + stringify(it.first);
+    uint64_t size = round_up_to(it.second, object_size);
+    int image_order = order;
+    r = librbd::create(ioctx, name.c_str(), size, &image_order);
+    if (r < 0) {
+      std::cerr << "failed to create " << name << ": " << cpp_strerror(r)
+                << std::endl;
+      return -r;
+    }
+
+    auto ictx = new librbd::ImageCtx(name, "", nullptr, ioctx, false);
+    r = ictx->state->open(false);
+    if (r < 0) {
+      std::cerr << "failed to open " << name << ": " << cpp_strerror(r)
+                << std::endl;
+      return -r;
+    }
+    images[it.first] = ictx;
+  }
+
+  TextTable tbl;
+  tbl.define_column("PHASE", TextTable::LEFT, TextTable::LEFT);
+  tbl.define_column("READS", TextTable::LEFT, TextTable::RIGHT);
+  tbl.define_column("WRITES", TextTable::LEFT, TextTable::RIGHT);
+  tbl.define_column("HIT_RATE", TextTable::LEFT, TextTable::RIGHT);
+  tbl.define_column("PREFETCHED", TextTable::LEFT, TextTable::RIGHT);
+  tbl.define_column("ACCURACY", TextTable::LEFT, TextTable::RIGHT);
+  tbl.define_column("WASTED_BYTES", TextTable::LEFT, TextTable::RIGHT);
+  tbl.define_column("P50_US", TextTable::LEFT, TextTable::RIGHT);
+  tbl.define_column("P99_US", TextTable::LEFT, TextTable::RIGHT);
+
+  PhaseStats total;
+  PhaseStats phase;
+  auto total_start = cache_stats(images);
+  auto phase_start = total_start;
+  uint64_t phase_num = 0;
+
+  for (size_t n = 0; n < ops.size(); ++n) {
+    auto &op = ops[n];
+    auto ictx = images[op.image];
+
+    switch (op.type) {
+    case OP_READ:
+      {
+        bufferlist bl;
+        auto start = ceph::mono_clock::now();
+        r = ictx->io_work_queue->read(op.offset, op.length,
+                                      librbd::io::ReadResult{&bl}, 0);
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+          ceph::mono_clock::now() - start).count();
+        phase.read_latencies_us.push_back(elapsed);
+        total.read_latencies_us.push_back(elapsed);
+        ++phase.reads;
+        ++total.reads;
+
+        // every image is sized to cover the trace, so a short read means
+        // the cache returned the wrong data
+        if (r >= 0 && (static_cast<uint64_t>(r) != op.length ||
+                       bl.length() != op.length)) {
+          std::cerr << "replayed read " << n << " " << op.offset << "~"
+                    << op.length << " returned " << r << " (" << bl.length()
+                    << " bytes)" << std::endl;
+          return EIO;
+        }
+      }
+      break;
+    case OP_WRITE:
+      {
+        bufferlist bl;
+        bl.append_zero(op.length);
+        r = ictx->io_work_queue->write(op.offset, op.length, std::move(bl), 0);
+        ++phase.writes;
+        ++total.writes;
+      }
+      break;
+    case OP_DISCARD:
+      r = ictx->io_work_queue->discard(op.offset, op.length, false);
+      ++phase.discards;
+      ++total.discards;
+      break;
+    }
+    if (r < 0) {
+      std::cerr << "replayed op " << n << " failed: " << cpp_strerror(r)
+                << std::endl;
+      return -r;
+    }
+
+    if (think_time_us > 0) {
+      usleep(think_time_us);
+    }
+
+    if ((n + 1) % phase_ops == 0 || n + 1 == ops.size()) {
+      auto phase_end = cache_stats(images);
+      add_row(tbl, stringify(phase_num++), phase_start, phase_end, phase);
+      phase_start = phase_end;
+      phase = PhaseStats();
+    }
+  }
+
+  // drop what is left in the caches so that prefetched chunks which were
+  // never read are accounted as wasted
+  for (auto &it : images) {
+    C_SaferCond ctx;
+    it.second->image_cache->invalidate(&ctx);
+    ctx.wait();
+  }
+  add_row(tbl, "total", total_start, cache_stats(images), total);
+
+  for (auto &it : images) {
+    it.second->state->close();
+  }
+  std::cout << tbl;
+
+  ioctx.close();
+  rados.pool_delete(POOL_NAME.c_str());
+  rados.shutdown();
+  return 0;
+}
@@ -0,0 +1,167 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+/*
+ * Microbenchmark of the virtual cache of the prefetch prediction model.
+ *
+ * A synthetic access stream is built from a set of "files", each a fixed
+ * random sequence of chunk IDs; files are replayed in random order so the
+ * successor model keeps finding candidates. For every virtual cache size
+ * the model is warmed up until the cache is full, then the average cost
+ * of VirtCache::updateHistory() is measured. With an indexed cache that
+ * cost should not depend on the cache size.
+ *
+ *   ceph_bench_librbd_virt_cache --sizes 16,256,4096 --accesses 200000
+ */
+
+#include "librbd/cache/ext/VirtCache.h"
+#include "common/ceph_argparse.h"
+#include "common/ceph_time.h"
+#include "common/TextTable.h"
+#include "include/stringify.h"
+#include "include/str_list.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+void usage(std::ostream &out) {
+  out << "usage: ceph_bench_librbd_virt_cache [options]\n"
+      << "\n"
+      << "  --sizes <n,...>      virtual cache sizes to measure"
+      << " (default 16,64,256,1024,4096,16384)\n"
+      << "  --accesses <n>       measured accesses per size (default 200000)\n"
+      << "  --files <n>          files in the synthetic stream (default 256)\n"
+      << "  --file-length <n>    chunks per file (default 32)\n"
+      << "  --model-size <bytes> successor model size (default 256M)\n";
+}
+
+typedef std::vector<std::vector<uint64_t>> Layout;
+
+Layout make_layout(uint64_t files, uint64_t file_length, std::mt19937_64 &rng) {
+  Layout layout(files);
+  std::uniform_int_distribution<uint64_t> chunk(1, files * file_length * 4);
+  for (auto &file : layout) {
+    for (uint64_t i = 0; i < file_length; ++i) {
+      file.push_back(chunk(rng));
+    }
+  }
+  return layout;
+}
+
+std::vector<uint64_t> make_stream(const Layout &layout, uint64_t accesses,
+                                  std::mt19937_64 &rng) {
+  std::vector<uint64_t> stream;
+  stream.reserve(accesses + layout[0].size());
+  std::uniform_int_distribution<uint64_t> pick(0, layout.size() - 1);
+  while (stream.size() < accesses) {
+    auto &file = layout[pick(rng)];
+    stream.insert(stream.end(), file.begin(), file.end());
+  }
+  stream.resize(accesses);
+  return stream;
+}
+
+} // anonymous namespace
+
+int main(int argc, const char **argv) {
+  std::vector<const char*> args;
+  argv_to_vec(argc, argv, args);
+
+  std::string sizes_str = "16,64,256,1024,4096,16384";
+  uint64_t accesses = 200000;
+  uint64_t files = 256;
+  uint64_t file_length = 32;
+  uint64_t model_bytes = 256 << 20;
+
+  std::string val;
+  for (auto i = args.begin(); i != args.end(); ) {
+    if (ceph_argparse_double_dash(args, i)) {
+      break;
+    } else if (ceph_argparse_flag(args, i, "-h", "--help", (char*)NULL)) {
+      usage(std::cout);
+      return 0;
+    } else if (ceph_argparse_witharg(args, i, &val, "--sizes", (char*)NULL)) {
+      sizes_str = val;
+    } else if (ceph_argparse_witharg(args, i, &val, "--accesses",
+                                     (char*)NULL)) {
+      accesses = std::max<uint64_t>(1, strtoull(val.c_str(), NULL, 10));
+    } else if (ceph_argparse_witharg(args, i, &val, "--files", (char*)NULL)) {
+      files = std::max<uint64_t>(1, strtoull(val.c_str(), NULL, 10));
+    } else if (ceph_argparse_witharg(args, i, &val, "--file-length",
+                                     (char*)NULL)) {
+      file_length = std::max<uint64_t>(1, strtoull(val.c_str(), NULL, 10));
+    } else if (ceph_argparse_witharg(args, i, &val, "--model-size",
+                                     (char*)NULL)) {
+      model_bytes = strtoull(val.c_str(), NULL, 10);
+    } else {
+      usage(std::cerr);
+      return 1;
+    }
+  }
+
+  std::vector<uint64_t> sizes;
+  for (auto &s : get_str_list(sizes_str, ",")) {
+    sizes.push_back(strtoull(s.c_str(), NULL, 10));
+  }
+  if (sizes.empty()) {
+    usage(std::cerr);
+    return 1;
+  }
+
+  std::mt19937_64 rng(0);
+  auto layout = make_layout(files, file_length, rng);
+  auto warmup = make_stream(layout, accesses, rng);
+  auto measured = make_stream(layout, accesses, rng);
+
+  TextTable tbl;
+  tbl.define_column("VCACHE_SIZE", TextTable::LEFT, TextTable::RIGHT);
+  tbl.define_column("ACCESSES", TextTable::LEFT, TextTable::RIGHT);
+  tbl.define_column("NS_PER_ACCESS", TextTable::LEFT, TextTable::RIGHT);
+  tbl.define_column("PREFETCH_PER_ACCESS", TextTable::LEFT, TextTable::RIGHT);
+  tbl.define_column("EVICTED", TextTable::LEFT, TextTable::RIGHT);
+
+  for (auto size : sizes) {
+    predictcache::CacheParameters params;
+    params.vcache_size = std::max<uint64_t>(size, 1);
+    params.model_bytes = model_bytes;
+    predictcache::VirtCache virt_cache(params);
+
+    for (auto id : warmup) {
+      virt_cache.updateHistory(id);
+      virt_cache.getPrefetchList().clear();
+      virt_cache.getEvictionList().clear();
+    }
+
+    uint64_t prefetched = 0;
+    uint64_t evicted = 0;
+    auto start = ceph::mono_clock::now();
+    for (auto id : measured) {
+      virt_cache.updateHistory(id);
+
+      auto &prefetch_list = virt_cache.getPrefetchList();
+      auto &eviction_list = virt_cache.getEvictionList();
+      prefetched += prefetch_list.size();
+      evicted += eviction_list.size();
+      prefetch_list.clear();
+      eviction_list.clear();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      ceph::mono_clock::now() - start).count();
+
+    tbl << size
+        << measured.size()
+        << elapsed / measured.size()
+        << stringify(static_cast<double>(prefetched) / measured.size())
+        << evicted
+        << TextTable::endrow;
+  }
+
+  std::cout << tbl;
+  return 0;
+}
@@ -0,0 +1,83 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "librbd/cache/AccessRing.h"
+#include "gtest/gtest.h"
+
+#include <thread>
+#include <vector>
+
+namespace librbd {
+namespace cache {
+
+TEST(TestAccessRing, Capacity) {
+  AccessRing<uint64_t> ring(5);
+  ASSERT_EQ(8u, ring.capacity());
+
+  for (uint64_t i = 0; i < 8; ++i) {
+    ASSERT_TRUE(ring.try_push(i));
+  }
+  ASSERT_FALSE(ring.try_push(8));
+  ASSERT_EQ(8u, ring.size());
+
+  uint64_t value;
+  for (uint64_t i = 0; i < 8; ++i) {
+    ASSERT_TRUE(ring.try_pop(&value));
+    ASSERT_EQ(i, value);
+  }
+  ASSERT_FALSE(ring.try_pop(&value));
+  ASSERT_EQ(0u, ring.size());
+}
+
+TEST(TestAccessRing, Wraparound) {
+  AccessRing<uint64_t> ring(4);
+
+  uint64_t value;
+  for (uint64_t i = 0; i < 100; ++i) {
+    ASSERT_TRUE(ring.try_push(i));
+    ASSERT_TRUE(ring.try_push(i + 1000));
+    ASSERT_TRUE(ring.try_pop(&value));
+    ASSERT_EQ(i, value);
+    ASSERT_TRUE(ring.try_pop(&value));
+    ASSERT_EQ(i + 1000, value);
+  }
+}
+
+TEST(TestAccessRing, ConcurrentProducers) {
+  const uint64_t producers = 4;
+  const uint64_t per_producer = 10000;
+  AccessRing<uint64_t> ring(64);
+
+  std::vector<std::thread> threads;
+  for (uint64_t p = 0; p < producers; ++p) {
+    threads.emplace_back([&ring, p, per_producer]() {
+        for (uint64_t i = 0; i < per_producer; ++i) {
+          while (!ring.try_push(p * per_producer + i)) {
+            std::this_thread::yield();
+          }
+        }
+      });
+  }
+
+  std::vector<bool> seen(producers * per_producer, false);
+  uint64_t popped = 0;
+  uint64_t value;
+  while (popped < producers * per_producer) {
+    if (!ring.try_pop(&value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    ASSERT_LT(value, seen.size());
+    ASSERT_FALSE(seen[value]);
+    seen[value] = true;
+    ++popped;
+  }
+
+  for (auto &t : threads) {
+    t.join();
+  }
+  ASSERT_FALSE(ring.try_pop(&value));
+}
+
+} // namespace cache
+} // namespace librbd
@@ -0,0 +1,123 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "test/librbd/test_fixture.h"
+#include "test/librbd/test_support.h"
+#include "librbd/ImageCtx.h"
+#include "librbd/cache/PrefetchImageCache.h"
+#include "librbd/io/ImageRequestWQ.h"
+#include "librbd/io/ReadResult.h"
+
+void register_test_prefetch_image_cache() {
+}
+
+namespace librbd {
+namespace cache {
+
+class TestPrefetchImageCache : public TestFixture {
+public:
+  void SetUp() override {
+    TestFixture::SetUp();
+    m_cct = reinterpret_cast<CephContext*>(m_ioctx.cct());
+
+    // cache from the first read
+    m_warmup_writes = m_cct->_conf->get_val<uint64_t>(
+      "rbd_prefetch_cache_warmup_writes");
+    ASSERT_EQ(0, m_cct->_conf->set_val("rbd_prefetch_cache_warmup_writes",
+                                       "0"));
+  }
+
+  void TearDown() override {
+    m_cct->_conf->set_val("rbd_prefetch_cache_warmup_writes",
+                          stringify(m_warmup_writes));
+    TestFixture::TearDown();
+  }
+
+  void write_pattern(ImageCtx *ictx, bufferlist *data) {
+    for (uint64_t i = 0; i < m_image_size; ++i) {
+      data->append(static_cast<char>((i * 7919) >> 5));
+    }
+    ASSERT_EQ((ssize_t)m_image_size,
+              ictx->io_work_queue->write(0, m_image_size, bufferlist{*data},
+                                         0));
+  }
+
+  void check_read(ImageCtx *ictx, const bufferlist &data, uint64_t off,
+                  uint64_t len) {
+    bufferlist read_bl;
+    ASSERT_EQ((ssize_t)len,
+              ictx->io_work_queue->read(off, len,
+                                        io::ReadResult{&read_bl}, 0));
+    bufferlist expected;
+    expected.substr_of(data, off, len);
+    ASSERT_EQ(len, read_bl.length()) << off << "~" << len;
+    ASSERT_TRUE(expected.contents_equal(read_bl)) << off << "~" << len;
+  }
+
+  CephContext *m_cct;
+  uint64_t m_warmup_writes = 0;
+};
+
+TEST_F(TestPrefetchImageCache, UnalignedReads) {
+  librbd::ImageCtx *ictx;
+  ASSERT_EQ(0, open_image(m_image_name, &ictx));
+
+  bufferlist data;
+  write_pattern(ictx, &data);
+
+  auto image_cache = static_cast<PrefetchImageCache<ImageCtx>*>(
+    ictx->image_cache);
+  uint64_t chunk_size = image_cache->get_chunk_size();
+  ASSERT_LT(2 * chunk_size, m_image_size);
+
+  // sub-chunk, unaligned, chunk-crossing and image-ending reads; each one
+  // twice, so that the second is served (at least partly) from the cache
+  std::vector<std::pair<uint64_t, uint64_t> > reads = {
+    {0, 512},
+    {1000, 3000},
+    {chunk_size - 100, 300},
+    {chunk_size + 1, chunk_size - 2},
+    {5, 2 * chunk_size + 17},
+    {m_image_size - chunk_size - 3, chunk_size + 3},
+    {m_image_size - 1, 1}};
+  for (int pass = 0; pass < 2; ++pass) {
+    for (auto &read : reads) {
+      check_read(ictx, data, read.first, read.second);
+    }
+  }
+  ASSERT_LT(0u, image_cache->get_cache_stats().hits);
+}
+
+TEST_F(TestPrefetchImageCache, PartiallyCachedRead) {
+  librbd::ImageCtx *ictx;
+  ASSERT_EQ(0, open_image(m_image_name, &ictx));
+
+  bufferlist data;
+  write_pattern(ictx, &data);
+
+  auto image_cache = static_cast<PrefetchImageCache<ImageCtx>*>(
+    ictx->image_cache);
+  uint64_t chunk_size = image_cache->get_chunk_size();
+  ASSERT_LT(6 * chunk_size, m_image_size);
+
+  // cache the middle chunk only, then read across all three
+  check_read(ictx, data, 4 * chunk_size + 10, 20);
+  check_read(ictx, data, 3 * chunk_size + 7, 2 * chunk_size + 11);
+
+  // a write drops the chunks it touches, and the next read sees it
+  bufferlist bl;
+  bl.append(std::string(100, 'x'));
+  ASSERT_EQ(100, ictx->io_work_queue->write(4 * chunk_size + 50, bl.length(),
+                                            bufferlist{bl}, 0));
+  bufferlist updated;
+  updated.substr_of(data, 0, 4 * chunk_size + 50);
+  updated.append(bl);
+  bufferlist tail;
+  tail.substr_of(data, 4 * chunk_size + 150,
+                 data.length() - (4 * chunk_size + 150));
+  updated.append(tail);
+  check_read(ictx, updated, 3 * chunk_size + 7, 2 * chunk_size + 11);
+}
+
+} // namespace cache
+} // namespace librbd
@@ -0,0 +1,159 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "librbd/cache/RealCache.h"
+#include "global/global_context.h"
+#include "gtest/gtest.h"
+
+#include <vector>
+
+namespace librbd {
+namespace cache {
+
+namespace {
+
+bufferptr make_chunk(size_t len, char c) {
+  bufferptr bp(buffer::create(len));
+  memset(bp.c_str(), c, len);
+  return bp;
+}
+
+} // anonymous namespace
+
+TEST(TestRealCache, InsertGet) {
+  RealCache real_cache(g_ceph_context, nullptr, 1 << 20, 4);
+
+  ASSERT_EQ(0u, real_cache.get(1).length());
+  real_cache.insert(1, make_chunk(4096, 'a'), false);
+  real_cache.insert(2, make_chunk(4096, 'b'), true);
+
+  bufferptr bp = real_cache.get(1);
+  ASSERT_EQ(4096u, bp.length());
+  ASSERT_EQ('a', bp.c_str()[0]);
+  ASSERT_EQ('b', real_cache.get(2).c_str()[4095]);
+
+  ASSERT_EQ(2u, real_cache.get_num_entries());
+  ASSERT_EQ(8192u, real_cache.get_bytes());
+  ASSERT_EQ(3u, real_cache.get_hits());
+  ASSERT_EQ(1u, real_cache.get_misses());
+}
+
+TEST(TestRealCache, ReplaceUpdatesBytes) {
+  RealCache real_cache(g_ceph_context, nullptr, 1 << 20, 1);
+
+  real_cache.insert(7, make_chunk(4096, 'a'), false);
+  real_cache.insert(7, make_chunk(1024, 'b'), false);
+
+  ASSERT_EQ(1u, real_cache.get_num_entries());
+  ASSERT_EQ(1024u, real_cache.get_bytes());
+  ASSERT_EQ('b', real_cache.get(7).c_str()[0]);
+}
+
+TEST(TestRealCache, EvictsLeastRecentlyUsed) {
+  // single shard with room for three chunks
+  RealCache real_cache(g_ceph_context, nullptr, 3 * 4096, 1);
+
+  real_cache.insert(1, make_chunk(4096, 'a'), false);
+  real_cache.insert(2, make_chunk(4096, 'b'), false);
+  real_cache.insert(3, make_chunk(4096, 'c'), false);
+
+  // touch 1 so that 2 becomes the oldest entry
+  ASSERT_EQ(4096u, real_cache.get(1).length());
+  real_cache.insert(4, make_chunk(4096, 'd'), false);
+
+  ASSERT_TRUE(real_cache.contains(1));
+  ASSERT_FALSE(real_cache.contains(2));
+  ASSERT_TRUE(real_cache.contains(3));
+  ASSERT_TRUE(real_cache.contains(4));
+  ASSERT_EQ(3u * 4096, real_cache.get_bytes());
+}
+
+TEST(TestRealCache, BudgetIsSplitAcrossShards) {
+  RealCache real_cache(g_ceph_context, nullptr, 4 * 4096, 4);
+  ASSERT_EQ(4096u, real_cache.get_shard_max_bytes());
+
+  // each shard holds a single chunk, wherever the IDs hash to
+  for (ElementID id = 0; id < 64; ++id) {
+    real_cache.insert(id, make_chunk(4096, 'a'), false);
+    ASSERT_TRUE(real_cache.contains(id));
+    ASSERT_GE(4u * 4096, real_cache.get_bytes());
+  }
+  ASSERT_GE(4u, real_cache.get_num_entries());
+}
+
+TEST(TestRealCache, NeighboursSpreadAcrossShards) {
+  RealCache real_cache(g_ceph_context, nullptr, 16 * 4096, 16);
+
+  // a sequential run of chunks does not pile into a few shards
+  for (ElementID id = 0; id < 16; ++id) {
+    real_cache.insert(id * 16, make_chunk(4096, 'a'), false);
+  }
+  ASSERT_LT(1u, real_cache.get_num_entries());
+}
+
+TEST(TestRealCache, RejectsChunkLargerThanShard) {
+  RealCache real_cache(g_ceph_context, nullptr, 2 * 4096, 2);
+
+  real_cache.insert(1, make_chunk(4096, 'a'), false);
+  real_cache.insert(2, make_chunk(8192, 'b'), false);
+
+  ASSERT_TRUE(real_cache.contains(1));
+  ASSERT_FALSE(real_cache.contains(2));
+  ASSERT_EQ(4096u, real_cache.get_bytes());
+}
+
+TEST(TestRealCache, EraseAndClear) {
+  RealCache real_cache(g_ceph_context, nullptr, 1 << 20, 2);
+
+  for (ElementID id = 1; id <= 8; ++id) {
+    real_cache.insert(id, make_chunk(512, 'x'), false);
+  }
+  real_cache.erase(3);
+  ASSERT_FALSE(real_cache.contains(3));
+  ASSERT_EQ(7u, real_cache.get_num_entries());
+
+  real_cache.clear();
+  ASSERT_EQ(0u, real_cache.get_num_entries());
+  ASSERT_EQ(0u, real_cache.get_bytes());
+}
+
+TEST(TestRealCache, InvalidateDropsStaleInserts) {
+  RealCache real_cache(g_ceph_context, nullptr, 1 << 20, 1);
+
+  real_cache.insert(1, make_chunk(4096, 'a'), false);
+  uint64_t epoch = real_cache.get_epoch(2);
+
+  // a write to chunk 1 lands while chunk 2 is being read
+  real_cache.invalidate(1);
+  ASSERT_FALSE(real_cache.contains(1));
+  ASSERT_NE(epoch, real_cache.get_epoch(2));
+
+  real_cache.insert(2, make_chunk(4096, 'b'), false, false, epoch);
+  ASSERT_FALSE(real_cache.contains(2));
+
+  real_cache.insert(2, make_chunk(4096, 'b'), false, false,
+                    real_cache.get_epoch(2));
+  ASSERT_TRUE(real_cache.contains(2));
+}
+
+TEST(TestRealCache, EvictHandler) {
+  RealCache real_cache(g_ceph_context, nullptr, 2 * 4096, 1);
+
+  std::vector<ElementID> evicted;
+  real_cache.set_evict_handler([&evicted](ElementID id, const bufferptr &bp) {
+      ASSERT_EQ(4096u, bp.length());
+      evicted.push_back(id);
+    });
+
+  real_cache.insert(1, make_chunk(4096, 'a'), false);
+  real_cache.insert(2, make_chunk(4096, 'b'), false);
+  real_cache.insert(3, make_chunk(4096, 'c'), false);
+
+  // invalidated chunks are dropped, not handed to the lower tier
+  real_cache.invalidate(2);
+
+  ASSERT_EQ(std::vector<ElementID>{1}, evicted);
+}
+
+} // namespace cache
+} // namespace librbd
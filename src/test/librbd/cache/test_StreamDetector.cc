@@ -0,0 +1,104 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "librbd/cache/StreamDetector.h"
+#include "global/global_context.h"
+#include "gtest/gtest.h"
+
+#include <vector>
+
+namespace librbd {
+namespace cache {
+
+namespace {
+
+typedef std::vector<ElementID> ElementIDs;
+
+} // anonymous namespace
+
+TEST(TestStreamDetector, Sequential) {
+  StreamDetector detector(g_ceph_context, 4, 3, 8, 4);
+  ElementIDs prefetch_ids;
+
+  ASSERT_FALSE(detector.update(1, 1000, &prefetch_ids));
+  ASSERT_FALSE(detector.update(2, 1000, &prefetch_ids));
+  ASSERT_FALSE(detector.update(3, 1000, &prefetch_ids));
+  ASSERT_TRUE(prefetch_ids.empty());
+
+  ASSERT_TRUE(detector.update(4, 1000, &prefetch_ids));
+  ASSERT_EQ(ElementIDs({5, 6}), prefetch_ids);
+
+  // half the window was consumed: the depth doubles
+  prefetch_ids.clear();
+  ASSERT_TRUE(detector.update(5, 1000, &prefetch_ids));
+  ASSERT_EQ(ElementIDs({7, 8, 9}), prefetch_ids);
+
+  prefetch_ids.clear();
+  ASSERT_TRUE(detector.update(6, 1000, &prefetch_ids));
+  ASSERT_TRUE(prefetch_ids.empty());
+
+  // repeated reads within a chunk stay part of the stream
+  ASSERT_TRUE(detector.update(6, 1000, &prefetch_ids));
+  ASSERT_TRUE(prefetch_ids.empty());
+}
+
+TEST(TestStreamDetector, Strided) {
+  StreamDetector detector(g_ceph_context, 4, 3, 8, 4);
+  ElementIDs prefetch_ids;
+
+  ASSERT_FALSE(detector.update(10, 1000, &prefetch_ids));
+  ASSERT_FALSE(detector.update(13, 1000, &prefetch_ids));
+  ASSERT_FALSE(detector.update(16, 1000, &prefetch_ids));
+  ASSERT_TRUE(detector.update(19, 1000, &prefetch_ids));
+  ASSERT_EQ(ElementIDs({22, 25}), prefetch_ids);
+}
+
+TEST(TestStreamDetector, Backward) {
+  StreamDetector detector(g_ceph_context, 4, 3, 8, 4);
+  ElementIDs prefetch_ids;
+
+  ASSERT_FALSE(detector.update(5, 1000, &prefetch_ids));
+  ASSERT_FALSE(detector.update(4, 1000, &prefetch_ids));
+  ASSERT_FALSE(detector.update(3, 1000, &prefetch_ids));
+  ASSERT_TRUE(detector.update(2, 1000, &prefetch_ids));
+
+  // never below the first chunk
+  ASSERT_EQ(ElementIDs({1}), prefetch_ids);
+}
+
+TEST(TestStreamDetector, Interleaved) {
+  StreamDetector detector(g_ceph_context, 4, 3, 8, 4);
+  ElementIDs prefetch_ids;
+
+  for (ElementID i = 0; i < 3; ++i) {
+    ASSERT_FALSE(detector.update(100 + i, 1000, &prefetch_ids));
+    ASSERT_FALSE(detector.update(200 + i, 1000, &prefetch_ids));
+  }
+  ASSERT_TRUE(detector.update(103, 1000, &prefetch_ids));
+  ASSERT_TRUE(detector.update(203, 1000, &prefetch_ids));
+  ASSERT_EQ(ElementIDs({104, 105, 204, 205}), prefetch_ids);
+}
+
+TEST(TestStreamDetector, ImageEnd) {
+  StreamDetector detector(g_ceph_context, 4, 3, 8, 4);
+  ElementIDs prefetch_ids;
+
+  for (ElementID id = 1; id < 4; ++id) {
+    ASSERT_FALSE(detector.update(id, 5, &prefetch_ids));
+  }
+  ASSERT_TRUE(detector.update(4, 5, &prefetch_ids));
+  ASSERT_EQ(ElementIDs({5}), prefetch_ids);
+}
+
+TEST(TestStreamDetector, Random) {
+  StreamDetector detector(g_ceph_context, 4, 3, 8, 4);
+  ElementIDs prefetch_ids;
+
+  for (ElementID id : {17, 503, 92, 3001, 44, 760, 1280, 9}) {
+    ASSERT_FALSE(detector.update(id, 10000, &prefetch_ids));
+  }
+  ASSERT_TRUE(prefetch_ids.empty());
+}
+
+} // namespace cache
+} // namespace librbd
@@ -0,0 +1,149 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include "librbd/cache/ext/SuccessorTable.h"
+#include "librbd/cache/ext/VirtStat.h"
+#include "gtest/gtest.h"
+
+#include <map>
+
+namespace predictcache {
+
+namespace {
+
+std::map<ObjectID, uint64_t> get_followers(const SuccessorTable &table,
+                                           ObjectID obj) {
+  std::map<ObjectID, uint64_t> followers;
+  table.forEachFollower(obj, [&followers](ObjectID id, uint64_t count) {
+      followers[id] = count;
+    });
+  return followers;
+}
+
+} // anonymous namespace
+
+TEST(TestSuccessorTable, Lookup) {
+  SuccessorTable table(1 << 16, 4, 1 << 30);
+
+  for (int i = 0; i < 3; ++i) {
+    table.updateCounts(1, 2);
+  }
+  table.updateCounts(1, 3);
+  table.updateCounts(2, 3);
+
+  ASSERT_EQ(3u, table.getCount(1, 2));
+  ASSERT_EQ(1u, table.getCount(1, 3));
+  ASSERT_EQ(0u, table.getCount(1, 4));
+  ASSERT_EQ(4u, table.getRowSum(1));
+  ASSERT_EQ(3u, table.getFrequency(2));
+  ASSERT_EQ(2u, table.getFrequency(3));
+
+  // never seen
+  ASSERT_EQ(0u, table.getRowSum(42));
+  ASSERT_EQ(0u, table.getFrequency(42));
+  ASSERT_TRUE(get_followers(table, 42).empty());
+}
+
+TEST(TestSuccessorTable, FollowerRanking) {
+  SuccessorTable table(1 << 16, 2, 1 << 30);
+
+  for (int i = 0; i < 5; ++i) {
+    table.updateCounts(1, 2);
+  }
+  for (int i = 0; i < 3; ++i) {
+    table.updateCounts(1, 3);
+  }
+  ASSERT_EQ((std::map<ObjectID, uint64_t>{{2, 5}, {3, 3}}),
+            get_followers(table, 1));
+
+  // a new follower takes over the least frequent slot and its count
+  table.updateCounts(1, 4);
+  ASSERT_EQ((std::map<ObjectID, uint64_t>{{2, 5}, {4, 4}}),
+            get_followers(table, 1));
+  ASSERT_EQ(9u, table.getRowSum(1));
+}
+
+TEST(TestSuccessorTable, Decay) {
+  SuccessorTable table(1 << 16, 4, 10);
+
+  for (int i = 0; i < 8; ++i) {
+    table.updateCounts(1, 2);
+  }
+  ASSERT_EQ(8u, table.getCount(1, 2));
+
+  // twenty transitions in all: the untouched row has been halved twice
+  for (int i = 0; i < 12; ++i) {
+    table.updateCounts(3, 4);
+  }
+  ASSERT_EQ(2u, table.getCount(1, 2));
+  ASSERT_EQ(2u, table.getRowSum(1));
+}
+
+TEST(TestSuccessorTable, EvictionUnderModelBytes) {
+  const uint64_t model_bytes = 1 << 14;
+  SuccessorTable table(model_bytes, 4, 1 << 30);
+
+  uint64_t num_rows = table.getNumRows();
+  ASSERT_LE(SuccessorTable::MAX_PROBE, num_rows);
+  ASSERT_EQ(0u, num_rows & (num_rows - 1));
+  ASSERT_GE(model_bytes, table.getMemoryUsage());
+  ASSERT_LT(model_bytes, 2 * table.getMemoryUsage());
+
+  for (int i = 0; i < 1000; ++i) {
+    table.updateCounts(1, 2);
+  }
+
+  // far more cold elements than rows: the memory stays put and cold rows
+  // are recycled instead of the hot ones
+  uint64_t memory = table.getMemoryUsage();
+  for (ObjectID obj = 1000; obj < 1000 + 100 * num_rows; ++obj) {
+    table.updateCounts(obj, obj + 1);
+  }
+  ASSERT_EQ(memory, table.getMemoryUsage());
+  ASSERT_EQ(num_rows, table.getNumRows());
+  ASSERT_LE(table.getNumUsedRows(), num_rows);
+  ASSERT_EQ(1000u, table.getCount(1, 2));
+  ASSERT_EQ(1000u, table.getFrequency(2));
+
+  uint64_t tracked = 0;
+  table.forEachRow([&tracked](ObjectID, uint64_t, uint64_t) {
+      ++tracked;
+    });
+  ASSERT_GE(num_rows, tracked);
+}
+
+TEST(TestSuccessorTable, TinyBudgetKeepsOneProbeWindow) {
+  SuccessorTable table(0, 4, 1 << 30);
+  ASSERT_EQ(SuccessorTable::MAX_PROBE, table.getNumRows());
+
+  table.updateCounts(1, 2);
+  ASSERT_EQ(1u, table.getCount(1, 2));
+}
+
+TEST(TestSuccessorTable, VirtStatResizesOnModelBytes) {
+  CacheParameters params;
+  params.model_bytes = 1 << 12;
+  VirtStat stat(params);
+  uint64_t num_rows = stat.getSuccessorTable().getNumRows();
+
+  for (int i = 0; i < 5; ++i) {
+    stat.updateCounts(1, 2);
+  }
+
+  params.model_bytes = 1 << 20;
+  stat.setParameters(params);
+  ASSERT_LT(num_rows, stat.getSuccessorTable().getNumRows());
+  ASSERT_GE(params.model_bytes, stat.getSuccessorTable().getMemoryUsage());
+
+  // the statistics survive the resize
+  ASSERT_EQ(5u, stat.getSuccessorTable().getCount(1, 2));
+  ASSERT_EQ(5u, stat.getSuccessorTable().getRowSum(1));
+  ASSERT_EQ(5u, stat.getSuccessorTable().getFrequency(2));
+
+  // other parameters leave the table alone
+  params.thresh = 0.5;
+  stat.setParameters(params);
+  ASSERT_EQ(5u, stat.getSuccessorTable().getCount(1, 2));
+}
+
+} // namespace predictcache
@@ -20,6 +20,7 @@ extern void register_test_mirroring();
 extern void register_test_mirroring_watcher();
 extern void register_test_object_map();
 extern void register_test_operations();
+extern void register_test_prefetch_image_cache();
 #endif // TEST_LIBRBD_INTERNALS
 
 int main(int argc, char **argv)
@@ -38,6 +39,7 @@ int main(int argc, char **argv)
   register_test_mirroring_watcher();
   register_test_object_map();
   register_test_operations();
+  register_test_prefetch_image_cache();
 #endif // TEST_LIBRBD_INTERNALS
 
   ::testing::InitGoogleTest(&argc, argv);
@@ -4,6 +4,7 @@
  * In memory space allocator benchmarks.
  * Author: Igor Fedotov, ifedotov@suse.com
  */
+#include <deque>
 #include <iostream>
 #include <boost/scoped_ptr.hpp>
 #include <gtest/gtest.h>
@@ -40,6 +41,7 @@ public:
   }
   void doOverwriteTest(uint64_t capacity, uint64_t prefill,
     uint64_t overwrite);
+  void doAgingTest(uint64_t capacity, uint64_t fill, unsigned rounds);
 };
 
 const uint64_t _1m = 1024 * 1024;
@@ -329,10 +331,114 @@ TEST_P(AllocTest, test_alloc_bench_10_300)
   doOverwriteTest(capacity, prefill, overwrite);
 }
 
+// Age the free space with small random allocations and releases until it
+// is badly fragmented, then measure what large allocations cost.
+void AllocTest::doAgingTest(uint64_t capacity, uint64_t fill,
+  unsigned rounds)
+{
+  uint64_t alloc_unit = 4096;
+  uint64_t big_size = 4 * _1m;
+  PExtentVector tmp;
+  AllocTracker at(capacity, alloc_unit);
+
+  init_alloc(capacity, alloc_unit);
+  alloc->init_add_free(0, capacity);
+
+  gen_type rng(time(NULL));
+  boost::uniform_int<> u1(0, 4); // 4K-64K
+
+  utime_t start = ceph_clock_now();
+  uint64_t used = 0;
+  for (unsigned round = 0; round < rounds; ++round) {
+    // fill up...
+    while (used < fill) {
+      uint32_t want = alloc_unit << u1(rng);
+      tmp.clear();
+      auto r = alloc->allocate(want, alloc_unit, 0, 0, &tmp);
+      if (r < want) {
+	break;
+      }
+      used += r;
+      for (auto a : tmp) {
+	bool full = !at.push(a.offset, a.length);
+	EXPECT_EQ(full, false);
+      }
+    }
+    // ...and punch random holes
+    uint64_t released = 0;
+    while (released < fill / 4) {
+      uint64_t o = 0;
+      uint32_t l = 0;
+      if (!at.pop_random(rng, &o, &l)) {
+	break;
+      }
+      interval_set<uint64_t> release_set;
+      release_set.insert(o, l);
+      alloc->release(release_set);
+      released += l;
+    }
+    used -= released;
+  }
+  std::cout << "Aged in " << ceph_clock_now() - start
+	    << ", fragmentation " << alloc->get_fragmentation(alloc_unit)
+	    << std::endl;
+
+  // keep a working set of big allocations alive, releasing the oldest
+  // once it is full, so that the allocator keeps carving into the aged
+  // free space instead of handing back the extent it just got
+  uint64_t working_set = std::min(alloc->get_free() / 4, 1024 * big_size);
+  std::deque<interval_set<uint64_t>> held;
+  uint64_t held_bytes = 0;
+
+  start = ceph_clock_now();
+  uint64_t extents = 0;
+  unsigned allocs = 0;
+  for (; allocs < 4096; ++allocs) {
+    tmp.clear();
+    auto r = alloc->allocate(big_size, alloc_unit, big_size, 0, &tmp);
+    if (r < (int64_t)big_size) {
+      break;
+    }
+    extents += tmp.size();
+    held.emplace_back();
+    for (auto& a : tmp) {
+      held.back().insert(a.offset, a.length);
+    }
+    held_bytes += r;
+    while (held_bytes > working_set) {
+      held_bytes -= held.front().size();
+      alloc->release(held.front());
+      held.pop_front();
+    }
+  }
+  utime_t elapsed = ceph_clock_now() - start;
+  for (auto& release_set : held) {
+    alloc->release(release_set);
+  }
+  std::cout << allocs << " x " << big_size / _1m << " MB allocations in "
+	    << elapsed << " (" << working_set / _1m << " MB working set), "
+	    << (allocs ? (double)extents / allocs : 0) << " extents each"
+	    << std::endl;
+  std::cout << "Avail " << alloc->get_free() / _1m << " MB" << std::endl;
+  dump_mempools();
+}
+
+TEST_P(AllocTest, test_alloc_bench_aging_70)
+{
+  uint64_t capacity = uint64_t(256) * 1024 * 1024 * 1024;
+  doAgingTest(capacity, capacity / 10 * 7, 8);
+}
+
+TEST_P(AllocTest, test_alloc_bench_aging_90)
+{
+  uint64_t capacity = uint64_t(256) * 1024 * 1024 * 1024;
+  doAgingTest(capacity, capacity / 10 * 9, 8);
+}
+
 INSTANTIATE_TEST_CASE_P(
   Allocator,
   AllocTest,
-  ::testing::Values("stupid", "bitmap"));
+  ::testing::Values("stupid", "bitmap", "avl"));
 
 #else
 
@@ -316,10 +316,64 @@ TEST_P(AllocTest, test_alloc_bug_24598)
   EXPECT_EQ(tmp.size(), 1);
 }
 
+TEST_P(AllocTest, test_alloc_dump_free)
+{
+  uint64_t capacity = 1024 * 1024 * 1024;
+  uint64_t alloc_unit = 0x1000;
+  init_alloc(capacity, alloc_unit);
+
+  interval_set<uint64_t> expected;
+  expected.insert(0, 0x10000);
+  expected.insert(0x20000, 0x1000);
+  expected.insert(0x40000, 0x100000);
+  expected.insert(capacity - 0x3000, 0x3000);
+  for (auto p = expected.begin(); p != expected.end(); ++p) {
+    alloc->init_add_free(p.get_start(), p.get_len());
+  }
+
+  PExtentVector extents;
+  EXPECT_EQ(0x2000, alloc->allocate(0x2000, alloc_unit, 0, 0x40000, &extents));
+  for (auto& e : extents) {
+    expected.erase(e.offset, e.length);
+  }
+
+  // the dumped extents must rebuild the very same free space
+  interval_set<uint64_t> dumped;
+  alloc->dump([&](uint64_t offset, uint64_t length) {
+      dumped.union_insert(offset, length);
+    });
+  EXPECT_EQ(expected, dumped);
+  EXPECT_EQ(alloc->get_free(), dumped.size());
+}
+
+TEST_P(AllocTest, test_alloc_misaligned_best_fit)
+{
+  if (string(GetParam()) != "avl")
+    return;
+
+  uint64_t capacity = 1024 * 1024 * 1024;
+  uint64_t alloc_unit = 0x10000;
+  init_alloc(capacity, 0x1000);
+
+  // plenty of extents long enough for alloc_unit, but none aligned to it,
+  // ahead of a single one that fits
+  for (uint64_t i = 0; i < 64; ++i) {
+    alloc->init_add_free(i * 0x20000 + 0x1000, alloc_unit);
+  }
+  alloc->init_add_free(0x10000000, 2 * alloc_unit);
+
+  PExtentVector extents;
+  EXPECT_EQ((int64_t)alloc_unit,
+	    alloc->allocate(alloc_unit, alloc_unit, 0, 0, &extents));
+  ASSERT_EQ(1u, extents.size());
+  EXPECT_EQ(0x10000000u, extents[0].offset);
+  EXPECT_EQ(alloc_unit, extents[0].length);
+}
+
 INSTANTIATE_TEST_CASE_P(
   Allocator,
   AllocTest,
-  ::testing::Values("stupid", "bitmap"));
+  ::testing::Values("stupid", "bitmap", "avl"));
 
 #else
 
@@ -18,6 +18,8 @@
 #include <stdint.h>
 #include <string>
 #include <iostream>
+#include <atomic>
+#include <new>
 
 using namespace std;
 
@@ -25,8 +27,28 @@ using namespace std;
 #include "common/debug.h"
 #include "common/Cycles.h"
 #include "global/global_init.h"
+#include "include/mempool.h"
 #include "os/ObjectStore.h"
 
+// count heap allocations, so that the cases can report them per op.
+// buffer data does not come from operator new; it is accounted in the
+// buffer_anon mempool instead, one item per raw buffer.
+static std::atomic<uint64_t> alloc_count(0);
+
+void *operator new(size_t size)
+{
+  alloc_count++;
+  void *p = malloc(size);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
 class Transaction {
  private:
   ObjectStore::Transaction t;
@@ -35,56 +57,103 @@ class Transaction {
   struct Tick {
     uint64_t ticks;
     uint64_t count;
-    Tick(): ticks(0), count(0) {}
-    void add(uint64_t a) {
+    uint64_t allocs;
+    int64_t buffers;
+    Tick(): ticks(0), count(0), allocs(0), buffers(0) {}
+    void add(uint64_t a, uint64_t n, int64_t b) {
       ticks += a;
       count++;
+      allocs += n;
+      buffers += b;
+    }
+    void dump(const char *name) const {
+      cerr << " " << name << ": " << Cycles::to_microseconds(ticks)
+	   << "us count: " << count << " allocs/op: "
+	   << (count ? (double)allocs / count : 0) << " buffers/op: "
+	   << (count ? (double)buffers / count : 0) << std::endl;
+    }
+  };
+  // measures one call, in ticks, allocations and buffers.  the buffer
+  // count is a difference, so it only sees the buffers that are still
+  // alive when the Measure goes out of scope: whatever the call builds
+  // has to outlive it.
+  struct Measure {
+    Tick &tick;
+    uint64_t start_time;
+    uint64_t start_allocs;
+    int64_t start_buffers;
+    explicit Measure(Tick &t)
+      : tick(t), start_time(Cycles::rdtsc()), start_allocs(alloc_count),
+	start_buffers(mempool::buffer_anon::allocated_items()) {}
+    ~Measure() {
+      tick.add(Cycles::rdtsc() - start_time, alloc_count - start_allocs,
+	       (int64_t)mempool::buffer_anon::allocated_items() -
+	       start_buffers);
     }
   };
   static Tick write_ticks, setattr_ticks, omap_setkeys_ticks, omap_rmkeys_ticks;
   static Tick encode_ticks, decode_ticks, iterate_ticks;
+  static Tick repop_reencode_ticks, repop_shared_ticks;
 
   void write(coll_t cid, const ghobject_t& oid, uint64_t off, uint64_t len,
              const bufferlist& data) {
-    uint64_t start_time = Cycles::rdtsc();
+    Measure m(write_ticks);
     t.write(cid, oid, off, len, data);
-    write_ticks.add(Cycles::rdtsc() - start_time);
   }
   void setattr(coll_t cid, const ghobject_t& oid, const string &name,
                bufferlist& val) {
-    uint64_t start_time = Cycles::rdtsc();
+    Measure m(setattr_ticks);
     t.setattr(cid, oid, name, val);
-    setattr_ticks.add(Cycles::rdtsc() - start_time);
   }
   void omap_setkeys(coll_t cid, const ghobject_t &oid,
                     const map<string, bufferlist> &attrset) {
-
-    uint64_t start_time = Cycles::rdtsc();
+    Measure m(omap_setkeys_ticks);
     t.omap_setkeys(cid, oid, attrset);
-    omap_setkeys_ticks.add(Cycles::rdtsc() - start_time);
   }
   void omap_rmkeys(coll_t cid, const ghobject_t &oid,
                    const set<string> &keys) {
-    uint64_t start_time = Cycles::rdtsc();
+    Measure m(omap_rmkeys_ticks);
     t.omap_rmkeys(cid, oid, keys);
-    omap_rmkeys_ticks.add(Cycles::rdtsc() - start_time);
   }
 
   void apply_encode_decode() {
     bufferlist bl;
     ObjectStore::Transaction d;
-    uint64_t start_time = Cycles::rdtsc();
-    t.encode(bl);
-    encode_ticks.add(Cycles::rdtsc() - start_time);
+    {
+      Measure m(encode_ticks);
+      t.encode(bl);
+    }
 
     auto bliter = bl.cbegin();
-    start_time = Cycles::rdtsc();
-    d.decode(bliter);
-    decode_ticks.add(Cycles::rdtsc() - start_time);
+    {
+      Measure m(decode_ticks);
+      d.decode(bliter);
+    }
+  }
+
+  // what the primary ships to its replicas: the transaction encoded
+  // for each MOSDRepOp, or encoded once and shared by all of them
+  void apply_repop(int replicas) {
+    {
+      vector<bufferlist> data(replicas);
+      Measure m(repop_reencode_ticks);
+      for (auto& bl : data) {
+	t.encode(bl);
+      }
+    }
+    {
+      vector<bufferlist> data(replicas);
+      bufferlist bl;
+      Measure m(repop_shared_ticks);
+      t.encode(bl);
+      for (auto& d : data) {
+	d.share(bl);
+      }
+    }
   }
 
   void apply_iterate() {
-    uint64_t start_time = Cycles::rdtsc();
+    Measure m(iterate_ticks);
     ObjectStore::Transaction::iterator i = t.begin();
     while (i.have_op()) {
     ObjectStore::Transaction::Op *op = i.decode_op();
@@ -123,17 +192,20 @@ class Transaction {
         break;
       }
     }
-    iterate_ticks.add(Cycles::rdtsc() - start_time);
   }
 
   static void dump_stat() {
-    cerr << " write op: " << Cycles::to_microseconds(write_ticks.ticks) << "us count: " << write_ticks.count << std::endl;
-    cerr << " setattr op: " << Cycles::to_microseconds(setattr_ticks.ticks) << "us count: " << setattr_ticks.count << std::endl;
-    cerr << " omap_setkeys op: " << Cycles::to_microseconds(Transaction::omap_setkeys_ticks.ticks) << "us count: " << Transaction::omap_setkeys_ticks.count << std::endl;
-    cerr << " omap_rmkeys op: " << Cycles::to_microseconds(Transaction::omap_rmkeys_ticks.ticks) << "us count: " << Transaction::omap_rmkeys_ticks.count << std::endl;
-    cerr << " encode op: " << Cycles::to_microseconds(Transaction::encode_ticks.ticks) << "us count: " << Transaction::encode_ticks.count << std::endl;
-    cerr << " decode op: " << Cycles::to_microseconds(Transaction::decode_ticks.ticks) << "us count: " << Transaction::decode_ticks.count << std::endl;
-    cerr << " iterate op: " << Cycles::to_microseconds(Transaction::iterate_ticks.ticks) << "us count: " << Transaction::iterate_ticks.count << std::endl;
+    write_ticks.dump("write op");
+    setattr_ticks.dump("setattr op");
+    omap_setkeys_ticks.dump("omap_setkeys op");
+    omap_rmkeys_ticks.dump("omap_rmkeys op");
+    encode_ticks.dump("encode op");
+    decode_ticks.dump("decode op");
+    iterate_ticks.dump("iterate op");
+    if (repop_reencode_ticks.count) {
+      repop_reencode_ticks.dump("repop encode per replica");
+      repop_shared_ticks.dump("repop encode once");
+    }
   }
 };
 
@@ -223,6 +295,23 @@ class PerfCase {
     }
     return ticks;
   }
+
+  // the data transaction of rados_write_4k, as shipped to replicas
+  uint64_t rados_write_4k_repop(int times, int replicas) {
+    uint64_t ticks = 0;
+    uint64_t len = Kib *4;
+    for (int i = 0; i < times; i++) {
+      Transaction t;
+      ghobject_t oid = create_object();
+      uint64_t start_time = Cycles::rdtsc();
+      t.write(cid, oid, 0, len, data["4k"]);
+      t.setattr(cid, oid, attr, data[attr]);
+      t.setattr(cid, oid, snapset_attr, data[snapset_attr]);
+      t.apply_repop(replicas);
+      ticks += Cycles::rdtsc() - start_time;
+    }
+    return ticks;
+  }
 };
 const string PerfCase::info_epoch_attr("11.40_epoch");
 const string PerfCase::info_info_attr("11.40_info");
@@ -235,9 +324,10 @@ const ghobject_t PerfCase::pglog_oid(hobject_t(sobject_t(object_t("cid_pglog"),
 const ghobject_t PerfCase::info_oid(hobject_t(sobject_t(object_t("infos"), 0)));
 Transaction::Tick Transaction::write_ticks, Transaction::setattr_ticks, Transaction::omap_setkeys_ticks, Transaction::omap_rmkeys_ticks;
 Transaction::Tick Transaction::encode_ticks, Transaction::decode_ticks, Transaction::iterate_ticks;
+Transaction::Tick Transaction::repop_reencode_ticks, Transaction::repop_shared_ticks;
 
 void usage(const string &name) {
-  cerr << "Usage: " << name << " [times] "
+  cerr << "Usage: " << name << " [times] [replicas]"
        << std::endl;
 }
 
@@ -262,8 +352,15 @@ int main(int argc, char **argv)
   uint64_t times = atoi(args[0]);
   PerfCase c;
   uint64_t ticks = c.rados_write_4k(times);
+  uint64_t repop_ticks = 0;
+  if (args.size() > 1) {
+    repop_ticks = c.rados_write_4k_repop(times, atoi(args[1]));
+  }
   Transaction::dump_stat();
   cerr << " Total rados op " << times << " run time " << Cycles::to_microseconds(ticks) << "us." << std::endl;
+  if (repop_ticks) {
+    cerr << " Total repop " << times << " run time " << Cycles::to_microseconds(repop_ticks) << "us." << std::endl;
+  }
 
   return 0;
 }
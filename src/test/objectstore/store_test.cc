@@ -28,6 +28,7 @@
 #include "os/filestore/FileStore.h"
 #if defined(WITH_BLUESTORE)
 #include "os/bluestore/BlueStore.h"
+#include "os/bluestore/ioring.h"
 #endif
 #include "include/Context.h"
 #include "common/ceph_argparse.h"
@@ -1311,6 +1312,128 @@ TEST_P(StoreTest, SimpleObjectTest) {
   }
 }
 
+static int read_async_wait(ObjectStore *store, ObjectStore::CollectionHandle& ch,
+			   const ghobject_t& hoid, uint64_t off, size_t len,
+			   bufferlist& bl)
+{
+  C_SaferCond c;
+  int r = store->read_async(ch, hoid, off, len, bl, 0,
+			    new FunctionContext([&c](int r) {
+				c.complete(r);
+			      }));
+  if (r == -EINPROGRESS) {
+    r = c.wait();
+  }
+  return r;
+}
+
+TEST_P(StoreTest, ReadAsyncTest) {
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("Object 2", CEPH_NOSNAP)));
+  int r;
+  auto ch = store->create_new_collection(cid);
+  bufferlist bl;
+  for (unsigned i = 0; i < 64; ++i) {
+    bl.append(string(4096, 'a' + (i % 26)));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    // several extents, and a hole
+    t.write(cid, hoid, 0, 0x20000, bl);
+    bufferlist tail;
+    tail.substr_of(bl, 0x20000, 0x20000);
+    t.write(cid, hoid, 0x30000, tail.length(), tail);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  bufferlist exp;
+  {
+    bufferlist t;
+    t.substr_of(bl, 0, 0x20000);
+    exp.append(t);
+    exp.append_zero(0x10000);
+    t.substr_of(bl, 0x20000, 0x20000);
+    exp.append(t);
+  }
+
+  // drop the caches, so that the data has to come from the device
+  ch.reset();
+  r = store->umount();
+  ASSERT_EQ(0, r);
+  r = store->mount();
+  ASSERT_EQ(0, r);
+  ch = store->open_collection(cid);
+
+  for (auto& i : { make_pair(0u, 0x50000u), make_pair(0x1234u, 0x3456u),
+		   make_pair(0x1f000u, 0x12000u), make_pair(0x48000u, 0x10000u),
+		   make_pair(0x60000u, 0x1000u) }) {
+    bufferlist in, e;
+    r = read_async_wait(store.get(), ch, hoid, i.first, i.second, in);
+    if (i.first >= exp.length()) {
+      ASSERT_EQ(0, r);
+      continue;
+    }
+    e.substr_of(exp, i.first, std::min<size_t>(i.second,
+					       exp.length() - i.first));
+    ASSERT_EQ((int)e.length(), r);
+    ASSERT_TRUE(bl_eq(e, in));
+  }
+  {
+    // the whole object, again, now (maybe) from the cache
+    bufferlist in;
+    r = read_async_wait(store.get(), ch, hoid, 0, 0, in);
+    ASSERT_EQ((int)exp.length(), r);
+    ASSERT_TRUE(bl_eq(exp, in));
+  }
+  {
+    bufferlist in;
+    r = read_async_wait(store.get(), ch, hoid2, 0, 0x1000, in);
+    ASSERT_EQ(-ENOENT, r);
+  }
+  {
+    // umount waits for the reads still in flight
+    ch.reset();
+    r = store->umount();
+    ASSERT_EQ(0, r);
+    r = store->mount();
+    ASSERT_EQ(0, r);
+    ch = store->open_collection(cid);
+    const unsigned num_reads = 8;
+    vector<bufferlist> ins(num_reads);
+    vector<int> results(num_reads, 1);
+    for (unsigned i = 0; i < num_reads; ++i) {
+      r = store->read_async(ch, hoid, i * 0x8000, 0x8000, ins[i], 0,
+			    new FunctionContext([&results, i](int r) {
+				results[i] = r;
+			      }));
+      if (r != -EINPROGRESS) {
+	results[i] = r;
+      }
+    }
+    ch.reset();
+    r = store->umount();
+    ASSERT_EQ(0, r);
+    for (unsigned i = 0; i < num_reads; ++i) {
+      bufferlist e;
+      e.substr_of(exp, i * 0x8000, 0x8000);
+      ASSERT_EQ((int)e.length(), results[i]);
+      ASSERT_TRUE(bl_eq(e, ins[i]));
+    }
+    r = store->mount();
+    ASSERT_EQ(0, r);
+    ch = store->open_collection(cid);
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
 #if defined(WITH_BLUESTORE)
 TEST_P(StoreTestSpecificAUSize, BluestoreStatFSTest) {
   if(string(GetParam()) != "bluestore")
@@ -4335,6 +4458,129 @@ TEST_P(StoreTestSpecificAUSize, SyntheticMatrixSharding) {
   do_matrix(m, std::bind(&StoreTest::doSyntheticTest, this, _1, _2, _3, _4));
 }
 
+TEST_P(StoreTestSpecificAUSize, SyntheticIoRing) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  // BlueStore quietly falls back to libaio, which the other synthetic
+  // tests already cover
+#if defined(HAVE_LIBURING)
+  if (!ioring_queue_t::supported()) {
+    cout << "SKIP: io_uring is not supported by this kernel" << std::endl;
+    return;
+  }
+#else
+  cout << "SKIP: built without liburing" << std::endl;
+  return;
+#endif
+  SetVal(g_conf, "bdev_ioring", "true");
+  SetVal(g_conf, "bdev_ioring_registered_buffers", "16");
+  StartDeferred(4096);
+  doSyntheticTest(10000, 400*1024, 40*1024, 0);
+}
+
+TEST_P(StoreTestSpecificAUSize, AllocSnapshotRemount) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_alloc_snapshot", "true");
+  g_conf->apply_changes(NULL);
+  StartDeferred(65536);
+  int r;
+  coll_t cid;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  // leave some holes behind
+  for (unsigned i = 0; i < 32; ++i) {
+    ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(i),
+					CEPH_NOSNAP)));
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(65536 * (1 + i % 4), 'a' + i % 26));
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  for (unsigned i = 0; i < 32; i += 3) {
+    ghobject_t hoid(hobject_t(sobject_t("Object " + stringify(i),
+					CEPH_NOSNAP)));
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  struct store_statfs_t before;
+  ASSERT_EQ(0, store->statfs(&before));
+  const PerfCounters* logger = store->get_perf_counters();
+  uint64_t loaded = logger->get(l_bluestore_alloc_snapshot_loaded);
+  uint64_t written = logger->get(l_bluestore_alloc_snapshot_written);
+
+  // clean umount writes the snapshot, mount loads it
+  ch.reset();
+  ASSERT_EQ(0, store->umount());
+  ASSERT_LT(written, logger->get(l_bluestore_alloc_snapshot_written));
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(++loaded, logger->get(l_bluestore_alloc_snapshot_loaded));
+  {
+    struct store_statfs_t after;
+    ASSERT_EQ(0, store->statfs(&after));
+    ASSERT_EQ(before.available, after.available);
+    ASSERT_EQ(before.allocated, after.allocated);
+  }
+  // older releases would leave a stale snapshot behind; keep them out
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+  ASSERT_EQ(bstore->alloc_snapshot_compat_ondisk_format,
+	    bstore->get_compat_ondisk_format());
+
+  // and must agree with what the freelist says
+  ASSERT_EQ(0, store->umount());
+  SetVal(g_conf, "bluestore_alloc_snapshot", "false");
+  g_conf->apply_changes(NULL);
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(loaded, logger->get(l_bluestore_alloc_snapshot_loaded));
+  {
+    struct store_statfs_t after;
+    ASSERT_EQ(0, store->statfs(&after));
+    ASSERT_EQ(before.available, after.available);
+  }
+
+  // writes made without snapshots must invalidate the old one
+  ch = store->open_collection(cid);
+  {
+    ghobject_t hoid(hobject_t(sobject_t("Object 100", CEPH_NOSNAP)));
+    ObjectStore::Transaction t;
+    bufferlist bl;
+    bl.append(std::string(65536 * 3, 'z'));
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(0, store->statfs(&before));
+  ch.reset();
+  ASSERT_EQ(0, store->umount());
+  SetVal(g_conf, "bluestore_alloc_snapshot", "true");
+  g_conf->apply_changes(NULL);
+  ASSERT_EQ(0, store->mount());
+  // the stale snapshot was dropped, so this came from the freelist
+  ASSERT_EQ(loaded, logger->get(l_bluestore_alloc_snapshot_loaded));
+  {
+    struct store_statfs_t after;
+    ASSERT_EQ(0, store->statfs(&after));
+    ASSERT_EQ(before.available, after.available);
+  }
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0, store->fsck(false));
+  ASSERT_EQ(0, store->mount());
+  ASSERT_EQ(++loaded, logger->get(l_bluestore_alloc_snapshot_loaded));
+}
+
 TEST_P(StoreTestSpecificAUSize, ZipperPatternSharded) {
   if(string(GetParam()) != "bluestore")
     return;
@@ -6639,6 +6885,60 @@ TEST_P(StoreTest, KVDBStatsTest) {
   cout << std::endl;
 }
 
+TEST_P(StoreTest, SlowTransactionsTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  // put the history size back once done, while the store is still
+  // mounted, so that its history is resized too
+  auto settings_bookmark = BookmarkSettings();
+  SetVal(g_conf, "bluestore_txc_slow_history_size", "5");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  int NUM_OBJS = 20;
+  coll_t cid;
+  string base("testobj.");
+  bufferlist a;
+  bufferptr ap(0x1000);
+  memset(ap.c_str(), 'a', 0x1000);
+  a.append(ap);
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  for (int i = 0; i < NUM_OBJS; ++i) {
+    ObjectStore::Transaction t;
+    ghobject_t hoid(hobject_t(sobject_t(base + stringify(i), CEPH_NOSNAP)));
+    t.write(cid, hoid, 0, 0x1000, a);
+    int r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // txcs are traced once they are done, which may trail the commit
+  ASSERT_EQ(0, store->umount());
+  ASSERT_EQ(0, store->mount());
+
+  auto count = [&](int num) {
+    JSONFormatter f(true);
+    store->dump_slow_transactions(&f, num);
+    stringstream ss;
+    f.flush(ss);
+    cout << ss.str() << std::endl;
+    string s = ss.str();
+    int n = 0;
+    for (size_t p = s.find("\"seq\""); p != string::npos;
+	 p = s.find("\"seq\"", p + 1)) {
+      ++n;
+    }
+    return n;
+  };
+  ASSERT_EQ(3, count(3));
+  ASSERT_EQ(5, count(-1));
+}
+
 #if defined(WITH_BLUESTORE)
 TEST_P(StoreTestSpecificAUSize, garbageCollection) {
   int r;
@@ -6984,6 +7284,336 @@ TEST_P(StoreTest, BluestoreRepairTest) {
   cerr << "Completing" << std::endl;
   bstore->mount();
 }
+TEST_P(StoreTest, BluestoreParallelFsck) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_fsck_on_mount", "false");
+  SetVal(g_conf, "bluestore_fsck_on_umount", "false");
+  SetVal(g_conf, "bluestore_fsck_threads", "4");
+  SetVal(g_conf, "bluestore_fsck_read_queue_depth", "2");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+
+  // objects spread over several collections, so that the fsck workers
+  // get different parts of the keyspace
+  const unsigned num_colls = 8;
+  const unsigned num_objects = 16;
+  vector<coll_t> cids;
+  bufferlist bl;
+  bl.append("1234512345");
+  int r;
+  for (unsigned i = 0; i < num_colls; ++i) {
+    coll_t cid(spg_t(pg_t(0, 555 + i), shard_id_t::NO_SHARD));
+    cids.push_back(cid);
+    auto ch = store->create_new_collection(cid);
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    for (unsigned j = 0; j < num_objects; ++j) {
+      ghobject_t hoid(hobject_t("Object " + stringify(j), "", CEPH_NOSNAP,
+				j, 555 + i, ""));
+      for (unsigned k = 0; k < 4; ++k) {
+	t.write(cid, hoid, k * 65536, bl.length(), bl);
+      }
+    }
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  bstore->umount();
+  ASSERT_EQ(bstore->fsck(false), 0);
+  ASSERT_EQ(bstore->fsck(true), 0);
+
+  // a misreference between objects of different collections is only
+  // visible once the workers' results are merged
+  cerr << "misreferencing across collections" << std::endl;
+  bstore->mount();
+  bstore->inject_misreference(
+    cids.front(), ghobject_t(hobject_t("Object 0", "", CEPH_NOSNAP, 0, 555, "")),
+    cids.back(), ghobject_t(hobject_t("Object 0", "", CEPH_NOSNAP, 0,
+				      555 + num_colls - 1, "")),
+    0);
+  bstore->umount();
+  ASSERT_EQ(bstore->fsck(false), 2);
+  ASSERT_EQ(bstore->repair(false), 0);
+  ASSERT_EQ(bstore->fsck(true), 0);
+
+  bstore->mount();
+}
+
+TEST_P(StoreTest, CompressionParallelTest) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_compression_algorithm", "snappy");
+  SetVal(g_conf, "bluestore_compression_mode", "force");
+  SetVal(g_conf, "bluestore_compression_max_blob_size", "131072");
+  SetVal(g_conf, "bluestore_compression_sample_size", "8192");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  const PerfCounters* counters = store->get_perf_counters();
+  coll_t cid;
+  ghobject_t hoid(hobject_t(sobject_t("compressible", CEPH_NOSNAP)));
+  ghobject_t hoid2(hobject_t(sobject_t("random", CEPH_NOSNAP)));
+  auto ch = store->create_new_collection(cid);
+  int r;
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  // a single write of many blobs, compressed in parallel
+  const unsigned len = 1024 * 1024;
+  string data(len, 0);
+  for (unsigned i = 0; i < len; ++i) {
+    data[i] = 'a' + (i / 512) % 8;
+  }
+  bufferlist bl;
+  bl.append(data);
+  uint64_t success0 = counters->get(l_bluestore_compress_success_count);
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(counters->get(l_bluestore_compress_success_count),
+	    success0 + len / 131072);
+  store_statfs_t statfs;
+  ASSERT_EQ(store->statfs(&statfs), 0);
+  ASSERT_EQ(statfs.compressed_original, len);
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, len, in);
+    ASSERT_EQ(r, (int)len);
+    ASSERT_TRUE(bl_eq(bl, in));
+  }
+
+  // incompressible data is given up on after compressing a sample
+  for (unsigned i = 0; i < len; ++i) {
+    data[i] = rand();
+  }
+  bl.clear();
+  bl.append(data);
+  uint64_t aborted0 = counters->get(l_bluestore_compress_early_abort_count);
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid2, 0, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  ASSERT_EQ(counters->get(l_bluestore_compress_early_abort_count),
+	    aborted0 + len / 131072);
+  ASSERT_EQ(store->statfs(&statfs), 0);
+  ASSERT_EQ(statfs.compressed_original, len);
+  {
+    bufferlist in;
+    r = store->read(ch, hoid2, 0, len, in);
+    ASSERT_EQ(r, (int)len);
+    ASSERT_TRUE(bl_eq(bl, in));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove(cid, hoid2);
+    t.remove_collection(cid);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+}
+
+TEST_P(StoreTest, BluestoreDeferredCombine) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  // keep every small write deferred, and queued until umount
+  SetVal(g_conf, "bluestore_prefer_deferred_size", "65536");
+  SetVal(g_conf, "bluestore_deferred_batch_ops", "10000");
+  SetVal(g_conf, "bluestore_deferred_combine_hdd", "true");
+  SetVal(g_conf, "bluestore_deferred_combine_ssd", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  const PerfCounters* counters = store->get_perf_counters();
+  uint64_t combined0 = counters->get(l_bluestore_deferred_combined_batches);
+
+  const unsigned num_colls = 4;
+  vector<coll_t> cids;
+  vector<pair<ghobject_t, bufferlist>> expected;
+  int r;
+  for (unsigned i = 0; i < num_colls; ++i) {
+    coll_t cid(spg_t(pg_t(0, 777 + i), shard_id_t::NO_SHARD));
+    cids.push_back(cid);
+    auto ch = store->create_new_collection(cid);
+    ghobject_t hoid(hobject_t("Object " + stringify(i), "", CEPH_NOSNAP,
+			      i, 777 + i, ""));
+    bufferlist bl;
+    for (unsigned k = 0; k < 4; ++k) {
+      bufferlist d;
+      d.append(string(4096, 'a' + i + k));
+      bl.append(d);
+    }
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    for (unsigned k = 0; k < 4; ++k) {
+      bufferlist d;
+      d.substr_of(bl, k * 4096, 4096);
+      t.write(cid, hoid, k * 4096, d.length(), d);
+    }
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    expected.emplace_back(hoid, bl);
+  }
+
+  // umount flushes all queued batches at once
+  r = store->umount();
+  ASSERT_EQ(r, 0);
+  ASSERT_LT(combined0, counters->get(l_bluestore_deferred_combined_batches));
+  r = store->mount();
+  ASSERT_EQ(r, 0);
+
+  for (unsigned i = 0; i < num_colls; ++i) {
+    auto ch = store->open_collection(cids[i]);
+    auto& p = expected[i];
+    bufferlist in;
+    r = store->read(ch, p.first, 0, p.second.length(), in);
+    ASSERT_EQ(r, (int)p.second.length());
+    ASSERT_TRUE(bl_eq(p.second, in));
+  }
+}
+
+TEST_P(StoreTest, BluestoreInlineData) {
+  if (string(GetParam()) != "bluestore")
+    return;
+
+  SetVal(g_conf, "bluestore_inline_data_max_size", "4096");
+  SetVal(g_conf, "bluestore_fsck_on_mount", "false");
+  SetVal(g_conf, "bluestore_fsck_on_umount", "false");
+  // an alloc snapshot would raise min_compat_ondisk_format on its own
+  SetVal(g_conf, "bluestore_alloc_snapshot", "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  int r = store->umount();
+  ASSERT_EQ(r, 0);
+  r = store->mount();
+  ASSERT_EQ(r, 0);
+
+  BlueStore* bstore = dynamic_cast<BlueStore*> (store.get());
+  // older releases can still mount a store without inline data
+  ASSERT_EQ(bstore->min_compat_ondisk_format,
+	    bstore->get_compat_ondisk_format());
+
+  coll_t cid;
+  ghobject_t hoid(hobject_t("tiny", "", CEPH_NOSNAP, 0, -1, ""));
+  ghobject_t hoid_cloned = hoid;
+  hoid_cloned.hobj.snap = 1;
+  auto ch = store->create_new_collection(cid);
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid, 0);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+
+  store_statfs_t statfs0, statfs;
+  ASSERT_EQ(store->statfs(&statfs0), 0);
+
+  bufferlist bl, expected;
+  bl.append("0123456789abcdef");
+  {
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, bl.length(), bl);
+    t.write(cid, hoid, 100, bl.length(), bl);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  expected.append(bl);
+  expected.append_zero(100 - bl.length());
+  expected.append(bl);
+
+  // nothing allocated, but accounted as stored
+  ASSERT_EQ(store->statfs(&statfs), 0);
+  ASSERT_EQ(statfs0.allocated, statfs.allocated);
+  ASSERT_EQ(statfs0.stored + expected.length(), statfs.stored);
+
+  // survives a remount (and fsck), and older releases now refuse to mount;
+  // a fresh instance has to find that out from the superblock
+  bstore->umount();
+  {
+    std::unique_ptr<BlueStore> fresh(
+      new BlueStore(g_ceph_context, get_data_dir()));
+    ASSERT_EQ(0, fresh->get_compat_ondisk_format());
+    ASSERT_EQ(fresh->fsck(false), 0);
+    ASSERT_EQ(fresh->inline_data_compat_ondisk_format,
+	      fresh->get_compat_ondisk_format());
+  }
+  bstore->mount();
+  ASSERT_EQ(bstore->inline_data_compat_ondisk_format,
+	    bstore->get_compat_ondisk_format());
+  ch = store->open_collection(cid);
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, 0, in);
+    ASSERT_EQ(r, (int)expected.length());
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+
+  // zero and truncate stay inline; the clone gets a copy
+  {
+    ObjectStore::Transaction t;
+    t.zero(cid, hoid, 4, 8);
+    t.truncate(cid, hoid, 108);
+    t.clone(cid, hoid, hoid_cloned);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+  }
+  {
+    bufferlist z;
+    z.append_zero(8);
+    bufferlist e;
+    e.substr_of(expected, 0, 4);
+    e.append(z);
+    bufferlist tail;
+    tail.substr_of(expected, 12, 108 - 12);
+    e.append(tail);
+    expected.swap(e);
+  }
+  for (auto& o : { hoid, hoid_cloned }) {
+    bufferlist in;
+    r = store->read(ch, o, 0, 0, in);
+    ASSERT_EQ(r, (int)expected.length());
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  ASSERT_EQ(store->statfs(&statfs), 0);
+  ASSERT_EQ(statfs0.allocated, statfs.allocated);
+  ASSERT_EQ(statfs0.stored + expected.length() * 2, statfs.stored);
+
+  // growing past the limit moves the data to a regular blob
+  {
+    bufferlist big;
+    big.append(string(8192, 'x'));
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, expected.length(), big.length(), big);
+    r = queue_transaction(store, ch, std::move(t));
+    ASSERT_EQ(r, 0);
+    expected.append(big);
+  }
+  {
+    bufferlist in;
+    r = store->read(ch, hoid, 0, 0, in);
+    ASSERT_EQ(r, (int)expected.length());
+    ASSERT_TRUE(bl_eq(expected, in));
+  }
+  ASSERT_EQ(store->statfs(&statfs), 0);
+  ASSERT_LT(statfs0.allocated, statfs.allocated);
+
+  bstore->umount();
+  ASSERT_EQ(bstore->fsck(false), 0);
+  bstore->mount();
+}
+
 TEST_P(StoreTest, BluestoreStatistics) {
   if (string(GetParam()) != "bluestore")
     return;
@@ -24,6 +24,9 @@ public:
   void SetUp() override;
   void TearDown() override;
   void SetVal(md_config_t* conf, const char* key, const char* val);
+  const std::string& get_data_dir() const {
+    return data_dir;
+  }
   struct SettingsBookmark {
     StoreTestFixture& s;
     size_t pos;
@@ -13,6 +13,7 @@
 #include "include/stringify.h"
 #include "include/scope_guard.h"
 #include "common/errno.h"
+#include "common/perf_counters.h"
 #include <gtest/gtest.h>
 
 #include "os/bluestore/BlueFS.h"
@@ -102,6 +103,100 @@ TEST(BlueFS, write_read) {
   rm_temp_bdev(fn);
 }
 
+TEST(BlueFS, readahead_and_batch_read) {
+  uint64_t size = 1048576 * 128;
+  string fn = get_temp_bdev(size);
+  // async readahead and batched reads are direct io only
+  g_ceph_context->_conf->set_val("bluefs_buffered_io", "false");
+  g_ceph_context->_conf->set_val("bluefs_async_readahead", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+  BlueFS fs(g_ceph_context);
+  ASSERT_EQ(0, fs.add_block_device(BlueFS::BDEV_DB, fn, false));
+  fs.add_block_extent(BlueFS::BDEV_DB, 1048576, size - 1048576);
+  uuid_d fsid;
+  ASSERT_EQ(0, fs.mkfs(fsid));
+  ASSERT_EQ(0, fs.mount());
+  const PerfCounters *logger = fs.get_perf_counters();
+  const uint64_t len = 4 * 1048576 + 12345;
+  std::unique_ptr<char[]> data = gen_buffer(len);
+  {
+    BlueFS::FileWriter *h;
+    ASSERT_EQ(0, fs.mkdir("dir"));
+    ASSERT_EQ(0, fs.open_for_write("dir", "file", &h, false));
+    for (uint64_t off = 0; off < len; off += 65536) {
+      h->append(data.get() + off, std::min<uint64_t>(65536, len - off));
+    }
+    fs.fsync(h);
+    fs.close_writer(h);
+  }
+  {
+    // sequential reads, each window after the first comes from readahead
+    BlueFS::FileReader *h;
+    ASSERT_EQ(0, fs.open_for_read("dir", "file", &h, false));
+    BlueFS::FileReaderBuffer buf(262144);
+    uint64_t hit = logger->get(l_bluefs_readahead_hit_bytes);
+    char out[10000];
+    for (uint64_t off = 0; off < len; off += sizeof(out)) {
+      int r = fs.read(h, &buf, off, sizeof(out), NULL, out);
+      ASSERT_EQ(std::min<uint64_t>(sizeof(out), len - off), (uint64_t)r);
+      ASSERT_EQ(0, memcmp(data.get() + off, out, r));
+    }
+    ASSERT_LT(hit + len / 2, logger->get(l_bluefs_readahead_hit_bytes));
+    delete h;
+  }
+  {
+    BlueFS::FileReader *h;
+    ASSERT_EQ(0, fs.open_for_read("dir", "file", &h, true));
+    // several ranges, unaligned, the last one past eof
+    std::unique_ptr<char[]> out = std::make_unique<char[]>(len);
+    vector<BlueFS::read_req_t> reqs;
+    reqs.emplace_back(1, 4095, out.get());
+    reqs.emplace_back(1048576 - 100, 200000, out.get() + 4096);
+    reqs.emplace_back(3 * 1048576 + 7, 65536, out.get() + 300000);
+    reqs.emplace_back(len - 1000, 5000, out.get() + 400000);
+    uint64_t ios = logger->get(l_bluefs_read_batch_ios);
+    ASSERT_EQ(0, fs.read_random_batch(h, reqs));
+    for (auto& req : reqs) {
+      ASSERT_EQ(std::min<uint64_t>(req.len, len - req.off), (uint64_t)req.r);
+      ASSERT_EQ(0, memcmp(data.get() + req.off, req.out, req.r));
+    }
+    ASSERT_LE(ios + reqs.size(), logger->get(l_bluefs_read_batch_ios));
+
+    // reads served from a prefetched range, and one outside of it
+    uint64_t hit = logger->get(l_bluefs_readahead_hit_bytes);
+    fs.prefetch(h, 2 * 1048576 + 100, 100000);
+    for (uint64_t off : {2 * 1048576 + 100, 2 * 1048576 + 50000,
+			 2 * 1048576 + 80000, 1048576 - 10}) {
+      int r = fs.read_random(h, off, 20000, out.get());
+      ASSERT_EQ(20000, r);
+      ASSERT_EQ(0, memcmp(data.get() + off, out.get(), r));
+    }
+    ASSERT_LE(hit + 100000, logger->get(l_bluefs_readahead_hit_bytes));
+    // the miss dropped what was left of the prefetched range
+    ASSERT_FALSE(h->prefetched.load());
+    ASSERT_EQ(0u, h->buf.bl.length());
+
+    // buffered io goes through the page cache, never through direct aio
+    g_ceph_context->_conf->set_val("bluefs_buffered_io", "true");
+    g_ceph_context->_conf->apply_changes(NULL);
+    hit = logger->get(l_bluefs_readahead_hit_bytes);
+    ios = logger->get(l_bluefs_read_batch_ios);
+    fs.prefetch(h, 2 * 1048576 + 100, 100000);
+    ASSERT_FALSE(h->prefetched.load());
+    ASSERT_EQ(0, fs.read_random_batch(h, reqs));
+    for (auto& req : reqs) {
+      ASSERT_EQ(0, memcmp(data.get() + req.off, req.out, req.r));
+    }
+    ASSERT_EQ(ios, logger->get(l_bluefs_read_batch_ios));
+    ASSERT_EQ(hit, logger->get(l_bluefs_readahead_hit_bytes));
+    delete h;
+  }
+  fs.umount();
+  rm_temp_bdev(fn);
+  g_ceph_context->_conf->set_val("bluefs_buffered_io", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 TEST(BlueFS, small_appends) {
   uint64_t size = 1048576 * 128;
   string fn = get_temp_bdev(size);
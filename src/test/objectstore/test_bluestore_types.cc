@@ -1179,6 +1179,106 @@ TEST(ExtentMap, compress_extent_map)
   ASSERT_EQ(6u, em.extent_map.size());
 }
 
+static bool has_onode(BlueStore::Collection *c, const ghobject_t& oid)
+{
+  return c->onode_map.map_any([&](BlueStore::OnodeRef o) {
+      return o->oid == oid;
+    });
+}
+
+TEST(ClockCache, onode_scan_resistance)
+{
+  BlueStore store(g_ceph_context, "", 4096);
+  BlueStore::ClockCache cache(g_ceph_context);
+  BlueStore::CollectionRef coll(new BlueStore::Collection(&store, &cache, coll_t()));
+  const uint64_t max = 20;
+
+  vector<ghobject_t> hot, cold;
+  for (unsigned i = 0; i < 10; ++i) {
+    hot.push_back(ghobject_t(hobject_t(sobject_t(
+      "hot" + stringify(i), CEPH_NOSNAP))));
+  }
+  for (unsigned i = 0; i < 200; ++i) {
+    cold.push_back(ghobject_t(hobject_t(sobject_t(
+      "cold" + stringify(i), CEPH_NOSNAP))));
+  }
+
+  for (auto& oid : hot) {
+    BlueStore::OnodeRef o = coll->onode_map.add(
+      oid, new BlueStore::Onode(coll.get(), oid, ""));
+    std::lock_guard<std::recursive_mutex> l(cache.lock);
+    cache._touch_onode(o);
+  }
+  cache.trim(max, 0);
+
+  // a scan sees each object once, and must not push out the hot ones
+  for (auto& oid : cold) {
+    coll->onode_map.add(oid, new BlueStore::Onode(coll.get(), oid, ""));
+    cache.trim(max, 0);
+    ASSERT_GE(max, cache._get_num_onodes());
+  }
+  for (auto& oid : hot) {
+    ASSERT_TRUE(has_onode(coll.get(), oid)) << oid;
+  }
+  ASSERT_FALSE(has_onode(coll.get(), cold.front()));
+
+  // the most recently evicted ones are remembered
+  ASSERT_EQ(0u, cache.onode_ghost_hits.load());
+  for (auto& oid : cold) {
+    if (!has_onode(coll.get(), oid)) {
+      coll->onode_map.add(oid, new BlueStore::Onode(coll.get(), oid, ""));
+    }
+  }
+  ASSERT_LT(0u, cache.onode_ghost_hits.load());
+  ASSERT_GE(max, cache.onode_ghost_hits.load());
+
+  coll->onode_map.clear();
+  ASSERT_EQ(0u, cache._get_num_onodes());
+}
+
+TEST(ClockCache, buffer_scan_resistance)
+{
+  BlueStore::ClockCache cache(g_ceph_context);
+  BlueStore::BufferSpace bs;
+  const uint64_t max = 16 * 4096;
+  bufferlist bl;
+  bl.append(string(4096, 'a'));
+
+  for (unsigned i = 0; i < 4; ++i) {
+    bs.did_read(&cache, i * 4096, bl);
+    std::lock_guard<std::recursive_mutex> l(cache.lock);
+    cache._touch_buffer(bs.buffer_map[i * 4096].get());
+  }
+  cache.trim(0, max);
+
+  for (unsigned i = 4; i < 100; ++i) {
+    bs.did_read(&cache, i * 4096, bl);
+    cache.trim(0, max);
+    ASSERT_GE(max, cache._get_buffer_bytes());
+  }
+  for (unsigned i = 0; i < 4; ++i) {
+    ASSERT_TRUE(bs.buffer_map[i * 4096]->is_clean()) << i;
+  }
+
+  // evicted buffers stay behind as empty ghosts, for a while
+  uint32_t ghost = 0;
+  for (auto& p : bs.buffer_map) {
+    ASSERT_FALSE(p.second->is_writing());
+    if (p.second->is_empty()) {
+      ghost = p.first;
+    }
+  }
+  ASSERT_NE(0u, ghost);
+  ASSERT_EQ(0u, cache.buffer_ghost_hit_bytes.load());
+  bs.did_read(&cache, ghost, bl);
+  ASSERT_EQ(4096u, cache.buffer_ghost_hit_bytes.load());
+  ASSERT_TRUE(bs.buffer_map[ghost]->is_clean());
+
+  std::lock_guard<std::recursive_mutex> l(cache.lock);
+  bs._clear(&cache);
+  ASSERT_EQ(0u, cache._get_buffer_bytes());
+}
+
 TEST(GarbageCollector, BasicTest)
 {
   BlueStore::LRUCache cache(g_ceph_context);
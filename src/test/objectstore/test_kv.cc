@@ -161,6 +161,75 @@ TEST_P(KVTest, PutReopen) {
   fini();
 }
 
+TEST_P(KVTest, GetBatch) {
+  ASSERT_EQ(0, db->create_and_open(cout));
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    for (unsigned i = 0; i < 100; i += 2) {
+      bufferlist value;
+      value.append(stringify(i));
+      t->set("prefix", stringify(i), value);
+    }
+    bufferlist value;
+    value.append("other");
+    t->set("other", "1", value);
+    db->submit_transaction_sync(t);
+  }
+  {
+    std::set<string> keys;
+    for (unsigned i = 0; i < 100; ++i) {
+      keys.insert(stringify(i));
+    }
+    keys.insert("zzz");  // past all the keys
+    std::map<string, bufferlist> out;
+    ASSERT_EQ(0, db->get("prefix", keys, &out));
+    ASSERT_EQ(50u, out.size());
+    for (auto& p : out) {
+      ASSERT_EQ(0u, std::stoul(p.first) % 2);
+      ASSERT_EQ(p.first, _bl_to_str(p.second));
+    }
+  }
+  {
+    std::set<string> keys;
+    std::map<string, bufferlist> out;
+    ASSERT_EQ(0, db->get("prefix", keys, &out));
+    ASSERT_TRUE(out.empty());
+  }
+  fini();
+}
+
+TEST_P(KVTest, GetInPlace) {
+  ASSERT_EQ(0, db->create_and_open(cout));
+  string big(10000, 'b');
+  {
+    KeyValueDB::Transaction t = db->get_transaction();
+    bufferlist value;
+    value.append("value");
+    t->set("prefix", "key", value);
+    value.clear();
+    value.append(big);
+    t->set("prefix", "big", value);
+    db->submit_transaction_sync(t);
+  }
+  // once from the memtable, once from an sst (and the block cache)
+  for (int i = 0; i < 2; ++i) {
+    bufferlist v1, v2, v3;
+    ASSERT_EQ(0, db->get_in_place("prefix", "key", &v1));
+    ASSERT_EQ("value", _bl_to_str(v1));
+    ASSERT_EQ(0, db->get_in_place("prefix", "big", &v2));
+    ASSERT_EQ(big, _bl_to_str(v2));
+    ASSERT_EQ(-ENOENT, db->get_in_place("prefix", "nokey", &v3));
+    ASSERT_EQ(0u, v3.length());
+
+    // copies don't extend the pin
+    bufferlist copy = v2;
+    v2.clear();
+    ASSERT_EQ(big, _bl_to_str(copy));
+    db->compact();
+  }
+  fini();
+}
+
 TEST_P(KVTest, BenchCommit) {
   int n = 1024;
   ASSERT_EQ(0, db->create_and_open(cout));
@@ -16,6 +16,7 @@
 #include <gtest/gtest.h>
 #include "common/Clock.h"
 #include "include/utime.h"
+#include "include/stringify.h"
 #include <boost/tuple/tuple.hpp>
 
 TEST(Transaction, MoveConstruct)
@@ -175,6 +176,171 @@ TEST(Transaction, GetNumBytes)
   ASSERT_TRUE(a.get_encoded_bytes() == a.get_encoded_bytes_test());
 }
 
+TEST(Transaction, EncodeDecode)
+{
+  auto a = ObjectStore::Transaction{};
+  coll_t cid(spg_t(pg_t(1,2), shard_id_t::NO_SHARD));
+  coll_t acid(spg_t(pg_t(3,2), shard_id_t::NO_SHARD));
+  bufferlist small, large;
+  small.append("some value");
+  small.append(" in two buffers");
+  large.append_zero(SMALL_ATTR_MAX + 1);
+
+  // more ops than OPS_PER_PTR, more objects than INDEX_SCAN_MAX, and
+  // objects named again out of order
+  vector<ghobject_t> oids;
+  for (unsigned i = 0; i < 2 * INDEX_SCAN_MAX; ++i) {
+    oids.push_back(ghobject_t(hobject_t(
+      "obj" + stringify(i), "", CEPH_NOSNAP, i % 3, 1, "")));
+  }
+  for (unsigned i = 0; i < oids.size(); ++i) {
+    a.touch(i % 2 ? cid : acid, oids[i]);
+    a.setattr(i % 2 ? cid : acid, oids[(i * 7) % oids.size()], "_",
+	      i % 2 ? small : large);
+  }
+  ASSERT_EQ(a.get_encoded_bytes(), a.get_encoded_bytes_test());
+
+  bufferlist bl;
+  a.encode(bl);
+  auto p = bl.cbegin();
+  auto b = ObjectStore::Transaction{};
+  b.decode(p);
+  ASSERT_EQ(a.get_num_ops(), b.get_num_ops());
+
+  auto i = a.begin();
+  auto j = b.begin();
+  ASSERT_EQ(i.colls, j.colls);
+  ASSERT_EQ(i.objects, j.objects);
+  ASSERT_EQ(oids.size(), j.objects.size());
+  unsigned n = 0;
+  while (i.have_op()) {
+    ASSERT_TRUE(j.have_op());
+    auto op = i.decode_op();
+    auto bop = j.decode_op();
+    ASSERT_EQ(op->op, bop->op);
+    ASSERT_EQ(i.get_cid(op->cid), j.get_cid(bop->cid));
+    ASSERT_EQ(i.get_oid(op->oid), j.get_oid(bop->oid));
+    if (op->op == ObjectStore::Transaction::OP_TOUCH) {
+      ASSERT_EQ(oids[n], j.get_oid(bop->oid));
+    } else {
+      ASSERT_EQ(oids[(n * 7) % oids.size()], j.get_oid(bop->oid));
+      ASSERT_EQ("_", j.decode_string());
+      bufferlist val;
+      j.decode_bl(val);
+      ASSERT_TRUE(val.contents_equal(n % 2 ? small : large));
+      i.decode_string();
+      i.decode_bl(val);
+      ++n;
+    }
+  }
+  ASSERT_FALSE(j.have_op());
+}
+
+TEST(Transaction, ManyCollections)
+{
+  auto a = ObjectStore::Transaction{};
+  ghobject_t oid(hobject_t(sobject_t("obj", CEPH_NOSNAP)));
+
+  // more collections than INDEX_SCAN_MAX, each named twice
+  vector<coll_t> cids;
+  for (unsigned i = 0; i < 2 * INDEX_SCAN_MAX; ++i) {
+    cids.push_back(coll_t(spg_t(pg_t(i, 1), shard_id_t::NO_SHARD)));
+  }
+  for (unsigned r = 0; r < 2; ++r) {
+    for (auto& cid : cids) {
+      a.touch(cid, oid);
+    }
+  }
+
+  bufferlist bl;
+  a.encode(bl);
+  auto p = bl.cbegin();
+  auto b = ObjectStore::Transaction{};
+  b.decode(p);
+  auto i = b.begin();
+  ASSERT_EQ(cids.size(), i.colls.size());
+  unsigned n = 0;
+  while (i.have_op()) {
+    auto op = i.decode_op();
+    ASSERT_EQ(n % cids.size(), op->cid);
+    ASSERT_EQ(cids[n % cids.size()], i.get_cid(op->cid));
+    ++n;
+  }
+  ASSERT_EQ(2 * cids.size(), n);
+}
+
+TEST(Transaction, DecodeHugeIndex)
+{
+  // a transaction claiming far more collections than it has bytes for
+  bufferlist payload;
+  encode(bufferlist(), payload);  // data_bl
+  encode(bufferlist(), payload);  // op_bl
+  encode((__u32)0x10000000, payload);
+  bufferlist bl;
+  encode((__u8)9, bl);
+  encode((__u8)9, bl);
+  encode((__u32)payload.length(), bl);
+  bl.append(payload);
+
+  auto p = bl.cbegin();
+  auto b = ObjectStore::Transaction{};
+  ASSERT_THROW(b.decode(p), buffer::malformed_input);
+}
+
+TEST(Transaction, DecodeRepeatedIndexId)
+{
+  // two collections sharing an id, which leaves id 1 unfilled
+  bufferlist payload;
+  encode(bufferlist(), payload);  // data_bl
+  encode(bufferlist(), payload);  // op_bl
+  encode((__u32)2, payload);
+  for (unsigned i = 0; i < 2; ++i) {
+    encode(coll_t(spg_t(pg_t(i, 1), shard_id_t::NO_SHARD)), payload);
+    __le32 id = 0;
+    encode(id, payload);
+  }
+  bufferlist bl;
+  encode((__u8)9, bl);
+  encode((__u8)9, bl);
+  encode((__u32)payload.length(), bl);
+  bl.append(payload);
+
+  auto p = bl.cbegin();
+  auto b = ObjectStore::Transaction{};
+  ASSERT_THROW(b.decode(p), buffer::malformed_input);
+}
+
+TEST(Transaction, IndexWireFormat)
+{
+  // the indexes go out byte for byte like the coll_t/ghobject_t -> id
+  // maps older releases kept, whatever order things were named in
+  auto a = ObjectStore::Transaction{};
+  map<coll_t, __le32> coll_index;
+  map<ghobject_t, __le32> object_index;
+  for (unsigned i = 0; i < 8; ++i) {
+    coll_t cid(spg_t(pg_t(7 - i % 2, 1), shard_id_t::NO_SHARD));
+    ghobject_t oid(hobject_t(sobject_t("obj" + stringify(7 - i),
+				       CEPH_NOSNAP)));
+    a.touch(cid, oid);
+    coll_index.insert(make_pair(cid, coll_index.size()));
+    object_index.insert(make_pair(oid, object_index.size()));
+  }
+  bufferlist expected;
+  encode(coll_index, expected);
+  encode(object_index, expected);
+
+  bufferlist bl;
+  a.encode(bl);
+  auto p = bl.cbegin();
+  p.advance(sizeof(__u8) * 2 + sizeof(__u32));  // struct_v, compat, len
+  bufferlist skip;
+  decode(skip, p);  // data_bl
+  decode(skip, p);  // op_bl
+  bufferlist actual;
+  p.copy(expected.length(), actual);
+  ASSERT_TRUE(actual.contents_equal(expected));
+}
+
 void bench_num_bytes(bool legacy)
 {
   const int max = 2500000;
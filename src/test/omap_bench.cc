@@ -26,6 +26,7 @@
 #include <cassert>
 #include <climits>
 #include <cmath>
+#include <vector>
 
 using namespace std;
 using ceph::bufferlist;
@@ -57,6 +58,14 @@ int OmapBench::setup(int argc, const char** argv) {
 	}
       } else if (strcmp(args[i], "--name") == 0) {
 	rados_id = args[i+1];
+      } else if (strcmp(args[i], "--test") == 0) {
+	if (strcmp("write", args[i+1]) == 0) {
+	  test = &OmapBench::test_write_objects_in_parallel;
+	} else if (strcmp("getvals", args[i+1]) == 0) {
+	  test = &OmapBench::test_get_vals_by_keys_in_parallel;
+	}
+      } else if (strcmp(args[i], "--keys") == 0) {
+	keys_per_get = atoi(args[i+1]);
       }
     } else if (strcmp(args[i], "--help") == 0) {
       cout << "\nUsage: ostorebench [options]\n"
@@ -87,6 +96,13 @@ int OmapBench::setup(int argc, const char** argv) {
            << "                        (default uniform)\n";
       cout << "	--name          the rados id to use (default "<< rados_id
            << ")\n";
+      cout << "	--test          write to time omap writes, getvals to "
+	   << "write the omaps first\n"
+	   << "                        and time omap_get_vals_by_keys on them "
+	   << "(default write)\n"
+	   << "	--keys          number of keys per getvals op, 0 for all the "
+	   << "entries (default " << keys_per_get;
+      cout << ")\n";
       exit(1);
     }
   }
@@ -407,6 +423,68 @@ int OmapBench::test_write_objects_in_parallel(omap_generator_t omap_gen) {
   return 0;
 }
 
+int OmapBench::test_get_vals_by_keys_in_parallel(omap_generator_t omap_gen) {
+  // populate the objects under the names the readers below will get
+  std::vector<std::set<std::string>> keys(objects);
+  for (int i = 0; i < objects; i++) {
+    std::map<std::string,bufferlist> omap;
+    int err = omap_gen(entries_per_omap, key_size, value_size, &omap);
+    if (err < 0) {
+      return err;
+    }
+    for (auto &kv : omap) {
+      if (keys_per_get > 0 && (int)keys[i].size() == keys_per_get) {
+	break;
+      }
+      keys[i].insert(kv.first);
+    }
+    std::stringstream oid;
+    oid << prefix << (i + 1);
+    librados::ObjectWriteOperation owo;
+    owo.create(false);
+    owo.omap_clear();
+    owo.omap_set(omap);
+    err = io_ctx.operate(oid.str(), &owo);
+    if (err < 0) {
+      cout << "writing omap failed with code " << err << std::endl;
+      return err;
+    }
+  }
+
+  Mutex::Locker l(thread_is_free_lock);
+  for (int i = 0; i < objects; i++) {
+    assert(busythreads_count <= threads);
+    //wait for a reader to be free
+    if (busythreads_count == threads) {
+      int err = thread_is_free.Wait(thread_is_free_lock);
+      assert(busythreads_count < threads);
+      if (err < 0) {
+	return err;
+      }
+    }
+
+    //set up the read; the values land in the reader's omap
+    AioWriter *this_aio_reader = new AioWriter(this);
+    this_aio_reader->set_aioc(safe, NULL);
+    librados::ObjectReadOperation op;
+    op.omap_get_vals_by_keys(keys[i], &this_aio_reader->get_omap(), NULL);
+
+    busythreads_count++;
+    this_aio_reader->start_time();
+    int err = io_ctx.aio_operate(this_aio_reader->get_oid(),
+				 this_aio_reader->get_aioc(), &op, NULL);
+    if (err < 0) {
+      cout << "reading omap failed with code " << err << std::endl;
+      return err;
+    }
+  }
+  while(busythreads_count > 0) {
+    thread_is_free.Wait(thread_is_free_lock);
+  }
+
+  return 0;
+}
+
 /**
  * runs the specified test with the specified parameters and generates
  * a histogram of latencies
@@ -102,6 +102,7 @@ protected:
   int entries_per_omap;
   int key_size;
   int value_size;
+  int keys_per_get;
   double increment;
 
   friend class Writer;
@@ -119,7 +120,7 @@ public:
       rados_id("admin"),
       prefix(rados_id+".obj."),
       threads(3), objects(100), entries_per_omap(10), key_size(10),
-      value_size(100), increment(10)
+      value_size(100), keys_per_get(0), increment(10)
   {}
   /**
    * Parses command line args, initializes rados and ioctx
@@ -200,6 +201,15 @@ public:
    */
   int test_write_objects_in_parallel(omap_generator_t omap_gen);
 
+  /*
+   * Writes omaps generated by omap_gen to OBJECTS objects, then reads
+   * KEYS_PER_GET of the keys of each back with omap_get_vals_by_keys,
+   * THREADS reads at a time, timing the reads only.
+   *
+   * @param omap_gen the method used to generate the omaps.
+   */
+  int test_get_vals_by_keys_in_parallel(omap_generator_t omap_gen);
+
 };
 
 